@@ -0,0 +1,357 @@
+#include "Utility.h"
+
+#include <string.h>
+
+#include "CpuFeatures.h"
+#include "MsgBuffer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CANARY_BASE64_X86 1
+#endif
+
+namespace canary {
+
+namespace utils {
+
+static const char kBase64Chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz"
+    "0123456789+/";
+
+static const char kUrlBase64Chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz"
+    "0123456789-_";
+
+// The 6-bit value of a char of either alphabet, 0xff for the others
+struct Base64DecodeTable {
+  constexpr Base64DecodeTable() : values_() {
+    for (auto &value : values_) value = 0xff;
+    for (int i = 0; i < 64; ++i) {
+      values_[static_cast<unsigned char>(kBase64Chars[i])] = i;
+      values_[static_cast<unsigned char>(kUrlBase64Chars[i])] = i;
+    }
+  }
+
+  unsigned char values_[256];
+};
+
+static constexpr Base64DecodeTable kBase64Values;
+
+static size_t encodeScalar(const unsigned char *in, size_t len, char *out,
+                           const char *chars) {
+  auto start = out;
+  size_t i = 0;
+  for (; i + 3 <= len; i += 3, out += 4) {
+    uint32_t bits = in[i] << 16 | in[i + 1] << 8 | in[i + 2];
+    out[0] = chars[bits >> 18];
+    out[1] = chars[(bits >> 12) & 0x3f];
+    out[2] = chars[(bits >> 6) & 0x3f];
+    out[3] = chars[bits & 0x3f];
+  }
+  if (i < len) {
+    bool two = i + 1 < len;
+    uint32_t bits = in[i] << 16 | (two ? in[i + 1] << 8 : 0);
+    out[0] = chars[bits >> 18];
+    out[1] = chars[(bits >> 12) & 0x3f];
+    out[2] = two ? chars[(bits >> 6) & 0x3f] : '=';
+    out[3] = '=';
+    out += 4;
+  }
+  return out - start;
+}
+
+// Decodes whole groups of 4 chars, then the valid chars of the last group
+static size_t decodeScalar(const char *in, size_t len, unsigned char *out) {
+  auto values = kBase64Values.values_;
+  auto start = out;
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4, out += 3) {
+    auto a = values[static_cast<unsigned char>(in[i])];
+    auto b = values[static_cast<unsigned char>(in[i + 1])];
+    auto c = values[static_cast<unsigned char>(in[i + 2])];
+    auto d = values[static_cast<unsigned char>(in[i + 3])];
+    if ((a | b | c | d) == 0xff) break;
+    uint32_t bits = a << 18 | b << 12 | c << 6 | d;
+    out[0] = static_cast<unsigned char>(bits >> 16);
+    out[1] = static_cast<unsigned char>(bits >> 8);
+    out[2] = static_cast<unsigned char>(bits);
+  }
+  uint32_t bits = 0;
+  int count = 0;
+  for (; i < len && count < 4; ++i, ++count) {
+    auto value = values[static_cast<unsigned char>(in[i])];
+    if (value == 0xff) break;
+    bits |= value << (18 - 6 * count);
+  }
+  // A lone char carries no whole byte
+  for (int j = 0; j < count - 1; ++j) {
+    *out++ = static_cast<unsigned char>(bits >> (16 - 8 * j));
+  }
+  return out - start;
+}
+
+#ifdef CANARY_BASE64_X86
+
+// The kernels of Wojciech Mula and Daniel Lemire ("Faster Base64 Encoding
+// and Decoding Using AVX2 Instructions"), 12 bytes to 16 chars per 128-bit
+// lane. The decoders accept both alphabets and stop before a block holding
+// any other char, which the scalar code then handles.
+
+__attribute__((target("ssse3"))) static inline __m128i encodeBlock(
+    __m128i input, __m128i shiftLut) {
+  // Every 32-bit lane gets the 3 bytes of 4 chars, then their 6-bit values
+  input = _mm_shuffle_epi8(
+      input, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+  auto t0 = _mm_and_si128(input, _mm_set1_epi32(0x0fc0fc00));
+  auto t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  auto t2 = _mm_and_si128(input, _mm_set1_epi32(0x003f03f0));
+  auto t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  auto indices = _mm_or_si128(t1, t3);
+  // 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12, the
+  // index of what is added to make the char
+  auto ranges = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  auto upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  ranges = _mm_or_si128(ranges, _mm_and_si128(upper, _mm_set1_epi8(13)));
+  return _mm_add_epi8(_mm_shuffle_epi8(shiftLut, ranges), indices);
+}
+
+__attribute__((target("ssse3"))) static inline __m128i encodeShifts(
+    bool urlSafe) {
+  return _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                       '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                       '0' - 52, (urlSafe ? '-' : '+') - 62,
+                       (urlSafe ? '_' : '/') - 63, 'A', 0, 0);
+}
+
+// Returns the bytes encoded, a multiple of 12
+__attribute__((target("ssse3"))) static size_t encodeSsse3(
+    const unsigned char *in, size_t len, char *out, bool urlSafe) {
+  auto shiftLut = encodeShifts(urlSafe);
+  size_t i = 0;
+  // 16 bytes are loaded, 12 used
+  for (; i + 16 <= len; i += 12, out += 16) {
+    auto input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                     encodeBlock(input, shiftLut));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t encodeAvx2(
+    const unsigned char *in, size_t len, char *out, bool urlSafe) {
+  auto shiftLut = _mm256_broadcastsi128_si256(encodeShifts(urlSafe));
+  auto shuffle = _mm256_broadcastsi128_si256(
+      _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+  size_t i = 0;
+  for (; i + 28 <= len; i += 24, out += 32) {
+    auto low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    auto high =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 12));
+    auto input =
+        _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+    input = _mm256_shuffle_epi8(input, shuffle);
+    auto t0 = _mm256_and_si256(input, _mm256_set1_epi32(0x0fc0fc00));
+    auto t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    auto t2 = _mm256_and_si256(input, _mm256_set1_epi32(0x003f03f0));
+    auto t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    auto indices = _mm256_or_si256(t1, t3);
+    auto ranges = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    auto upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    ranges =
+        _mm256_or_si256(ranges, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+    auto chars =
+        _mm256_add_epi8(_mm256_shuffle_epi8(shiftLut, ranges), indices);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), chars);
+  }
+  return i + encodeSsse3(in + i, len - i, out, urlSafe);
+}
+
+// All ones in the bytes from low to high
+__attribute__((target("ssse3"))) static inline __m128i inRange(__m128i input,
+                                                              char low,
+                                                              char high) {
+  return _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8(low - 1)),
+                       _mm_cmpgt_epi8(_mm_set1_epi8(high + 1), input));
+}
+
+__attribute__((target("avx2"))) static inline __m256i inRange(__m256i input,
+                                                             char low,
+                                                             char high) {
+  return _mm256_and_si256(
+      _mm256_cmpgt_epi8(input, _mm256_set1_epi8(low - 1)),
+      _mm256_cmpgt_epi8(_mm256_set1_epi8(high + 1), input));
+}
+
+// The 6-bit values of 16 chars, false when any is not base64
+__attribute__((target("ssse3"))) static inline bool decodeValues(
+    __m128i input, __m128i *values) {
+  auto upper = inRange(input, 'A', 'Z');
+  auto lower = inRange(input, 'a', 'z');
+  auto digit = inRange(input, '0', '9');
+  auto plus = _mm_or_si128(_mm_cmpeq_epi8(input, _mm_set1_epi8('+')),
+                           _mm_cmpeq_epi8(input, _mm_set1_epi8('-')));
+  auto slash = _mm_or_si128(_mm_cmpeq_epi8(input, _mm_set1_epi8('/')),
+                            _mm_cmpeq_epi8(input, _mm_set1_epi8('_')));
+  auto symbols = _mm_or_si128(plus, slash);
+  auto valid = _mm_or_si128(_mm_or_si128(upper, lower),
+                            _mm_or_si128(digit, symbols));
+  if (_mm_movemask_epi8(valid) != 0xffff) return false;
+  auto shift = _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+                            _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+  shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+  auto letters = _mm_andnot_si128(symbols, _mm_add_epi8(input, shift));
+  *values = _mm_or_si128(
+      letters, _mm_or_si128(_mm_and_si128(plus, _mm_set1_epi8(62)),
+                            _mm_and_si128(slash, _mm_set1_epi8(63))));
+  return true;
+}
+
+// 16 values to 12 bytes, in the low 12 bytes of every 128-bit lane
+__attribute__((target("ssse3"))) static inline __m128i packValues(
+    __m128i values) {
+  auto pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+  auto triples = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(
+      triples,
+      _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+// Returns the chars decoded, a multiple of 16
+__attribute__((target("ssse3"))) static size_t decodeSsse3(
+    const char *in, size_t len, unsigned char *out) {
+  size_t i = 0;
+  __m128i values;
+  for (; i + 16 <= len; i += 16, out += 12) {
+    auto input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    if (!decodeValues(input, &values)) break;
+    auto bytes = packValues(values);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out), bytes);
+    uint32_t last = _mm_cvtsi128_si32(_mm_srli_si128(bytes, 8));
+    memcpy(out + 8, &last, 4);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t decodeAvx2(const char *in,
+                                                         size_t len,
+                                                         unsigned char *out) {
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32, out += 24) {
+    auto input = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+    auto upper = inRange(input, 'A', 'Z');
+    auto lower = inRange(input, 'a', 'z');
+    auto digit = inRange(input, '0', '9');
+    auto plus =
+        _mm256_or_si256(_mm256_cmpeq_epi8(input, _mm256_set1_epi8('+')),
+                        _mm256_cmpeq_epi8(input, _mm256_set1_epi8('-')));
+    auto slash =
+        _mm256_or_si256(_mm256_cmpeq_epi8(input, _mm256_set1_epi8('/')),
+                        _mm256_cmpeq_epi8(input, _mm256_set1_epi8('_')));
+    auto symbols = _mm256_or_si256(plus, slash);
+    auto valid = _mm256_or_si256(_mm256_or_si256(upper, lower),
+                                 _mm256_or_si256(digit, symbols));
+    if (_mm256_movemask_epi8(valid) != -1) break;
+    auto shift =
+        _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+                        _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+    shift = _mm256_or_si256(
+        shift, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+    auto values = _mm256_or_si256(
+        _mm256_andnot_si256(symbols, _mm256_add_epi8(input, shift)),
+        _mm256_or_si256(_mm256_and_si256(plus, _mm256_set1_epi8(62)),
+                        _mm256_and_si256(slash, _mm256_set1_epi8(63))));
+    auto pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    auto triples = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    auto bytes = _mm256_shuffle_epi8(
+        triples, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1,
+                                  -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+                                  13, 12, -1, -1, -1, -1));
+    // The 12 bytes of both lanes side by side
+    bytes = _mm256_permutevar8x32_epi32(
+        bytes, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                     _mm256_castsi256_si128(bytes));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 16),
+                     _mm256_extracti128_si256(bytes, 1));
+  }
+  return i + decodeSsse3(in + i, len - i, out);
+}
+
+#endif  // CANARY_BASE64_X86
+
+size_t base64Encode(const unsigned char *in, size_t len, char *out,
+                    bool url_safe) {
+  size_t done = 0;
+#ifdef CANARY_BASE64_X86
+  switch (simdLevel()) {
+    case SimdLevel::Avx2:
+      done = encodeAvx2(in, len, out, url_safe);
+      break;
+    case SimdLevel::Ssse3:
+      done = encodeSsse3(in, len, out, url_safe);
+      break;
+    case SimdLevel::Scalar:
+      break;
+  }
+#endif
+  auto written = done / 3 * 4;
+  return written + encodeScalar(in + done, len - done, out + written,
+                                url_safe ? kUrlBase64Chars : kBase64Chars);
+}
+
+void base64Encode(const unsigned char *in, size_t len, MsgBuffer &out,
+                  bool url_safe) {
+  out.ensureWritableBytes(base64EncodedLength(len));
+  out.hasWritten(base64Encode(in, len, out.beginWrite(), url_safe));
+}
+
+std::string base64Encode(const unsigned char *bytes_to_encode,
+                         unsigned int in_len, bool url_safe) {
+  std::string ret(base64EncodedLength(in_len), '\0');
+  base64Encode(bytes_to_encode, in_len, &ret[0], url_safe);
+  return ret;
+}
+
+size_t base64Decode(const char *in, size_t len, unsigned char *out) {
+  size_t done = 0;
+#ifdef CANARY_BASE64_X86
+  switch (simdLevel()) {
+    case SimdLevel::Avx2:
+      done = decodeAvx2(in, len, out);
+      break;
+    case SimdLevel::Ssse3:
+      done = decodeSsse3(in, len, out);
+      break;
+    case SimdLevel::Scalar:
+      break;
+  }
+#endif
+  auto written = done / 4 * 3;
+  return written + decodeScalar(in + done, len - done, out + written);
+}
+
+void base64Decode(const char *in, size_t len, MsgBuffer &out) {
+  out.ensureWritableBytes(base64DecodedLength(len));
+  out.hasWritten(base64Decode(
+      in, len, reinterpret_cast<unsigned char *>(out.beginWrite())));
+}
+
+std::vector<char> base64DecodeToVector(const std::string &encoded_string) {
+  std::vector<char> ret(base64DecodedLength(encoded_string.length()));
+  ret.resize(base64Decode(encoded_string.data(), encoded_string.length(),
+                          reinterpret_cast<unsigned char *>(ret.data())));
+  return ret;
+}
+
+std::string base64Decode(const std::string &encoded_string) {
+  std::string ret(base64DecodedLength(encoded_string.length()), '\0');
+  ret.resize(base64Decode(encoded_string.data(), encoded_string.length(),
+                          reinterpret_cast<unsigned char *>(&ret[0])));
+  return ret;
+}
+
+}  // namespace utils
+
+}  // namespace canary
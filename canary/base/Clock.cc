@@ -0,0 +1,135 @@
+#include "Clock.h"
+
+#include <atomic>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define CANARY_HAS_TSC 1
+#endif
+
+using namespace canary;
+
+namespace canary {
+
+// What the loop of this thread read last
+struct ClockReading {
+  bool valid_{false};
+  Date date_;
+  CachedClock::TimePoint steady_;
+  // When the TSC is used: the TSC time of the last sync with the system
+  // clocks, and what they read then
+  bool synced_{false};
+  int64_t syncNanos_{0};
+  Date syncDate_;
+  CachedClock::TimePoint syncSteady_;
+};
+
+static thread_local ClockReading reading;
+
+static std::atomic<bool> tscEnabled{false};
+
+static constexpr int64_t kTscSyncNanos = 1000 * 1000 * 1000;
+
+static int64_t steadyNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+#ifdef CANARY_HAS_TSC
+static bool detectInvariantTsc() {
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) {
+    return false;
+  }
+  __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+  return edx & (1 << 8);
+}
+
+// Nanoseconds per tick, from the ticks of a 10 millisecond span
+struct TscCalibration {
+  TscCalibration() {
+    auto startNanos = steadyNanos();
+    startTicks_ = __rdtsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto endNanos = steadyNanos();
+    auto endTicks = __rdtsc();
+    nanosPerTick_ = static_cast<double>(endNanos - startNanos) /
+                    static_cast<double>(endTicks - startTicks_);
+  }
+
+  uint64_t startTicks_;
+  double nanosPerTick_;
+};
+#endif
+
+}  // namespace canary
+
+bool TscClock::available() {
+#ifdef CANARY_HAS_TSC
+  static const bool invariant = detectInvariantTsc();
+  return invariant;
+#else
+  return false;
+#endif
+}
+
+int64_t TscClock::nanoseconds() {
+#ifdef CANARY_HAS_TSC
+  if (available()) {
+    static const TscCalibration calibration;
+    return static_cast<int64_t>(
+        static_cast<double>(__rdtsc() - calibration.startTicks_) *
+        calibration.nanosPerTick_);
+  }
+#endif
+  return steadyNanos();
+}
+
+Date CachedClock::now() {
+  return reading.valid_ ? reading.date_ : Date::date();
+}
+
+CachedClock::TimePoint CachedClock::steadyNow() {
+  return reading.valid_ ? reading.steady_ : std::chrono::steady_clock::now();
+}
+
+void CachedClock::update() {
+  if (tscEnabled.load(std::memory_order_relaxed)) {
+    auto nanos = TscClock::nanoseconds();
+    auto elapsed = nanos - reading.syncNanos_;
+    if (reading.synced_ && elapsed >= 0 && elapsed < kTscSyncNanos) {
+      reading.date_ = Date(reading.syncDate_.microSecondsSinceEpoch() +
+                           elapsed / 1000);
+      reading.steady_ = reading.syncSteady_ + std::chrono::nanoseconds(elapsed);
+      return;
+    }
+    reading.syncNanos_ = nanos;
+    reading.syncDate_ = Date::date();
+    reading.syncSteady_ = std::chrono::steady_clock::now();
+    reading.date_ = reading.syncDate_;
+    reading.steady_ = reading.syncSteady_;
+    reading.synced_ = true;
+    reading.valid_ = true;
+    return;
+  }
+  reading.synced_ = false;
+  reading.date_ = Date::date();
+  reading.steady_ = std::chrono::steady_clock::now();
+  reading.valid_ = true;
+}
+
+void CachedClock::invalidate() {
+  reading.valid_ = false;
+  reading.synced_ = false;
+}
+
+bool CachedClock::useTsc(bool on) {
+  if (on && !TscClock::available()) return false;
+  // Calibrated here rather than by the first update() in a loop
+  if (on) TscClock::nanoseconds();
+  tscEnabled.store(on, std::memory_order_relaxed);
+  return true;
+}
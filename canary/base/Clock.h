@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "Date.h"
+
+namespace canary {
+
+// The time as of the current iteration of the thread's event loop. The
+// loop reads the clocks once after every poll, so the timers, the idle
+// timeouts and the log lines of an iteration share one reading instead of
+// making their own. Threads without a loop, or whose loop is not running,
+// get the precise time.
+class CachedClock {
+ public:
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  // The wall clock, stale by the time spent in the iteration so far
+  static Date now();
+
+  // The monotonic clock, likewise
+  static TimePoint steadyNow();
+
+  // Reads the clocks, called by EventLoop after every poll
+  static void update();
+
+  // Returns the thread to the precise time, when its loop stops
+  static void invalidate();
+
+  // Lets update() derive the time from the TSC when the CPU has an
+  // invariant one, syncing with the system clocks every second. Returns
+  // false, and changes nothing, without it. The first call calibrates the
+  // TSC in the calling thread, which sleeps 10 milliseconds, so it is best
+  // made before the loops start.
+  static bool useTsc(bool on);
+};
+
+// A monotonic clock reading the time stamp counter, scaled by a
+// calibration against steady_clock made on first use (or by useTsc()).
+// Cheaper than a clock_gettime() but only as good as the calibration, so
+// the loop only uses it between syncs with the system clocks.
+class TscClock {
+ public:
+  // The CPU has a TSC running at a constant rate in all power states
+  static bool available();
+
+  // Nanoseconds from an arbitrary start; from steady_clock when the TSC is
+  // not available
+  static int64_t nanoseconds();
+};
+
+}  // namespace canary
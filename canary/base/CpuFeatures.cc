@@ -0,0 +1,68 @@
+#include "CpuFeatures.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include <atomic>
+
+using namespace canary;
+
+namespace canary {
+
+static SimdLevel detect() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+  if (__builtin_cpu_supports("ssse3")) return SimdLevel::Ssse3;
+#endif
+  return SimdLevel::Scalar;
+}
+
+static std::atomic<SimdLevel> limit{SimdLevel::Avx2};
+
+// SHA-NI needs SSE4.1 too, for the blends and extracts around it
+static bool detectSha() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  unsigned eax, ebx, ecx, edx;
+  if (!__builtin_cpu_supports("sse4.1") ||
+      !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  return ebx & bit_SHA;
+#else
+  return false;
+#endif
+}
+
+static bool detectCrc32c() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.2");
+#else
+  return false;
+#endif
+}
+
+}  // namespace canary
+
+SimdLevel canary::simdLevel() {
+  static const SimdLevel detected = detect();
+  auto level = limit.load(std::memory_order_relaxed);
+  return detected < level ? detected : level;
+}
+
+void canary::limitSimd(SimdLevel level) {
+  limit.store(level, std::memory_order_relaxed);
+}
+
+bool canary::hasShaExtensions() {
+  static const bool detected = detectSha();
+  return detected && limit.load(std::memory_order_relaxed) != SimdLevel::Scalar;
+}
+
+bool canary::hasCrc32c() {
+  static const bool detected = detectCrc32c();
+  return detected && limit.load(std::memory_order_relaxed) != SimdLevel::Scalar;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+namespace canary {
+
+// The instruction sets the SIMD kernels may use, each including the ones
+// before it. Kernels are compiled for all of them and picked at runtime.
+enum class SimdLevel { Scalar, Ssse3, Avx2 };
+
+// The best level of this CPU, or less after limitSimd()
+SimdLevel simdLevel();
+
+// Keeps the kernels to level at most, for tests and benchmarks
+void limitSimd(SimdLevel level);
+
+// The instructions outside the levels, which are off too once limited to
+// SimdLevel::Scalar
+
+// The SHA extensions (SHA-NI) for SHA-1 and SHA-256
+bool hasShaExtensions();
+
+// The CRC32 instruction of SSE4.2, which computes CRC32C
+bool hasCrc32c();
+
+}  // namespace canary
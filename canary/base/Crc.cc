@@ -0,0 +1,141 @@
+#include "Crc.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "CpuFeatures.h"
+#include "MsgBuffer.h"
+
+using namespace canary;
+
+namespace canary {
+
+struct Crc16Table {
+  constexpr Crc16Table() : values_() {
+    for (int i = 0; i < 256; ++i) {
+      uint16_t crc = static_cast<uint16_t>(i << 8);
+      for (int j = 0; j < 8; ++j) {
+        crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021)
+                             : static_cast<uint16_t>(crc << 1);
+      }
+      values_[i] = crc;
+    }
+  }
+
+  uint16_t values_[256];
+};
+
+static constexpr Crc16Table kCrc16Table;
+
+// Slicing by 8: values_[k][b] is the CRC of byte b followed by k zeros
+struct Crc32cTables {
+  constexpr Crc32cTables() : values_() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int j = 0; j < 8; ++j) {
+        crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+      }
+      values_[0][i] = crc;
+    }
+    for (int k = 1; k < 8; ++k) {
+      for (int i = 0; i < 256; ++i) {
+        auto prev = values_[k - 1][i];
+        values_[k][i] = (prev >> 8) ^ values_[0][prev & 0xff];
+      }
+    }
+  }
+
+  uint32_t values_[8][256];
+};
+
+static constexpr Crc32cTables kCrc32cTables;
+
+static uint32_t crc32cScalar(uint32_t crc, const unsigned char *p,
+                             size_t len) {
+  auto &t = kCrc32cTables.values_;
+  for (; len >= 8; p += 8, len -= 8) {
+    uint32_t low = crc ^ (uint32_t(p[0]) | uint32_t(p[1]) << 8 |
+                          uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24);
+    crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^
+          t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^ t[3][p[4]] ^
+          t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+  }
+  for (; len > 0; ++p, --len) crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+  return crc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2"))) static uint32_t crc32cHardware(
+    uint32_t crc, const unsigned char *p, size_t len) {
+#ifdef __x86_64__
+  uint64_t crc64 = crc;
+  for (; len >= 8; p += 8, len -= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = static_cast<uint32_t>(crc64);
+#endif
+  for (; len >= 4; p += 4, len -= 4) {
+    uint32_t word;
+    memcpy(&word, p, 4);
+    crc = _mm_crc32_u32(crc, word);
+  }
+  for (; len > 0; ++p, --len) crc = _mm_crc32_u8(crc, *p);
+  return crc;
+}
+#endif
+
+}  // namespace canary
+
+void Crc16::update(const void *data, size_t len) {
+  auto p = static_cast<const unsigned char *>(data);
+  auto crc = crc_;
+  for (size_t i = 0; i < len; ++i) {
+    crc = static_cast<uint16_t>((crc << 8) ^
+                                kCrc16Table.values_[(crc >> 8) ^ p[i]]);
+  }
+  crc_ = crc;
+}
+
+void Crc16::update(const MsgBuffer &buffer) {
+  update(buffer.peek(), buffer.readableBytes());
+}
+
+uint16_t Crc16::checksum(const void *data, size_t len) {
+  Crc16 crc;
+  crc.update(data, len);
+  return crc.value();
+}
+
+uint16_t Crc16::checksum(const MsgBuffer &buffer) {
+  return checksum(buffer.peek(), buffer.readableBytes());
+}
+
+void Crc32c::update(const void *data, size_t len) {
+  auto p = static_cast<const unsigned char *>(data);
+#if defined(__x86_64__) || defined(__i386__)
+  if (hasCrc32c()) {
+    crc_ = crc32cHardware(crc_, p, len);
+    return;
+  }
+#endif
+  crc_ = crc32cScalar(crc_, p, len);
+}
+
+void Crc32c::update(const MsgBuffer &buffer) {
+  update(buffer.peek(), buffer.readableBytes());
+}
+
+uint32_t Crc32c::checksum(const void *data, size_t len) {
+  Crc32c crc;
+  crc.update(data, len);
+  return crc.value();
+}
+
+uint32_t Crc32c::checksum(const MsgBuffer &buffer) {
+  return checksum(buffer.peek(), buffer.readableBytes());
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace canary {
+
+class MsgBuffer;
+
+// CRC16-CCITT (XMODEM), the key hash of Redis Cluster
+class Crc16 {
+ public:
+  void reset() { crc_ = 0; }
+
+  void update(const void *data, size_t len);
+
+  // Of the readable bytes, which are not retrieved
+  void update(const MsgBuffer &buffer);
+
+  uint16_t value() const { return crc_; }
+
+  static uint16_t checksum(const void *data, size_t len);
+
+  static uint16_t checksum(const MsgBuffer &buffer);
+
+ private:
+  uint16_t crc_{0};
+};
+
+// CRC32C (Castagnoli), with the CRC32 instruction of SSE4.2 when the CPU
+// has it, else 8 bytes at a time through tables
+class Crc32c {
+ public:
+  void reset() { crc_ = 0xffffffff; }
+
+  void update(const void *data, size_t len);
+
+  // Of the readable bytes, which are not retrieved
+  void update(const MsgBuffer &buffer);
+
+  // The checksum of the bytes so far, update() may go on
+  uint32_t value() const { return ~crc_; }
+
+  static uint32_t checksum(const void *data, size_t len);
+
+  static uint32_t checksum(const MsgBuffer &buffer);
+
+ private:
+  uint32_t crc_{0xffffffff};
+};
+
+}  // namespace canary
@@ -2,14 +2,346 @@
 
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 
+#include <climits>
+#include <cstdio>
 #include <cstdlib>
-#include <iostream>
-
-#include "Funcs.h"
 
 namespace canary {
 
+static const char kDigitPairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char *const kWeekdays[7] = {"Sun", "Mon", "Tue", "Wed",
+                                         "Thu", "Fri", "Sat"};
+
+static const char *const kMonths[12] = {"Jan", "Feb", "Mar", "Apr",
+                                        "May", "Jun", "Jul", "Aug",
+                                        "Sep", "Oct", "Nov", "Dec"};
+
+static constexpr int64_t kSecondsPerDay = 24 * 3600;
+
+static inline char *putTwoDigits(char *p, unsigned value) {
+  memcpy(p, kDigitPairs + value * 2, 2);
+  return p + 2;
+}
+
+static inline char *putSixDigits(char *p, unsigned value) {
+  p = putTwoDigits(p, value / 10000);
+  p = putTwoDigits(p, value / 100 % 100);
+  return putTwoDigits(p, value % 100);
+}
+
+// As "%4d" does
+static char *putYear(char *p, int year) {
+  if (year >= 1000 && year <= 9999) {
+    p = putTwoDigits(p, static_cast<unsigned>(year) / 100);
+    return putTwoDigits(p, static_cast<unsigned>(year) % 100);
+  }
+  return p + snprintf(p, 16, "%4d", year);
+}
+
+static inline int64_t floorDiv(int64_t a, int64_t b) {
+  return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+// Days since 1970-01-01 of a date of the proleptic Gregorian calendar and
+// back, after http://howardhinnant.github.io/date_algorithms.html. Days
+// beyond the end of the month run into the next ones, as with mktime().
+static int64_t daysFromCivil(int64_t year, unsigned month, unsigned day) {
+  year -= month <= 2;
+  const int64_t era = floorDiv(year, 400);
+  const unsigned yoe = static_cast<unsigned>(year - era * 400);
+  const unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 +
+                       day - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+// Fills the date fields of tm
+static void civilFromDays(int64_t days, struct tm *tm) {
+  const int64_t z = days + 719468;
+  const int64_t era = floorDiv(z, 146097);
+  const unsigned doe = static_cast<unsigned>(z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp = (5 * doy + 2) / 153;
+  const unsigned month = mp < 10 ? mp + 3 : mp - 9;
+  const int64_t year = static_cast<int64_t>(yoe) + era * 400 + (month <= 2);
+  tm->tm_year = static_cast<int>(year - 1900);
+  tm->tm_mon = static_cast<int>(month - 1);
+  tm->tm_mday = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+  // 1970-01-01 was a Thursday
+  tm->tm_wday = static_cast<int>(days - floorDiv(days + 4, 7) * 7 + 4);
+  tm->tm_yday = static_cast<int>(days - daysFromCivil(year, 1, 1));
+}
+
+// The date part of the last day the thread broke down, the formatting of
+// a run of dates of one day only computes the time of day
+struct DayCache {
+  int64_t day_{INT64_MIN};
+  struct tm tm_;
+};
+
+// The offset from UTC of the local time during a UTC day, when it does not
+// change that day. The days looked up lately are kept, so that
+// localtime_r() runs for new days only, and on the days of a change.
+struct OffsetDay {
+  int64_t day_{INT64_MIN};
+  bool constant_{false};
+  long offset_{0};
+  int isdst_{0};
+  const char *zone_{nullptr};
+};
+
+static thread_local DayCache utcDay;
+static thread_local DayCache localDay;
+static thread_local OffsetDay offsetDays[4];
+
+static const OffsetDay &offsetDay(int64_t day) {
+  OffsetDay &cache = offsetDays[day & 3];
+  if (cache.day_ != day) {
+    // The day starts and ends with one offset, two changes within a day
+    // never happened
+    time_t first = static_cast<time_t>(day * kSecondsPerDay);
+    time_t last = static_cast<time_t>(first + kSecondsPerDay - 1);
+    struct tm firstTm, lastTm;
+    localtime_r(&first, &firstTm);
+    localtime_r(&last, &lastTm);
+    cache.day_ = day;
+    cache.constant_ = firstTm.tm_gmtoff == lastTm.tm_gmtoff &&
+                      firstTm.tm_isdst == lastTm.tm_isdst;
+    cache.offset_ = firstTm.tm_gmtoff;
+    cache.isdst_ = firstTm.tm_isdst;
+    cache.zone_ = firstTm.tm_zone;
+  }
+  return cache;
+}
+
+// Sets the offset, isdst and zone fields of tm for the seconds
+static void localOffsetAt(int64_t seconds, struct tm *tm) {
+  const OffsetDay &cache = offsetDay(floorDiv(seconds, kSecondsPerDay));
+  if (!cache.constant_) {
+    time_t t = static_cast<time_t>(seconds);
+    struct tm exact;
+    localtime_r(&t, &exact);
+    tm->tm_gmtoff = exact.tm_gmtoff;
+    tm->tm_isdst = exact.tm_isdst;
+    tm->tm_zone = exact.tm_zone;
+    return;
+  }
+  tm->tm_gmtoff = cache.offset_;
+  tm->tm_isdst = cache.isdst_;
+  tm->tm_zone = cache.zone_;
+}
+
+// gmtime_r() or localtime_r() from the caches of the thread
+static void breakDown(int64_t seconds, bool local, struct tm *tm) {
+  DayCache *cache = &utcDay;
+  if (local) {
+    localOffsetAt(seconds, tm);
+    seconds += tm->tm_gmtoff;
+    cache = &localDay;
+  } else {
+    tm->tm_gmtoff = 0;
+    tm->tm_isdst = 0;
+    tm->tm_zone = "GMT";
+  }
+  const int64_t day = floorDiv(seconds, kSecondsPerDay);
+  if (day != cache->day_) {
+    civilFromDays(day, &cache->tm_);
+    cache->day_ = day;
+  }
+  tm->tm_year = cache->tm_.tm_year;
+  tm->tm_mon = cache->tm_.tm_mon;
+  tm->tm_mday = cache->tm_.tm_mday;
+  tm->tm_wday = cache->tm_.tm_wday;
+  tm->tm_yday = cache->tm_.tm_yday;
+  const int secondOfDay = static_cast<int>(seconds - day * kSecondsPerDay);
+  tm->tm_hour = secondOfDay / 3600;
+  tm->tm_min = secondOfDay / 60 % 60;
+  tm->tm_sec = secondOfDay % 60;
+}
+
+// The seconds since the epoch of a local time given in seconds since
+// 1970-01-01 00:00 local. False near a change of offset, where the time
+// may be skipped or repeated and mktime() has the say.
+static bool secondsOfLocal(int64_t localSeconds, int64_t *seconds) {
+  // The offsets are under a day, so the time is in one of the three UTC
+  // days around, and with one offset for all three it is that one
+  const int64_t day = floorDiv(localSeconds, kSecondsPerDay);
+  const OffsetDay &today = offsetDay(day);
+  if (!today.constant_) return false;
+  const long offset = today.offset_;
+  for (int64_t d : {day - 1, day + 1}) {
+    const OffsetDay &cache = offsetDay(d);
+    if (!cache.constant_ || cache.offset_ != offset) return false;
+  }
+  *seconds = localSeconds - offset;
+  return true;
+}
+
+// The seconds and microseconds of a Date, the microseconds never negative
+static inline int64_t splitMicroseconds(int64_t microSecondsSinceEpoch,
+                                        unsigned *microseconds) {
+  const int64_t seconds =
+      floorDiv(microSecondsSinceEpoch, MICRO_SECONDS_PRE_SEC);
+  *microseconds = static_cast<unsigned>(microSecondsSinceEpoch -
+                                        seconds * MICRO_SECONDS_PRE_SEC);
+  return seconds;
+}
+
+// "YYYYMMDD HH:MM:SS" or, with separator '-', "YYYY-MM-DD HH:MM:SS";
+// returns the end
+static char *putDateTime(char *p, const struct tm &tm, char separator,
+                         bool withTime) {
+  p = putYear(p, tm.tm_year + 1900);
+  if (separator) *p++ = separator;
+  p = putTwoDigits(p, static_cast<unsigned>(tm.tm_mon + 1));
+  if (separator) *p++ = separator;
+  p = putTwoDigits(p, static_cast<unsigned>(tm.tm_mday));
+  if (!withTime) return p;
+  *p++ = ' ';
+  p = putTwoDigits(p, static_cast<unsigned>(tm.tm_hour));
+  *p++ = ':';
+  p = putTwoDigits(p, static_cast<unsigned>(tm.tm_min));
+  *p++ = ':';
+  return putTwoDigits(p, static_cast<unsigned>(tm.tm_sec));
+}
+
+static std::string formattedString(int64_t microSecondsSinceEpoch,
+                                   bool local, bool showMicroseconds) {
+  unsigned microseconds;
+  const int64_t seconds =
+      splitMicroseconds(microSecondsSinceEpoch, &microseconds);
+  struct tm tm;
+  breakDown(seconds, local, &tm);
+  char buf[64];
+  char *p = putDateTime(buf, tm, 0, true);
+  if (showMicroseconds) {
+    *p++ = '.';
+    p = putSixDigits(p, microseconds);
+  }
+  return std::string(buf, p);
+}
+
+// As strftime(), with the common conversions rendered here and the names
+// of days and months in English, as in the C locale. strftime() does the
+// formats with other conversions.
+static size_t formatTm(const char *fmt, const struct tm &tm, char *buf,
+                       size_t len) {
+  for (const char *f = fmt; *f; ++f) {
+    if (*f == '%' && !strchr("YmdHMSyeabFT%", f[1] ? f[1] : '?')) {
+      return strftime(buf, len, fmt, &tm);
+    }
+    if (*f == '%') ++f;
+  }
+  char *p = buf;
+  char *end = buf + len;
+  // The longest conversion, a year of %F with the dashes
+  static constexpr size_t kMaxConversion = 32;
+  for (const char *f = fmt; *f; ++f) {
+    if (static_cast<size_t>(end - p) <= kMaxConversion) {
+      return strftime(buf, len, fmt, &tm);
+    }
+    if (*f != '%') {
+      *p++ = *f;
+      continue;
+    }
+    switch (*++f) {
+      case 'Y':
+        p += snprintf(p, kMaxConversion, "%d", tm.tm_year + 1900);
+        break;
+      case 'y':
+        p = putTwoDigits(p, static_cast<unsigned>(
+                                (tm.tm_year + 1900) % 100 + 100) % 100);
+        break;
+      case 'm':
+        p = putTwoDigits(p, static_cast<unsigned>(tm.tm_mon + 1));
+        break;
+      case 'd':
+        p = putTwoDigits(p, static_cast<unsigned>(tm.tm_mday));
+        break;
+      case 'e':
+        p = putTwoDigits(p, static_cast<unsigned>(tm.tm_mday));
+        if (tm.tm_mday < 10) p[-2] = ' ';
+        break;
+      case 'H':
+        p = putTwoDigits(p, static_cast<unsigned>(tm.tm_hour));
+        break;
+      case 'M':
+        p = putTwoDigits(p, static_cast<unsigned>(tm.tm_min));
+        break;
+      case 'S':
+        p = putTwoDigits(p, static_cast<unsigned>(tm.tm_sec));
+        break;
+      case 'a':
+        memcpy(p, kWeekdays[tm.tm_wday], 3);
+        p += 3;
+        break;
+      case 'b':
+        memcpy(p, kMonths[tm.tm_mon], 3);
+        p += 3;
+        break;
+      case 'F':
+        p += snprintf(p, kMaxConversion, "%d-", tm.tm_year + 1900);
+        p = putTwoDigits(p, static_cast<unsigned>(tm.tm_mon + 1));
+        *p++ = '-';
+        p = putTwoDigits(p, static_cast<unsigned>(tm.tm_mday));
+        break;
+      case 'T':
+        p = putTwoDigits(p, static_cast<unsigned>(tm.tm_hour));
+        *p++ = ':';
+        p = putTwoDigits(p, static_cast<unsigned>(tm.tm_min));
+        *p++ = ':';
+        p = putTwoDigits(p, static_cast<unsigned>(tm.tm_sec));
+        break;
+      default:
+        *p++ = '%';
+        break;
+    }
+  }
+  *p = '\0';
+  return static_cast<size_t>(p - buf);
+}
+
+static std::string customedFormattedString(int64_t microSecondsSinceEpoch,
+                                           const std::string &fmtStr,
+                                           bool local,
+                                           bool showMicroseconds) {
+  unsigned microseconds;
+  const int64_t seconds =
+      splitMicroseconds(microSecondsSinceEpoch, &microseconds);
+  struct tm tm;
+  breakDown(seconds, local, &tm);
+  char buf[256];
+  size_t length = formatTm(fmtStr.c_str(), tm, buf, sizeof(buf) - 8);
+  if (showMicroseconds) {
+    buf[length] = '.';
+    length = putSixDigits(buf + length + 1, microseconds) - buf;
+  }
+  return std::string(buf, length);
+}
+
+// Parses the digits at p, at most maxDigits of them; false without any
+static bool parseNumber(const char *&p, const char *end, unsigned maxDigits,
+                        unsigned *value) {
+  const char *start = p;
+  unsigned v = 0;
+  while (p < end && static_cast<unsigned>(p - start) < maxDigits &&
+         *p >= '0' && *p <= '9') {
+    v = v * 10 + static_cast<unsigned>(*p - '0');
+    ++p;
+  }
+  *value = v;
+  return p != start;
+}
+
 const Date Date::date() {
   struct timeval tv;
   gettimeofday(&tv, NULL);
@@ -28,119 +360,62 @@ const Date Date::roundSecond() const {
 }
 
 const Date Date::roundDay() const {
+  unsigned microseconds;
   struct tm t;
-  time_t seconds =
-      static_cast<time_t>(microSecondsSinceEpoch_ / MICRO_SECONDS_PRE_SEC);
-
-  localtime_r(&seconds, &t);
-  t.tm_hour = 0;
-  t.tm_min = 0;
-  t.tm_sec = 0;
-  return Date(mktime(&t) * MICRO_SECONDS_PRE_SEC);
+  breakDown(splitMicroseconds(microSecondsSinceEpoch_, &microseconds), true,
+            &t);
+  return Date(t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
 }
 
 struct tm Date::tmStruct() const {
-  time_t seconds =
-      static_cast<time_t>(microSecondsSinceEpoch_ / MICRO_SECONDS_PRE_SEC);
+  unsigned microseconds;
   struct tm tm_time;
-  gmtime_r(&seconds, &tm_time);
+  breakDown(splitMicroseconds(microSecondsSinceEpoch_, &microseconds), false,
+            &tm_time);
   return tm_time;
 }
 
 std::string Date::toFormattedString(bool showMicroseconds) const {
-  char buf[128] = {0};
-  time_t seconds =
-      static_cast<time_t>(microSecondsSinceEpoch_ / MICRO_SECONDS_PRE_SEC);
-  struct tm tm_time;
-  gmtime_r(&seconds, &tm_time);
-
-  if (showMicroseconds) {
-    int microseconds =
-        static_cast<int>(microSecondsSinceEpoch_ % MICRO_SECONDS_PRE_SEC);
-    snprintf(buf, sizeof(buf), "%4d%02d%02d %02d:%02d:%02d.%06d",
-             tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
-             tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec, microseconds);
-  } else {
-    snprintf(buf, sizeof(buf), "%4d%02d%02d %02d:%02d:%02d",
-             tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
-             tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec);
-  }
-  return buf;
+  return formattedString(microSecondsSinceEpoch_, false, showMicroseconds);
 }
 
 std::string Date::toCustomedFormattedString(const std::string &fmtStr,
                                             bool showMicroseconds) const {
-  char buf[256] = {0};
-  time_t seconds =
-      static_cast<time_t>(microSecondsSinceEpoch_ / MICRO_SECONDS_PRE_SEC);
-  struct tm tm_time;
-  gmtime_r(&seconds, &tm_time);
-
-  strftime(buf, sizeof(buf), fmtStr.c_str(), &tm_time);
-  if (!showMicroseconds) return std::string(buf);
-  char decimals[12] = {0};
-  int microseconds =
-      static_cast<int>(microSecondsSinceEpoch_ % MICRO_SECONDS_PRE_SEC);
-  snprintf(decimals, sizeof(decimals), ".%06d", microseconds);
-  return std::string(buf) + decimals;
+  return customedFormattedString(microSecondsSinceEpoch_, fmtStr, false,
+                                 showMicroseconds);
 }
 
 void Date::toCustomedFormattedString(const std::string &fmtStr, char *str,
                                      size_t len) const {
-  time_t seconds =
-      static_cast<time_t>(microSecondsSinceEpoch_ / MICRO_SECONDS_PRE_SEC);
+  unsigned microseconds;
   struct tm tm_time;
-  gmtime_r(&seconds, &tm_time);
-  strftime(str, len, fmtStr.c_str(), &tm_time);
+  breakDown(splitMicroseconds(microSecondsSinceEpoch_, &microseconds), false,
+            &tm_time);
+  formatTm(fmtStr.c_str(), tm_time, str, len);
 }
 
 std::string Date::toFormattedStringLocal(bool showMicroseconds) const {
-  char buf[128] = {0};
-  time_t seconds =
-      static_cast<time_t>(microSecondsSinceEpoch_ / MICRO_SECONDS_PRE_SEC);
-  struct tm tm_time;
-  localtime_r(&seconds, &tm_time);
-
-  if (showMicroseconds) {
-    int microseconds =
-        static_cast<int>(microSecondsSinceEpoch_ % MICRO_SECONDS_PRE_SEC);
-    snprintf(buf, sizeof(buf), "%4d%02d%02d %02d:%02d:%02d.%06d",
-             tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
-             tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec, microseconds);
-  } else {
-    snprintf(buf, sizeof(buf), "%4d%02d%02d %02d:%02d:%02d",
-             tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
-             tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec);
-  }
-  return buf;
+  return formattedString(microSecondsSinceEpoch_, true, showMicroseconds);
 }
 
 std::string Date::toDbStringLocal() const {
-  char buf[128] = {0};
-  time_t seconds =
-      static_cast<time_t>(microSecondsSinceEpoch_ / MICRO_SECONDS_PRE_SEC);
+  unsigned microseconds;
+  const int64_t seconds =
+      splitMicroseconds(microSecondsSinceEpoch_, &microseconds);
   struct tm tm_time;
-  localtime_r(&seconds, &tm_time);
-
-  bool showMicroseconds =
-      (microSecondsSinceEpoch_ % MICRO_SECONDS_PRE_SEC != 0);
-  if (showMicroseconds) {
-    int microseconds =
-        static_cast<int>(microSecondsSinceEpoch_ % MICRO_SECONDS_PRE_SEC);
-    snprintf(buf, sizeof(buf), "%4d-%02d-%02d %02d:%02d:%02d.%06d",
-             tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
-             tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec, microseconds);
+  breakDown(seconds, true, &tm_time);
+  char buf[64];
+  char *p;
+  if (microseconds != 0) {
+    p = putDateTime(buf, tm_time, '-', true);
+    *p++ = '.';
+    p = putSixDigits(p, microseconds);
   } else {
-    if (*this == roundDay()) {
-      snprintf(buf, sizeof(buf), "%4d-%02d-%02d", tm_time.tm_year + 1900,
-               tm_time.tm_mon + 1, tm_time.tm_mday);
-    } else {
-      snprintf(buf, sizeof(buf), "%4d-%02d-%02d %02d:%02d:%02d",
-               tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
-               tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec);
-    }
+    bool midnight =
+        tm_time.tm_hour == 0 && tm_time.tm_min == 0 && tm_time.tm_sec == 0;
+    p = putDateTime(buf, tm_time, '-', !midnight);
   }
-  return buf;
+  return std::string(buf, p);
 }
 
 std::string Date::toDbString() const {
@@ -148,29 +423,25 @@ std::string Date::toDbString() const {
 }
 
 Date Date::fromDbStringLocal(const std::string &datetime) {
-  unsigned int year = {0}, month = {0}, day = {0}, hour = {0}, minute = {0},
-               second = {0}, microSecond = {0};
-  std::vector<std::string> &&v = splitString(datetime, " ");
-  if (2 == v.size()) {
-    std::vector<std::string> date = splitString(v[0], "-");
-    if (3 == date.size()) {
-      year = std::stol(date[0]);
-      month = std::stol(date[1]);
-      day = std::stol(date[2]);
-      std::vector<std::string> time = splitString(v[1], ":");
-      if (2 < time.size()) {
-        hour = std::stol(time[0]);
-        minute = std::stol(time[1]);
-        auto seconds = splitString(time[2], ".");
-        second = std::stol(seconds[0]);
-        if (1 < seconds.size()) {
-          if (seconds[1].length() > 6) {
-            seconds[1].resize(6);
-          } else if (seconds[1].length() < 6) {
-            seconds[1].append(6 - seconds[1].length(), '0');
-          }
-          microSecond = std::stol(seconds[1]);
-        }
+  // YYYY-MM-DD[ HH:MM:SS[.ffffff]], the fraction cut or padded to six
+  // digits
+  unsigned year = {0}, month = {0}, day = {0}, hour = {0}, minute = {0},
+           second = {0}, microSecond = {0};
+  const char *p = datetime.data();
+  const char *end = p + datetime.size();
+  if (!parseNumber(p, end, 9, &year) || p == end || *p++ != '-' ||
+      !parseNumber(p, end, 9, &month) || p == end || *p++ != '-' ||
+      !parseNumber(p, end, 9, &day)) {
+    return Date();
+  }
+  while (p < end && *p == ' ') ++p;
+  if (parseNumber(p, end, 9, &hour) && p < end && *p++ == ':' &&
+      parseNumber(p, end, 9, &minute) && p < end && *p++ == ':' &&
+      parseNumber(p, end, 9, &second) && p < end && *p++ == '.') {
+    const char *fraction = p;
+    if (parseNumber(p, end, 6, &microSecond)) {
+      for (auto digits = p - fraction; digits < 6; ++digits) {
+        microSecond *= 10;
       }
     }
   }
@@ -182,38 +453,52 @@ Date Date::fromDbString(const std::string &datetime) {
       static_cast<double>(timezoneOffset()));
 }
 
+Date Date::fromUtc(unsigned int year, unsigned int month, unsigned int day,
+                   unsigned int hour, unsigned int minute, unsigned int second,
+                   unsigned int microSecond) {
+  if (month == 0 || month > 12) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = minute;
+    tm.tm_sec = second;
+    return Date(static_cast<int64_t>(timegm(&tm)) * MICRO_SECONDS_PRE_SEC +
+                microSecond);
+  }
+  int64_t seconds = daysFromCivil(year, month, day) * kSecondsPerDay +
+                    hour * 3600LL + minute * 60LL + second;
+  return Date(seconds * MICRO_SECONDS_PRE_SEC + microSecond);
+}
+
 std::string Date::toCustomedFormattedStringLocal(const std::string &fmtStr,
                                                  bool showMicroseconds) const {
-  char buf[256] = {0};
-  time_t seconds =
-      static_cast<time_t>(microSecondsSinceEpoch_ / MICRO_SECONDS_PRE_SEC);
-  struct tm tm_time;
-  localtime_r(&seconds, &tm_time);
-  strftime(buf, sizeof(buf), fmtStr.c_str(), &tm_time);
-  if (!showMicroseconds) return std::string(buf);
-  char decimals[12] = {0};
-  int microseconds =
-      static_cast<int>(microSecondsSinceEpoch_ % MICRO_SECONDS_PRE_SEC);
-  snprintf(decimals, sizeof(decimals), ".%06d", microseconds);
-  return std::string(buf) + decimals;
+  return customedFormattedString(microSecondsSinceEpoch_, fmtStr, true,
+                                 showMicroseconds);
 }
 
 Date::Date(unsigned int year, unsigned int month, unsigned int day,
            unsigned int hour, unsigned int minute, unsigned int second,
            unsigned int microSecond) {
-  struct tm tm;
-  memset(&tm, 0, sizeof(tm));
-  tm.tm_isdst = -1;
-  time_t epoch;
-  tm.tm_year = year - 1900;
-  tm.tm_mon = month - 1;
-  tm.tm_mday = day;
-  tm.tm_hour = hour;
-  tm.tm_min = minute;
-  tm.tm_sec = second;
-  epoch = mktime(&tm);
-  microSecondsSinceEpoch_ =
-      static_cast<int64_t>(epoch) * MICRO_SECONDS_PRE_SEC + microSecond;
+  int64_t seconds;
+  if (month == 0 || month > 12 ||
+      !secondsOfLocal(daysFromCivil(year, month, day) * kSecondsPerDay +
+                          hour * 3600LL + minute * 60LL + second,
+                      &seconds)) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_isdst = -1;
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = minute;
+    tm.tm_sec = second;
+    seconds = static_cast<int64_t>(mktime(&tm));
+  }
+  microSecondsSinceEpoch_ = seconds * MICRO_SECONDS_PRE_SEC + microSecond;
 }
 
 }  // namespace canary
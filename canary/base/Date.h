@@ -88,6 +88,11 @@ class Date : public canary::Copyable {
 
   static Date fromDbString(const std::string &datetime);
 
+  // The date of a UTC time, as timegm() would give
+  static Date fromUtc(unsigned int year, unsigned int month, unsigned int day,
+                      unsigned int hour = 0, unsigned int minute = 0,
+                      unsigned int second = 0, unsigned int microSecond = 0);
+
   void toCustomedFormattedString(const std::string &fmtStr, char *str,
                                  size_t len) const;  // UTC
 
@@ -0,0 +1,169 @@
+#include "GzipStream.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "Logger.h"
+
+using namespace canary;
+
+namespace canary {
+static constexpr size_t kChunkSize{16 * 1024};
+static constexpr size_t kMaxAvail{std::numeric_limits<uInt>::max()};
+}  // namespace canary
+
+GzipEncoder::GzipEncoder(int level) : stream_(new z_stream_s()) {
+  ok_ = deflateInit2(stream_.get(), level, Z_DEFLATED, MAX_WBITS + 16, 8,
+                     Z_DEFAULT_STRATEGY) == Z_OK;
+  if (!ok_) LOG_ERROR << "deflateInit2 error!";
+}
+
+GzipEncoder::~GzipEncoder() {
+  if (ok_) (void)deflateEnd(stream_.get());
+}
+
+bool GzipEncoder::compress(int flush, MsgBuffer *output) {
+  assert(output);
+  do {
+    output->ensureWritableBytes(kChunkSize);
+    auto avail = std::min(output->writableBytes(), kMaxAvail);
+    stream_->next_out = reinterpret_cast<Bytef *>(output->beginWrite());
+    stream_->avail_out = static_cast<uInt>(avail);
+    auto ret = ::deflate(stream_.get(), flush);
+    if (ret == Z_STREAM_ERROR) {
+      LOG_ERROR << "deflate error!";
+      ok_ = false;
+      return false;
+    }
+    output->hasWritten(avail - stream_->avail_out);
+  } while (stream_->avail_out == 0);
+  return true;
+}
+
+bool GzipEncoder::update(const char *data, size_t len, MsgBuffer *output) {
+  if (!ok_) return false;
+  while (len > 0) {
+    auto n = std::min(len, kMaxAvail);
+    stream_->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream_->avail_in = static_cast<uInt>(n);
+    if (!compress(Z_NO_FLUSH, output)) return false;
+    assert(stream_->avail_in == 0);
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool GzipEncoder::flush(MsgBuffer *output) {
+  if (!ok_) return false;
+  return compress(Z_SYNC_FLUSH, output);
+}
+
+bool GzipEncoder::finish(MsgBuffer *output) {
+  if (!ok_) return false;
+  bool ret = compress(Z_FINISH, output);
+  reset();
+  return ret;
+}
+
+void GzipEncoder::reset() {
+  // deflateReset keeps the allocated window and hash tables
+  ok_ = deflateReset(stream_.get()) == Z_OK;
+}
+
+StreamCallback GzipEncoder::wrapStream(StreamCallback source, int level) {
+  struct State {
+    explicit State(StreamCallback &&cb, int level)
+        : source_(std::move(cb)), encoder_(level) {}
+    StreamCallback source_;
+    GzipEncoder encoder_;
+    MsgBuffer pending_;
+    std::vector<char> input_;
+    bool finished_{false};
+  };
+  auto state = std::make_shared<State>(std::move(source), level);
+  return [state](char *buf, std::size_t len) -> std::size_t {
+    if (!buf) {
+      // sendStream() is done with the stream, let the source clean up
+      state->source_(nullptr, 0);
+      return 0;
+    }
+    auto &pending = state->pending_;
+    while (pending.readableBytes() == 0 && !state->finished_) {
+      state->input_.resize(kChunkSize);
+      auto n = state->source_(state->input_.data(), state->input_.size());
+      bool ok = n > 0 ? state->encoder_.update(state->input_.data(), n,
+                                               &pending)
+                      : state->encoder_.finish(&pending);
+      if (!ok) {
+        // Cut the stream, the peer sees a truncated gzip member
+        pending.retrieveAll();
+        state->finished_ = true;
+      } else if (n == 0) {
+        state->finished_ = true;
+      }
+    }
+    auto n = std::min(len, pending.readableBytes());
+    memcpy(buf, pending.peek(), n);
+    pending.retrieve(n);
+    return n;
+  };
+}
+
+GzipDecoder::GzipDecoder() : stream_(new z_stream_s()) {
+  // 32 enables automatic gzip/zlib header detection
+  ok_ = inflateInit2(stream_.get(), MAX_WBITS + 32) == Z_OK;
+  if (!ok_) LOG_ERROR << "inflateInit2 error!";
+}
+
+GzipDecoder::~GzipDecoder() {
+  if (ok_) (void)inflateEnd(stream_.get());
+}
+
+bool GzipDecoder::update(const char *data, size_t len, MsgBuffer *output) {
+  assert(output);
+  if (!ok_) return false;
+  while (len > 0) {
+    auto n = std::min(len, kMaxAvail);
+    stream_->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream_->avail_in = static_cast<uInt>(n);
+    while (true) {
+      output->ensureWritableBytes(kChunkSize);
+      auto avail = std::min(output->writableBytes(), kMaxAvail);
+      stream_->next_out = reinterpret_cast<Bytef *>(output->beginWrite());
+      stream_->avail_out = static_cast<uInt>(avail);
+      auto ret = inflate(stream_.get(), Z_NO_FLUSH);
+      output->hasWritten(avail - stream_->avail_out);
+      if (ret == Z_STREAM_END) {
+        finished_ = stream_->avail_in == 0;
+        if (finished_) break;
+        // Another member follows
+        if (inflateReset(stream_.get()) != Z_OK) {
+          ok_ = false;
+          return false;
+        }
+      } else if (ret == Z_OK) {
+        finished_ = false;
+        if (stream_->avail_in == 0 && stream_->avail_out > 0) break;
+      } else if (ret == Z_BUF_ERROR) {
+        // No progress possible, all input consumed
+        break;
+      } else {
+        LOG_ERROR << "inflate error: " << ret;
+        ok_ = false;
+        return false;
+      }
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+void GzipDecoder::reset() {
+  ok_ = inflateReset(stream_.get()) == Z_OK;
+  finished_ = false;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
+#include "MsgBuffer.h"
+#include "NonCopyable.h"
+
+struct z_stream_s;
+
+namespace canary {
+
+using StreamCallback = std::function<std::size_t(char *, std::size_t)>;
+
+// Stateful gzip compressor. Input can be fed in any number of chunks and the
+// compressed bytes are appended to a MsgBuffer as they become available, so
+// memory use does not depend on the size of the message. After finish() the
+// zlib state is reset (not reallocated) and the encoder can be reused for the
+// next message.
+class GzipEncoder : NonCopyable {
+ public:
+  // level follows zlib, -1 means Z_DEFAULT_COMPRESSION, 1(fastest)..9(best)
+  explicit GzipEncoder(int level = -1);
+
+  ~GzipEncoder();
+
+  bool update(const char *data, size_t len, MsgBuffer *output);
+
+  bool update(const MsgBuffer &input, MsgBuffer *output) {
+    return update(input.peek(), input.readableBytes(), output);
+  }
+
+  // Emit all pending output on a byte boundary (Z_SYNC_FLUSH), so the peer
+  // can decompress everything sent so far.
+  bool flush(MsgBuffer *output);
+
+  // Write the gzip trailer and get ready for the next message
+  bool finish(MsgBuffer *output);
+
+  // Drop the current message, if any
+  void reset();
+
+  // Wraps a sendStream() callback so that the data it produces is compressed
+  // on the fly: conn->sendStream(GzipEncoder::wrapStream(reader)).
+  static StreamCallback wrapStream(StreamCallback source, int level = -1);
+
+ private:
+  bool compress(int flush, MsgBuffer *output);
+
+  std::unique_ptr<z_stream_s> stream_;
+  bool ok_{false};
+};
+
+// Stateful gzip (or zlib) decompressor, the counterpart of GzipEncoder.
+// Concatenated gzip members are decoded as one stream.
+class GzipDecoder : NonCopyable {
+ public:
+  GzipDecoder();
+
+  ~GzipDecoder();
+
+  // Returns false if the input is corrupted, the decoder must be reset() then
+  bool update(const char *data, size_t len, MsgBuffer *output);
+
+  bool update(const MsgBuffer &input, MsgBuffer *output) {
+    return update(input.peek(), input.readableBytes(), output);
+  }
+
+  // True if the input ended exactly at the end of a member
+  bool finished() const { return finished_; }
+
+  void reset();
+
+ private:
+  std::unique_ptr<z_stream_s> stream_;
+  bool ok_{false};
+  bool finished_{false};
+};
+
+}  // namespace canary
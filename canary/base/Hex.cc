@@ -0,0 +1,190 @@
+#include "Utility.h"
+
+#include <assert.h>
+
+#include "CpuFeatures.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CANARY_HEX_X86 1
+#endif
+
+namespace canary {
+
+namespace utils {
+
+static const char kHexDigits[] = "0123456789ABCDEF";
+
+// The value of a hex digit, 0xff for the other chars
+struct HexDigitTable {
+  constexpr HexDigitTable() : values_() {
+    for (auto &value : values_) value = 0xff;
+    for (int i = 0; i < 10; ++i) values_['0' + i] = i;
+    for (int i = 0; i < 6; ++i) {
+      values_['a' + i] = 10 + i;
+      values_['A' + i] = 10 + i;
+    }
+  }
+
+  unsigned char values_[256];
+};
+
+static constexpr HexDigitTable kHexDigitValues;
+
+static void toHexScalar(const unsigned char *in, size_t len, char *out) {
+  for (size_t i = 0; i < len; ++i) {
+    out[2 * i] = kHexDigits[in[i] >> 4];
+    out[2 * i + 1] = kHexDigits[in[i] & 0x0f];
+  }
+}
+
+static bool fromHexScalar(const char *in, size_t len, unsigned char *out) {
+  auto values = kHexDigitValues.values_;
+  for (size_t i = 0; i < len / 2; ++i) {
+    auto high = values[static_cast<unsigned char>(in[2 * i])];
+    auto low = values[static_cast<unsigned char>(in[2 * i + 1])];
+    if ((high | low) == 0xff) return false;
+    out[i] = static_cast<unsigned char>(high << 4 | low);
+  }
+  return true;
+}
+
+#ifdef CANARY_HEX_X86
+
+// The kernels return the bytes they did, the scalar code does the rest
+
+__attribute__((target("ssse3"))) static size_t toHexSsse3(
+    const unsigned char *in, size_t len, char *out) {
+  auto digits = _mm_loadu_si128(reinterpret_cast<const __m128i *>(kHexDigits));
+  auto nibble = _mm_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16, out += 32) {
+    auto input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    auto high = _mm_shuffle_epi8(
+        digits, _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+    auto low = _mm_shuffle_epi8(digits, _mm_and_si128(input, nibble));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                     _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16),
+                     _mm_unpackhi_epi8(high, low));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t toHexAvx2(
+    const unsigned char *in, size_t len, char *out) {
+  auto digits = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kHexDigits)));
+  auto nibble = _mm256_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32, out += 64) {
+    auto input = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+    auto high = _mm256_shuffle_epi8(
+        digits, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+    auto low = _mm256_shuffle_epi8(digits, _mm256_and_si256(input, nibble));
+    // The unpacks work in 128-bit lanes: bytes 0-7 and 16-23, 8-15 and
+    // 24-31
+    auto first = _mm256_unpacklo_epi8(high, low);
+    auto second = _mm256_unpackhi_epi8(high, low);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out),
+                        _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 32),
+                        _mm256_permute2x128_si256(first, second, 0x31));
+  }
+  return i + toHexSsse3(in + i, len - i, out);
+}
+
+// The values of 16 hex digits, or false when one is not
+__attribute__((target("ssse3"))) static inline bool hexValues(
+    __m128i input, __m128i *values) {
+  auto digit = _mm_sub_epi8(input, _mm_set1_epi8('0'));
+  // Unsigned compares through a bias: x < n as signed x - 128 < n - 128
+  auto isDigit = _mm_cmpgt_epi8(_mm_set1_epi8(10 - 128),
+                                _mm_xor_si128(digit, _mm_set1_epi8(-128)));
+  auto letter = _mm_sub_epi8(_mm_or_si128(input, _mm_set1_epi8(0x20)),
+                             _mm_set1_epi8('a'));
+  auto isLetter = _mm_cmpgt_epi8(_mm_set1_epi8(6 - 128),
+                                 _mm_xor_si128(letter, _mm_set1_epi8(-128)));
+  if (_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xffff) {
+    return false;
+  }
+  *values = _mm_or_si128(
+      _mm_and_si128(isDigit, digit),
+      _mm_and_si128(isLetter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+  return true;
+}
+
+__attribute__((target("ssse3"))) static size_t fromHexSsse3(
+    const char *in, size_t len, unsigned char *out) {
+  // Pairs of digits to bytes, high * 16 + low
+  auto weights = _mm_set1_epi16(0x0110);
+  size_t i = 0;
+  __m128i first, second;
+  for (; i + 32 <= len; i += 32, out += 16) {
+    auto p = reinterpret_cast<const __m128i *>(in + i);
+    if (!hexValues(_mm_loadu_si128(p), &first) ||
+        !hexValues(_mm_loadu_si128(p + 1), &second)) {
+      break;
+    }
+    auto bytes = _mm_packus_epi16(_mm_maddubs_epi16(first, weights),
+                                  _mm_maddubs_epi16(second, weights));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), bytes);
+  }
+  return i;
+}
+
+#endif  // CANARY_HEX_X86
+
+void binaryToHex(const unsigned char *in, size_t length, char *out) {
+  size_t done = 0;
+#ifdef CANARY_HEX_X86
+  switch (simdLevel()) {
+    case SimdLevel::Avx2:
+      done = toHexAvx2(in, length, out);
+      break;
+    case SimdLevel::Ssse3:
+      done = toHexSsse3(in, length, out);
+      break;
+    case SimdLevel::Scalar:
+      break;
+  }
+#endif
+  toHexScalar(in + done, length - done, out + 2 * done);
+}
+
+bool hexToBinary(const char *in, size_t length, unsigned char *out) {
+  size_t done = 0;
+#ifdef CANARY_HEX_X86
+  if (simdLevel() != SimdLevel::Scalar) done = fromHexSsse3(in, length, out);
+#endif
+  return fromHexScalar(in + done, length - done, out + done / 2);
+}
+
+std::string binaryStringToHex(const unsigned char *ptr, size_t length) {
+  std::string idString(2 * length, '\0');
+  binaryToHex(ptr, length, &idString[0]);
+  return idString;
+}
+
+std::string hexToBinaryString(const char *ptr, size_t length) {
+  assert(length % 2 == 0);
+  std::string ret(length / 2, '\0');
+  if (!hexToBinary(ptr, length, reinterpret_cast<unsigned char *>(&ret[0]))) {
+    return "";
+  }
+  return ret;
+}
+
+std::vector<char> hexToBinaryVector(const char *ptr, size_t length) {
+  assert(length % 2 == 0);
+  std::vector<char> ret(length / 2, '\0');
+  if (!hexToBinary(ptr, length,
+                   reinterpret_cast<unsigned char *>(ret.data()))) {
+    return std::vector<char>();
+  }
+  return ret;
+}
+
+}  // namespace utils
+
+}  // namespace canary
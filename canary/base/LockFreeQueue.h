@@ -5,6 +5,7 @@
 #include <atomic>
 #include <memory>
 #include <type_traits>
+#include <vector>
 
 #include "NonCopyable.h"
 
@@ -69,4 +70,112 @@ class MpscQueue : public NonCopyable {
   std::atomic<BufferNode *> tail_;
 };
 
+// Chase-Lev work-stealing deque of pointers (Le et al., "Correct and
+// Efficient Work-Stealing for Weak Memory Models"). The owner thread pushes
+// and pops at the bottom, any thread steals from the top. The buffer grows
+// as needed; the outgrown ones are kept until the deque goes away, since a
+// thief may still be reading them.
+template <typename T>
+class WorkStealingDeque : public NonCopyable {
+  static_assert(std::is_pointer<T>::value, "T must be a pointer");
+
+ public:
+  explicit WorkStealingDeque(size_t capacity = 256) {
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+    arrays_.emplace_back(new Array(size));
+    array_.store(arrays_.back().get(), std::memory_order_relaxed);
+  }
+
+  // Owner only
+  void push(T item) {
+    auto bottom = bottom_.load(std::memory_order_relaxed);
+    auto top = top_.load(std::memory_order_acquire);
+    auto array = array_.load(std::memory_order_relaxed);
+    if (bottom - top > static_cast<int64_t>(array->capacity_) - 1) {
+      array = grow(array, top, bottom);
+    }
+    array->put(bottom, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only, null when empty
+  T pop() {
+    auto bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    auto array = array_.load(std::memory_order_relaxed);
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto top = top_.load(std::memory_order_relaxed);
+    if (top > bottom) {
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T item = array->get(bottom);
+    if (top == bottom) {
+      // The last item, a thief may be taking it too
+      if (!top_.compare_exchange_strong(top, top + 1,
+                                        std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+        item = nullptr;
+      }
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  // Any thread, null when empty or when another thread won the item
+  T steal() {
+    auto top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom) return nullptr;
+    auto array = array_.load(std::memory_order_acquire);
+    T item = array->get(top);
+    if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return item;
+  }
+
+  // A hint when read by another thread than the owner
+  bool empty() const {
+    return bottom_.load(std::memory_order_relaxed) <=
+           top_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Array {
+    explicit Array(size_t capacity)
+        : capacity_(capacity), items_(new std::atomic<T>[capacity]) {}
+
+    T get(int64_t index) const {
+      return items_[index & (capacity_ - 1)].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t index, T item) {
+      items_[index & (capacity_ - 1)].store(item, std::memory_order_relaxed);
+    }
+
+    // A power of 2
+    const size_t capacity_;
+    std::unique_ptr<std::atomic<T>[]> items_;
+  };
+
+  Array *grow(Array *array, int64_t top, int64_t bottom) {
+    auto bigger = new Array(array->capacity_ * 2);
+    for (auto i = top; i < bottom; ++i) bigger->put(i, array->get(i));
+    arrays_.emplace_back(bigger);
+    array_.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+
+  std::atomic<int64_t> top_{0};
+  std::atomic<int64_t> bottom_{0};
+  std::atomic<Array *> array_;
+  // Owner only
+  std::vector<std::unique_ptr<Array>> arrays_;
+};
+
 }  // namespace canary
@@ -0,0 +1,73 @@
+#include "LogCollector.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include "Clock.h"
+
+using namespace canary;
+
+LogCollector::LogCollector(const std::string &path, size_t batchSize,
+                           double maxDelay)
+    : fd_(::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)),
+      batchSize_(batchSize),
+      maxDelay_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(maxDelay))) {
+  memset(&address_, 0, sizeof(address_));
+  address_.sun_family = AF_UNIX;
+  // Every line is dropped without a socket or with a path too long
+  if (path.size() >= sizeof(address_.sun_path)) {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    return;
+  }
+  memcpy(address_.sun_path, path.data(), path.size());
+  addressLength_ =
+      static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size());
+  batch_.reserve(batchSize_);
+}
+
+LogCollector::~LogCollector() {
+  flush();
+  if (fd_ >= 0) ::close(fd_);
+}
+
+void LogCollector::output(const char *msg, uint64_t len) {
+  auto now = CachedClock::steadyNow();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (batch_.size() + len > batchSize_) {
+    sendBatchLocked();
+    // A line longer than a batch goes alone
+    if (len > batchSize_) {
+      sendLocked(msg, static_cast<size_t>(len), 1);
+      return;
+    }
+  }
+  if (batchLines_ == 0) batchStart_ = now;
+  batch_.append(msg, static_cast<size_t>(len));
+  ++batchLines_;
+  if (now - batchStart_ >= maxDelay_) sendBatchLocked();
+}
+
+void LogCollector::flush() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  sendBatchLocked();
+}
+
+void LogCollector::sendBatchLocked() {
+  sendLocked(batch_.data(), batch_.size(), batchLines_);
+  batch_.clear();
+  batchLines_ = 0;
+}
+
+void LogCollector::sendLocked(const char *data, size_t length,
+                              size_t lines) {
+  if (lines == 0) return;
+  // Not connected, so that a restarted collector gets the next batch
+  if (fd_ < 0 ||
+      ::sendto(fd_, data, length, MSG_DONTWAIT | MSG_NOSIGNAL,
+               reinterpret_cast<const sockaddr *>(&address_),
+               addressLength_) < 0) {
+    dropped_.fetch_add(lines, std::memory_order_relaxed);
+  }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include "NonCopyable.h"
+
+namespace canary {
+
+// An output function for Logger shipping the lines to a collector on the
+// host, a log agent reading a Unix datagram socket, many lines to a
+// datagram. A batch is sent when it is full, when it is older than the
+// delay as the next line comes, and on flush(), which Logger calls after
+// errors; call flush() from a timer too so that a quiet spell does not
+// hold lines back. Lines are dropped, and counted, when the collector is
+// not there or does not keep up: logging never blocks.
+//
+//   auto collector = std::make_shared<LogCollector>("/run/agent.sock");
+//   Logger::setOutputFunction(
+//       [collector](const char *msg, const uint64_t len) {
+//         collector->output(msg, len);
+//       },
+//       [collector]() { collector->flush(); });
+class LogCollector : NonCopyable {
+ public:
+  explicit LogCollector(const std::string &path, size_t batchSize = 16384,
+                        double maxDelay = 0.2);
+
+  // Sends what is left
+  ~LogCollector();
+
+  // May be called in any thread
+  void output(const char *msg, uint64_t len);
+
+  void flush();
+
+  // Lines dropped so far
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  void sendBatchLocked();
+  void sendLocked(const char *data, size_t length, size_t lines);
+
+  int fd_;
+  struct sockaddr_un address_;
+  socklen_t addressLength_{0};
+  size_t batchSize_;
+  std::chrono::steady_clock::duration maxDelay_;
+
+  std::mutex mutex_;
+  std::string batch_;
+  size_t batchLines_{0};
+  std::chrono::steady_clock::time_point batchStart_;
+  std::atomic<uint64_t> dropped_{0};
+};
+
+}  // namespace canary
@@ -8,6 +8,9 @@
 #include <algorithm>
 #include <iostream>
 #include <limits>
+#include <type_traits>
+
+#include "Utility.h"
 
 using namespace canary;
 using namespace canary::detail;
@@ -16,29 +19,14 @@ namespace canary {
 
 namespace detail {
 
-const char digits[] = "9876543210123456789";
-const char *zero = digits + 9;
-
 const char digitsHex[] = "0123456789ABCDEF";
 
 template <typename T>
 size_t convert(char buf[], T value) {
-  T i = value;
-  char *p = buf;
-
-  do {
-    int lsd = static_cast<int>(i % 10);
-    i /= 10;
-    *p++ = zero[lsd];
-  } while (i != 0);
-
-  if (value < 0) {
-    *p++ = '-';
+  if (std::is_signed<T>::value) {
+    return utils::formatInt64(static_cast<int64_t>(value), buf);
   }
-  *p = '\0';
-  std::reverse(buf, p);
-
-  return p - buf;
+  return utils::formatUint64(static_cast<uint64_t>(value), buf);
 }
 
 size_t convertHex(char buf[], uintptr_t value) {
@@ -57,6 +45,14 @@ size_t convertHex(char buf[], uintptr_t value) {
   return p - buf;
 }
 
+size_t convertFloating(char buf[], float value) {
+  return utils::formatFloat(value, buf);
+}
+
+size_t convertFloating(char buf[], double value) {
+  return utils::formatDouble(value, buf);
+}
+
 template class FixedBuffer<kSmallBuffer>;
 template class FixedBuffer<kLargeBuffer>;
 
@@ -159,21 +155,32 @@ LogStream &LogStream::operator<<(const void *p) {
   return *this;
 }
 
-LogStream &LogStream::operator<<(const double &v) {
+template <typename T>
+void LogStream::formatFloating(T v) {
   constexpr static int kMaxNumericSize = 32;
+  static_assert(kMaxNumericSize >= utils::kMaxDoubleLength, "");
   if (exBuffer_.empty()) {
     if (buffer_.avail() >= kMaxNumericSize) {
-      int len = snprintf(buffer_.current(), kMaxNumericSize, "%.12g", v);
+      size_t len = convertFloating(buffer_.current(), v);
       buffer_.add(len);
-      return *this;
+      return;
     } else {
       exBuffer_.append(buffer_.data(), buffer_.length());
     }
   }
   auto oldLen = exBuffer_.length();
   exBuffer_.resize(oldLen + kMaxNumericSize);
-  int len = snprintf(&(exBuffer_[oldLen]), kMaxNumericSize, "%.12g", v);
+  size_t len = convertFloating(&exBuffer_[oldLen], v);
   exBuffer_.resize(oldLen + len);
+}
+
+LogStream &LogStream::operator<<(float &v) {
+  formatFloating(v);
+  return *this;
+}
+
+LogStream &LogStream::operator<<(const double &v) {
+  formatFloating(v);
   return *this;
 }
 
@@ -86,10 +86,8 @@ class LogStream : NonCopyable {
 
   self &operator<<(const void *);
 
-  self &operator<<(float &v) {
-    *this << static_cast<double>(v);
-    return *this;
-  }
+  // The shortest digits that read back as the value
+  self &operator<<(float &v);
   self &operator<<(const double &);
   self &operator<<(const long double &v);
 
@@ -168,6 +166,9 @@ class LogStream : NonCopyable {
   template <typename T>
   void formatInteger(T);
 
+  template <typename T>
+  void formatFloating(T);
+
   Buffer buffer_;
   std::string exBuffer_;
 };
@@ -38,6 +38,20 @@ static thread_local uint64_t lastSecond_{0};
 static thread_local char lastTimeString_[32] = {0};
 static thread_local pid_t threadId_{0};
 
+namespace canary {
+static pid_t currentThreadId() {
+  if (threadId_ == 0) threadId_ = static_cast<pid_t>(::syscall(SYS_gettid));
+  return threadId_;
+}
+
+// Over the six zeros at digits
+static void putMicroseconds(char *digits, uint64_t microSec) {
+  for (int i = 5; i >= 0 && microSec != 0; --i, microSec /= 10) {
+    digits[i] = static_cast<char>('0' + microSec % 10);
+  }
+}
+}  // namespace canary
+
 void Logger::formatTime() {
   uint64_t now = static_cast<uint64_t>(date_.secondsSinceEpoch());
   uint64_t microSec =
@@ -49,12 +63,10 @@ void Logger::formatTime() {
             sizeof(lastTimeString_) - 1);
   }
   logStream_ << T(lastTimeString_, 17);
-  char tmp[32];
-  snprintf(tmp, sizeof(tmp), ".%06llu UTC ",
-           static_cast<long long unsigned int>(microSec));
+  char tmp[] = ".000000 UTC ";
+  putMicroseconds(tmp + 1, microSec);
   logStream_ << T(tmp, 12);
-  if (threadId_ == 0) threadId_ = static_cast<pid_t>(::syscall(SYS_gettid));
-  logStream_ << threadId_;
+  logStream_ << currentThreadId();
 }
 
 static const char *logLevelStr[Logger::LogLevel::kNumberOfLogLevels] = {
@@ -117,3 +129,148 @@ Logger::~Logger() {
 }
 
 LogStream &Logger::stream() { return logStream_; }
+
+static const char *kvLevelNames[Logger::LogLevel::kNumberOfLogLevels] = {
+    "trace", "debug", "info", "warn", "error", "fatal",
+};
+
+static thread_local int64_t lastIsoSecond_{-1};
+static thread_local char lastIsoTimeString_[32] = {0};
+
+namespace canary {
+// 2024-05-06T07:08:09.123456Z
+static void appendIsoTime(LogStream &stream, const Date &date) {
+  int64_t now = date.secondsSinceEpoch();
+  if (now != lastIsoSecond_) {
+    lastIsoSecond_ = now;
+    date.toCustomedFormattedString("%Y-%m-%dT%H:%M:%S", lastIsoTimeString_,
+                                   sizeof(lastIsoTimeString_));
+  }
+  stream << T(lastIsoTimeString_, 19);
+  char tmp[] = ".000000Z";
+  putMicroseconds(tmp + 1, static_cast<uint64_t>(date.microSecondsSinceEpoch() -
+                                                 now * MICRO_SECONDS_PRE_SEC));
+  stream << T(tmp, 8);
+}
+
+// With the escapes of JSON, which logfmt takes too
+static void appendEscaped(LogStream &stream, string_view text) {
+  static const char kHex[] = "0123456789abcdef";
+  size_t clean = 0;
+  for (size_t i = 0; i < text.size(); ++i) {
+    unsigned char c = static_cast<unsigned char>(text[i]);
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+    stream.append(text.data() + clean, i - clean);
+    clean = i + 1;
+    switch (c) {
+      case '"':
+        stream << T("\\\"", 2);
+        break;
+      case '\\':
+        stream << T("\\\\", 2);
+        break;
+      case '\n':
+        stream << T("\\n", 2);
+        break;
+      case '\r':
+        stream << T("\\r", 2);
+        break;
+      case '\t':
+        stream << T("\\t", 2);
+        break;
+      default: {
+        char escape[] = "\\u0000";
+        escape[4] = kHex[c >> 4];
+        escape[5] = kHex[c & 0xf];
+        stream << T(escape, 6);
+        break;
+      }
+    }
+  }
+  stream.append(text.data() + clean, text.size() - clean);
+}
+
+// logfmt quotes the values that are empty or have spaces, quotes, equal
+// signs or control chars
+static bool needsQuotes(string_view text) {
+  if (text.empty()) return true;
+  for (char ch : text) {
+    unsigned char c = static_cast<unsigned char>(ch);
+    if (c <= ' ' || c == '"' || c == '=' || c == '\\' || c == 0x7f) {
+      return true;
+    }
+  }
+  return false;
+}
+}  // namespace canary
+
+KvLogger::KvLogger(Logger::SourceFile file, int line, Logger::LogLevel level)
+    : recordFormat_(format_()), level_(level) {
+  const bool json = recordFormat_ == Format::kJson;
+  logStream_ << (json ? T("{\"ts\":\"", 7) : T("ts=", 3));
+  appendIsoTime(logStream_, CachedClock::now());
+  if (json) logStream_ << '"';
+  appendKey("level", 5);
+  appendValue(string_view(kvLevelNames[level]));
+  appendKey("thread", 6);
+  logStream_ << currentThreadId();
+  appendKey("src", 3);
+  if (json) {
+    logStream_ << '"';
+    appendEscaped(logStream_, string_view(file.data_, file.size_));
+    logStream_ << ':' << line << '"';
+  } else {
+    logStream_ << file << ':' << line;
+  }
+}
+
+KvLogger::~KvLogger() {
+  if (recordFormat_ == Format::kJson) {
+    logStream_ << T("}\n", 2);
+  } else {
+    logStream_ << '\n';
+  }
+  auto &oFunc = Logger::outputFunc_();
+  if (!oFunc) return;
+  oFunc(logStream_.bufferData(), logStream_.bufferLength());
+  if (level_ >= Logger::kError) Logger::flushFunc_()();
+}
+
+void KvLogger::appendKey(const char *key, size_t length) {
+  if (recordFormat_ == Format::kJson) {
+    logStream_ << T(",\"", 2);
+    logStream_.append(key, length);
+    logStream_ << T("\":", 2);
+  } else {
+    logStream_ << ' ';
+    logStream_.append(key, length);
+    logStream_ << '=';
+  }
+}
+
+void KvLogger::appendValue(bool value) {
+  if (value) {
+    logStream_ << T("true", 4);
+  } else {
+    logStream_ << T("false", 5);
+  }
+}
+
+void KvLogger::appendValue(string_view value) {
+  if (recordFormat_ == Format::kLogfmt && !needsQuotes(value)) {
+    logStream_.append(value.data(), value.size());
+    return;
+  }
+  logStream_ << '"';
+  appendEscaped(logStream_, value);
+  logStream_ << '"';
+}
+
+void KvLogger::appendValue(double value) {
+  // JSON has no NaN nor infinities
+  if (recordFormat_ == Format::kJson && value - value != 0) {
+    logStream_ << T("null", 4);
+    return;
+  }
+  logStream_ << value;
+}
@@ -3,11 +3,15 @@
 #include <cstring>
 #include <functional>
 #include <iostream>
+#include <string>
+#include <type_traits>
 #include <vector>
 
+#include "Clock.h"
 #include "Date.h"
 #include "LogStream.h"
 #include "NonCopyable.h"
+#include "StringView.h"
 
 #define CANARY_IF_(cond) for (int _r = 0; _r == 0 && (cond); _r = 1)
 
@@ -133,8 +137,10 @@ class Logger : public NonCopyable {
   }
 
   friend class RawLogger;
+  friend class KvLogger;
   LogStream logStream_;
-  Date date_{Date::now()};
+  // Shared by the lines of an event loop iteration
+  Date date_{CachedClock::now()};
   SourceFile sourceFile_;
   int fileLine_;
   LogLevel level_;
@@ -157,6 +163,82 @@ class RawLogger : public NonCopyable {
   int index_{-1};
 };
 
+// Writes a record of typed fields in logfmt or JSON, for collectors to
+// read without parsing free text. LOG_INFO_KV("accept", "conn", fd,
+// "peer", addr) writes
+//   ts=2024-05-06T07:08:09.123456Z level=info thread=42 src=Foo.cc:12
+//   event=accept conn=12 peer="10.0.0.1:5000"
+// on one line. Keys are string literals, written as they are, so they
+// must not need quoting. The fields are formatted straight into the
+// buffer of the record, which goes to the output function of Logger.
+class KvLogger : public NonCopyable {
+ public:
+  enum class Format { kLogfmt, kJson };
+
+  KvLogger(Logger::SourceFile file, int line, Logger::LogLevel level);
+  ~KvLogger();
+
+  // logfmt by default
+  static void setFormat(Format format) { format_() = format; }
+
+  static Format format() { return format_(); }
+
+  template <int N, typename V>
+  KvLogger &field(const char (&key)[N], const V &value) {
+    appendKey(key, N - 1);
+    appendValue(value);
+    return *this;
+  }
+
+  template <typename... Fields>
+  KvLogger &event(string_view name, const Fields &...fields) {
+    appendKey("event", 5);
+    appendValue(name);
+    return this->fields(fields...);
+  }
+
+  KvLogger &fields() { return *this; }
+
+  // Key, value, key, value...
+  template <int N, typename V, typename... Rest>
+  KvLogger &fields(const char (&key)[N], const V &value,
+                   const Rest &...rest) {
+    field(key, value);
+    return fields(rest...);
+  }
+
+ private:
+  static Format &format_() {
+    static Format format = Format::kLogfmt;
+    return format;
+  }
+
+  void appendKey(const char *key, size_t length);
+
+  void appendValue(bool value);
+  void appendValue(char value) { appendValue(string_view(&value, 1)); }
+  void appendValue(const char *value) {
+    appendValue(value ? string_view(value) : string_view());
+  }
+  void appendValue(const std::string &value) {
+    appendValue(string_view(value));
+  }
+  void appendValue(string_view value);
+  void appendValue(double value);
+  void appendValue(float value) { appendValue(static_cast<double>(value)); }
+
+  template <typename V>
+  typename std::enable_if<std::is_integral<V>::value ||
+                          std::is_enum<V>::value>::type
+  appendValue(V value) {
+    logStream_ << +value;
+  }
+
+  LogStream logStream_;
+  Format recordFormat_;
+  Logger::LogLevel level_;
+};
+
 #ifdef NDEBUG
 #define LOG_TRACE \
   CANARY_IF_(0)   \
@@ -306,6 +388,29 @@ class RawLogger : public NonCopyable {
   canary::Logger(__FILE__, __LINE__, canary::Logger::kFatal).stream()
 #endif
 
+// LOG_INFO_KV(event, key, value, ...)
+#define LOG_TRACE_KV(...)                                          \
+  CANARY_IF_(canary::Logger::logLevel() <= canary::Logger::kTrace) \
+  canary::KvLogger(__FILE__, __LINE__, canary::Logger::kTrace)     \
+      .event(__VA_ARGS__)
+#define LOG_DEBUG_KV(...)                                          \
+  CANARY_IF_(canary::Logger::logLevel() <= canary::Logger::kDebug) \
+  canary::KvLogger(__FILE__, __LINE__, canary::Logger::kDebug)     \
+      .event(__VA_ARGS__)
+#define LOG_INFO_KV(...)                                          \
+  CANARY_IF_(canary::Logger::logLevel() <= canary::Logger::kInfo) \
+  canary::KvLogger(__FILE__, __LINE__, canary::Logger::kInfo)     \
+      .event(__VA_ARGS__)
+#define LOG_WARN_KV(...)                                      \
+  canary::KvLogger(__FILE__, __LINE__, canary::Logger::kWarn) \
+      .event(__VA_ARGS__)
+#define LOG_ERROR_KV(...)                                      \
+  canary::KvLogger(__FILE__, __LINE__, canary::Logger::kError) \
+      .event(__VA_ARGS__)
+#define LOG_FATAL_KV(...)                                      \
+  canary::KvLogger(__FILE__, __LINE__, canary::Logger::kFatal) \
+      .event(__VA_ARGS__)
+
 const char *strerror_tl(int savedErrno);
 
 }  // namespace canary
@@ -1,186 +1,253 @@
 #include "Md5.h"
 
-#include <math.h>
 #include <string.h>
 
-const uint32_t Md5Encode::kA = 0x67452301;
-const uint32_t Md5Encode::kB = 0xefcdab89;
-const uint32_t Md5Encode::kC = 0x98badcfe;
-const uint32_t Md5Encode::kD = 0x10325476;
+#include <algorithm>
 
-const uint64_t Md5Encode::tiNumInteger = 4294967296;
+#include "CpuFeatures.h"
 
-uint32_t Md5Encode::cycleMoveLeft(uint32_t srcNum, int bitNumToMove) {
-  uint32_t srcNum1 = srcNum;
-  uint32_t srcNum2 = srcNum;
-  if (0 >= bitNumToMove) {
-    return srcNum;
+using namespace canary;
+
+namespace canary {
+
+static const uint32_t kInitState[4] = {0x67452301, 0xefcdab89, 0x98badcfe,
+                                       0x10325476};
+
+// floor(abs(sin(i + 1)) * 2^32)
+static const uint32_t kSines[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+static const int kShifts[4][4] = {
+    {7, 12, 17, 22}, {5, 9, 14, 20}, {4, 11, 16, 23}, {6, 10, 15, 21}};
+
+// The 64 steps on one block. V is uint32_t for a single message, or a GCC
+// vector of uint32_t holding a word of several messages, one per lane; the
+// same code then compiles to SIMD in the callers with a target attribute.
+template <typename V>
+__attribute__((always_inline)) static inline void compress(V *state,
+                                                           const V *w) {
+  V a = state[0], b = state[1], c = state[2], d = state[3];
+#pragma GCC unroll 64
+  for (int i = 0; i < 64; ++i) {
+    V f;
+    int g;
+    if (i < 16) {
+      f = d ^ (b & (c ^ d));
+      g = i;
+    } else if (i < 32) {
+      f = c ^ (d & (b ^ c));
+      g = (5 * i + 1) % 16;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) % 16;
+    } else {
+      f = c ^ (b | ~d);
+      g = 7 * i % 16;
+    }
+    int s = kShifts[i / 16][i % 4];
+    V t = a + f + kSines[i] + w[g];
+    a = d;
+    d = c;
+    c = b;
+    b = b + ((t << s) | (t >> (32 - s)));
   }
-  return ((srcNum1 << bitNumToMove) | (srcNum2 >> (32 - bitNumToMove)));
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
 }
 
-uint32_t Md5Encode::fillData(const char *inDataPtr, int dataByteLen,
-                             char **outDataPtr) {
-  int bitNum = dataByteLen * BIT_OF_BYTE;
-  // int grop_num = bitNum / BIT_OF_GROUP;
-  int modBitNum = bitNum % BIT_OF_GROUP;
-  int bitNeedFill = 0;
-  if (modBitNum >= (BIT_OF_GROUP - SRC_DATA_LEN)) {
-    bitNeedFill = (BIT_OF_GROUP - modBitNum);
-    bitNeedFill += (BIT_OF_GROUP - SRC_DATA_LEN);
-  } else {
-    bitNeedFill = (BIT_OF_GROUP - SRC_DATA_LEN) - modBitNum;
-  }
-  int allBit = bitNum + bitNeedFill;
-  if (0 < bitNeedFill) {
-    *outDataPtr = new char[allBit / BIT_OF_BYTE + SRC_DATA_LEN / BIT_OF_BYTE];
-    memset(*outDataPtr, 0, allBit / BIT_OF_BYTE + SRC_DATA_LEN / BIT_OF_BYTE);
-    // copy data
-    memcpy(*outDataPtr, inDataPtr, dataByteLen);
-    // fill rest data
-    unsigned char *tmp = reinterpret_cast<unsigned char *>(*outDataPtr);
-    tmp += dataByteLen;
-    // fill 1 and 0
-    *tmp = 0x80;
-    // fill origin data len
-    unsigned long long *originNum =
-        (unsigned long long *)((*outDataPtr) + ((allBit / BIT_OF_BYTE)));
-    *originNum = dataByteLen * BIT_OF_BYTE;
-  }
-  return (allBit / BIT_OF_BYTE + SRC_DATA_LEN / BIT_OF_BYTE);
+// The words of MD5 are little endian
+static inline uint32_t loadWord(const unsigned char *p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 |
+         uint32_t(p[3]) << 24;
 }
 
-void Md5Encode::roundF(char *data512Ptr, ParamDynamic &param) {
-  uint32_t *M = reinterpret_cast<uint32_t *>(data512Ptr);
-  int s[] = {7, 12, 17, 22};
-  for (int i = 0; i < 16; ++i) {
-    uint64_t ti = tiNumInteger * fabs(sin(i + 1));
-    if (i % 4 == 0) {
-      FF(param.ua_, param.ub_, param.uc_, param.ud_, M[i], s[i % 4], ti);
-    } else if (i % 4 == 1) {
-      FF(param.ud_, param.ua_, param.ub_, param.uc_, M[i], s[i % 4], ti);
-    } else if (i % 4 == 2) {
-      FF(param.uc_, param.ud_, param.ua_, param.ub_, M[i], s[i % 4], ti);
-    } else if (i % 4 == 3) {
-      FF(param.ub_, param.uc_, param.ud_, param.ua_, M[i], s[i % 4], ti);
-    }
-  }
+static void transform(uint32_t *state, const unsigned char *block) {
+  uint32_t w[16];
+  for (int i = 0; i < 16; ++i) w[i] = loadWord(block + 4 * i);
+  compress(state, w);
 }
 
-void Md5Encode::roundG(char *data512Ptr, ParamDynamic &param) {
-  uint32_t *M = reinterpret_cast<uint32_t *>(data512Ptr);
-  int s[] = {5, 9, 14, 20};
-  for (int i = 0; i < 16; ++i) {
-    auto sss = sin(i + 1 + 16);
-    uint64_t ti = tiNumInteger * fabs(sss);
-    int index = (i * 5 + 1) % 16;
-    if (i % 4 == 0) {
-      GG(param.ua_, param.ub_, param.uc_, param.ud_, M[index], s[i % 4], ti);
-    } else if (i % 4 == 1) {
-      GG(param.ud_, param.ua_, param.ub_, param.uc_, M[index], s[i % 4], ti);
-    } else if (i % 4 == 2) {
-      GG(param.uc_, param.ud_, param.ua_, param.ub_, M[index], s[i % 4], ti);
-    } else if (i % 4 == 3) {
-      GG(param.ub_, param.uc_, param.ud_, param.ua_, M[index], s[i % 4], ti);
-    }
+// The last one or two blocks of a message of len bytes, whose rest does
+// not fill a block; returns how many
+static size_t padTail(const unsigned char *rest, size_t len,
+                      unsigned char *tail) {
+  auto restLen = len % 64;
+  auto blocks = restLen < 56 ? 1 : 2;
+  memset(tail, 0, 64 * blocks);
+  if (restLen > 0) memcpy(tail, rest, restLen);
+  tail[restLen] = 0x80;
+  uint64_t bits = static_cast<uint64_t>(len) * 8;
+  for (int i = 0; i < 8; ++i) {
+    tail[64 * blocks - 8 + i] = static_cast<unsigned char>(bits >> (8 * i));
   }
+  return blocks;
 }
 
-void Md5Encode::roundH(char *data512Ptr, ParamDynamic &param) {
-  uint32_t *M = reinterpret_cast<uint32_t *>(data512Ptr);
-  int s[] = {4, 11, 16, 23};
-  for (int i = 0; i < 16; ++i) {
-    uint64_t ti = tiNumInteger * fabs(sin(i + 1 + 32));
-    int index = (i * 3 + 5) % 16;
-    if (i % 4 == 0) {
-      HH(param.ua_, param.ub_, param.uc_, param.ud_, M[index], s[i % 4], ti);
-    } else if (i % 4 == 1) {
-      HH(param.ud_, param.ua_, param.ub_, param.uc_, M[index], s[i % 4], ti);
-    } else if (i % 4 == 2) {
-      HH(param.uc_, param.ud_, param.ua_, param.ub_, M[index], s[i % 4], ti);
-    } else if (i % 4 == 3) {
-      HH(param.ub_, param.uc_, param.ud_, param.ua_, M[index], s[i % 4], ti);
+static void storeDigest(const uint32_t *state, unsigned char *digest) {
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      digest[4 * i + j] = static_cast<unsigned char>(state[i] >> (8 * j));
     }
   }
 }
 
-void Md5Encode::roundI(char *data512Ptr, ParamDynamic &param) {
-  uint32_t *M = reinterpret_cast<uint32_t *>(data512Ptr);
-  int s[] = {6, 10, 15, 21};
-  for (int i = 0; i < 16; ++i) {
-    uint64_t ti = tiNumInteger * fabs(sin(i + 1 + 48));
-    int index = (i * 7 + 0) % 16;
-    if (i % 4 == 0) {
-      II(param.ua_, param.ub_, param.uc_, param.ud_, M[index], s[i % 4], ti);
-    } else if (i % 4 == 1) {
-      II(param.ud_, param.ua_, param.ub_, param.uc_, M[index], s[i % 4], ti);
-    } else if (i % 4 == 2) {
-      II(param.uc_, param.ud_, param.ua_, param.ub_, M[index], s[i % 4], ti);
-    } else if (i % 4 == 3) {
-      II(param.ub_, param.uc_, param.ud_, param.ua_, M[index], s[i % 4], ti);
+#if defined(__x86_64__) || defined(__i386__)
+
+typedef uint32_t Lanes4 __attribute__((vector_size(16)));
+typedef uint32_t Lanes8 __attribute__((vector_size(32)));
+
+// Hashes kLanes messages at once or fewer, the missing ones being empty.
+// Every round takes the next block of each message, or a block of zeros
+// whose result is dropped when the message is done.
+template <typename V, size_t kLanes>
+__attribute__((always_inline)) static inline void digestLanes(
+    const void *const *data, const size_t *lens, size_t count,
+    unsigned char *digests) {
+  const unsigned char *messages[kLanes];
+  size_t fullBlocks[kLanes];
+  size_t totalBlocks[kLanes];
+  unsigned char tails[kLanes][128];
+  size_t rounds = 0;
+  for (size_t lane = 0; lane < kLanes; ++lane) {
+    size_t len = lane < count ? lens[lane] : 0;
+    messages[lane] = lane < count
+                         ? static_cast<const unsigned char *>(data[lane])
+                         : nullptr;
+    fullBlocks[lane] = len / 64;
+    totalBlocks[lane] =
+        fullBlocks[lane] +
+        padTail(messages[lane] + len / 64 * 64, len, tails[lane]);
+    rounds = std::max(rounds, totalBlocks[lane]);
+  }
+  V state[4];
+  for (int i = 0; i < 4; ++i) {
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+      state[i][lane] = kInitState[i];
+    }
+  }
+  static const unsigned char zeros[64] = {};
+  for (size_t round = 0; round < rounds; ++round) {
+    V w[16];
+    V active;
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+      const unsigned char *block;
+      if (round < fullBlocks[lane]) {
+        block = messages[lane] + 64 * round;
+      } else if (round < totalBlocks[lane]) {
+        block = tails[lane] + 64 * (round - fullBlocks[lane]);
+      } else {
+        block = zeros;
+      }
+      for (int i = 0; i < 16; ++i) w[i][lane] = loadWord(block + 4 * i);
+      active[lane] = round < totalBlocks[lane] ? ~0u : 0;
     }
+    V next[4] = {state[0], state[1], state[2], state[3]};
+    compress(next, w);
+    for (int i = 0; i < 4; ++i) {
+      state[i] = (next[i] & active) | (state[i] & ~active);
+    }
+  }
+  for (size_t lane = 0; lane < count; ++lane) {
+    uint32_t laneState[4] = {state[0][lane], state[1][lane], state[2][lane],
+                             state[3][lane]};
+    storeDigest(laneState, digests + Md5::kDigestLength * lane);
   }
 }
 
-void Md5Encode::rotationCalculate(char *data512Ptr, ParamDynamic &param) {
-  if (nullptr == data512Ptr) {
-    return;
-  }
-  roundF(data512Ptr, param);
-  roundG(data512Ptr, param);
-  roundH(data512Ptr, param);
-  roundI(data512Ptr, param);
-  param.ua_ = param.va_last_ + param.ua_;
-  param.ub_ = param.vb_last_ + param.ub_;
-  param.uc_ = param.vc_last_ + param.uc_;
-  param.ud_ = param.vd_last_ + param.ud_;
-
-  param.va_last_ = param.ua_;
-  param.vb_last_ = param.ub_;
-  param.vc_last_ = param.uc_;
-  param.vd_last_ = param.ud_;
+__attribute__((target("ssse3"))) static void digestLanesSsse3(
+    const void *const *data, const size_t *lens, size_t count,
+    unsigned char *digests) {
+  digestLanes<Lanes4, 4>(data, lens, count, digests);
 }
 
-std::string Md5Encode::getHexStr(uint32_t numStr) {
-  std::string hexstr = "";
-  char szch[] = {'0', '1', '2', '3', '4', '5', '6', '7',
-                 '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
-  unsigned char *tmptr = (unsigned char *)&numStr;
-  int len = sizeof(numStr);
-  for (int i = 0; i < len; ++i) {
-    unsigned char ch = tmptr[i] & 0xF0;
-    ch = ch >> 4;
-    hexstr.append(1, szch[ch]);
-    ch = tmptr[i] & 0x0F;
-    hexstr.append(1, szch[ch]);
-  }
-  return hexstr;
+__attribute__((target("avx2"))) static void digestLanesAvx2(
+    const void *const *data, const size_t *lens, size_t count,
+    unsigned char *digests) {
+  digestLanes<Lanes8, 8>(data, lens, count, digests);
+}
+
+#endif
+
+}  // namespace canary
+
+void Md5::reset() {
+  memcpy(state_, kInitState, sizeof(state_));
+  length_ = 0;
+  buffered_ = 0;
 }
 
-std::string Md5Encode::encode(const char *data, const size_t dataLen) {
-  ParamDynamic param;
-  param.ua_ = kA;
-  param.ub_ = kB;
-  param.uc_ = kC;
-  param.ud_ = kD;
-  param.va_last_ = kA;
-  param.vb_last_ = kB;
-  param.vc_last_ = kC;
-  param.vd_last_ = kD;
-
-  std::string result;
-  char *outDataPtr = nullptr;
-  int totalByte = fillData(data, dataLen, &outDataPtr);
-
-  for (int i = 0; i < totalByte / (BIT_OF_GROUP / BIT_OF_BYTE); ++i) {
-    char *dataBitOfGroup = outDataPtr;
-    dataBitOfGroup += i * (BIT_OF_GROUP / BIT_OF_BYTE);
-    rotationCalculate(dataBitOfGroup, param);
+void Md5::update(const void *data, size_t len) {
+  auto p = static_cast<const unsigned char *>(data);
+  length_ += len;
+  if (buffered_ > 0) {
+    auto n = std::min(len, sizeof(buffer_) - buffered_);
+    memcpy(buffer_ + buffered_, p, n);
+    buffered_ += n;
+    p += n;
+    len -= n;
+    if (buffered_ < sizeof(buffer_)) return;
+    transform(state_, buffer_);
+    buffered_ = 0;
   }
-  delete[] outDataPtr, outDataPtr = nullptr;
-  result.append(getHexStr(param.ua_));
-  result.append(getHexStr(param.ub_));
-  result.append(getHexStr(param.uc_));
-  result.append(getHexStr(param.ud_));
+  for (; len >= sizeof(buffer_); p += 64, len -= 64) transform(state_, p);
+  memcpy(buffer_, p, len);
+  buffered_ = len;
+}
+
+void Md5::final(unsigned char *digest) {
+  unsigned char tail[128];
+  auto blocks = padTail(buffer_, length_, tail);
+  for (size_t i = 0; i < blocks; ++i) transform(state_, tail + 64 * i);
+  storeDigest(state_, digest);
+}
+
+std::string Md5::digest(const void *data, size_t len) {
+  Md5 md5;
+  md5.update(data, len);
+  std::string result(kDigestLength, '\0');
+  md5.final(reinterpret_cast<unsigned char *>(&result[0]));
   return result;
 }
+
+void Md5::digestMany(const void *const *data, const size_t *lens,
+                     size_t count, unsigned char *digests) {
+  size_t done = 0;
+#if defined(__x86_64__) || defined(__i386__)
+  switch (simdLevel()) {
+    case SimdLevel::Avx2:
+      for (; done + 1 < count; done += 8) {
+        auto n = std::min<size_t>(8, count - done);
+        digestLanesAvx2(data + done, lens + done, n,
+                        digests + kDigestLength * done);
+      }
+      break;
+    case SimdLevel::Ssse3:
+      for (; done + 1 < count; done += 4) {
+        auto n = std::min<size_t>(4, count - done);
+        digestLanesSsse3(data + done, lens + done, n,
+                         digests + kDigestLength * done);
+      }
+      break;
+    case SimdLevel::Scalar:
+      break;
+  }
+#endif
+  // What is left is a single message or no SIMD
+  for (; done < count; ++done) {
+    Md5 md5;
+    md5.update(data[done], lens[done]);
+    md5.final(digests + kDigestLength * done);
+  }
+}
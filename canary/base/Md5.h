@@ -1,57 +1,41 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 
-#define BIT_OF_BYTE 8
-#define BIT_OF_GROUP 512
-#define SRC_DATA_LEN 64
-
-#define DEF_F(X, Y, Z) ((((X) & (Y)) | ((~X) & (Z))))
-#define DEF_G(X, Y, Z) (((X) & (Z)) | ((Y) & (~Z)))
-#define DEF_H(X, Y, Z) ((X) ^ (Y) ^ (Z))
-#define DEF_I(X, Y, Z) ((Y) ^ ((X) | (~Z)))
-
-#define FF(a, b, c, d, Mj, s, ti) \
-  (a = b + cycleMoveLeft((a + DEF_F(b, c, d) + Mj + ti), s))
-#define GG(a, b, c, d, Mj, s, ti) \
-  (a = b + cycleMoveLeft((a + DEF_G(b, c, d) + Mj + ti), s))
-#define HH(a, b, c, d, Mj, s, ti) \
-  (a = b + cycleMoveLeft((a + DEF_H(b, c, d) + Mj + ti), s))
-#define II(a, b, c, d, Mj, s, ti) \
-  (a = b + cycleMoveLeft((a + DEF_I(b, c, d) + Mj + ti), s))
-
-class Md5Encode {
- public:
-  struct ParamDynamic {
-    uint32_t ua_;
-    uint32_t ub_;
-    uint32_t uc_;
-    uint32_t ud_;
-    uint32_t va_last_;
-    uint32_t vb_last_;
-    uint32_t vc_last_;
-    uint32_t vd_last_;
-  };
+namespace canary {
 
+// Incremental MD5, used for ETags and cache keys. Not meant for anything
+// security sensitive.
+class Md5 {
  public:
-  static std::string encode(const char *data, const size_t dataLen);
-
- protected:
-  static uint32_t cycleMoveLeft(uint32_t srcNum, int bitNumToMove);
-  static void roundF(char *data512Ptr, ParamDynamic &param);
-  static void roundG(char *data512Ptr, ParamDynamic &param);
-  static void roundH(char *data512Ptr, ParamDynamic &param);
-  static void roundI(char *data512Ptr, ParamDynamic &param);
-  static void rotationCalculate(char *data512Ptr, ParamDynamic &param);
-  static std::string getHexStr(uint32_t numStr);
-  static uint32_t fillData(const char *inDataPtr, int dataByteLen,
-                           char **outDataPtr);
+  static constexpr size_t kDigestLength = 16;
+
+  Md5() { reset(); }
+
+  void reset();
+
+  void update(const void *data, size_t len);
+
+  // Writes kDigestLength bytes, the object must be reset() before reuse
+  void final(unsigned char *digest);
+
+  // The raw 16 byte digest of data
+  static std::string digest(const void *data, size_t len);
+
+  // Hashes count independent messages at once, writing their digests one
+  // after the other to digests. The messages share the SIMD lanes, 8 at a
+  // time with AVX2 and 4 with SSSE3, so this pays off for many messages of
+  // similar lengths, such as the files of a directory.
+  static void digestMany(const void *const *data, const size_t *lens,
+                         size_t count, unsigned char *digests);
 
  private:
-  static const uint32_t kA;
-  static const uint32_t kB;
-  static const uint32_t kC;
-  static const uint32_t kD;
-  static const uint64_t tiNumInteger;
+  uint32_t state_[4];
+  uint64_t length_{0};
+  unsigned char buffer_[64];
+  size_t buffered_{0};
 };
+
+}  // namespace canary
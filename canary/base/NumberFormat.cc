@@ -0,0 +1,461 @@
+#include "Utility.h"
+
+#include <string.h>
+
+#include <vector>
+
+namespace canary {
+
+namespace utils {
+
+static const char kDigitPairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const uint64_t kPowersOf10[20] = {1ULL,
+                                         10ULL,
+                                         100ULL,
+                                         1000ULL,
+                                         10000ULL,
+                                         100000ULL,
+                                         1000000ULL,
+                                         10000000ULL,
+                                         100000000ULL,
+                                         1000000000ULL,
+                                         10000000000ULL,
+                                         100000000000ULL,
+                                         1000000000000ULL,
+                                         10000000000000ULL,
+                                         100000000000000ULL,
+                                         1000000000000000ULL,
+                                         10000000000000000ULL,
+                                         100000000000000000ULL,
+                                         1000000000000000000ULL,
+                                         10000000000000000000ULL};
+
+static inline unsigned decimalLength(uint64_t value) {
+  // log10 from log2, one short at most
+  const unsigned guess =
+      static_cast<unsigned>((64 - __builtin_clzll(value | 1)) * 1233) >> 12;
+  return guess + (value >= kPowersOf10[guess] || value == 0);
+}
+
+// Writes the digits of value backwards from end, two at a time
+static inline void putDigits(uint64_t value, char *end) {
+  while (value >= 100) {
+    const unsigned pair = static_cast<unsigned>(value % 100) * 2;
+    value /= 100;
+    end -= 2;
+    memcpy(end, kDigitPairs + pair, 2);
+  }
+  if (value >= 10) {
+    memcpy(end - 2, kDigitPairs + value * 2, 2);
+  } else {
+    end[-1] = static_cast<char>('0' + value);
+  }
+}
+
+size_t formatUint64(uint64_t value, char *out) {
+  const unsigned length = decimalLength(value);
+  putDigits(value, out + length);
+  return length;
+}
+
+size_t formatInt64(int64_t value, char *out) {
+  if (value < 0) {
+    *out = '-';
+    return 1 + formatUint64(0 - static_cast<uint64_t>(value), out + 1);
+  }
+  return formatUint64(static_cast<uint64_t>(value), out);
+}
+
+// The shortest round trip follows Ryu (Ulf Adams, "Ryu: fast float-to-
+// string conversion", PLDI 2018): the interval of the reals that round to
+// the binary value is scaled by a power of ten taken from a table of 125
+// bit approximations, and digits are dropped while both ends of the
+// interval still differ.
+
+static constexpr int kPow5Bits = 125;
+static constexpr int kPow5TableSize = 326;
+static constexpr int kPow5InverseTableSize = 342;
+
+// ceil(log2(5^e)), and 1 for e = 0
+static inline int32_t pow5Bits(int32_t e) {
+  return static_cast<int32_t>((static_cast<uint32_t>(e) * 1217359) >> 19) + 1;
+}
+
+// floor(log10(2^e))
+static inline uint32_t log10Pow2(int32_t e) {
+  return (static_cast<uint32_t>(e) * 78913) >> 18;
+}
+
+// floor(log10(5^e))
+static inline uint32_t log10Pow5(int32_t e) {
+  return (static_cast<uint32_t>(e) * 732923) >> 20;
+}
+
+// An unsigned integer of any size, just what building the tables takes
+class BigUnsigned {
+ public:
+  explicit BigUnsigned(uint32_t value) : words_(1, value) {}
+
+  void multiply(uint32_t factor) {
+    uint64_t carry = 0;
+    for (auto &word : words_) {
+      carry += static_cast<uint64_t>(word) * factor;
+      word = static_cast<uint32_t>(carry);
+      carry >>= 32;
+    }
+    if (carry) words_.push_back(static_cast<uint32_t>(carry));
+  }
+
+  int bitLength() const {
+    return static_cast<int>(words_.size() * 32) -
+           __builtin_clz(words_.back());
+  }
+
+  bool bit(int index) const {
+    return (words_[index / 32] >> (index % 32)) & 1;
+  }
+
+  // this = 2 * this + bit
+  void shiftInBit(bool bit) {
+    uint32_t carry = bit;
+    for (auto &word : words_) {
+      uint32_t next = word >> 31;
+      word = (word << 1) | carry;
+      carry = next;
+    }
+    if (carry) words_.push_back(carry);
+  }
+
+  bool lessThan(const BigUnsigned &other) const {
+    if (words_.size() != other.words_.size()) {
+      return words_.size() < other.words_.size();
+    }
+    for (size_t i = words_.size(); i-- > 0;) {
+      if (words_[i] != other.words_[i]) return words_[i] < other.words_[i];
+    }
+    return false;
+  }
+
+  // other is not greater
+  void subtract(const BigUnsigned &other) {
+    int64_t borrow = 0;
+    for (size_t i = 0; i < words_.size(); ++i) {
+      int64_t difference = static_cast<int64_t>(words_[i]) - borrow -
+                           (i < other.words_.size() ? other.words_[i] : 0);
+      borrow = difference < 0;
+      words_[i] = static_cast<uint32_t>(difference);
+    }
+    while (words_.size() > 1 && words_.back() == 0) words_.pop_back();
+  }
+
+  static BigUnsigned powerOf2(int exponent) {
+    BigUnsigned result(0);
+    result.words_.assign(exponent / 32 + 1, 0);
+    result.words_.back() = 1u << (exponent % 32);
+    return result;
+  }
+
+ private:
+  std::vector<uint32_t> words_;
+};
+
+using Uint128 = unsigned __int128;
+
+// 5^i, and 2^(pow5Bits(i) - 1 + kPow5Bits) / 5^i, both scaled to 125 bits.
+// Built on first use, taking a fraction of a millisecond.
+struct Pow5Tables {
+  Pow5Tables() {
+    BigUnsigned pow5(1);
+    for (int i = 0; i < kPow5InverseTableSize; ++i) {
+      const int bits = pow5.bitLength();
+      if (i < kPow5TableSize) {
+        // The top kPow5Bits bits
+        Uint128 top = 0;
+        for (int b = bits - 1; b >= 0 && b >= bits - kPow5Bits; --b) {
+          top = (top << 1) | pow5.bit(b);
+        }
+        if (bits < kPow5Bits) top <<= kPow5Bits - bits;
+        powers_[i] = top;
+      }
+      // floor(2^(bits - 1 + kPow5Bits) / 5^i) + 1 by long division, the
+      // first bits quotient bits done at once for 5^i > 1
+      if (i == 0) {
+        inverses_[i] = (static_cast<Uint128>(1) << kPow5Bits) + 1;
+      } else {
+        BigUnsigned remainder = BigUnsigned::powerOf2(bits);
+        remainder.subtract(pow5);
+        Uint128 quotient = 1;
+        for (int b = 0; b < kPow5Bits - 1; ++b) {
+          remainder.shiftInBit(false);
+          quotient <<= 1;
+          if (!remainder.lessThan(pow5)) {
+            remainder.subtract(pow5);
+            quotient |= 1;
+          }
+        }
+        inverses_[i] = quotient + 1;
+      }
+      pow5.multiply(5);
+    }
+  }
+
+  Uint128 powers_[kPow5TableSize];
+  Uint128 inverses_[kPow5InverseTableSize];
+};
+
+static const Pow5Tables &pow5Tables() {
+  static const Pow5Tables tables;
+  return tables;
+}
+
+// (m * factor) >> shift, shift being above 64
+static inline uint64_t mulShift(uint64_t m, Uint128 factor, int32_t shift) {
+  const Uint128 low = static_cast<Uint128>(m) * static_cast<uint64_t>(factor);
+  const Uint128 high =
+      static_cast<Uint128>(m) * static_cast<uint64_t>(factor >> 64);
+  return static_cast<uint64_t>(((low >> 64) + high) >> (shift - 64));
+}
+
+static inline uint32_t pow5Factor(uint64_t value) {
+  uint32_t count = 0;
+  while (value % 5 == 0) {
+    value /= 5;
+    ++count;
+  }
+  return count;
+}
+
+static inline bool multipleOfPowerOf5(uint64_t value, uint32_t p) {
+  return pow5Factor(value) >= p;
+}
+
+static inline bool multipleOfPowerOf2(uint64_t value, uint32_t p) {
+  return (value & ((1ULL << p) - 1)) == 0;
+}
+
+// digits_ * 10^exponent_
+struct Decimal {
+  uint64_t digits_;
+  int32_t exponent_;
+};
+
+// The shortest decimal in the interval of the reals rounding to the binary
+// value, the closest to it of them. The fields are those of an IEEE 754
+// value, positive and finite, of mantissaBits and the bias.
+static Decimal shortestDecimal(uint64_t mantissa, uint32_t exponent,
+                               int32_t mantissaBits, int32_t bias) {
+  int32_t e2;
+  uint64_t m2;
+  if (exponent == 0) {
+    e2 = 1 - bias - mantissaBits - 2;
+    m2 = mantissa;
+  } else {
+    e2 = static_cast<int32_t>(exponent) - bias - mantissaBits - 2;
+    m2 = (1ULL << mantissaBits) | mantissa;
+  }
+  // Round half to even when reading back
+  const bool acceptBounds = (m2 & 1) == 0;
+
+  // The interval is [4 * m2 - 1 - mmShift, 4 * m2 + 2] * 2^e2, narrower
+  // below a power of two
+  const uint64_t mv = 4 * m2;
+  const uint32_t mmShift = mantissa != 0 || exponent <= 1;
+
+  const Pow5Tables &tables = pow5Tables();
+  uint64_t vr, vp, vm;
+  int32_t e10;
+  bool vmIsTrailingZeros = false;
+  bool vrIsTrailingZeros = false;
+  if (e2 >= 0) {
+    const uint32_t q = log10Pow2(e2) - (e2 > 3);
+    e10 = static_cast<int32_t>(q);
+    const int32_t k = kPow5Bits + pow5Bits(static_cast<int32_t>(q)) - 1;
+    const int32_t i = -e2 + static_cast<int32_t>(q) + k;
+    const Uint128 factor = tables.inverses_[q];
+    vr = mulShift(mv, factor, i);
+    vp = mulShift(mv + 2, factor, i);
+    vm = mulShift(mv - 1 - mmShift, factor, i);
+    if (q <= 21) {
+      // Only one of mp, mv and mm can be a multiple of 5, if any
+      if (mv % 5 == 0) {
+        vrIsTrailingZeros = multipleOfPowerOf5(mv, q);
+      } else if (acceptBounds) {
+        vmIsTrailingZeros = multipleOfPowerOf5(mv - 1 - mmShift, q);
+      } else {
+        vp -= multipleOfPowerOf5(mv + 2, q);
+      }
+    }
+  } else {
+    const uint32_t q = log10Pow5(-e2) - (-e2 > 1);
+    e10 = static_cast<int32_t>(q) + e2;
+    const int32_t i = -e2 - static_cast<int32_t>(q);
+    const int32_t k = pow5Bits(i) - kPow5Bits;
+    const int32_t j = static_cast<int32_t>(q) - k;
+    const Uint128 factor = tables.powers_[i];
+    vr = mulShift(mv, factor, j);
+    vp = mulShift(mv + 2, factor, j);
+    vm = mulShift(mv - 1 - mmShift, factor, j);
+    if (q <= 1) {
+      // mv has at least q trailing zero bits, being a multiple of 4
+      vrIsTrailingZeros = true;
+      if (acceptBounds) {
+        vmIsTrailingZeros = mmShift == 1;
+      } else {
+        --vp;
+      }
+    } else if (q < 63) {
+      vrIsTrailingZeros = multipleOfPowerOf2(mv, q);
+    }
+  }
+
+  int32_t removed = 0;
+  uint32_t lastRemovedDigit = 0;
+  uint64_t output;
+  if (vmIsTrailingZeros || vrIsTrailingZeros) {
+    // The rare case where the ends or the value itself may be exact
+    while (vp / 10 > vm / 10) {
+      vmIsTrailingZeros &= vm % 10 == 0;
+      vrIsTrailingZeros &= lastRemovedDigit == 0;
+      lastRemovedDigit = static_cast<uint32_t>(vr % 10);
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      ++removed;
+    }
+    if (vmIsTrailingZeros) {
+      while (vm % 10 == 0) {
+        vrIsTrailingZeros &= lastRemovedDigit == 0;
+        lastRemovedDigit = static_cast<uint32_t>(vr % 10);
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        ++removed;
+      }
+    }
+    if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0) {
+      // Exactly half way, to even
+      lastRemovedDigit = 4;
+    }
+    output = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) ||
+                   lastRemovedDigit >= 5);
+  } else {
+    bool roundUp = false;
+    if (vp / 100 > vm / 100) {
+      // Two digits at once, most of the time
+      roundUp = vr % 100 >= 50;
+      vr /= 100;
+      vp /= 100;
+      vm /= 100;
+      removed += 2;
+    }
+    while (vp / 10 > vm / 10) {
+      roundUp = vr % 10 >= 5;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      ++removed;
+    }
+    output = vr + (vr == vm || roundUp);
+  }
+  return Decimal{output, e10 + removed};
+}
+
+// As printf's %g would, with all the digits: fixed notation for the
+// exponents from -5 to 16, else scientific
+static size_t formatDecimal(bool negative, const Decimal &decimal,
+                            char *out) {
+  char *p = out;
+  if (negative) *p++ = '-';
+  const int32_t length =
+      static_cast<int32_t>(decimalLength(decimal.digits_));
+  const int32_t exponent = decimal.exponent_ + length - 1;
+  if (exponent < -4 || exponent >= 17) {
+    // d[.ddd]e+XX
+    putDigits(decimal.digits_, p + length + 1);
+    p[0] = p[1];
+    if (length > 1) {
+      p[1] = '.';
+      p += length + 1;
+    } else {
+      p += 1;
+    }
+    *p++ = 'e';
+    *p++ = exponent < 0 ? '-' : '+';
+    uint32_t magnitude = static_cast<uint32_t>(exponent < 0 ? -exponent
+                                                            : exponent);
+    if (magnitude >= 100) {
+      *p++ = static_cast<char>('0' + magnitude / 100);
+      magnitude %= 100;
+    }
+    memcpy(p, kDigitPairs + magnitude * 2, 2);
+    p += 2;
+  } else if (decimal.exponent_ >= 0) {
+    // ddd000
+    putDigits(decimal.digits_, p + length);
+    p += length;
+    memset(p, '0', static_cast<size_t>(decimal.exponent_));
+    p += decimal.exponent_;
+  } else if (exponent >= 0) {
+    // dd.ddd
+    putDigits(decimal.digits_, p + length + 1);
+    memmove(p, p + 1, static_cast<size_t>(exponent + 1));
+    p[exponent + 1] = '.';
+    p += length + 1;
+  } else {
+    // 0.000ddd
+    const int32_t zeros = -exponent - 1;
+    memcpy(p, "0.0000", static_cast<size_t>(2 + zeros));
+    p += 2 + zeros;
+    putDigits(decimal.digits_, p + length);
+    p += length;
+  }
+  return static_cast<size_t>(p - out);
+}
+
+static size_t formatSpecial(bool negative, bool nan, char *out) {
+  char *p = out;
+  if (negative) *p++ = '-';
+  memcpy(p, nan ? "nan" : "inf", 3);
+  return static_cast<size_t>(p + 3 - out);
+}
+
+static size_t formatZero(bool negative, char *out) {
+  char *p = out;
+  if (negative) *p++ = '-';
+  *p++ = '0';
+  return static_cast<size_t>(p - out);
+}
+
+size_t formatDouble(double value, char *out) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const bool negative = (bits >> 63) != 0;
+  const uint64_t mantissa = bits & ((1ULL << 52) - 1);
+  const uint32_t exponent = static_cast<uint32_t>(bits >> 52) & 0x7ff;
+  if (exponent == 0x7ff) return formatSpecial(negative, mantissa != 0, out);
+  if (exponent == 0 && mantissa == 0) return formatZero(negative, out);
+  return formatDecimal(negative, shortestDecimal(mantissa, exponent, 52, 1023),
+                       out);
+}
+
+size_t formatFloat(float value, char *out) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const bool negative = (bits >> 31) != 0;
+  const uint32_t mantissa = bits & ((1u << 23) - 1);
+  const uint32_t exponent = (bits >> 23) & 0xff;
+  if (exponent == 0xff) return formatSpecial(negative, mantissa != 0, out);
+  if (exponent == 0 && mantissa == 0) return formatZero(negative, out);
+  return formatDecimal(negative, shortestDecimal(mantissa, exponent, 23, 127),
+                       out);
+}
+
+}  // namespace utils
+
+}  // namespace canary
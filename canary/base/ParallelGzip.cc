@@ -0,0 +1,215 @@
+#include "ParallelGzip.h"
+
+#include <assert.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <future>
+#include <limits>
+#include <vector>
+
+#include "Logger.h"
+
+using namespace canary;
+
+namespace canary {
+static constexpr size_t kWindowSize{32 * 1024};
+static constexpr size_t kMinBlockSize{kWindowSize};
+// deflate works on uInt lengths
+static constexpr size_t kMaxBlockSize{std::numeric_limits<uInt>::max() / 2};
+
+// One deflate state per worker thread, reset (not reallocated) per block
+struct RawDeflater {
+  explicit RawDeflater(int level) : level_(level) {
+    ok_ = deflateInit2(&stream_, level, Z_DEFLATED, -MAX_WBITS, 8,
+                       Z_DEFAULT_STRATEGY) == Z_OK;
+    if (!ok_) LOG_ERROR << "deflateInit2 error!";
+  }
+  ~RawDeflater() {
+    if (ok_) (void)deflateEnd(&stream_);
+  }
+  z_stream stream_{};
+  int level_;
+  bool ok_;
+};
+}  // namespace canary
+
+struct ParallelGzip::Job {
+  struct Block {
+    std::string compressed_;
+    uLong crc_{0};
+    bool ok_{false};
+  };
+  std::shared_ptr<const std::string> data_;
+  std::vector<Block> blocks_;
+  std::atomic<size_t> remaining_{0};
+  size_t blockSize_{0};
+  int level_{-1};
+  EventLoop *loop_{nullptr};
+  ResultCallback callback_;
+};
+
+ParallelGzip::ParallelGzip(const std::shared_ptr<EventLoopThreadPool> &workers,
+                           size_t blockSize, int level)
+    : workers_(workers),
+      blockSize_(std::min(std::max(blockSize, kMinBlockSize), kMaxBlockSize)),
+      level_(level) {
+  assert(workers_ && workers_->size() > 0);
+}
+
+ParallelGzip::ParallelGzip(const std::shared_ptr<WorkerPool> &pool,
+                           size_t blockSize, int level,
+                           WorkerPool::Priority priority)
+    : pool_(pool),
+      priority_(priority),
+      blockSize_(std::min(std::max(blockSize, kMinBlockSize), kMaxBlockSize)),
+      level_(level) {
+  assert(pool_);
+}
+
+void ParallelGzip::compress(EventLoop *loop, std::string data,
+                            ResultCallback callback) {
+  compress(loop, std::make_shared<const std::string>(std::move(data)),
+           std::move(callback));
+}
+
+void ParallelGzip::compress(EventLoop *loop,
+                            const std::shared_ptr<const std::string> &data,
+                            ResultCallback callback) {
+  assert(loop);
+  start(loop, data, std::move(callback));
+}
+
+void ParallelGzip::start(EventLoop *loop,
+                         const std::shared_ptr<const std::string> &data,
+                         ResultCallback callback) {
+  assert(data);
+  auto job = std::make_shared<Job>();
+  job->data_ = data;
+  job->blockSize_ = blockSize_;
+  job->level_ = level_;
+  job->loop_ = loop;
+  job->callback_ = std::move(callback);
+  // An empty input still needs one (empty) final block
+  auto count = std::max<size_t>(1, (data->length() + blockSize_ - 1) /
+                                       blockSize_);
+  job->blocks_.resize(count);
+  job->remaining_ = count;
+  dispatch(job);
+}
+
+std::string ParallelGzip::compress(const char *data, size_t len) {
+  std::promise<std::string> promise;
+  auto future = promise.get_future();
+  start(nullptr, std::make_shared<const std::string>(data, len),
+        [&promise](std::string &&result) {
+          promise.set_value(std::move(result));
+        });
+  return future.get();
+}
+
+void ParallelGzip::dispatch(const std::shared_ptr<Job> &job) {
+  if (pool_) {
+    for (size_t i = 0; i < job->blocks_.size(); ++i) {
+      pool_->submit([job, i]() { compressBlock(job, i); }, priority_);
+    }
+    return;
+  }
+  // getNextLoop() is not thread safe, compress() may be called from any loop
+  auto workers = workers_->size();
+  for (size_t i = 0; i < job->blocks_.size(); ++i) {
+    auto loop = workers_->getLoop(nextWorker_++ % workers);
+    // The job carries its own settings, the compressor may go away first
+    loop->queueInLoop([job, i]() { compressBlock(job, i); });
+  }
+}
+
+void ParallelGzip::compressBlock(const std::shared_ptr<Job> &job,
+                                 size_t index) {
+  static thread_local std::unique_ptr<RawDeflater> deflater;
+  auto blockSize = job->blockSize_;
+  if (!deflater || !deflater->ok_ || deflater->level_ != job->level_) {
+    deflater.reset(new RawDeflater(job->level_));
+  } else {
+    deflater->ok_ = deflateReset(&deflater->stream_) == Z_OK;
+  }
+
+  auto &data = *job->data_;
+  auto &block = job->blocks_[index];
+  auto begin = index * blockSize;
+  auto len = std::min(blockSize, data.length() - begin);
+  auto input = reinterpret_cast<const Bytef *>(data.data() + begin);
+  bool last = index + 1 == job->blocks_.size();
+  block.crc_ = crc32(0, input, static_cast<uInt>(len));
+
+  auto strm = &deflater->stream_;
+  bool ok = deflater->ok_;
+  if (ok && index > 0) {
+    // Prime the window with the tail of the previous block, so matches
+    // across the block boundary are not lost
+    auto dictLen = std::min(kWindowSize, begin);
+    ok = deflateSetDictionary(strm, input - dictLen,
+                              static_cast<uInt>(dictLen)) == Z_OK;
+  }
+  if (ok) {
+    // Non-final blocks end with an empty stored block (Z_SYNC_FLUSH), which
+    // leaves them byte aligned and without the BFINAL bit, so the blocks can
+    // simply be concatenated.
+    block.compressed_.resize(deflateBound(strm, static_cast<uLong>(len)) + 16);
+    strm->next_in = const_cast<Bytef *>(input);
+    strm->avail_in = static_cast<uInt>(len);
+    size_t written = 0;
+    int ret;
+    do {
+      if (written == block.compressed_.size()) {
+        block.compressed_.resize(written * 2);
+      }
+      strm->next_out = reinterpret_cast<Bytef *>(&block.compressed_[written]);
+      strm->avail_out = static_cast<uInt>(block.compressed_.size() - written);
+      ret = deflate(strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+      written = block.compressed_.size() - strm->avail_out;
+    } while (ret == Z_OK && strm->avail_out == 0);
+    ok = last ? ret == Z_STREAM_END : ret == Z_OK || ret == Z_BUF_ERROR;
+    block.compressed_.resize(written);
+  }
+  if (!ok) LOG_ERROR << "deflate error on block " << index;
+  block.ok_ = ok;
+
+  if (--job->remaining_ > 0) return;
+
+  // The last block to finish assembles the member, off the IO loop
+  std::string result;
+  bool success = std::all_of(job->blocks_.begin(), job->blocks_.end(),
+                             [](const Job::Block &b) { return b.ok_; });
+  if (success) {
+    size_t total = 18;
+    for (auto &b : job->blocks_) total += b.compressed_.length();
+    result.reserve(total);
+    // ID1 ID2 CM FLG MTIME(4) XFL OS(unix)
+    static const char header[] = {'\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, 3};
+    result.append(header, sizeof(header));
+    uLong crc = crc32(0, Z_NULL, 0);
+    for (size_t i = 0; i < job->blocks_.size(); ++i) {
+      auto &b = job->blocks_[i];
+      result.append(b.compressed_);
+      auto blockLen = std::min(blockSize, data.length() - i * blockSize);
+      crc = crc32_combine(crc, b.crc_, static_cast<z_off_t>(blockLen));
+    }
+    uint32_t trailer[2] = {static_cast<uint32_t>(crc),
+                           static_cast<uint32_t>(data.length())};
+    for (auto value : trailer) {
+      for (int i = 0; i < 4; ++i) {
+        result.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+      }
+    }
+  }
+  job->blocks_.clear();
+  auto loop = job->loop_;
+  if (!loop) {
+    job->callback_(std::move(result));
+    return;
+  }
+  loop->queueInLoop([job, result = std::move(result)]() mutable {
+    job->callback_(std::move(result));
+  });
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "EventLoopThreadPool.h"
+#include "NonCopyable.h"
+#include "WorkerPool.h"
+
+namespace canary {
+
+// pigz-style gzip compressor for large bodies. The input is split into
+// blocks that are deflated in parallel on worker loops or in a WorkerPool;
+// each block is primed with the last 32KB of the previous one, so the ratio
+// stays close to a single-threaded gzip. The blocks are byte aligned raw
+// deflate streams and their CRCs are combined, which makes the result one
+// valid gzip member.
+class ParallelGzip : NonCopyable {
+ public:
+  using ResultCallback = std::function<void(std::string &&)>;
+
+  // The workers must not be IO loops, compression blocks them.
+  explicit ParallelGzip(const std::shared_ptr<EventLoopThreadPool> &workers,
+                        size_t blockSize = 128 * 1024, int level = -1);
+
+  // The blocks are jobs of the pool, at the given priority
+  explicit ParallelGzip(
+      const std::shared_ptr<WorkerPool> &pool, size_t blockSize = 128 * 1024,
+      int level = -1,
+      WorkerPool::Priority priority = WorkerPool::Priority::Normal);
+
+  // Compress data on the workers and run the callback in loop with the gzip
+  // result (an empty string on failure). Returns immediately.
+  void compress(EventLoop *loop, std::string data, ResultCallback callback);
+
+  void compress(EventLoop *loop,
+                const std::shared_ptr<const std::string> &data,
+                ResultCallback callback);
+
+  // Blocking variant for threads that are neither IO loops nor workers
+  std::string compress(const char *data, size_t len);
+
+  size_t blockSize() const { return blockSize_; }
+
+ private:
+  struct Job;
+
+  static void compressBlock(const std::shared_ptr<Job> &job, size_t index);
+
+  // Without a loop the callback runs on the worker finishing last
+  void start(EventLoop *loop, const std::shared_ptr<const std::string> &data,
+             ResultCallback callback);
+
+  void dispatch(const std::shared_ptr<Job> &job);
+
+  std::shared_ptr<EventLoopThreadPool> workers_;
+  std::shared_ptr<WorkerPool> pool_;
+  const WorkerPool::Priority priority_{WorkerPool::Priority::Normal};
+  const size_t blockSize_;
+  const int level_;
+  std::atomic<size_t> nextWorker_{0};
+};
+
+}  // namespace canary
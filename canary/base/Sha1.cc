@@ -0,0 +1,199 @@
+#include "Sha1.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "CpuFeatures.h"
+#include "MsgBuffer.h"
+
+using namespace canary;
+
+namespace canary {
+static inline uint32_t rotateLeft(uint32_t x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Four rounds per sha1rnds4, the message schedule running three groups of
+// four words ahead (Intel's SHA extensions reference)
+__attribute__((target("sha,sse4.1,ssse3"))) static void transformSha(
+    uint32_t *state, const unsigned char *blocks, size_t count) {
+  const auto byteSwap =
+      _mm_set_epi64x(0x0001020304050607LL, 0x08090a0b0c0d0e0fLL);
+  auto abcd = _mm_shuffle_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0x1b);
+  auto e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+  for (; count > 0; --count, blocks += 64) {
+    auto abcdSave = abcd;
+    auto e0Save = e0;
+    __m128i e1;
+    __m128i w[4];
+#pragma GCC unroll 20
+    for (int i = 0; i < 20; ++i) {
+      if (i < 4) {
+        w[i] = _mm_shuffle_epi8(
+            _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(blocks + 16 * i)),
+            byteSwap);
+      }
+      auto &current = i % 2 ? e1 : e0;
+      auto &next = i % 2 ? e0 : e1;
+      if (i == 0) {
+        e0 = _mm_add_epi32(e0, w[0]);
+      } else {
+        current = _mm_sha1nexte_epu32(current, w[i % 4]);
+      }
+      next = abcd;
+      if (i >= 3 && i <= 18) {
+        w[(i + 1) % 4] = _mm_sha1msg2_epu32(w[(i + 1) % 4], w[i % 4]);
+      }
+      switch (i / 5) {
+        case 0:
+          abcd = _mm_sha1rnds4_epu32(abcd, current, 0);
+          break;
+        case 1:
+          abcd = _mm_sha1rnds4_epu32(abcd, current, 1);
+          break;
+        case 2:
+          abcd = _mm_sha1rnds4_epu32(abcd, current, 2);
+          break;
+        default:
+          abcd = _mm_sha1rnds4_epu32(abcd, current, 3);
+          break;
+      }
+      if (i >= 1 && i <= 16) {
+        w[(i - 1) % 4] = _mm_sha1msg1_epu32(w[(i - 1) % 4], w[i % 4]);
+      }
+      if (i >= 2 && i <= 17) {
+        w[(i - 2) % 4] = _mm_xor_si128(w[(i - 2) % 4], w[i % 4]);
+      }
+    }
+    e0 = _mm_sha1nexte_epu32(e0, e0Save);
+    abcd = _mm_add_epi32(abcd, abcdSave);
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(state),
+                   _mm_shuffle_epi32(abcd, 0x1b));
+  state[4] = static_cast<uint32_t>(_mm_extract_epi32(e0, 3));
+}
+#endif
+}  // namespace canary
+
+void Sha1::reset() {
+  state_[0] = 0x67452301;
+  state_[1] = 0xefcdab89;
+  state_[2] = 0x98badcfe;
+  state_[3] = 0x10325476;
+  state_[4] = 0xc3d2e1f0;
+  length_ = 0;
+  buffered_ = 0;
+}
+
+void Sha1::transform(const unsigned char *block) {
+  uint32_t w[80];
+  for (int i = 0; i < 16; ++i) {
+    w[i] = (uint32_t(block[4 * i]) << 24) | (uint32_t(block[4 * i + 1]) << 16) |
+           (uint32_t(block[4 * i + 2]) << 8) | uint32_t(block[4 * i + 3]);
+  }
+  for (int i = 16; i < 80; ++i) {
+    w[i] = rotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+  uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3],
+           e = state_[4];
+  for (int i = 0; i < 80; ++i) {
+    uint32_t f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+    uint32_t t = rotateLeft(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = rotateLeft(b, 30);
+    b = a;
+    a = t;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+}
+
+void Sha1::transformBlocks(const unsigned char *blocks, size_t count) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (hasShaExtensions()) {
+    transformSha(state_, blocks, count);
+    return;
+  }
+#endif
+  for (; count > 0; --count, blocks += 64) transform(blocks);
+}
+
+void Sha1::update(const void *data, size_t len) {
+  auto p = static_cast<const unsigned char *>(data);
+  length_ += len;
+  if (buffered_ > 0) {
+    auto n = std::min(len, sizeof(buffer_) - buffered_);
+    memcpy(buffer_ + buffered_, p, n);
+    buffered_ += n;
+    p += n;
+    len -= n;
+    if (buffered_ < sizeof(buffer_)) return;
+    transformBlocks(buffer_, 1);
+    buffered_ = 0;
+  }
+  auto blocks = len / sizeof(buffer_);
+  transformBlocks(p, blocks);
+  p += blocks * sizeof(buffer_);
+  len -= blocks * sizeof(buffer_);
+  memcpy(buffer_, p, len);
+  buffered_ = len;
+}
+
+void Sha1::final(unsigned char *digest) {
+  uint64_t bits = length_ * 8;
+  static const unsigned char padding[64] = {0x80};
+  auto padLen = buffered_ < 56 ? 56 - buffered_ : 120 - buffered_;
+  update(padding, padLen);
+  unsigned char lengthBytes[8];
+  for (int i = 0; i < 8; ++i) {
+    lengthBytes[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+  }
+  update(lengthBytes, 8);
+  for (int i = 0; i < 5; ++i) {
+    digest[4 * i] = static_cast<unsigned char>(state_[i] >> 24);
+    digest[4 * i + 1] = static_cast<unsigned char>(state_[i] >> 16);
+    digest[4 * i + 2] = static_cast<unsigned char>(state_[i] >> 8);
+    digest[4 * i + 3] = static_cast<unsigned char>(state_[i]);
+  }
+}
+
+std::string Sha1::digest(const void *data, size_t len) {
+  Sha1 sha1;
+  sha1.update(data, len);
+  std::string result(kDigestLength, '\0');
+  sha1.final(reinterpret_cast<unsigned char *>(&result[0]));
+  return result;
+}
+
+void Sha1::update(const MsgBuffer &buffer) {
+  update(buffer.peek(), buffer.readableBytes());
+}
+
+std::string Sha1::digest(const MsgBuffer &buffer) {
+  return digest(buffer.peek(), buffer.readableBytes());
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace canary {
+
+class MsgBuffer;
+
+// Incremental SHA-1, used by the WebSocket handshake and the MySQL native
+// password scramble. Not meant for anything security sensitive.
+class Sha1 {
+ public:
+  static constexpr size_t kDigestLength = 20;
+
+  Sha1() { reset(); }
+
+  void reset();
+
+  void update(const void *data, size_t len);
+
+  // Writes kDigestLength bytes, the object must be reset() before reuse
+  void final(unsigned char *digest);
+
+  // The raw 20 byte digest of data
+  static std::string digest(const void *data, size_t len);
+
+  // Of the readable bytes, which are not retrieved
+  void update(const MsgBuffer &buffer);
+
+  static std::string digest(const MsgBuffer &buffer);
+
+ private:
+  void transform(const unsigned char *block);
+  // With the SHA extensions when the CPU has them
+  void transformBlocks(const unsigned char *blocks, size_t count);
+
+  uint32_t state_[5];
+  uint64_t length_{0};
+  unsigned char buffer_[64];
+  size_t buffered_{0};
+};
+
+}  // namespace canary
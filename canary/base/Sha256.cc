@@ -0,0 +1,206 @@
+#include "Sha256.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "CpuFeatures.h"
+#include "MsgBuffer.h"
+
+using namespace canary;
+
+namespace canary {
+static const uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t rotateRight(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Two rounds per sha256rnds2, the message schedule running three groups of
+// four words ahead (Intel's SHA extensions reference). The state is kept as
+// ABEF and CDGH.
+__attribute__((target("sha,sse4.1,ssse3"))) static void transformSha(
+    uint32_t *state, const unsigned char *blocks, size_t count) {
+  const auto byteSwap =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+  auto tmp = _mm_shuffle_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0xb1);
+  auto state1 = _mm_shuffle_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(state + 4)), 0x1b);
+  auto state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+  for (; count > 0; --count, blocks += 64) {
+    auto abefSave = state0;
+    auto cdghSave = state1;
+    __m128i w[4];
+#pragma GCC unroll 16
+    for (int i = 0; i < 16; ++i) {
+      if (i < 4) {
+        w[i] = _mm_shuffle_epi8(
+            _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(blocks + 16 * i)),
+            byteSwap);
+      }
+      auto message = _mm_add_epi32(
+          w[i % 4], _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+                        kRoundConstants + 4 * i)));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+      if (i >= 3 && i <= 14) {
+        auto &next = w[(i + 1) % 4];
+        next = _mm_add_epi32(next,
+                             _mm_alignr_epi8(w[i % 4], w[(i + 3) % 4], 4));
+        next = _mm_sha256msg2_epu32(next, w[i % 4]);
+      }
+      message = _mm_shuffle_epi32(message, 0x0e);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, message);
+      if (i >= 1 && i <= 12) {
+        w[(i - 1) % 4] = _mm_sha256msg1_epu32(w[(i - 1) % 4], w[i % 4]);
+      }
+    }
+    state0 = _mm_add_epi32(state0, abefSave);
+    state1 = _mm_add_epi32(state1, cdghSave);
+  }
+  tmp = _mm_shuffle_epi32(state0, 0x1b);
+  state1 = _mm_shuffle_epi32(state1, 0xb1);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(state),
+                   _mm_blend_epi16(tmp, state1, 0xf0));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(state + 4),
+                   _mm_alignr_epi8(state1, tmp, 8));
+}
+#endif
+}  // namespace canary
+
+void Sha256::reset() {
+  state_[0] = 0x6a09e667;
+  state_[1] = 0xbb67ae85;
+  state_[2] = 0x3c6ef372;
+  state_[3] = 0xa54ff53a;
+  state_[4] = 0x510e527f;
+  state_[5] = 0x9b05688c;
+  state_[6] = 0x1f83d9ab;
+  state_[7] = 0x5be0cd19;
+  length_ = 0;
+  buffered_ = 0;
+}
+
+void Sha256::transform(const unsigned char *block) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; ++i) {
+    w[i] = (uint32_t(block[4 * i]) << 24) | (uint32_t(block[4 * i + 1]) << 16) |
+           (uint32_t(block[4 * i + 2]) << 8) | uint32_t(block[4 * i + 3]);
+  }
+  for (int i = 16; i < 64; ++i) {
+    uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^
+                  (w[i - 15] >> 3);
+    uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^
+                  (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3],
+           e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+  for (int i = 0; i < 64; ++i) {
+    uint32_t s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + ch + kRoundConstants[i] + w[i];
+    uint32_t s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+  state_[5] += f;
+  state_[6] += g;
+  state_[7] += h;
+}
+
+void Sha256::transformBlocks(const unsigned char *blocks, size_t count) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (hasShaExtensions()) {
+    transformSha(state_, blocks, count);
+    return;
+  }
+#endif
+  for (; count > 0; --count, blocks += 64) transform(blocks);
+}
+
+void Sha256::update(const void *data, size_t len) {
+  auto p = static_cast<const unsigned char *>(data);
+  length_ += len;
+  if (buffered_ > 0) {
+    auto n = std::min(len, sizeof(buffer_) - buffered_);
+    memcpy(buffer_ + buffered_, p, n);
+    buffered_ += n;
+    p += n;
+    len -= n;
+    if (buffered_ < sizeof(buffer_)) return;
+    transformBlocks(buffer_, 1);
+    buffered_ = 0;
+  }
+  auto blocks = len / sizeof(buffer_);
+  transformBlocks(p, blocks);
+  p += blocks * sizeof(buffer_);
+  len -= blocks * sizeof(buffer_);
+  memcpy(buffer_, p, len);
+  buffered_ = len;
+}
+
+void Sha256::final(unsigned char *digest) {
+  uint64_t bits = length_ * 8;
+  static const unsigned char padding[64] = {0x80};
+  auto padLen = buffered_ < 56 ? 56 - buffered_ : 120 - buffered_;
+  update(padding, padLen);
+  unsigned char lengthBytes[8];
+  for (int i = 0; i < 8; ++i) {
+    lengthBytes[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+  }
+  update(lengthBytes, 8);
+  for (int i = 0; i < 8; ++i) {
+    digest[4 * i] = static_cast<unsigned char>(state_[i] >> 24);
+    digest[4 * i + 1] = static_cast<unsigned char>(state_[i] >> 16);
+    digest[4 * i + 2] = static_cast<unsigned char>(state_[i] >> 8);
+    digest[4 * i + 3] = static_cast<unsigned char>(state_[i]);
+  }
+}
+
+std::string Sha256::digest(const void *data, size_t len) {
+  Sha256 sha256;
+  sha256.update(data, len);
+  std::string result(kDigestLength, '\0');
+  sha256.final(reinterpret_cast<unsigned char *>(&result[0]));
+  return result;
+}
+
+void Sha256::update(const MsgBuffer &buffer) {
+  update(buffer.peek(), buffer.readableBytes());
+}
+
+std::string Sha256::digest(const MsgBuffer &buffer) {
+  return digest(buffer.peek(), buffer.readableBytes());
+}
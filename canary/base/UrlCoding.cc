@@ -0,0 +1,290 @@
+#include "Utility.h"
+
+#include "CpuFeatures.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CANARY_URL_X86 1
+#endif
+
+namespace canary {
+
+namespace utils {
+
+// The chars kept as they are, all ASCII: the unreserved ones and marks of
+// urlEncodeComponent(), and some of the reserved ones for urlEncode()
+static constexpr char kComponentMarks[] = "-_.!~*()";
+static constexpr char kUrlMarks[] = "-_.!~*'()&=/\\?";
+
+// Both a 256-entry table for the scalar code and, for the kernels, the
+// rows of the chars as bits by their low nibble: char 0xhl is kept when bit
+// h of rows_[l] is set.
+struct UrlCharSet {
+  constexpr explicit UrlCharSet(const char *marks) : kept_(), rows_() {
+    for (int c = '0'; c <= '9'; ++c) add(c);
+    for (int c = 'A'; c <= 'Z'; ++c) add(c);
+    for (int c = 'a'; c <= 'z'; ++c) add(c);
+    for (; *marks; ++marks) add(*marks);
+  }
+
+  constexpr void add(int c) {
+    kept_[c] = true;
+    rows_[c & 0x0f] |= 1 << (c >> 4);
+  }
+
+  bool kept_[256];
+  unsigned char rows_[16];
+};
+
+static constexpr UrlCharSet kComponentChars(kComponentMarks);
+static constexpr UrlCharSet kUrlChars(kUrlMarks);
+
+// The value of a hex digit, 0xff for the other chars
+struct HexTable {
+  constexpr HexTable() : values_() {
+    for (auto &value : values_) value = 0xff;
+    for (int i = 0; i < 10; ++i) values_['0' + i] = i;
+    for (int i = 0; i < 6; ++i) {
+      values_['a' + i] = 10 + i;
+      values_['A' + i] = 10 + i;
+    }
+  }
+
+  unsigned char values_[256];
+};
+
+static constexpr HexTable kHexValues;
+
+static size_t scanEncodeScalar(const char *in, size_t len,
+                               const UrlCharSet &chars) {
+  size_t i = 0;
+  while (i < len && chars.kept_[static_cast<unsigned char>(in[i])]) ++i;
+  return i;
+}
+
+static size_t scanDecodeScalar(const char *in, size_t len) {
+  size_t i = 0;
+  while (i < len && in[i] != '+' && in[i] != '%') ++i;
+  return i;
+}
+
+#ifdef CANARY_URL_X86
+
+// The scanners return the index of the first char to change, or where the
+// whole blocks end for the scalar code to go on from.
+
+// Classifies 16 chars at once by looking their rows up with the low nibble
+// and matching the high nibble against them (Mula's pshufb lookup). Chars
+// from 0x80 have no bit, pshufb gives 0 for them.
+__attribute__((target("ssse3"))) static size_t scanEncodeSsse3(
+    const char *in, size_t len, const UrlCharSet &chars) {
+  auto rows = _mm_loadu_si128(reinterpret_cast<const __m128i *>(chars.rows_));
+  auto bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0,
+                            0, 0);
+  auto nibble = _mm_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    auto input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    auto low = _mm_shuffle_epi8(rows, _mm_and_si128(input, nibble));
+    auto high = _mm_shuffle_epi8(
+        bits, _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+    auto escaped = _mm_cmpeq_epi8(_mm_and_si128(low, high),
+                                  _mm_setzero_si128());
+    int mask = _mm_movemask_epi8(escaped);
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t scanEncodeAvx2(
+    const char *in, size_t len, const UrlCharSet &chars) {
+  auto rows = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(chars.rows_)));
+  auto bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0,
+                               0, 0, 0, 1, 2, 4, 8, 16, 32, 64, -128, 0, 0,
+                               0, 0, 0, 0, 0, 0);
+  auto nibble = _mm256_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    auto input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+    auto low = _mm256_shuffle_epi8(rows, _mm256_and_si256(input, nibble));
+    auto high = _mm256_shuffle_epi8(
+        bits, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+    auto escaped = _mm256_cmpeq_epi8(_mm256_and_si256(low, high),
+                                     _mm256_setzero_si256());
+    auto mask = static_cast<unsigned>(_mm256_movemask_epi8(escaped));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return i + scanEncodeSsse3(in + i, len - i, chars);
+}
+
+__attribute__((target("ssse3"))) static size_t scanDecodeSsse3(
+    const char *in, size_t len) {
+  auto plus = _mm_set1_epi8('+');
+  auto percent = _mm_set1_epi8('%');
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    auto input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(input, plus),
+                                              _mm_cmpeq_epi8(input, percent)));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t scanDecodeAvx2(const char *in,
+                                                             size_t len) {
+  auto plus = _mm256_set1_epi8('+');
+  auto percent = _mm256_set1_epi8('%');
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    auto input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+    auto mask = static_cast<unsigned>(_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(input, plus),
+                        _mm256_cmpeq_epi8(input, percent))));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return i + scanDecodeSsse3(in + i, len - i);
+}
+
+#endif  // CANARY_URL_X86
+
+// The index of the first char not kept in chars, len when there is none
+static size_t scanEncode(const char *in, size_t len, const UrlCharSet &chars) {
+  size_t i = 0;
+#ifdef CANARY_URL_X86
+  switch (simdLevel()) {
+    case SimdLevel::Avx2:
+      i = scanEncodeAvx2(in, len, chars);
+      break;
+    case SimdLevel::Ssse3:
+      i = scanEncodeSsse3(in, len, chars);
+      break;
+    case SimdLevel::Scalar:
+      break;
+  }
+  if (i < len && !chars.kept_[static_cast<unsigned char>(in[i])]) return i;
+#endif
+  return i + scanEncodeScalar(in + i, len - i, chars);
+}
+
+// The index of the first '+' or '%', len when there is none
+static size_t scanDecode(const char *in, size_t len) {
+  size_t i = 0;
+#ifdef CANARY_URL_X86
+  switch (simdLevel()) {
+    case SimdLevel::Avx2:
+      i = scanDecodeAvx2(in, len);
+      break;
+    case SimdLevel::Ssse3:
+      i = scanDecodeSsse3(in, len);
+      break;
+    case SimdLevel::Scalar:
+      break;
+  }
+  if (i < len && (in[i] == '+' || in[i] == '%')) return i;
+#endif
+  return i + scanDecodeScalar(in + i, len - i);
+}
+
+// Copies the runs of kept chars as found by the scanner, escaping the chars
+// between them
+static string_view encode(string_view src, std::string &storage,
+                          const UrlCharSet &chars) {
+  static const char hex[] = "0123456789ABCDEF";
+  auto in = src.data();
+  auto len = src.length();
+  auto i = scanEncode(in, len, chars);
+  if (i == len) return src;
+  storage.clear();
+  storage.reserve(len + len / 2);
+  while (i < len) {
+    storage.append(in, i);
+    auto c = static_cast<unsigned char>(in[i]);
+    if (c == ' ') {
+      storage += '+';
+    } else {
+      char escaped[] = {'%', hex[c >> 4], hex[c & 0x0f]};
+      storage.append(escaped, 3);
+    }
+    in += i + 1;
+    len -= i + 1;
+    i = scanEncode(in, len, chars);
+  }
+  storage.append(in, len);
+  return storage;
+}
+
+string_view urlEncode(string_view src, std::string &storage) {
+  return encode(src, storage, kUrlChars);
+}
+
+string_view urlEncodeComponent(string_view src, std::string &storage) {
+  return encode(src, storage, kComponentChars);
+}
+
+std::string urlEncode(const std::string &src) {
+  std::string storage;
+  auto encoded = urlEncode(src, storage);
+  if (encoded.data() == src.data()) return src;
+  return storage;
+}
+
+std::string urlEncodeComponent(const std::string &src) {
+  std::string storage;
+  auto encoded = urlEncodeComponent(src, storage);
+  if (encoded.data() == src.data()) return src;
+  return storage;
+}
+
+bool needUrlDecoding(const char *begin, const char *end) {
+  size_t len = end - begin;
+  return scanDecode(begin, len) != len;
+}
+
+string_view urlDecode(string_view src, std::string &storage) {
+  auto in = src.data();
+  auto len = src.length();
+  auto i = scanDecode(in, len);
+  if (i == len) return src;
+  storage.clear();
+  storage.reserve(len);
+  auto values = kHexValues.values_;
+  while (i < len) {
+    storage.append(in, i);
+    if (in[i] == '+') {
+      storage += ' ';
+      ++i;
+    } else {
+      unsigned char high, low;
+      // A '%' not followed by two hex digits is kept
+      if (i + 2 < len &&
+          (high = values[static_cast<unsigned char>(in[i + 1])]) != 0xff &&
+          (low = values[static_cast<unsigned char>(in[i + 2])]) != 0xff) {
+        storage += static_cast<char>(high << 4 | low);
+        i += 3;
+      } else {
+        storage += '%';
+        ++i;
+      }
+    }
+    in += i;
+    len -= i;
+    i = scanDecode(in, len);
+  }
+  storage.append(in, len);
+  return storage;
+}
+
+std::string urlDecode(const char *begin, const char *end) {
+  std::string storage;
+  auto decoded = urlDecode(string_view(begin, end - begin), storage);
+  if (decoded.data() == begin) return std::string(begin, end);
+  return storage;
+}
+
+}  // namespace utils
+
+}  // namespace canary
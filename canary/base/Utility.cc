@@ -8,6 +8,10 @@
 #include <unistd.h>
 #include <uuid.h>
 #include <zlib.h>
+#ifdef USE_BROTLI
+#include <brotli/decode.h>
+#include <brotli/encode.h>
+#endif
 
 #include <algorithm>
 #include <array>
@@ -151,54 +155,6 @@ bool verifySslName(const std::string &certName, const std::string &hostname) {
   return certName == hostname;
 }
 
-static const std::string base64Chars =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-    "abcdefghijklmnopqrstuvwxyz"
-    "0123456789+/";
-
-static const std::string urlBase64Chars =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-    "abcdefghijklmnopqrstuvwxyz"
-    "0123456789-_";
-class Base64CharMap {
- public:
-  Base64CharMap() {
-    char index = 0;
-    for (int c = 'A'; c <= 'Z'; ++c) {
-      charMap_[c] = index++;
-    }
-    for (int c = 'a'; c <= 'z'; ++c) {
-      charMap_[c] = index++;
-    }
-    for (int c = '0'; c <= '9'; ++c) {
-      charMap_[c] = index++;
-    }
-    charMap_[static_cast<int>('+')] = charMap_[static_cast<int>('-')] = index++;
-    charMap_[static_cast<int>('/')] = charMap_[static_cast<int>('_')] = index;
-    charMap_[0] = 0xff;
-  }
-  char getIndex(const char c) const noexcept {
-    return charMap_[static_cast<int>(c)];
-  }
-
- private:
-  char charMap_[256]{0};
-};
-
-const static Base64CharMap base64CharMap;
-
-static inline bool isBase64(unsigned char c) {
-  if (isalnum(c)) return true;
-  switch (c) {
-    case '+':
-    case '/':
-    case '-':
-    case '_':
-      return true;
-  }
-  return false;
-}
-
 bool isInteger(const std::string &str) {
   for (auto const &c : str) {
     if (c > '9' || c < '0') return false;
@@ -231,94 +187,6 @@ std::string genRandomString(int length) {
   return str;
 }
 
-std::vector<char> hexToBinaryVector(const char *ptr, size_t length) {
-  assert(length % 2 == 0);
-  std::vector<char> ret(length / 2, '\0');
-  for (size_t i = 0; i < ret.size(); ++i) {
-    auto p = i * 2;
-    char c1 = ptr[p];
-    if (c1 >= '0' && c1 <= '9') {
-      c1 -= '0';
-    } else if (c1 >= 'a' && c1 <= 'f') {
-      c1 -= 'a';
-      c1 += 10;
-    } else if (c1 >= 'A' && c1 <= 'F') {
-      c1 -= 'A';
-      c1 += 10;
-    } else {
-      return std::vector<char>();
-    }
-    char c2 = ptr[p + 1];
-    if (c2 >= '0' && c2 <= '9') {
-      c2 -= '0';
-    } else if (c2 >= 'a' && c2 <= 'f') {
-      c2 -= 'a';
-      c2 += 10;
-    } else if (c2 >= 'A' && c2 <= 'F') {
-      c2 -= 'A';
-      c2 += 10;
-    } else {
-      return std::vector<char>();
-    }
-    ret[i] = c1 * 16 + c2;
-  }
-  return ret;
-}
-
-std::string hexToBinaryString(const char *ptr, size_t length) {
-  assert(length % 2 == 0);
-  std::string ret(length / 2, '\0');
-  for (size_t i = 0; i < ret.length(); ++i) {
-    auto p = i * 2;
-    char c1 = ptr[p];
-    if (c1 >= '0' && c1 <= '9') {
-      c1 -= '0';
-    } else if (c1 >= 'a' && c1 <= 'f') {
-      c1 -= 'a';
-      c1 += 10;
-    } else if (c1 >= 'A' && c1 <= 'F') {
-      c1 -= 'A';
-      c1 += 10;
-    } else {
-      return "";
-    }
-    char c2 = ptr[p + 1];
-    if (c2 >= '0' && c2 <= '9') {
-      c2 -= '0';
-    } else if (c2 >= 'a' && c2 <= 'f') {
-      c2 -= 'a';
-      c2 += 10;
-    } else if (c2 >= 'A' && c2 <= 'F') {
-      c2 -= 'A';
-      c2 += 10;
-    } else {
-      return "";
-    }
-    ret[i] = c1 * 16 + c2;
-  }
-  return ret;
-}
-
-std::string binaryStringToHex(const unsigned char *ptr, size_t length) {
-  std::string idString;
-  for (size_t i = 0; i < length; ++i) {
-    int value = (ptr[i] & 0xf0) >> 4;
-    if (value < 10) {
-      idString.append(1, char(value + 48));
-    } else {
-      idString.append(1, char(value + 55));
-    }
-
-    value = (ptr[i] & 0x0f);
-    if (value < 10) {
-      idString.append(1, char(value + 48));
-    } else {
-      idString.append(1, char(value + 55));
-    }
-  }
-  return idString;
-}
-
 std::set<std::string> splitStringToSet(const std::string &str,
                                        const std::string &separator) {
   std::set<std::string> ret;
@@ -346,402 +214,13 @@ std::string getUuid() {
   return binaryStringToHex(uu, 16);
 }
 
-std::string base64Encode(const unsigned char *bytes_to_encode,
-                         unsigned int in_len, bool url_safe) {
-  std::string ret;
-  int i = 0;
-  unsigned char char_array_3[3];
-  unsigned char char_array_4[4];
-
-  const std::string &charSet = url_safe ? urlBase64Chars : base64Chars;
-
-  while (in_len--) {
-    char_array_3[i++] = *(bytes_to_encode++);
-    if (i == 3) {
-      char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-      char_array_4[1] =
-          ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-      char_array_4[2] =
-          ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-      char_array_4[3] = char_array_3[2] & 0x3f;
-
-      for (i = 0; (i < 4); ++i) ret += charSet[char_array_4[i]];
-      i = 0;
-    }
-  }
-
-  if (i) {
-    for (int j = i; j < 3; ++j) char_array_3[j] = '\0';
-
-    char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-    char_array_4[1] =
-        ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-    char_array_4[2] =
-        ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-    char_array_4[3] = char_array_3[2] & 0x3f;
-
-    for (int j = 0; (j < i + 1); ++j) ret += charSet[char_array_4[j]];
-
-    while ((i++ < 3)) ret += '=';
-  }
-  return ret;
-}
-
-std::vector<char> base64DecodeToVector(const std::string &encoded_string) {
-  auto in_len = encoded_string.size();
-  int i = 0;
-  int in_{0};
-  char char_array_4[4], char_array_3[3];
-  std::vector<char> ret;
-  ret.reserve(in_len);
-
-  while (in_len-- && (encoded_string[in_] != '=') &&
-         isBase64(encoded_string[in_])) {
-    char_array_4[i++] = encoded_string[in_];
-    ++in_;
-    if (i == 4) {
-      for (i = 0; i < 4; ++i) {
-        char_array_4[i] = base64CharMap.getIndex(char_array_4[i]);
-      }
-
-      char_array_3[0] =
-          (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-      char_array_3[1] =
-          ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-      char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-      for (i = 0; (i < 3); ++i) ret.push_back(char_array_3[i]);
-      i = 0;
-    }
-  }
-
-  if (i) {
-    for (int j = i; j < 4; ++j) char_array_4[j] = 0;
-
-    for (int j = 0; j < 4; ++j) {
-      char_array_4[j] = base64CharMap.getIndex(char_array_4[j]);
-    }
-
-    char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-    char_array_3[1] =
-        ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-    char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-    for (int j = 0; (j < i - 1); ++j) ret.push_back(char_array_3[j]);
-  }
-
-  return ret;
-}
-
-std::string base64Decode(const std::string &encoded_string) {
-  auto in_len = encoded_string.size();
-  int i = 0;
-  int in_{0};
-  unsigned char char_array_4[4], char_array_3[3];
-  std::string ret;
-
-  while (in_len-- && (encoded_string[in_] != '=') &&
-         isBase64(encoded_string[in_])) {
-    char_array_4[i++] = encoded_string[in_];
-    ++in_;
-    if (i == 4) {
-      for (i = 0; i < 4; ++i) {
-        char_array_4[i] = base64CharMap.getIndex(char_array_4[i]);
-      }
-      char_array_3[0] =
-          (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-      char_array_3[1] =
-          ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-      char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-      for (i = 0; (i < 3); ++i) ret += char_array_3[i];
-      i = 0;
-    }
-  }
-
-  if (i) {
-    for (int j = i; j < 4; ++j) char_array_4[j] = 0;
-
-    for (int j = 0; j < 4; ++j) {
-      char_array_4[j] = base64CharMap.getIndex(char_array_4[j]);
-    }
-
-    char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-    char_array_3[1] =
-        ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-    char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-    for (int j = 0; (j < i - 1); ++j) ret += char_array_3[j];
-  }
-
-  return ret;
-}
-
-static std::string charToHex(char c) {
-  std::string result;
-  char first, second;
-
-  first = (c & 0xF0) / 16;
-  first += first > 9 ? 'A' - 10 : '0';
-  second = c & 0x0F;
-  second += second > 9 ? 'A' - 10 : '0';
-
-  result.append(1, first);
-  result.append(1, second);
-
-  return result;
-}
-
-std::string urlEncodeComponent(const std::string &src) {
-  std::string result;
-  std::string::const_iterator iter;
-
-  for (iter = src.begin(); iter != src.end(); ++iter) {
-    switch (*iter) {
-      case ' ':
-        result.append(1, '+');
-        break;
-      // alnum
-      case 'A':
-      case 'B':
-      case 'C':
-      case 'D':
-      case 'E':
-      case 'F':
-      case 'G':
-      case 'H':
-      case 'I':
-      case 'J':
-      case 'K':
-      case 'L':
-      case 'M':
-      case 'N':
-      case 'O':
-      case 'P':
-      case 'Q':
-      case 'R':
-      case 'S':
-      case 'T':
-      case 'U':
-      case 'V':
-      case 'W':
-      case 'X':
-      case 'Y':
-      case 'Z':
-      case 'a':
-      case 'b':
-      case 'c':
-      case 'd':
-      case 'e':
-      case 'f':
-      case 'g':
-      case 'h':
-      case 'i':
-      case 'j':
-      case 'k':
-      case 'l':
-      case 'm':
-      case 'n':
-      case 'o':
-      case 'p':
-      case 'q':
-      case 'r':
-      case 's':
-      case 't':
-      case 'u':
-      case 'v':
-      case 'w':
-      case 'x':
-      case 'y':
-      case 'z':
-      case '0':
-      case '1':
-      case '2':
-      case '3':
-      case '4':
-      case '5':
-      case '6':
-      case '7':
-      case '8':
-      case '9':
-      // mark
-      case '-':
-      case '_':
-      case '.':
-      case '!':
-      case '~':
-      case '*':
-      case '(':
-      case ')':
-        result.append(1, *iter);
-        break;
-      // escape
-      default:
-        result.append(1, '%');
-        result.append(charToHex(*iter));
-        break;
-    }
-  }
-
-  return result;
-}
-
-std::string urlEncode(const std::string &src) {
-  std::string result;
-  std::string::const_iterator iter;
-
-  for (iter = src.begin(); iter != src.end(); ++iter) {
-    switch (*iter) {
-      case ' ':
-        result.append(1, '+');
-        break;
-      // alnum
-      case 'A':
-      case 'B':
-      case 'C':
-      case 'D':
-      case 'E':
-      case 'F':
-      case 'G':
-      case 'H':
-      case 'I':
-      case 'J':
-      case 'K':
-      case 'L':
-      case 'M':
-      case 'N':
-      case 'O':
-      case 'P':
-      case 'Q':
-      case 'R':
-      case 'S':
-      case 'T':
-      case 'U':
-      case 'V':
-      case 'W':
-      case 'X':
-      case 'Y':
-      case 'Z':
-      case 'a':
-      case 'b':
-      case 'c':
-      case 'd':
-      case 'e':
-      case 'f':
-      case 'g':
-      case 'h':
-      case 'i':
-      case 'j':
-      case 'k':
-      case 'l':
-      case 'm':
-      case 'n':
-      case 'o':
-      case 'p':
-      case 'q':
-      case 'r':
-      case 's':
-      case 't':
-      case 'u':
-      case 'v':
-      case 'w':
-      case 'x':
-      case 'y':
-      case 'z':
-      case '0':
-      case '1':
-      case '2':
-      case '3':
-      case '4':
-      case '5':
-      case '6':
-      case '7':
-      case '8':
-      case '9':
-      // mark
-      case '-':
-      case '_':
-      case '.':
-      case '!':
-      case '~':
-      case '*':
-      case '\'':
-      case '(':
-      case ')':
-      case '&':
-      case '=':
-      case '/':
-      case '\\':
-      case '?':
-        result.append(1, *iter);
-        break;
-      // escape
-      default:
-        result.append(1, '%');
-        result.append(charToHex(*iter));
-        break;
-    }
-  }
-
-  return result;
-}
-
-bool needUrlDecoding(const char *begin, const char *end) {
-  return std::find_if(begin, end,
-                      [](const char c) { return c == '+' || c == '%'; }) != end;
-}
-
-std::string urlDecode(const char *begin, const char *end) {
-  std::string result;
-  size_t len = end - begin;
-  result.reserve(len * 2);
-  int hex = 0;
-  for (size_t i = 0; i < len; ++i) {
-    switch (begin[i]) {
-      case '+':
-        result += ' ';
-        break;
-      case '%':
-        if ((i + 2) < len && isxdigit(begin[i + 1]) && isxdigit(begin[i + 2])) {
-          unsigned int x1 = begin[i + 1];
-          if (x1 >= '0' && x1 <= '9') {
-            x1 -= '0';
-          } else if (x1 >= 'a' && x1 <= 'f') {
-            x1 = x1 - 'a' + 10;
-          } else if (x1 >= 'A' && x1 <= 'F') {
-            x1 = x1 - 'A' + 10;
-          }
-          unsigned int x2 = begin[i + 2];
-          if (x2 >= '0' && x2 <= '9') {
-            x2 -= '0';
-          } else if (x2 >= 'a' && x2 <= 'f') {
-            x2 = x2 - 'a' + 10;
-          } else if (x2 >= 'A' && x2 <= 'F') {
-            x2 = x2 - 'A' + 10;
-          }
-          hex = x1 * 16 + x2;
-
-          result += char(hex);
-          i += 2;
-        } else {
-          result += '%';
-        }
-        break;
-      default:
-        result += begin[i];
-        break;
-    }
-  }
-  return result;
-}
-
 /* Compress gzip data */
-std::string gzipCompress(const char *data, const size_t ndata) {
+std::string gzipCompress(const char *data, const size_t ndata, int level) {
   z_stream strm = {nullptr, 0,       0,       nullptr, 0, 0, nullptr,
                    nullptr, nullptr, nullptr, nullptr, 0, 0, 0};
   if (data && ndata > 0) {
-    if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16,
-                     8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    if (deflateInit2(&strm, level, Z_DEFLATED, MAX_WBITS + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
       LOG_ERROR << "deflateInit2 error!";
       return std::string{};
     }
@@ -830,7 +309,53 @@ char *getHttpFullDate(const canary::Date &date) {
   return lastTimeString;
 }
 
+// The fields of "Sun, 06 Nov 1994 08:49:37 GMT", the form of RFC 7231 all
+// the senders are to use; false for any other
+static bool parseImfFixdate(const std::string &date, canary::Date *result) {
+  static const char kWeekdays[] = "SunMonTueWedThuFriSat";
+  static const char kMonths[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  if (date.size() < 25) return false;
+  const char *p = date.data();
+  auto digit = [p](size_t i) -> int {
+    return p[i] >= '0' && p[i] <= '9' ? p[i] - '0' : -1;
+  };
+  auto number = [&digit](size_t i, size_t count) -> int {
+    int value = 0;
+    for (size_t j = i; j < i + count; ++j) {
+      if (digit(j) < 0) return -1;
+      value = value * 10 + digit(j);
+    }
+    return value;
+  };
+  if (p[3] != ',' || p[4] != ' ' || p[7] != ' ' || p[11] != ' ' ||
+      p[16] != ' ' || p[19] != ':' || p[22] != ':') {
+    return false;
+  }
+  bool knownDay = false;
+  for (size_t i = 0; i < 21 && !knownDay; i += 3) {
+    knownDay = memcmp(p, kWeekdays + i, 3) == 0;
+  }
+  unsigned month = 0;
+  for (unsigned i = 0; i < 12 && month == 0; ++i) {
+    if (memcmp(p + 8, kMonths + 3 * i, 3) == 0) month = i + 1;
+  }
+  int day = number(5, 2);
+  int year = number(12, 4);
+  int hour = number(17, 2);
+  int minute = number(20, 2);
+  int second = number(23, 2);
+  if (!knownDay || month == 0 || day < 1 || day > 31 || year < 0 ||
+      hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 ||
+      second > 60) {
+    return false;
+  }
+  *result = canary::Date::fromUtc(year, month, day, hour, minute, second);
+  return true;
+}
+
 canary::Date getHttpDate(const std::string &httpFullDateString) {
+  canary::Date date;
+  if (parseImfFixdate(httpFullDateString, &date)) return date;
   static const std::array<const char *, 4> formats = {
       // RFC822 (default)
       "%a, %d %b %Y %H:%M:%S",
@@ -903,7 +428,63 @@ int createPath(const std::string &path) {
   return 0;
 }
 
-std::string brotliCompress(const char * /*data*/, const size_t /*ndata*/) {
+#ifdef USE_BROTLI
+std::string brotliCompress(const char *data, const size_t ndata,
+                           int quality) {
+  std::string ret;
+  if (ndata == 0) return ret;
+  ret.resize(BrotliEncoderMaxCompressedSize(ndata));
+  size_t encodedSize{ret.size()};
+  auto r = BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW,
+                                 BROTLI_DEFAULT_MODE, ndata,
+                                 reinterpret_cast<const uint8_t *>(data),
+                                 &encodedSize,
+                                 reinterpret_cast<uint8_t *>(&ret[0]));
+  if (r == BROTLI_FALSE) {
+    LOG_ERROR << "BrotliEncoderCompress error!";
+    ret.resize(0);
+  } else {
+    ret.resize(encodedSize);
+  }
+  return ret;
+}
+
+std::string brotliDecompress(const char *data, const size_t ndata) {
+  if (ndata == 0) return std::string(data, ndata);
+
+  size_t availableIn = ndata;
+  auto nextIn = reinterpret_cast<const uint8_t *>(data);
+  auto decompressed = std::string(availableIn * 3, 0);
+  size_t availableOut = decompressed.size();
+  auto nextOut = reinterpret_cast<uint8_t *>(&decompressed[0]);
+  size_t totalOut{0};
+  bool done = false;
+  auto s = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+  while (!done) {
+    auto result = BrotliDecoderDecompressStream(
+        s, &availableIn, &nextIn, &availableOut, &nextOut, &totalOut);
+    if (result == BROTLI_DECODER_RESULT_SUCCESS) {
+      decompressed.resize(totalOut);
+      done = true;
+    } else if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT) {
+      assert(totalOut == decompressed.size());
+      decompressed.resize(totalOut * 2);
+      nextOut = reinterpret_cast<uint8_t *>(&decompressed[totalOut]);
+      availableOut = totalOut;
+    } else {
+      // corrupted or truncated input
+      decompressed.resize(0);
+      done = true;
+    }
+  }
+  BrotliDecoderDestroyInstance(s);
+  return decompressed;
+}
+
+bool brotliSupported() { return true; }
+#else
+std::string brotliCompress(const char * /*data*/, const size_t /*ndata*/,
+                           int /*quality*/) {
   LOG_ERROR << "If you do not have the brotli package installed, you cannot "
                "use brotliCompress()";
   abort();
@@ -915,8 +496,15 @@ std::string brotliDecompress(const char * /*data*/, const size_t /*ndata*/) {
   abort();
 }
 
+bool brotliSupported() { return false; }
+#endif
+
 std::string getMd5(const char *data, const size_t dataLen) {
-  return Md5Encode::encode(data, dataLen);
+  unsigned char digest[Md5::kDigestLength];
+  Md5 md5;
+  md5.update(data, dataLen);
+  md5.final(digest);
+  return binaryStringToHex(digest, sizeof(digest));
 }
 
 void replaceAll(std::string &s, const std::string &from,
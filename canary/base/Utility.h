@@ -14,6 +14,8 @@
 
 namespace canary {
 
+class MsgBuffer;
+
 namespace internal {
 
 template <typename T>
@@ -67,6 +69,14 @@ bool isInteger(const std::string &str);
 
 std::string genRandomString(int length);
 
+// The hex functions use SSSE3 or AVX2 kernels when the CPU has them
+
+// Writes 2 * length upper case digits to out
+void binaryToHex(const unsigned char *in, size_t length, char *out);
+
+// Writes length / 2 bytes to out, false when a char is not a hex digit
+bool hexToBinary(const char *in, size_t length, unsigned char *out);
+
 std::string binaryStringToHex(const unsigned char *ptr, size_t length);
 
 std::string hexToBinaryString(const char *ptr, size_t length);
@@ -84,6 +94,51 @@ std::set<std::string> splitStringToSet(const std::string &str,
 
 std::string getUuid();
 
+// The number functions write to out without a terminating null and return
+// the length written
+
+static constexpr size_t kMaxInt64Length = 20;
+static constexpr size_t kMaxDoubleLength = 24;
+
+size_t formatUint64(uint64_t value, char *out);
+
+size_t formatInt64(int64_t value, char *out);
+
+// The shortest digits that read back as the same value, in fixed notation
+// for the exponents from -5 to 16 and in scientific notation else, as %g
+// writes them; "nan" and "inf" for those
+size_t formatDouble(double value, char *out);
+
+size_t formatFloat(float value, char *out);
+
+// The base64 functions use SSSE3 or AVX2 kernels when the CPU has them.
+// Decoding accepts both alphabets and stops at the first '=' or other char
+// not of them.
+
+inline size_t base64EncodedLength(size_t length) {
+  return (length + 2) / 3 * 4;
+}
+
+// The most a decoding of length chars may write
+inline size_t base64DecodedLength(size_t length) {
+  return (length + 3) / 4 * 3;
+}
+
+// Writes base64EncodedLength(length) chars to out, returns their count
+size_t base64Encode(const unsigned char *in, size_t length, char *out,
+                    bool url_safe = false);
+
+// Appends to out
+void base64Encode(const unsigned char *in, size_t length, MsgBuffer &out,
+                  bool url_safe = false);
+
+// Writes at most base64DecodedLength(length) bytes to out, returns their
+// count
+size_t base64Decode(const char *in, size_t length, unsigned char *out);
+
+// Appends to out
+void base64Decode(const char *in, size_t length, MsgBuffer &out);
+
 std::string base64Encode(const unsigned char *bytes_to_encode,
                          unsigned int in_len, bool url_safe = false);
 
@@ -91,8 +146,19 @@ std::string base64Decode(const std::string &encoded_string);
 
 std::vector<char> base64DecodeToVector(const std::string &encoded_string);
 
+// The url functions find the chars to change with SSSE3 or AVX2 when the
+// CPU has them. Those taking a storage return src itself when it needs no
+// change, else the result they put in storage, so the common case does not
+// copy.
+
 bool needUrlDecoding(const char *begin, const char *end);
 
+string_view urlDecode(string_view src, std::string &storage);
+
+string_view urlEncode(string_view src, std::string &storage);
+
+string_view urlEncodeComponent(string_view src, std::string &storage);
+
 std::string urlDecode(const char *begin, const char *end);
 
 inline std::string urlDecode(const std::string &szToDecode) {
@@ -115,14 +181,21 @@ inline std::string getMd5(const std::string &originalString) {
   return getMd5(originalString.data(), originalString.length());
 }
 
-std::string gzipCompress(const char *data, const size_t ndata);
+// level follows zlib, -1 means Z_DEFAULT_COMPRESSION, 1(fastest)..9(best)
+std::string gzipCompress(const char *data, const size_t ndata, int level = -1);
 
 std::string gzipDecompress(const char *data, const size_t ndata);
 
-std::string brotliCompress(const char *data, const size_t ndata);
+// quality follows brotli, 0(fastest)..11(best)
+std::string brotliCompress(const char *data, const size_t ndata,
+                           int quality = 5);
 
 std::string brotliDecompress(const char *data, const size_t ndata);
 
+// true if the library was built with brotli, otherwise brotliCompress() and
+// brotliDecompress() abort
+bool brotliSupported();
+
 char *getHttpFullDate(const canary::Date &date = canary::Date::now());
 
 canary::Date getHttpDate(const std::string &httpFullDateString);
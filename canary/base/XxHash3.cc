@@ -0,0 +1,312 @@
+#include "XxHash3.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "MsgBuffer.h"
+
+using namespace canary;
+
+namespace canary {
+
+static const unsigned char kDefaultSecret[XxHash3::kSecretLength] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+    0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+    0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+    0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+    0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+    0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+    0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+    0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+    0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+    0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+    0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+    0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+    0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e};
+
+static constexpr uint32_t kPrime32_1 = 0x9e3779b1;
+static constexpr uint32_t kPrime32_2 = 0x85ebca77;
+static constexpr uint32_t kPrime32_3 = 0xc2b2ae3d;
+static constexpr uint64_t kPrime64_1 = 0x9e3779b185ebca87;
+static constexpr uint64_t kPrime64_2 = 0xc2b2ae3d27d4eb4f;
+static constexpr uint64_t kPrime64_3 = 0x165667b19e3779f9;
+static constexpr uint64_t kPrime64_4 = 0x85ebca77c2b2ae63;
+static constexpr uint64_t kPrime64_5 = 0x27d4eb2f165667c5;
+static constexpr uint64_t kPrimeMx1 = 0x165667919e3779f9;
+static constexpr uint64_t kPrimeMx2 = 0x9fb21c651e98df25;
+
+static constexpr size_t kStripeLength = 64;
+// Secret bytes moved by per stripe
+static constexpr size_t kSecretStep = 8;
+static constexpr size_t kStripesPerBlock =
+    (XxHash3::kSecretLength - kStripeLength) / kSecretStep;
+static constexpr size_t kBlockLength = kStripeLength * kStripesPerBlock;
+static constexpr size_t kMidSizeMax = 240;
+
+// Input is little endian
+static inline uint32_t read32(const unsigned char *p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 |
+         uint32_t(p[3]) << 24;
+}
+
+static inline uint64_t read64(const unsigned char *p) {
+  return uint64_t(read32(p)) | uint64_t(read32(p + 4)) << 32;
+}
+
+static inline uint64_t rotateLeft(uint64_t x, int n) {
+  return (x << n) | (x >> (64 - n));
+}
+
+static inline uint64_t mulFold(uint64_t lhs, uint64_t rhs) {
+  auto product = static_cast<unsigned __int128>(lhs) * rhs;
+  return static_cast<uint64_t>(product) ^
+         static_cast<uint64_t>(product >> 64);
+}
+
+static inline uint64_t xxh64Avalanche(uint64_t h) {
+  h ^= h >> 33;
+  h *= kPrime64_2;
+  h ^= h >> 29;
+  h *= kPrime64_3;
+  return h ^ (h >> 32);
+}
+
+static inline uint64_t avalanche(uint64_t h) {
+  h ^= h >> 37;
+  h *= kPrimeMx1;
+  return h ^ (h >> 32);
+}
+
+static inline uint64_t rrmxmx(uint64_t h, uint64_t len) {
+  h ^= rotateLeft(h, 49) ^ rotateLeft(h, 24);
+  h *= kPrimeMx2;
+  h ^= (h >> 35) + len;
+  h *= kPrimeMx2;
+  return h ^ (h >> 28);
+}
+
+static inline uint64_t mix16(const unsigned char *in,
+                             const unsigned char *secret, uint64_t seed) {
+  return mulFold(read64(in) ^ (read64(secret) + seed),
+                 read64(in + 8) ^ (read64(secret + 8) - seed));
+}
+
+// Up to 240 bytes, with the default secret
+static uint64_t hashShort(const unsigned char *in, size_t len,
+                          uint64_t seed) {
+  auto secret = kDefaultSecret;
+  if (len == 0) {
+    return xxh64Avalanche(seed ^ (read64(secret + 56) ^ read64(secret + 64)));
+  }
+  if (len <= 3) {
+    uint32_t combined = uint32_t(in[0]) << 16 | uint32_t(in[len >> 1]) << 24 |
+                        uint32_t(in[len - 1]) | uint32_t(len) << 8;
+    uint64_t bitflip = (read32(secret) ^ read32(secret + 4)) + seed;
+    return xxh64Avalanche(combined ^ bitflip);
+  }
+  if (len <= 8) {
+    seed ^= uint64_t(__builtin_bswap32(static_cast<uint32_t>(seed))) << 32;
+    uint64_t bitflip = (read64(secret + 8) ^ read64(secret + 16)) - seed;
+    uint64_t input = read32(in + len - 4) + (uint64_t(read32(in)) << 32);
+    return rrmxmx(input ^ bitflip, len);
+  }
+  if (len <= 16) {
+    uint64_t bitflip1 = (read64(secret + 24) ^ read64(secret + 32)) + seed;
+    uint64_t bitflip2 = (read64(secret + 40) ^ read64(secret + 48)) - seed;
+    uint64_t low = read64(in) ^ bitflip1;
+    uint64_t high = read64(in + len - 8) ^ bitflip2;
+    return avalanche(len + __builtin_bswap64(low) + high + mulFold(low, high));
+  }
+  uint64_t acc = len * kPrime64_1;
+  if (len <= 128) {
+    // Pairs of 16 bytes from both ends toward the middle
+    for (size_t i = 0; i <= (len - 1) / 32; ++i) {
+      acc += mix16(in + 16 * i, secret + 32 * i, seed);
+      acc += mix16(in + len - 16 * (i + 1), secret + 32 * i + 16, seed);
+    }
+    return avalanche(acc);
+  }
+  for (size_t i = 0; i < 8; ++i) {
+    acc += mix16(in + 16 * i, secret + 16 * i, seed);
+  }
+  acc = avalanche(acc);
+  uint64_t accEnd = mix16(in + len - 16, secret + 136 - 17, seed);
+  for (size_t i = 8; i < len / 16; ++i) {
+    accEnd += mix16(in + 16 * i, secret + 16 * (i - 8) + 3, seed);
+  }
+  return avalanche(acc + accEnd);
+}
+
+static void initAccs(uint64_t *accs) {
+  accs[0] = kPrime32_3;
+  accs[1] = kPrime64_1;
+  accs[2] = kPrime64_2;
+  accs[3] = kPrime64_3;
+  accs[4] = kPrime64_4;
+  accs[5] = kPrime32_2;
+  accs[6] = kPrime64_5;
+  accs[7] = kPrime32_1;
+}
+
+static void initSecret(unsigned char *secret, uint64_t seed) {
+  for (size_t i = 0; i < XxHash3::kSecretLength; i += 16) {
+    uint64_t low = read64(kDefaultSecret + i) + seed;
+    uint64_t high = read64(kDefaultSecret + i + 8) - seed;
+    for (int j = 0; j < 8; ++j) {
+      secret[i + j] = static_cast<unsigned char>(low >> (8 * j));
+      secret[i + 8 + j] = static_cast<unsigned char>(high >> (8 * j));
+    }
+  }
+}
+
+// The 8 lanes are independent, the compiler vectorizes them
+static inline void accumulateStripe(uint64_t *accs, const unsigned char *in,
+                                    const unsigned char *secret) {
+  for (int i = 0; i < 8; ++i) {
+    uint64_t value = read64(in + 8 * i);
+    uint64_t key = value ^ read64(secret + 8 * i);
+    accs[i ^ 1] += value;
+    accs[i] += (key & 0xffffffff) * (key >> 32);
+  }
+}
+
+static inline void scramble(uint64_t *accs, const unsigned char *secret) {
+  for (int i = 0; i < 8; ++i) {
+    uint64_t acc = accs[i];
+    acc ^= acc >> 47;
+    acc ^= read64(secret + 8 * i);
+    accs[i] = acc * kPrime32_1;
+  }
+}
+
+// Feeds count stripes, *stripes of the current block being done already
+static void consumeStripes(uint64_t *accs, size_t *stripes,
+                           const unsigned char *in, size_t count,
+                           const unsigned char *secret) {
+  while (count > 0) {
+    auto n = std::min(count, kStripesPerBlock - *stripes);
+    for (size_t i = 0; i < n; ++i, in += kStripeLength) {
+      accumulateStripe(accs, in, secret + (*stripes + i) * kSecretStep);
+    }
+    *stripes += n;
+    count -= n;
+    if (*stripes == kStripesPerBlock) {
+      scramble(accs, secret + XxHash3::kSecretLength - kStripeLength);
+      *stripes = 0;
+    }
+  }
+}
+
+static uint64_t mergeAccs(const uint64_t *accs, const unsigned char *secret,
+                          uint64_t len) {
+  uint64_t result = len * kPrime64_1;
+  for (int i = 0; i < 4; ++i) {
+    result += mulFold(accs[2 * i] ^ read64(secret + 11 + 16 * i),
+                      accs[2 * i + 1] ^ read64(secret + 11 + 16 * i + 8));
+  }
+  return avalanche(result);
+}
+
+// The last stripe is the last 64 bytes, overlapping the ones before
+static uint64_t finishLong(uint64_t *accs, const unsigned char *lastStripe,
+                           const unsigned char *secret, uint64_t len) {
+  accumulateStripe(accs, lastStripe,
+                   secret + XxHash3::kSecretLength - kStripeLength - 7);
+  return mergeAccs(accs, secret, len);
+}
+
+}  // namespace canary
+
+uint64_t XxHash3::hash(const void *data, size_t len, uint64_t seed) {
+  auto in = static_cast<const unsigned char *>(data);
+  if (len <= kMidSizeMax) return hashShort(in, len, seed);
+  unsigned char custom[kSecretLength];
+  const unsigned char *secret = kDefaultSecret;
+  if (seed != 0) {
+    initSecret(custom, seed);
+    secret = custom;
+  }
+  uint64_t accs[8];
+  initAccs(accs);
+  // Whole blocks, then the stripes before the last one; a final stripe
+  // that is whole is left for finishLong() too
+  auto blocks = (len - 1) / kBlockLength;
+  size_t stripes = 0;
+  consumeStripes(accs, &stripes, in, blocks * kStripesPerBlock, secret);
+  auto rest = len - blocks * kBlockLength;
+  consumeStripes(accs, &stripes, in + blocks * kBlockLength,
+                 (rest - 1) / kStripeLength, secret);
+  return finishLong(accs, in + len - kStripeLength, secret, len);
+}
+
+uint64_t XxHash3::hash(const MsgBuffer &buffer, uint64_t seed) {
+  return hash(buffer.peek(), buffer.readableBytes(), seed);
+}
+
+void XxHash3::reset(uint64_t seed) {
+  initAccs(accs_);
+  seed_ = seed;
+  initSecret(secret_, seed);
+  stripes_ = 0;
+  length_ = 0;
+  buffered_ = 0;
+}
+
+void XxHash3::update(const void *data, size_t len) {
+  auto in = static_cast<const unsigned char *>(data);
+  length_ += len;
+  if (len <= kBufferLength - buffered_) {
+    memcpy(buffer_ + buffered_, in, len);
+    buffered_ += len;
+    return;
+  }
+  auto end = in + len;
+  if (buffered_ > 0) {
+    auto fill = kBufferLength - buffered_;
+    memcpy(buffer_ + buffered_, in, fill);
+    in += fill;
+    consumeStripes(accs_, &stripes_, buffer_, kBufferLength / kStripeLength,
+                   secret_);
+    buffered_ = 0;
+  }
+  if (static_cast<size_t>(end - in) > kBufferLength) {
+    // Leaves at least one byte, and keeps the last stripe for value()
+    auto count = static_cast<size_t>(end - 1 - in) / kStripeLength;
+    consumeStripes(accs_, &stripes_, in, count, secret_);
+    in += count * kStripeLength;
+    memcpy(buffer_ + kBufferLength - kStripeLength, in - kStripeLength,
+           kStripeLength);
+  }
+  memcpy(buffer_, in, end - in);
+  buffered_ = end - in;
+}
+
+void XxHash3::update(const MsgBuffer &buffer) {
+  update(buffer.peek(), buffer.readableBytes());
+}
+
+uint64_t XxHash3::value() const {
+  if (length_ <= kMidSizeMax) return hashShort(buffer_, length_, seed_);
+  uint64_t accs[8];
+  memcpy(accs, accs_, sizeof(accs));
+  auto stripes = stripes_;
+  unsigned char lastStripe[kStripeLength];
+  const unsigned char *last;
+  if (buffered_ >= kStripeLength) {
+    consumeStripes(accs, &stripes, buffer_, (buffered_ - 1) / kStripeLength,
+                   secret_);
+    last = buffer_ + buffered_ - kStripeLength;
+  } else {
+    // The rest of the stripe is the end of what was hashed before, kept at
+    // the end of the buffer
+    auto catchUp = kStripeLength - buffered_;
+    memcpy(lastStripe, buffer_ + kBufferLength - catchUp, catchUp);
+    memcpy(lastStripe + catchUp, buffer_, buffered_);
+    last = lastStripe;
+  }
+  return finishLong(accs, last, secret_, length_);
+}
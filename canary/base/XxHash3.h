@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace canary {
+
+class MsgBuffer;
+
+// The 64-bit XXH3 of xxHash 0.8, a fast non-cryptographic hash for hash
+// tables and cache keys. Its values match the reference implementation, so
+// they may be stored or shared with other programs.
+class XxHash3 {
+ public:
+  explicit XxHash3(uint64_t seed = 0) { reset(seed); }
+
+  void reset(uint64_t seed = 0);
+
+  void update(const void *data, size_t len);
+
+  // Of the readable bytes, which are not retrieved
+  void update(const MsgBuffer &buffer);
+
+  // The hash of the bytes so far, update() may go on
+  uint64_t value() const;
+
+  static uint64_t hash(const void *data, size_t len, uint64_t seed = 0);
+
+  static uint64_t hash(const MsgBuffer &buffer, uint64_t seed = 0);
+
+  static constexpr size_t kSecretLength = 192;
+
+ private:
+  static constexpr size_t kBufferLength = 256;
+
+  uint64_t accs_[8];
+  uint64_t seed_;
+  // The default secret mixed with the seed
+  unsigned char secret_[kSecretLength];
+  // Stripes of 64 bytes taken in the current block of the secret
+  size_t stripes_;
+  uint64_t length_;
+  // Input is hashed once more than a buffer is waiting, so the last stripe
+  // is always at hand
+  unsigned char buffer_[kBufferLength];
+  size_t buffered_;
+};
+
+}  // namespace canary
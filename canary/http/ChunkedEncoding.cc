@@ -0,0 +1,217 @@
+#include "ChunkedEncoding.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+using namespace canary;
+
+namespace canary {
+static constexpr size_t kMaxLineLength{4096};
+// 15 hex digits keep the size far from overflowing size_t
+static constexpr size_t kMaxSizeDigits{15};
+static constexpr size_t kStreamChunkSize{16 * 1024};
+static constexpr size_t kMaxTrailerLines{64};
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+}  // namespace canary
+
+void ChunkedEncoder::encodeChunk(const char *data, size_t len,
+                                 MsgBuffer *output) {
+  assert(output);
+  if (len == 0) return;
+  char header[32];
+  auto n = snprintf(header, sizeof(header), "%zx\r\n", len);
+  output->append(header, n);
+  output->append(data, len);
+  output->append("\r\n", 2);
+}
+
+void ChunkedEncoder::encodeLastChunk(MsgBuffer *output,
+                                     const std::string &trailers) {
+  assert(output);
+  output->append("0\r\n", 3);
+  output->append(trailers);
+  output->append("\r\n", 2);
+}
+
+StreamCallback ChunkedEncoder::wrapStream(StreamCallback source) {
+  struct State {
+    StreamCallback source_;
+    MsgBuffer pending_;
+    std::vector<char> input_;
+    bool finished_{false};
+  };
+  auto state = std::make_shared<State>();
+  state->source_ = std::move(source);
+  return [state](char *buf, std::size_t len) -> std::size_t {
+    if (!buf) {
+      state->source_(nullptr, 0);
+      return 0;
+    }
+    auto &pending = state->pending_;
+    if (pending.readableBytes() == 0 && !state->finished_) {
+      state->input_.resize(kStreamChunkSize);
+      auto n = state->source_(state->input_.data(), state->input_.size());
+      if (n > 0) {
+        encodeChunk(state->input_.data(), n, &pending);
+      } else {
+        encodeLastChunk(&pending);
+        state->finished_ = true;
+      }
+    }
+    auto n = std::min(len, pending.readableBytes());
+    memcpy(buf, pending.peek(), n);
+    pending.retrieve(n);
+    return n;
+  };
+}
+
+ChunkedDecoder::Status ChunkedDecoder::decode(MsgBuffer *input,
+                                              const DataCallback &callback) {
+  assert(input);
+  while (true) {
+    switch (state_) {
+      case State::kSize: {
+        auto crlf = input->findCRLF();
+        if (!crlf) {
+          if (input->readableBytes() > kMaxLineLength) break;
+          return Status::kNeedMore;
+        }
+        size_t size = 0;
+        size_t digits = 0;
+        const char *p = input->peek();
+        for (; p < crlf; ++p) {
+          auto v = hexValue(*p);
+          if (v < 0) break;
+          size = (size << 4) | static_cast<size_t>(v);
+          ++digits;
+        }
+        // Anything after the size must be a chunk extension, which we ignore
+        if (digits == 0 || digits > kMaxSizeDigits ||
+            (p < crlf && *p != ';' && *p != ' ' && *p != '\t')) {
+          break;
+        }
+        input->retrieveUntil(crlf + 2);
+        chunkLeft_ = size;
+        state_ = size > 0 ? State::kData : State::kTrailer;
+        continue;
+      }
+      case State::kData: {
+        if (input->readableBytes() == 0) return Status::kNeedMore;
+        auto n = std::min(chunkLeft_, input->readableBytes());
+        callback(input->peek(), n);
+        input->retrieve(n);
+        chunkLeft_ -= n;
+        if (chunkLeft_ == 0) state_ = State::kDataCRLF;
+        continue;
+      }
+      case State::kDataCRLF: {
+        if (input->readableBytes() < 2) return Status::kNeedMore;
+        if (input->peek()[0] != '\r' || input->peek()[1] != '\n') break;
+        input->retrieve(2);
+        state_ = State::kSize;
+        continue;
+      }
+      case State::kTrailer: {
+        auto crlf = input->findCRLF();
+        if (!crlf) {
+          if (input->readableBytes() > kMaxLineLength) break;
+          return Status::kNeedMore;
+        }
+        bool empty = crlf == input->peek();
+        // Trailer fields are skipped, an empty line ends the body
+        if (!empty && ++trailerLines_ > kMaxTrailerLines) break;
+        input->retrieveUntil(crlf + 2);
+        if (empty) state_ = State::kDone;
+        continue;
+      }
+      case State::kDone:
+        return Status::kDone;
+      case State::kError:
+        return Status::kError;
+    }
+    // Only malformed input breaks out of the switch
+    state_ = State::kError;
+    return Status::kError;
+  }
+}
+
+void ChunkedDecoder::reset() {
+  state_ = State::kSize;
+  chunkLeft_ = 0;
+  trailerLines_ = 0;
+}
+
+ChunkedWriter::ChunkedWriter(const TcpConnectionPtr &conn,
+                             size_t highWaterMark)
+    : conn_(conn), highWaterMark_(highWaterMark) {
+  assert(conn_);
+}
+
+void ChunkedWriter::installCallbacks() {
+  conn_->getLoop()->assertInLoopThread();
+  savedHighWaterMarkCallback_ = conn_->highWaterMarkCallback();
+  savedHighWaterMark_ = conn_->highWaterMarkLength();
+  savedDrainCallback_ = conn_->drainCallback();
+  std::weak_ptr<ChunkedWriter> weakPtr = shared_from_this();
+  conn_->setHighWaterMarkCallback(
+      [weakPtr](const TcpConnectionPtr &, const size_t) {
+        auto thisPtr = weakPtr.lock();
+        if (thisPtr) thisPtr->paused_ = true;
+      },
+      highWaterMark_);
+  conn_->setDrainCallback([weakPtr](const TcpConnectionPtr &conn) {
+    auto thisPtr = weakPtr.lock();
+    if (!thisPtr) return;
+    if (conn->disconnected()) {
+      thisPtr->handleClose();
+      return;
+    }
+    if (!thisPtr->paused_) return;
+    thisPtr->paused_ = false;
+    if (thisPtr->resumeCallback_) thisPtr->resumeCallback_();
+  });
+  installed_ = true;
+}
+
+void ChunkedWriter::handleClose() {
+  // The producer is told once, and its callback dropped along with what it
+  // holds, the writer itself often
+  auto callback = std::move(resumeCallback_);
+  resumeCallback_ = nullptr;
+  bool wasPaused = paused_;
+  paused_ = false;
+  if (wasPaused && callback) callback();
+}
+
+bool ChunkedWriter::write(const char *data, size_t len) {
+  conn_->getLoop()->assertInLoopThread();
+  assert(!finished_);
+  if (finished_ || !conn_->connected()) return false;
+  if (!installed_) installCallbacks();
+  ChunkedEncoder::encodeChunk(data, len, &buffer_);
+  conn_->send(buffer_);
+  buffer_.retrieveAll();
+  return !paused_;
+}
+
+void ChunkedWriter::finish(const std::string &trailers) {
+  if (finished_) return;
+  finished_ = true;
+  ChunkedEncoder::encodeLastChunk(&buffer_, trailers);
+  conn_->send(buffer_);
+  buffer_.retrieveAll();
+  if (installed_) {
+    conn_->setHighWaterMarkCallback(savedHighWaterMarkCallback_,
+                                    savedHighWaterMark_);
+    conn_->setDrainCallback(savedDrainCallback_);
+  }
+  paused_ = false;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "GzipStream.h"
+#include "MsgBuffer.h"
+#include "NonCopyable.h"
+#include "TcpConnection.h"
+
+namespace canary {
+
+// Framing for "Transfer-Encoding: chunked" bodies
+class ChunkedEncoder {
+ public:
+  // Appends one chunk, an empty chunk is not written because it would end
+  // the body.
+  static void encodeChunk(const char *data, size_t len, MsgBuffer *output);
+
+  // Appends the last (zero sized) chunk and the end of the body. trailers
+  // are complete "Name: value\r\n" lines.
+  static void encodeLastChunk(MsgBuffer *output,
+                              const std::string &trailers = "");
+
+  // Wraps a sendStream() callback of unknown length so that every piece it
+  // produces goes out as a chunk, followed by the last chunk at EOF.
+  static StreamCallback wrapStream(StreamCallback source);
+};
+
+// Incremental decoder of a chunked body. Data is handed out as soon as it
+// arrives, nothing is accumulated.
+class ChunkedDecoder {
+ public:
+  enum class Status { kNeedMore = 0, kDone, kError };
+
+  using DataCallback = std::function<void(const char *, size_t)>;
+
+  // Consumes as much of input as possible. After kDone the bytes following
+  // the body (a pipelined request, say) are left in input.
+  Status decode(MsgBuffer *input, const DataCallback &callback);
+
+  bool done() const { return state_ == State::kDone; }
+
+  void reset();
+
+ private:
+  enum class State { kSize = 0, kData, kDataCRLF, kTrailer, kDone, kError };
+
+  State state_{State::kSize};
+  size_t chunkLeft_{0};
+  size_t trailerLines_{0};
+};
+
+// Push-based chunked body writer for producers that do not know the length
+// of what they send. The connection's high water mark is used as a
+// backpressure signal: once write() returns false the producer should stop
+// and wait for the resume callback, which runs when the output buffer is
+// drained, or when the connection closes, closed() being true then. Must be
+// created with std::make_shared and used in the loop of the connection; it
+// takes over the high water mark and drain callbacks of the connection from
+// the first write() and puts the previous ones back in finish(), they are
+// not called in between.
+class ChunkedWriter : NonCopyable,
+                      public std::enable_shared_from_this<ChunkedWriter> {
+ public:
+  using ResumeCallback = std::function<void()>;
+
+  explicit ChunkedWriter(const TcpConnectionPtr &conn,
+                         size_t highWaterMark = 64 * 1024);
+
+  // Returns false if the producer should pause, or stop once closed(). Must
+  // be called in the loop of the connection.
+  bool write(const char *data, size_t len);
+
+  bool write(const std::string &data) {
+    return write(data.data(), data.length());
+  }
+
+  void finish(const std::string &trailers = "");
+
+  bool paused() const { return paused_; }
+
+  bool finished() const { return finished_; }
+
+  // The connection is gone, nothing more can be written
+  bool closed() const { return conn_->disconnected(); }
+
+  void setResumeCallback(const ResumeCallback &cb) { resumeCallback_ = cb; }
+
+  void setResumeCallback(ResumeCallback &&cb) {
+    resumeCallback_ = std::move(cb);
+  }
+
+ private:
+  void installCallbacks();
+
+  void handleClose();
+
+  TcpConnectionPtr conn_;
+  size_t highWaterMark_;
+  ResumeCallback resumeCallback_;
+  HighWaterMarkCallback savedHighWaterMarkCallback_;
+  size_t savedHighWaterMark_{0};
+  WriteCompleteCallback savedDrainCallback_;
+  MsgBuffer buffer_;
+  bool installed_{false};
+  bool paused_{false};
+  bool finished_{false};
+};
+
+}  // namespace canary
@@ -0,0 +1,260 @@
+#include "ContentEncoding.h"
+
+#include <assert.h>
+#include <sys/stat.h>
+
+#include "Sha256.h"
+#include "Utility.h"
+
+namespace canary {
+
+namespace {
+
+string_view trim(string_view str) {
+  while (!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+    str.remove_prefix(1);
+  while (!str.empty() && (str.back() == ' ' || str.back() == '\t'))
+    str.remove_suffix(1);
+  return str;
+}
+
+bool iequals(string_view a, string_view b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (tolower(static_cast<unsigned char>(a[i])) !=
+        tolower(static_cast<unsigned char>(b[i])))
+      return false;
+  }
+  return true;
+}
+
+// qvalue = ( "0" [ "." 0*3DIGIT ] ) / ( "1" [ "." 0*3("0") ] )
+float parseQValue(string_view params) {
+  while (!params.empty()) {
+    auto semi = params.find(';');
+    auto param = trim(params.substr(0, semi));
+    params =
+        semi == string_view::npos ? string_view() : params.substr(semi + 1);
+    if (param.size() < 2 || (param[0] != 'q' && param[0] != 'Q') ||
+        param[1] != '=')
+      continue;
+    param.remove_prefix(2);
+    float value = 0;
+    float scale = 0;
+    for (auto c : param) {
+      if (c == '.' && scale == 0) {
+        scale = 0.1f;
+      } else if (c >= '0' && c <= '9') {
+        if (scale == 0) {
+          value = value * 10 + (c - '0');
+        } else {
+          value += scale * (c - '0');
+          scale /= 10;
+        }
+      } else {
+        return 0;  // malformed, treat as not acceptable
+      }
+    }
+    return value > 1 ? 1 : value;
+  }
+  return 1;
+}
+
+bool isFreshSibling(const std::string &path, const struct stat &original) {
+  struct stat sibling;
+  if (stat(path.c_str(), &sibling) != 0) return false;
+  return S_ISREG(sibling.st_mode) && sibling.st_mtime >= original.st_mtime;
+}
+
+}  // namespace
+
+string_view toStringView(ContentEncoding encoding) {
+  switch (encoding) {
+    case ContentEncoding::kGzip:
+      return "gzip";
+    case ContentEncoding::kBrotli:
+      return "br";
+    default:
+      return "identity";
+  }
+}
+
+AcceptEncoding::AcceptEncoding(string_view header) {
+  bool hasGzip = false, hasBrotli = false, hasIdentity = false;
+  float star = -1;
+  while (!header.empty()) {
+    auto comma = header.find(',');
+    auto item = trim(header.substr(0, comma));
+    header =
+        comma == string_view::npos ? string_view() : header.substr(comma + 1);
+    if (item.empty()) continue;
+    auto semi = item.find(';');
+    auto coding = trim(item.substr(0, semi));
+    float q =
+        semi == string_view::npos ? 1 : parseQValue(item.substr(semi + 1));
+    if (iequals(coding, "gzip") || iequals(coding, "x-gzip")) {
+      gzip_ = q;
+      hasGzip = true;
+    } else if (iequals(coding, "br")) {
+      brotli_ = q;
+      hasBrotli = true;
+    } else if (iequals(coding, "identity")) {
+      identity_ = q;
+      hasIdentity = true;
+    } else if (coding == "*") {
+      star = q;
+    }
+  }
+  if (star >= 0) {
+    if (!hasGzip) gzip_ = star;
+    if (!hasBrotli) brotli_ = star;
+    if (!hasIdentity) identity_ = star;
+  }
+}
+
+float AcceptEncoding::weight(ContentEncoding encoding) const {
+  switch (encoding) {
+    case ContentEncoding::kGzip:
+      return gzip_;
+    case ContentEncoding::kBrotli:
+      return brotli_;
+    default:
+      return identity_;
+  }
+}
+
+bool AcceptEncoding::accepts(ContentEncoding encoding) const {
+  return weight(encoding) > 0;
+}
+
+ContentEncoding AcceptEncoding::preferred() const {
+  if (brotli_ > 0 && brotli_ >= gzip_ && utils::brotliSupported())
+    return ContentEncoding::kBrotli;
+  if (gzip_ > 0) return ContentEncoding::kGzip;
+  return ContentEncoding::kIdentity;
+}
+
+std::string compressContent(ContentEncoding encoding, const char *data,
+                            size_t len) {
+  switch (encoding) {
+    case ContentEncoding::kGzip:
+      return utils::gzipCompress(data, len);
+    case ContentEncoding::kBrotli:
+      return utils::brotliCompress(data, len);
+    default:
+      return std::string(data, len);
+  }
+}
+
+std::string findPrecompressedFile(const std::string &path,
+                                  const AcceptEncoding &accept,
+                                  ContentEncoding *encoding) {
+  assert(encoding);
+  *encoding = ContentEncoding::kIdentity;
+  struct stat original;
+  if (stat(path.c_str(), &original) != 0) return path;
+  // Precompressed brotli can be served even if we can not encode it
+  bool br = accept.accepts(ContentEncoding::kBrotli);
+  bool gz = accept.accepts(ContentEncoding::kGzip);
+  if (br && (!gz || accept.weight(ContentEncoding::kBrotli) >=
+                        accept.weight(ContentEncoding::kGzip))) {
+    auto sibling = path + ".br";
+    if (isFreshSibling(sibling, original)) {
+      *encoding = ContentEncoding::kBrotli;
+      return sibling;
+    }
+    br = false;
+  }
+  if (gz) {
+    auto sibling = path + ".gz";
+    if (isFreshSibling(sibling, original)) {
+      *encoding = ContentEncoding::kGzip;
+      return sibling;
+    }
+  }
+  if (br) {
+    auto sibling = path + ".br";
+    if (isFreshSibling(sibling, original)) {
+      *encoding = ContentEncoding::kBrotli;
+      return sibling;
+    }
+  }
+  return path;
+}
+
+CompressionCache::CompressionCache(size_t capacity, int gzipLevel,
+                                   int brotliQuality)
+    : capacity_(capacity),
+      gzipLevel_(gzipLevel),
+      brotliQuality_(brotliQuality) {}
+
+size_t CompressionCache::entryCost(const Entry &entry) {
+  return sizeof(Entry) + entry.key.digest.capacity() +
+         (entry.data ? entry.data->size() : 0);
+}
+
+std::shared_ptr<const std::string> CompressionCache::get(
+    ContentEncoding encoding, const char *data, size_t len) {
+  if (encoding == ContentEncoding::kIdentity || len == 0) return nullptr;
+  if (encoding == ContentEncoding::kBrotli && !utils::brotliSupported())
+    return nullptr;
+  Key key{Sha256::digest(data, len), len, encoding};
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = index_.find(key);
+    if (iter != index_.end()) {
+      lru_.splice(lru_.begin(), lru_, iter->second);
+      return iter->second->data;
+    }
+  }
+  std::string compressed;
+  if (encoding == ContentEncoding::kGzip) {
+    compressed = utils::gzipCompress(data, len, gzipLevel_);
+  } else {
+    compressed = utils::brotliCompress(data, len, brotliQuality_);
+  }
+  std::shared_ptr<const std::string> result;
+  if (!compressed.empty() && compressed.length() < len) {
+    result = std::make_shared<const std::string>(std::move(compressed));
+  }
+  insert(key, result);
+  return result;
+}
+
+void CompressionCache::insert(const Key &key,
+                              const std::shared_ptr<const std::string> &data) {
+  Entry entry{key, data};
+  auto cost = entryCost(entry);
+  if (cost > capacity_) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Another loop may have compressed the same content meanwhile
+  if (index_.find(key) != index_.end()) return;
+  lru_.push_front(std::move(entry));
+  index_.emplace(key, lru_.begin());
+  size_ += cost;
+  while (size_ > capacity_) {
+    auto &victim = lru_.back();
+    size_ -= entryCost(victim);
+    index_.erase(victim.key);
+    lru_.pop_back();
+  }
+}
+
+size_t CompressionCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return size_;
+}
+
+size_t CompressionCache::count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return lru_.size();
+}
+
+void CompressionCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  index_.clear();
+  lru_.clear();
+  size_ = 0;
+}
+
+}  // namespace canary
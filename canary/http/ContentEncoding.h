@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "NonCopyable.h"
+#include "StringView.h"
+
+namespace canary {
+
+enum class ContentEncoding { kIdentity = 0, kGzip, kBrotli };
+
+// "identity", "gzip" or "br", as used in the Content-Encoding header
+string_view toStringView(ContentEncoding encoding);
+
+// The parsed value of an Accept-Encoding header. q-values are kept per coding
+// so that callers can both test a coding and pick the preferred one.
+class AcceptEncoding {
+ public:
+  // No header means only identity is acceptable
+  AcceptEncoding() = default;
+
+  explicit AcceptEncoding(string_view header);
+
+  // The q-value of the coding, 0 means not acceptable
+  float weight(ContentEncoding encoding) const;
+
+  bool accepts(ContentEncoding encoding) const;
+
+  // The coding to compress a response with on the fly. Brotli is only chosen
+  // if the library was built with it, and wins ties against gzip because it
+  // compresses better.
+  ContentEncoding preferred() const;
+
+ private:
+  float gzip_{0};
+  float brotli_{0};
+  float identity_{1};
+};
+
+// Compress data with the given coding, returns an empty string on failure.
+// For kIdentity the data is returned unchanged.
+std::string compressContent(ContentEncoding encoding, const char *data,
+                            size_t len);
+
+// Find a precompressed sibling of a static file ("app.js.br", "app.js.gz")
+// that the client accepts and that is not older than the file itself. Returns
+// the path to send and sets *encoding accordingly; the original path and
+// kIdentity are returned if there is no usable sibling.
+std::string findPrecompressedFile(const std::string &path,
+                                  const AcceptEncoding &accept,
+                                  ContentEncoding *encoding);
+
+// A bounded in-memory LRU cache of the compressed variants of response
+// bodies, keyed by the SHA-256 of the content, so the same catalog or script
+// is compressed once and then served from memory. The cache is shared by all
+// IO loops; compression runs outside the lock.
+class CompressionCache : NonCopyable {
+ public:
+  explicit CompressionCache(size_t capacity = 64 * 1024 * 1024,
+                            int gzipLevel = 9, int brotliQuality = 9);
+
+  // Returns the compressed variant of the content. nullptr means the content
+  // is not worth compressing (the variant would not be smaller) and should be
+  // sent as is; this outcome is cached too.
+  std::shared_ptr<const std::string> get(ContentEncoding encoding,
+                                         const char *data, size_t len);
+
+  std::shared_ptr<const std::string> get(ContentEncoding encoding,
+                                         const std::string &content) {
+    return get(encoding, content.data(), content.length());
+  }
+
+  // Approximate bytes held by the cache, bounded by capacity()
+  size_t size() const;
+
+  size_t count() const;
+
+  size_t capacity() const { return capacity_; }
+
+  void clear();
+
+ private:
+  // The SHA-256 of the content, so that content chosen to collide with
+  // another response can not be served its compressed body
+  struct Key {
+    std::string digest;
+    size_t length;
+    ContentEncoding encoding;
+    bool operator==(const Key &other) const {
+      return digest == other.digest && length == other.length &&
+             encoding == other.encoding;
+    }
+  };
+
+  struct KeyHasher {
+    size_t operator()(const Key &key) const {
+      size_t hash;
+      memcpy(&hash, key.digest.data(), sizeof(hash));
+      return hash ^ static_cast<size_t>(key.encoding);
+    }
+  };
+
+  struct Entry {
+    Key key;
+    std::shared_ptr<const std::string> data;
+  };
+
+  using EntryList = std::list<Entry>;
+
+  static size_t entryCost(const Entry &entry);
+
+  void insert(const Key &key, const std::shared_ptr<const std::string> &data);
+
+  const size_t capacity_;
+  const int gzipLevel_;
+  const int brotliQuality_;
+
+  mutable std::mutex mutex_;
+  EntryList lru_;  // most recently used at front
+  std::unordered_map<Key, EntryList::iterator, KeyHasher> index_;
+  size_t size_{0};
+};
+
+}  // namespace canary
@@ -0,0 +1,52 @@
+#include "HttpBodyReader.h"
+
+#include <assert.h>
+
+#include <algorithm>
+
+using namespace canary;
+
+HttpBodyReader::HttpBodyReader(size_t contentLength, DataCallback callback)
+    : callback_(std::move(callback)),
+      chunked_(false),
+      bytesLeft_(contentLength),
+      done_(contentLength == 0) {}
+
+HttpBodyReader::HttpBodyReader(DataCallback callback)
+    : callback_(std::move(callback)), chunked_(true) {}
+
+void HttpBodyReader::deliver(const char *data, size_t len) {
+  bytesRead_ += len;
+  if (bytesRead_ > maxBodySize_) {
+    tooLarge_ = true;
+    return;
+  }
+  if (callback_) callback_(data, len);
+}
+
+bool HttpBodyReader::feed(MsgBuffer *buffer) {
+  assert(buffer);
+  if (tooLarge_) return false;
+  if (done_) return true;
+  if (!chunked_) {
+    // Known length, reject early instead of streaming most of it
+    if (bytesRead_ + bytesLeft_ > maxBodySize_) {
+      tooLarge_ = true;
+      return false;
+    }
+    auto n = std::min(bytesLeft_, buffer->readableBytes());
+    if (n > 0) {
+      deliver(buffer->peek(), n);
+      buffer->retrieve(n);
+      bytesLeft_ -= n;
+    }
+    done_ = bytesLeft_ == 0;
+    return true;
+  }
+  auto status = decoder_.decode(buffer, [this](const char *data, size_t len) {
+    if (!tooLarge_) deliver(data, len);
+  });
+  if (status == ChunkedDecoder::Status::kError || tooLarge_) return false;
+  done_ = status == ChunkedDecoder::Status::kDone;
+  return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <functional>
+#include <limits>
+
+#include "ChunkedEncoding.h"
+#include "MsgBuffer.h"
+#include "NonCopyable.h"
+
+namespace canary {
+
+// Streams a request (or response) body out of the receive buffer of a
+// connection. Feed it from the recv message callback once the headers have
+// been parsed; every byte of body is handed to the data callback and removed
+// from the buffer right away, so an upload never has to fit in memory.
+class HttpBodyReader : NonCopyable {
+ public:
+  using DataCallback = std::function<void(const char *, size_t)>;
+
+  // A body with a Content-Length
+  HttpBodyReader(size_t contentLength, DataCallback callback);
+
+  // A "Transfer-Encoding: chunked" body
+  explicit HttpBodyReader(DataCallback callback);
+
+  // Bodies larger than this are rejected (413), unlimited by default
+  void setMaxBodySize(size_t size) { maxBodySize_ = size; }
+
+  // Returns false if the body is malformed or too large, the connection
+  // should be closed then. Bytes after the end of the body stay in buffer.
+  bool feed(MsgBuffer *buffer);
+
+  bool done() const { return done_; }
+
+  bool tooLarge() const { return tooLarge_; }
+
+  size_t bytesRead() const { return bytesRead_; }
+
+ private:
+  void deliver(const char *data, size_t len);
+
+  DataCallback callback_;
+  bool chunked_;
+  size_t bytesLeft_{0};
+  size_t bytesRead_{0};
+  size_t maxBodySize_{std::numeric_limits<size_t>::max()};
+  ChunkedDecoder decoder_;
+  bool done_{false};
+  bool tooLarge_{false};
+};
+
+}  // namespace canary
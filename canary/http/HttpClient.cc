@@ -0,0 +1,341 @@
+#include "HttpClient.h"
+
+#include <algorithm>
+
+using namespace canary;
+
+HttpClientPtr HttpClient::newHttpClient(const std::string &hostString,
+                                        EventLoop *loop) {
+  std::string host = hostString;
+  bool valid = true;
+  static const std::string kScheme = "http://";
+  if (host.compare(0, kScheme.length(), kScheme) == 0) {
+    host.erase(0, kScheme.length());
+  } else if (host.find("://") != std::string::npos) {
+    // Only plain http is supported
+    valid = false;
+  }
+  auto slash = host.find('/');
+  if (slash != std::string::npos) host.erase(slash);
+
+  std::string ip = host;
+  bool ipv6 = false;
+  uint16_t port = 80;
+  std::string portString;
+  if (!host.empty() && host[0] == '[') {
+    auto close = host.find(']');
+    if (close == std::string::npos) {
+      valid = false;
+    } else {
+      ip = host.substr(1, close - 1);
+      ipv6 = true;
+      if (close + 1 < host.length()) {
+        if (host[close + 1] != ':') valid = false;
+        portString = host.substr(close + 2);
+      }
+    }
+  } else {
+    auto colon = host.find(':');
+    if (colon != std::string::npos) {
+      ip = host.substr(0, colon);
+      portString = host.substr(colon + 1);
+    }
+  }
+  if (!portString.empty()) {
+    unsigned long value = 0;
+    for (char c : portString) {
+      if (c < '0' || c > '9' || value > 65535) {
+        valid = false;
+        break;
+      }
+      value = value * 10 + (c - '0');
+    }
+    if (value == 0 || value > 65535) valid = false;
+    port = static_cast<uint16_t>(value);
+  }
+  // An unparsable ip leaves the address unspecified
+  InetAddress addr(valid ? ip : std::string(), port, ipv6);
+  return std::make_shared<HttpClient>(loop, addr, host);
+}
+
+HttpClientPtr HttpClient::newHttpClient(const InetAddress &serverAddr,
+                                        EventLoop *loop) {
+  std::string host =
+      serverAddr.isIpV6() ? "[" + serverAddr.toIp() + "]" : serverAddr.toIp();
+  if (serverAddr.toPort() != 80) {
+    host += ":" + std::to_string(serverAddr.toPort());
+  }
+  return std::make_shared<HttpClient>(loop, serverAddr, host);
+}
+
+HttpClient::HttpClient(EventLoop *loop, const InetAddress &serverAddr,
+                       const std::string &host)
+    : loop_(loop), serverAddr_(serverAddr), host_(host) {}
+
+HttpClient::~HttpClient() {
+  // Requests still waiting are dropped, the TcpClients close their
+  // connections when they go away.
+  for (auto &connection : connections_) {
+    connection->closed_ = true;
+  }
+}
+
+void HttpClient::sendRequest(const HttpRequestPtr &req,
+                             const HttpReqCallback &callback, double timeout) {
+  HttpReqCallback cb = callback;
+  sendRequest(req, std::move(cb), timeout);
+}
+
+void HttpClient::sendRequest(const HttpRequestPtr &req,
+                             HttpReqCallback &&callback, double timeout) {
+  auto request = std::make_shared<Request>();
+  request->req_ = req;
+  request->callback_ = std::move(callback);
+  request->timeout_ = timeout;
+  auto thisPtr = shared_from_this();
+  loop_->runInLoop(
+      [thisPtr, request]() { thisPtr->sendRequestInLoop(request); });
+}
+
+std::future<std::pair<ReqResult, HttpResponsePtr>> HttpClient::sendRequest(
+    const HttpRequestPtr &req, double timeout) {
+  auto promise =
+      std::make_shared<std::promise<std::pair<ReqResult, HttpResponsePtr>>>();
+  auto future = promise->get_future();
+  sendRequest(
+      req,
+      [promise](ReqResult result, const HttpResponsePtr &response) {
+        promise->set_value(std::make_pair(result, response));
+      },
+      timeout);
+  return future;
+}
+
+void HttpClient::sendRequestInLoop(const RequestPtr &request) {
+  loop_->assertInLoopThread();
+  if (serverAddr_.isUnspecified()) {
+    finish(request, ReqResult::BadServerAddress);
+    return;
+  }
+  if (request->timeout_ > 0) {
+    std::weak_ptr<HttpClient> weakPtr = shared_from_this();
+    std::weak_ptr<Request> weakRequest = request;
+    request->timerId_ =
+        loop_->runAfter(request->timeout_, [weakPtr, weakRequest]() {
+          auto thisPtr = weakPtr.lock();
+          auto request = weakRequest.lock();
+          if (thisPtr && request) thisPtr->onTimeout(request);
+        });
+  }
+  pending_.push_back(request);
+  dispatch();
+}
+
+void HttpClient::dispatch() {
+  while (!pending_.empty()) {
+    if (pending_.front()->done_) {
+      pending_.pop_front();
+      continue;
+    }
+    Connection *best = nullptr;
+    size_t connecting = 0;
+    for (auto &connection : connections_) {
+      if (!connection->conn_) {
+        ++connecting;
+      } else if (connection->inflight_.size() < pipeliningDepth_ &&
+                 (!best ||
+                  connection->inflight_.size() < best->inflight_.size())) {
+        best = connection.get();
+      }
+    }
+    bool canGrow = connections_.size() < maxConnections_;
+    if (!best) {
+      // Every connection being established will take requests as well
+      if (canGrow && connecting * pipeliningDepth_ < pending_.size()) {
+        newConnection();
+      }
+      return;
+    }
+    // A fresh connection beats a pipelined request
+    if (!best->inflight_.empty() && canGrow && connecting == 0) {
+      newConnection();
+    }
+    auto request = std::move(pending_.front());
+    pending_.pop_front();
+    if (best->inflight_.empty()) {
+      best->parser_.reset(request->req_->method() == Head);
+    }
+    best->inflight_.push_back(request);
+    MsgBuffer buffer;
+    request->req_->appendToBuffer(&buffer, host_);
+    best->conn_->send(std::move(buffer));
+  }
+}
+
+void HttpClient::newConnection() {
+  auto connection = std::make_shared<Connection>();
+  connection->tcpClient_ =
+      std::make_shared<TcpClient>(loop_, serverAddr_, "HttpClient");
+  std::weak_ptr<HttpClient> weakPtr = shared_from_this();
+  std::weak_ptr<Connection> weakConnection = connection;
+  auto &tcpClient = connection->tcpClient_;
+  tcpClient->setConnectionCallback(
+      [weakPtr, weakConnection](const TcpConnectionPtr &conn) {
+        auto thisPtr = weakPtr.lock();
+        auto connection = weakConnection.lock();
+        if (!thisPtr || !connection || connection->closed_) return;
+        if (conn->connected()) {
+          conn->setTcpNoDelay(true);
+          connection->conn_ = conn;
+          thisPtr->dispatch();
+          return;
+        }
+        // The end of the connection completes a response without length
+        auto &inflight = connection->inflight_;
+        if (!inflight.empty() && connection->parser_.started() &&
+            connection->parser_.onClose() ==
+                HttpResponseParser::Status::kDone) {
+          auto request = std::move(inflight.front());
+          inflight.pop_front();
+          auto response = connection->parser_.release();
+          thisPtr->removeConnection(connection, ReqResult::NetworkFailure);
+          thisPtr->finish(request, ReqResult::Ok, response);
+          return;
+        }
+        thisPtr->removeConnection(connection, ReqResult::NetworkFailure);
+      });
+  tcpClient->setMessageCallback(
+      [weakPtr, weakConnection](const TcpConnectionPtr &, MsgBuffer *buffer) {
+        auto thisPtr = weakPtr.lock();
+        auto connection = weakConnection.lock();
+        if (!thisPtr || !connection) {
+          buffer->retrieveAll();
+          return;
+        }
+        thisPtr->onMessage(connection, buffer);
+      });
+  tcpClient->setConnectionErrorCallback([weakPtr, weakConnection]() {
+    auto thisPtr = weakPtr.lock();
+    auto connection = weakConnection.lock();
+    if (thisPtr && connection) {
+      thisPtr->removeConnection(connection, ReqResult::NetworkFailure);
+    }
+  });
+  connections_.push_back(connection);
+  ++connectionCount_;
+  // Deferred, so that a failure to connect is never reported in the middle
+  // of dispatch()
+  loop_->queueInLoop([connection]() { connection->tcpClient_->connect(); });
+}
+
+void HttpClient::onMessage(const ConnectionPtr &connection,
+                           MsgBuffer *buffer) {
+  auto &inflight = connection->inflight_;
+  auto &parser = connection->parser_;
+  while (!connection->closed_) {
+    if (inflight.empty()) {
+      // Nothing was asked for
+      if (buffer->readableBytes() > 0) {
+        buffer->retrieveAll();
+        removeConnection(connection, ReqResult::NetworkFailure);
+      }
+      return;
+    }
+    auto status = parser.parse(buffer);
+    if (status == HttpResponseParser::Status::kNeedMore) return;
+    auto request = std::move(inflight.front());
+    inflight.pop_front();
+    if (status == HttpResponseParser::Status::kError) {
+      buffer->retrieveAll();
+      removeConnection(connection, ReqResult::NetworkFailure);
+      finish(request, ReqResult::BadResponse);
+      return;
+    }
+    auto response = parser.release();
+    if (!parser.keepAlive()) {
+      removeConnection(connection, ReqResult::NetworkFailure);
+    } else if (!inflight.empty()) {
+      parser.reset(inflight.front()->req_->method() == Head);
+    }
+    dispatch();
+    finish(request, ReqResult::Ok, response);
+  }
+}
+
+void HttpClient::onTimeout(const RequestPtr &request) {
+  if (request->done_) return;
+  request->timerId_ = InvalidTimerId;
+  // A request on the wire can't be taken back, its connection has to go
+  ConnectionPtr owner;
+  for (auto &connection : connections_) {
+    auto &inflight = connection->inflight_;
+    auto iter = std::find(inflight.begin(), inflight.end(), request);
+    if (iter != inflight.end()) {
+      inflight.erase(iter);
+      owner = connection;
+      break;
+    }
+  }
+  if (owner) {
+    removeConnection(owner, ReqResult::NetworkFailure);
+  } else {
+    pending_.erase(std::remove(pending_.begin(), pending_.end(), request),
+                   pending_.end());
+  }
+  finish(request, ReqResult::Timeout);
+}
+
+void HttpClient::removeConnection(const ConnectionPtr &connection,
+                                  ReqResult result) {
+  if (connection->closed_) return;
+  connection->closed_ = true;
+  auto iter = std::find(connections_.begin(), connections_.end(), connection);
+  if (iter != connections_.end()) {
+    connections_.erase(iter);
+    --connectionCount_;
+  }
+  if (connection->conn_) connection->conn_->forceClose();
+  // We may be inside a callback of the TcpClient, destroy it later
+  loop_->queueInLoop([connection]() {});
+
+  // Requests that were written but not answered. The connection may have
+  // been closed by the server as it received them (an idle keep-alive
+  // timeout), so idempotent ones get another try.
+  std::vector<RequestPtr> failed;
+  std::vector<RequestPtr> retried;
+  for (auto &request : connection->inflight_) {
+    if (request->done_) continue;
+    if (request->req_->isIdempotent() && !request->retried_) {
+      request->retried_ = true;
+      retried.push_back(request);
+    } else {
+      failed.push_back(request);
+    }
+  }
+  connection->inflight_.clear();
+  pending_.insert(pending_.begin(), retried.begin(), retried.end());
+
+  // A failure to connect while no connection is up fails everything that
+  // waits, instead of trying again and again until the timeouts fire.
+  bool established = std::any_of(
+      connections_.begin(), connections_.end(),
+      [](const ConnectionPtr &other) { return other->conn_ != nullptr; });
+  if (!connection->conn_ && !established) {
+    for (auto &request : pending_) failed.push_back(request);
+    pending_.clear();
+  }
+  dispatch();
+  for (auto &request : failed) finish(request, result);
+}
+
+void HttpClient::finish(const RequestPtr &request, ReqResult result,
+                        const HttpResponsePtr &response) {
+  if (request->done_) return;
+  request->done_ = true;
+  if (request->timerId_ != InvalidTimerId) {
+    loop_->invalidateTimer(request->timerId_);
+    request->timerId_ = InvalidTimerId;
+  }
+  auto callback = std::move(request->callback_);
+  if (callback) callback(result, response);
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "EventLoop.h"
+#include "HttpRequest.h"
+#include "HttpResponse.h"
+#include "InetAddress.h"
+#include "NonCopyable.h"
+#include "TcpClient.h"
+
+namespace canary {
+
+class HttpClient;
+using HttpClientPtr = std::shared_ptr<HttpClient>;
+
+// The response is null unless the result is ReqResult::Ok
+using HttpReqCallback =
+    std::function<void(ReqResult, const HttpResponsePtr &)>;
+
+// Asynchronous HTTP/1.1 client for one server. Connections are kept alive
+// and pooled: a request goes to the idle connection with the fewest
+// requests in flight, up to pipeliningDepth requests are written back to
+// back on one connection, and a new connection is opened while the pool is
+// below maxConnections and requests are waiting. All the work is done in
+// the loop of the client, callbacks are called there too. Requests may be
+// sent from any thread. Must be created with newHttpClient().
+//
+// The pool is not a ConnectionPool: an HTTP/1.1 connection answers one
+// request at a time, so requests wait here for the first free connection
+// rather than queueing behind a slow response on a busy one, and the ones
+// lost with a connection are sent again on another.
+class HttpClient : NonCopyable,
+                   public std::enable_shared_from_this<HttpClient> {
+ public:
+  // hostString is "[http://]ip[:port]", port 80 by default. Requests to an
+  // unusable host fail with ReqResult::BadServerAddress.
+  static HttpClientPtr newHttpClient(const std::string &hostString,
+                                     EventLoop *loop);
+
+  static HttpClientPtr newHttpClient(const InetAddress &serverAddr,
+                                     EventLoop *loop);
+
+  HttpClient(EventLoop *loop, const InetAddress &serverAddr,
+             const std::string &host);
+
+  ~HttpClient();
+
+  // timeout is in seconds, 0 means no timeout. The timer covers the time
+  // the request waits for a connection, too.
+  void sendRequest(const HttpRequestPtr &req, const HttpReqCallback &callback,
+                   double timeout = 0);
+
+  void sendRequest(const HttpRequestPtr &req, HttpReqCallback &&callback,
+                   double timeout = 0);
+
+  // Must not be waited on in the loop of the client
+  std::future<std::pair<ReqResult, HttpResponsePtr>> sendRequest(
+      const HttpRequestPtr &req, double timeout = 0);
+
+  // 6 by default
+  void setMaxConnections(size_t num) { maxConnections_ = num ? num : 1; }
+
+  // Requests in flight on one connection, 1 (no pipelining) by default.
+  // Only enable it for servers known to handle pipelining well.
+  void setPipeliningDepth(size_t depth) {
+    pipeliningDepth_ = depth ? depth : 1;
+  }
+
+  // Open connections, including the ones being established
+  size_t connectionCount() const { return connectionCount_; }
+
+  EventLoop *getLoop() const { return loop_; }
+
+  const InetAddress &serverAddress() const { return serverAddr_; }
+
+ private:
+  struct Request {
+    HttpRequestPtr req_;
+    HttpReqCallback callback_;
+    double timeout_{0};
+    TimerId timerId_{InvalidTimerId};
+    bool retried_{false};
+    bool done_{false};
+  };
+  using RequestPtr = std::shared_ptr<Request>;
+
+  struct Connection {
+    std::shared_ptr<TcpClient> tcpClient_;
+    TcpConnectionPtr conn_;
+    std::deque<RequestPtr> inflight_;
+    HttpResponseParser parser_;
+    bool closed_{false};
+  };
+  using ConnectionPtr = std::shared_ptr<Connection>;
+
+  void sendRequestInLoop(const RequestPtr &request);
+
+  // Hands the waiting requests to connections, opens new ones if needed
+  void dispatch();
+
+  void newConnection();
+
+  void onMessage(const ConnectionPtr &connection, MsgBuffer *buffer);
+
+  void onTimeout(const RequestPtr &request);
+
+  // Takes a connection out of the pool. Requests in flight on it are sent
+  // again if that is safe, otherwise they fail with result.
+  void removeConnection(const ConnectionPtr &connection, ReqResult result);
+
+  void finish(const RequestPtr &request, ReqResult result,
+              const HttpResponsePtr &response = nullptr);
+
+  EventLoop *loop_;
+  const InetAddress serverAddr_;
+  const std::string host_;
+  std::atomic<size_t> maxConnections_{6};
+  std::atomic<size_t> pipeliningDepth_{1};
+  std::atomic<size_t> connectionCount_{0};
+  // Only touched in the loop
+  std::deque<RequestPtr> pending_;
+  std::vector<ConnectionPtr> connections_;
+};
+
+}  // namespace canary
@@ -0,0 +1,109 @@
+#include "HttpRequest.h"
+
+#include <strings.h>
+
+#include "Utility.h"
+
+using namespace canary;
+
+const char *HttpRequest::methodString() const {
+  switch (method_) {
+    case Get:
+      return "GET";
+    case Post:
+      return "POST";
+    case Head:
+      return "HEAD";
+    case Put:
+      return "PUT";
+    case Delete:
+      return "DELETE";
+    case Options:
+      return "OPTIONS";
+    case Patch:
+      return "PATCH";
+    default:
+      return "UNKNOWN";
+  }
+}
+
+void HttpRequest::setContentTypeCode(ContentType type) {
+  switch (type) {
+    case CT_APPLICATION_JSON:
+      contentType_ = "application/json; charset=utf-8";
+      break;
+    case CT_TEXT_PLAIN:
+      contentType_ = "text/plain; charset=utf-8";
+      break;
+    case CT_TEXT_HTML:
+      contentType_ = "text/html; charset=utf-8";
+      break;
+    case CT_APPLICATION_X_FORM:
+      contentType_ = "application/x-www-form-urlencoded";
+      break;
+    case CT_TEXT_XML:
+      contentType_ = "text/xml; charset=utf-8";
+      break;
+    case CT_APPLICATION_XML:
+      contentType_ = "application/xml; charset=utf-8";
+      break;
+    case CT_APPLICATION_OCTET_STREAM:
+      contentType_ = "application/octet-stream";
+      break;
+    case CT_NONE:
+      contentType_.clear();
+      break;
+    default:
+      contentType_ = "application/octet-stream";
+      break;
+  }
+}
+
+void HttpRequest::appendToBuffer(MsgBuffer *output,
+                                 const std::string &host) const {
+  output->append(methodString());
+  output->append(" ", 1);
+  output->append(path_);
+  char sep = path_.find('?') == std::string::npos ? '?' : '&';
+  std::string storage;
+  for (auto &param : parameters_) {
+    output->append(&sep, 1);
+    auto key = utils::urlEncodeComponent(param.first, storage);
+    output->append(key.data(), key.length());
+    output->append("=", 1);
+    auto value = utils::urlEncodeComponent(param.second, storage);
+    output->append(value.data(), value.length());
+    sep = '&';
+  }
+  output->append(" HTTP/1.1\r\n");
+
+  bool hasHost = false;
+  for (auto &header : headers_) {
+    if (strcasecmp(header.first.c_str(), "content-length") == 0) continue;
+    if (strcasecmp(header.first.c_str(), "host") == 0) hasHost = true;
+    output->append(header.first);
+    output->append(": ", 2);
+    output->append(header.second);
+    output->append("\r\n", 2);
+  }
+  if (!hasHost) {
+    output->append("Host: ");
+    output->append(host);
+    output->append("\r\n", 2);
+  }
+  if (!contentType_.empty()) {
+    output->append("Content-Type: ");
+    output->append(contentType_);
+    output->append("\r\n", 2);
+  }
+  // A server has no other way to tell that a POST has an empty body
+  if (!body_.empty() || method_ == Post || method_ == Put ||
+      method_ == Patch) {
+    char length[utils::kMaxInt64Length];
+    output->append("Content-Length: ");
+    output->append(length, utils::formatUint64(body_.length(), length));
+    output->append("\r\n", 2);
+  }
+  output->append("\r\n", 2);
+  output->append(body_);
+}
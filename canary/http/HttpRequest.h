@@ -0,0 +1,80 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "HttpTypes.h"
+#include "MsgBuffer.h"
+
+namespace canary {
+
+class HttpRequest;
+using HttpRequestPtr = std::shared_ptr<HttpRequest>;
+
+// An outgoing HTTP/1.1 request, see HttpClient
+class HttpRequest {
+ public:
+  static HttpRequestPtr newHttpRequest() {
+    return std::make_shared<HttpRequest>();
+  }
+
+  void setMethod(HttpMethod method) { method_ = method; }
+
+  HttpMethod method() const { return method_; }
+
+  const char *methodString() const;
+
+  // Safe to send again on a new connection if the first attempt was lost
+  bool isIdempotent() const { return method_ != Post && method_ != Patch; }
+
+  // The path is sent as is, it must already be url encoded
+  void setPath(const std::string &path) { path_ = path; }
+
+  void setPath(std::string &&path) { path_ = std::move(path); }
+
+  const std::string &path() const { return path_; }
+
+  // Query parameters, url encoded when the request is serialized
+  void setParameter(const std::string &key, const std::string &value) {
+    parameters_[key] = value;
+  }
+
+  const std::map<std::string, std::string> &parameters() const {
+    return parameters_;
+  }
+
+  // Host and Content-Length are filled in by the client
+  void addHeader(const std::string &field, const std::string &value) {
+    headers_.emplace_back(field, value);
+  }
+
+  const std::vector<std::pair<std::string, std::string>> &headers() const {
+    return headers_;
+  }
+
+  void setBody(const std::string &body) { body_ = body; }
+
+  void setBody(std::string &&body) { body_ = std::move(body); }
+
+  const std::string &body() const { return body_; }
+
+  void setContentTypeCode(ContentType type);
+
+  void setContentTypeString(const std::string &type) { contentType_ = type; }
+
+  // Appends the serialized request, host is the value of the Host header
+  void appendToBuffer(MsgBuffer *output, const std::string &host) const;
+
+ private:
+  HttpMethod method_{Get};
+  std::string path_{"/"};
+  std::map<std::string, std::string> parameters_;
+  std::vector<std::pair<std::string, std::string>> headers_;
+  std::string contentType_;
+  std::string body_;
+};
+
+}  // namespace canary
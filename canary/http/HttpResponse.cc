@@ -0,0 +1,213 @@
+#include "HttpResponse.h"
+
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+
+using namespace canary;
+
+namespace canary {
+static constexpr size_t kMaxHeadSize{64 * 1024};
+
+static string_view trim(string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+    s.remove_prefix(1);
+  }
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+    s.remove_suffix(1);
+  }
+  return s;
+}
+
+// Case-insensitive search of token in a comma separated header value
+static bool hasToken(const std::string &header, string_view token) {
+  string_view value(header);
+  while (!value.empty()) {
+    auto comma = value.find(',');
+    auto item = trim(value.substr(0, comma));
+    if (item.size() == token.size() &&
+        strncasecmp(item.data(), token.data(), token.size()) == 0) {
+      return true;
+    }
+    if (comma == string_view::npos) break;
+    value.remove_prefix(comma + 1);
+  }
+  return false;
+}
+}  // namespace canary
+
+const std::string &HttpResponse::getHeader(const std::string &field) const {
+  static const std::string empty;
+  auto iter = headers_.find(field);
+  return iter == headers_.end() ? empty : iter->second;
+}
+
+void HttpResponseParser::reset(bool headRequest) {
+  state_ = State::kStatusLine;
+  response_ = std::make_shared<HttpResponse>();
+  headRequest_ = headRequest;
+  started_ = false;
+  keepAlive_ = true;
+  headBytes_ = 0;
+  bodyLeft_ = 0;
+  chunked_.reset();
+}
+
+HttpResponseParser::Status HttpResponseParser::parse(MsgBuffer *buffer) {
+  if (!response_) reset(headRequest_);
+  if (buffer->readableBytes() > 0) started_ = true;
+  while (true) {
+    switch (state_) {
+      case State::kStatusLine:
+      case State::kHeaders: {
+        const char *crlf = buffer->findCRLF();
+        if (!crlf) {
+          if (headBytes_ + buffer->readableBytes() > kMaxHeadSize) {
+            return fail();
+          }
+          return Status::kNeedMore;
+        }
+        headBytes_ += crlf - buffer->peek() + 2;
+        if (headBytes_ > kMaxHeadSize) return fail();
+        bool ok;
+        if (state_ == State::kStatusLine) {
+          ok = parseStatusLine(buffer->peek(), crlf);
+          state_ = State::kHeaders;
+        } else if (crlf == buffer->peek()) {
+          ok = headersDone();
+        } else {
+          ok = parseHeader(buffer->peek(), crlf);
+        }
+        buffer->retrieveUntil(crlf + 2);
+        if (!ok) return fail();
+        break;
+      }
+      case State::kBody: {
+        size_t n = std::min(bodyLeft_, buffer->readableBytes());
+        response_->body_.append(buffer->peek(), n);
+        buffer->retrieve(n);
+        bodyLeft_ -= n;
+        if (bodyLeft_ > 0) return Status::kNeedMore;
+        state_ = State::kDone;
+        break;
+      }
+      case State::kChunked: {
+        auto &body = response_->body_;
+        auto status = chunked_.decode(buffer, [&body](const char *data,
+                                                      size_t len) {
+          body.append(data, len);
+        });
+        if (status == ChunkedDecoder::Status::kError ||
+            body.length() > maxBodySize_) {
+          return fail();
+        }
+        if (status == ChunkedDecoder::Status::kNeedMore) {
+          return Status::kNeedMore;
+        }
+        state_ = State::kDone;
+        break;
+      }
+      case State::kUntilClose:
+        response_->body_.append(buffer->peek(), buffer->readableBytes());
+        buffer->retrieveAll();
+        if (response_->body_.length() > maxBodySize_) return fail();
+        return Status::kNeedMore;
+      case State::kDone:
+        return Status::kDone;
+      case State::kError:
+        return Status::kError;
+    }
+  }
+}
+
+HttpResponseParser::Status HttpResponseParser::onClose() {
+  if (state_ == State::kUntilClose) state_ = State::kDone;
+  if (state_ == State::kDone) return Status::kDone;
+  return fail();
+}
+
+bool HttpResponseParser::parseStatusLine(const char *begin, const char *end) {
+  // HTTP/1.x 200 OK
+  static const char kPrefix[] = "HTTP/1.";
+  if (end - begin < 12 || memcmp(begin, kPrefix, 7) != 0 || begin[8] != ' ') {
+    return false;
+  }
+  if (begin[7] == '1') {
+    response_->version_ = Version::kHttp11;
+  } else if (begin[7] == '0') {
+    response_->version_ = Version::kHttp10;
+  } else {
+    return false;
+  }
+  int code = 0;
+  for (const char *p = begin + 9; p < begin + 12; ++p) {
+    if (*p < '0' || *p > '9') return false;
+    code = code * 10 + (*p - '0');
+  }
+  if (end - begin > 12) {
+    if (begin[12] != ' ') return false;
+    response_->statusMessage_.assign(begin + 13, end);
+  }
+  response_->statusCode_ = static_cast<HttpStatusCode>(code);
+  return true;
+}
+
+bool HttpResponseParser::parseHeader(const char *begin, const char *end) {
+  string_view line(begin, end - begin);
+  auto colon = line.find(':');
+  if (colon == string_view::npos || colon == 0) return false;
+  std::string name(line.data(), colon);
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  auto value = trim(line.substr(colon + 1));
+  auto &field = response_->headers_[name];
+  if (!field.empty()) field += ", ";
+  field.append(value.data(), value.size());
+  return true;
+}
+
+bool HttpResponseParser::headersDone() {
+  auto code = response_->statusCode_;
+  // Interim responses are skipped, except a protocol switch which ends the
+  // HTTP conversation on this connection.
+  if (code >= 100 && code < 200 && code != k101SwitchingProtocols) {
+    response_->headers_.clear();
+    response_->statusMessage_.clear();
+    state_ = State::kStatusLine;
+    return true;
+  }
+  auto &connection = response_->getHeader("connection");
+  if (response_->version_ == Version::kHttp11) {
+    keepAlive_ = !hasToken(connection, "close");
+  } else {
+    keepAlive_ = hasToken(connection, "keep-alive");
+  }
+  if (code == k101SwitchingProtocols) keepAlive_ = false;
+  if (headRequest_ || code < 200 || code == k204NoContent ||
+      code == k304NotModified) {
+    state_ = State::kDone;
+    return true;
+  }
+  auto &transferEncoding = response_->getHeader("transfer-encoding");
+  if (!transferEncoding.empty()) {
+    if (!hasToken(transferEncoding, "chunked")) return false;
+    state_ = State::kChunked;
+    return true;
+  }
+  auto &contentLength = response_->getHeader("content-length");
+  if (contentLength.empty()) {
+    state_ = State::kUntilClose;
+    keepAlive_ = false;
+    return true;
+  }
+  size_t length = 0;
+  for (char c : contentLength) {
+    if (c < '0' || c > '9') return false;
+    length = length * 10 + (c - '0');
+    if (length > maxBodySize_) return false;
+  }
+  response_->body_.reserve(length);
+  bodyLeft_ = length;
+  state_ = length > 0 ? State::kBody : State::kDone;
+  return true;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "ChunkedEncoding.h"
+#include "HttpTypes.h"
+#include "MsgBuffer.h"
+#include "NonCopyable.h"
+
+namespace canary {
+
+class HttpResponse;
+using HttpResponsePtr = std::shared_ptr<HttpResponse>;
+
+// A response received by HttpClient
+class HttpResponse {
+ public:
+  HttpStatusCode statusCode() const { return statusCode_; }
+
+  Version version() const { return version_; }
+
+  const std::string &statusMessage() const { return statusMessage_; }
+
+  // Header names are lower-cased, repeated headers are joined with ", "
+  const std::string &getHeader(const std::string &field) const;
+
+  const std::unordered_map<std::string, std::string> &headers() const {
+    return headers_;
+  }
+
+  const std::string &body() const { return body_; }
+
+  string_view getBody() const { return body_; }
+
+ private:
+  friend class HttpResponseParser;
+
+  HttpStatusCode statusCode_{kUnknown};
+  Version version_{Version::kUnknown};
+  std::string statusMessage_;
+  std::unordered_map<std::string, std::string> headers_;
+  std::string body_;
+};
+
+// Incremental parser of the responses coming back on one connection. Bodies
+// delimited by Content-Length, by chunked encoding or by the end of the
+// connection are supported.
+class HttpResponseParser : NonCopyable {
+ public:
+  enum class Status { kNeedMore = 0, kDone, kError };
+
+  // Prepares for the next response, the response to a HEAD request has no
+  // body whatever its headers say.
+  void reset(bool headRequest = false);
+
+  // Consumes the bytes of one response, the bytes of a following response
+  // stay in buffer.
+  Status parse(MsgBuffer *buffer);
+
+  // The peer closed the connection, which completes a response without
+  // length.
+  Status onClose();
+
+  // True once any byte of the current response has been consumed
+  bool started() const { return started_; }
+
+  // Whether the connection can be reused after the current response
+  bool keepAlive() const { return keepAlive_; }
+
+  HttpResponsePtr release() { return std::move(response_); }
+
+  void setMaxBodySize(size_t size) { maxBodySize_ = size; }
+
+ private:
+  enum class State { kStatusLine = 0, kHeaders, kBody, kChunked, kUntilClose,
+                     kDone, kError };
+
+  bool parseStatusLine(const char *begin, const char *end);
+
+  bool parseHeader(const char *begin, const char *end);
+
+  bool headersDone();
+
+  Status fail() {
+    state_ = State::kError;
+    return Status::kError;
+  }
+
+  State state_{State::kStatusLine};
+  HttpResponsePtr response_;
+  bool headRequest_{false};
+  bool started_{false};
+  bool keepAlive_{true};
+  size_t headBytes_{0};
+  size_t bodyLeft_{0};
+  size_t maxBodySize_{64 * 1024 * 1024};
+  ChunkedDecoder chunked_;
+};
+
+}  // namespace canary
@@ -0,0 +1,79 @@
+#include "WebSocketClient.h"
+
+using namespace canary;
+using namespace std::placeholders;
+
+WebSocketClient::WebSocketClient(EventLoop *loop, const InetAddress &serverAddr,
+                                 const std::string &host,
+                                 const std::string &path)
+    : tcpClient_(std::make_shared<TcpClient>(loop, serverAddr,
+                                             "WebSocketClient")),
+      host_(host),
+      path_(path) {
+  tcpClient_->setConnectionCallback(
+      std::bind(&WebSocketClient::onConnection, this, _1));
+  tcpClient_->setMessageCallback(
+      std::bind(&WebSocketClient::onMessage, this, _1, _2));
+  tcpClient_->setConnectionErrorCallback([this]() {
+    if (connectionErrorCallback_) connectionErrorCallback_();
+  });
+}
+
+WebSocketClient::~WebSocketClient() {
+  auto wsConn = connection();
+  if (wsConn) wsConn->tcpConnection()->clearContext();
+}
+
+void WebSocketClient::disconnect() {
+  auto wsConn = connection();
+  if (wsConn) {
+    wsConn->shutdown();
+  } else {
+    tcpClient_->disconnect();
+  }
+}
+
+void WebSocketClient::onConnection(const TcpConnectionPtr &conn) {
+  if (conn->connected()) {
+    auto wsConn = std::make_shared<WebSocketConnection>(
+        conn, WebSocketCodec::Role::kClient, maxMessageSize_);
+    conn->setContext(wsConn);
+    wsConn->sendUpgradeRequest(host_, path_, deflate_);
+    return;
+  }
+  auto wsConn = conn->getContext<WebSocketConnection>();
+  conn->clearContext();
+  if (!wsConn || !wsConn->upgraded_) return;
+  wsConn->closing_ = true;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    connection_.reset();
+  }
+  if (connectionCallback_) connectionCallback_(wsConn);
+}
+
+void WebSocketClient::onMessage(const TcpConnectionPtr &conn,
+                                MsgBuffer *buffer) {
+  auto wsConn = conn->getContext<WebSocketConnection>();
+  if (!wsConn) {
+    buffer->retrieveAll();
+    return;
+  }
+  if (!wsConn->upgraded_) {
+    auto status = wsConn->checkUpgradeResponse(buffer);
+    if (status == WebSocketConnection::HandshakeStatus::kNeedMore) return;
+    if (status == WebSocketConnection::HandshakeStatus::kFailed) {
+      buffer->retrieveAll();
+      conn->forceClose();
+      if (connectionErrorCallback_) connectionErrorCallback_();
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      connection_ = wsConn;
+    }
+    if (connectionCallback_) connectionCallback_(wsConn);
+    if (buffer->readableBytes() == 0) return;
+  }
+  wsConn->onData(buffer, messageCallback_);
+}
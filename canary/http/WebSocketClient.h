@@ -0,0 +1,75 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+
+#include "NonCopyable.h"
+#include "TcpClient.h"
+#include "WebSocketConnection.h"
+
+namespace canary {
+
+// A WebSocket client on top of TcpClient. The connection callback runs once
+// the upgrade succeeded and again when the connection is closed; a failed
+// TCP connection or handshake is reported by the error callback.
+class WebSocketClient : NonCopyable {
+ public:
+  WebSocketClient(EventLoop *loop, const InetAddress &serverAddr,
+                  const std::string &host, const std::string &path = "/");
+
+  ~WebSocketClient();
+
+  // Offer permessage-deflate to the server
+  void enablePerMessageDeflate(bool on = true) { deflate_ = on; }
+
+  void setMaxMessageSize(size_t size) { maxMessageSize_ = size; }
+
+  void connect() { tcpClient_->connect(); }
+
+  void disconnect();
+
+  WebSocketConnectionPtr connection() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return connection_;
+  }
+
+  EventLoop *getLoop() const { return tcpClient_->getLoop(); }
+
+  void setMessageCallback(const WebSocketMessageCallback &cb) {
+    messageCallback_ = cb;
+  }
+
+  void setMessageCallback(WebSocketMessageCallback &&cb) {
+    messageCallback_ = std::move(cb);
+  }
+
+  void setConnectionCallback(const WebSocketConnectionCallback &cb) {
+    connectionCallback_ = cb;
+  }
+
+  void setConnectionCallback(WebSocketConnectionCallback &&cb) {
+    connectionCallback_ = std::move(cb);
+  }
+
+  void setConnectionErrorCallback(const ConnectionErrorCallback &cb) {
+    connectionErrorCallback_ = cb;
+  }
+
+ private:
+  void onConnection(const TcpConnectionPtr &conn);
+
+  void onMessage(const TcpConnectionPtr &conn, MsgBuffer *buffer);
+
+  std::shared_ptr<TcpClient> tcpClient_;
+  std::string host_;
+  std::string path_;
+  bool deflate_{false};
+  size_t maxMessageSize_{16 * 1024 * 1024};
+  WebSocketMessageCallback messageCallback_;
+  WebSocketConnectionCallback connectionCallback_;
+  ConnectionErrorCallback connectionErrorCallback_;
+  mutable std::mutex mutex_;
+  WebSocketConnectionPtr connection_;  // @GuardedBy mutex_
+};
+
+}  // namespace canary
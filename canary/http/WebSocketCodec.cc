@@ -0,0 +1,544 @@
+#include "WebSocketCodec.h"
+
+#include <string.h>
+#include <zlib.h>
+
+#include <random>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CANARY_MASK_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "CpuFeatures.h"
+#include "Sha1.h"
+#include "Utility.h"
+
+using namespace canary;
+
+namespace canary {
+static constexpr unsigned char kFin{0x80};
+static constexpr unsigned char kRsv1{0x40};
+static constexpr unsigned char kMasked{0x80};
+static constexpr size_t kChunkSize{16 * 1024};
+static const char kDeflateTail[] = {'\x00', '\x00', '\xff', '\xff'};
+
+enum Opcode {
+  kContinuation = 0x0,
+  kText = 0x1,
+  kBinary = 0x2,
+  kClose = 0x8,
+  kPing = 0x9,
+  kPong = 0xa
+};
+
+// Close status codes (RFC 6455 7.4.1)
+enum CloseCode : uint16_t {
+  kProtocolError = 1002,
+  kInvalidPayload = 1007,
+  kMessageTooBig = 1009
+};
+
+static int toOpcode(WebSocketMessageType type) {
+  switch (type) {
+    case WebSocketMessageType::Text:
+      return kText;
+    case WebSocketMessageType::Binary:
+      return kBinary;
+    case WebSocketMessageType::Ping:
+      return kPing;
+    case WebSocketMessageType::Pong:
+      return kPong;
+    case WebSocketMessageType::Close:
+      return kClose;
+    default:
+      return kBinary;
+  }
+}
+
+static WebSocketMessageType toMessageType(int opcode) {
+  switch (opcode) {
+    case kText:
+      return WebSocketMessageType::Text;
+    case kBinary:
+      return WebSocketMessageType::Binary;
+    case kPing:
+      return WebSocketMessageType::Ping;
+    case kPong:
+      return WebSocketMessageType::Pong;
+    case kClose:
+      return WebSocketMessageType::Close;
+    default:
+      return WebSocketMessageType::Unknown;
+  }
+}
+
+static std::unique_ptr<z_stream_s> newDeflater(int windowBits, int level) {
+  std::unique_ptr<z_stream_s> stream(new z_stream_s());
+  if (deflateInit2(stream.get(), level, Z_DEFLATED, -windowBits, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return nullptr;
+  }
+  return stream;
+}
+
+// Compresses one message with Z_SYNC_FLUSH and drops the 00 00 ff ff tail
+// (RFC 7692 7.2.1)
+static bool deflateWith(z_stream_s *stream, const char *data, size_t len,
+                        MsgBuffer *output) {
+  stream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+  stream->avail_in = static_cast<uInt>(len);
+  auto start = output->readableBytes();
+  do {
+    output->ensureWritableBytes(kChunkSize);
+    auto avail = output->writableBytes();
+    stream->next_out = reinterpret_cast<Bytef *>(output->beginWrite());
+    stream->avail_out = static_cast<uInt>(avail);
+    if (deflate(stream, Z_SYNC_FLUSH) == Z_STREAM_ERROR) return false;
+    output->hasWritten(avail - stream->avail_out);
+  } while (stream->avail_out == 0);
+  if (output->readableBytes() - start < 4 ||
+      memcmp(output->beginWrite() - 4, kDeflateTail, 4) != 0) {
+    return false;
+  }
+  output->unwrite(4);
+  return true;
+}
+
+// Well-formed UTF-8 (RFC 3629): no overlong forms, no surrogates, nothing
+// past U+10FFFF
+static bool isValidUtf8(string_view text) {
+  auto p = reinterpret_cast<const unsigned char *>(text.data());
+  auto end = p + text.size();
+  while (p < end) {
+    // Text is mostly ASCII, skipped 8 bytes at a time
+    for (uint64_t word; end - p >= 8; p += 8) {
+      memcpy(&word, p, 8);
+      if (word & 0x8080808080808080ULL) break;
+    }
+    if (p == end) break;
+    if (*p < 0x80) {
+      ++p;
+      continue;
+    }
+    size_t length;
+    unsigned char low = 0x80, high = 0xbf;
+    if (*p >= 0xc2 && *p <= 0xdf) {
+      length = 2;
+    } else if (*p >= 0xe0 && *p <= 0xef) {
+      length = 3;
+      if (*p == 0xe0) low = 0xa0;
+      if (*p == 0xed) high = 0x9f;
+    } else if (*p >= 0xf0 && *p <= 0xf4) {
+      length = 4;
+      if (*p == 0xf0) low = 0x90;
+      if (*p == 0xf4) high = 0x8f;
+    } else {
+      return false;
+    }
+    if (static_cast<size_t>(end - p) < length || p[1] < low || p[1] > high) {
+      return false;
+    }
+    for (size_t i = 2; i < length; ++i) {
+      if ((p[i] & 0xc0) != 0x80) return false;
+    }
+    p += length;
+  }
+  return true;
+}
+}  // namespace canary
+
+#ifdef CANARY_MASK_X86
+namespace canary {
+// The kernels return the bytes they did, a multiple of 4 so that the key
+// stays in phase for the scalar code doing the rest
+
+__attribute__((target("sse2"))) static size_t maskSse2(
+    char *data, size_t len, uint32_t mask32) {
+  auto mask128 = _mm_set1_epi32(static_cast<int>(mask32));
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    auto p = reinterpret_cast<__m128i *>(data + i);
+    _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), mask128));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t maskAvx2(
+    char *data, size_t len, uint32_t mask32) {
+  auto mask256 = _mm256_set1_epi32(static_cast<int>(mask32));
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    auto p = reinterpret_cast<__m256i *>(data + i);
+    _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), mask256));
+  }
+  return i + maskSse2(data + i, len - i, mask32);
+}
+}  // namespace canary
+#endif  // CANARY_MASK_X86
+
+void canary::maskWebSocketPayload(char *data, size_t len,
+                                  const unsigned char *key, size_t offset) {
+  unsigned char rotated[4];
+  for (size_t i = 0; i < 4; ++i) rotated[i] = key[(offset + i) & 3];
+  uint32_t mask32;
+  memcpy(&mask32, rotated, 4);
+  size_t i = 0;
+#ifdef CANARY_MASK_X86
+  switch (simdLevel()) {
+    case SimdLevel::Avx2:
+      i = maskAvx2(data, len, mask32);
+      break;
+    case SimdLevel::Ssse3:
+      i = maskSse2(data, len, mask32);
+      break;
+    case SimdLevel::Scalar:
+      break;
+  }
+#elif defined(__ARM_NEON)
+  auto mask128 = vreinterpretq_u8_u32(vdupq_n_u32(mask32));
+  for (; i + 16 <= len; i += 16) {
+    auto p = reinterpret_cast<uint8_t *>(data + i);
+    vst1q_u8(p, veorq_u8(vld1q_u8(p), mask128));
+  }
+#endif
+  uint64_t mask64 = (static_cast<uint64_t>(mask32) << 32) | mask32;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    word ^= mask64;
+    memcpy(data + i, &word, 8);
+  }
+  // i is a multiple of 4 here, so the key stays in phase
+  for (; i < len; ++i) data[i] ^= rotated[i & 3];
+}
+
+std::string canary::webSocketAcceptKey(const std::string &key) {
+  auto input = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+  auto digest = Sha1::digest(input.data(), input.length());
+  return utils::base64Encode(
+      reinterpret_cast<const unsigned char *>(digest.data()),
+      static_cast<unsigned int>(digest.length()));
+}
+
+bool PerMessageDeflateParams::parse(string_view header,
+                                    PerMessageDeflateParams *params) {
+  auto trim = [](string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+      s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+      s.remove_suffix(1);
+    }
+    return s;
+  };
+  auto parseBits = [](string_view value, int *bits) {
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+      value = value.substr(1, value.size() - 2);
+    }
+    if (value.empty() || value.size() > 2) return false;
+    int n = 0;
+    for (auto c : value) {
+      if (c < '0' || c > '9') return false;
+      n = n * 10 + (c - '0');
+    }
+    if (n < 8 || n > 15) return false;
+    *bits = n;
+    return true;
+  };
+  while (!header.empty()) {
+    auto comma = header.find(',');
+    auto entry = header.substr(0, comma);
+    header = comma == string_view::npos ? string_view()
+                                        : header.substr(comma + 1);
+    PerMessageDeflateParams result;
+    bool valid = true;
+    bool first = true;
+    int seen = 0;
+    while (valid) {
+      auto semicolon = entry.find(';');
+      auto token = trim(entry.substr(0, semicolon));
+      auto eq = token.find('=');
+      auto name = trim(token.substr(0, eq));
+      auto value = eq == string_view::npos ? string_view()
+                                           : trim(token.substr(eq + 1));
+      if (first) {
+        valid = name == "permessage-deflate";
+        first = false;
+      } else if (name == "server_no_context_takeover" && !(seen & 1)) {
+        result.serverNoContextTakeover_ = true;
+        seen |= 1;
+        valid = eq == string_view::npos;
+      } else if (name == "client_no_context_takeover" && !(seen & 2)) {
+        result.clientNoContextTakeover_ = true;
+        seen |= 2;
+        valid = eq == string_view::npos;
+      } else if (name == "server_max_window_bits" && !(seen & 4)) {
+        seen |= 4;
+        valid = parseBits(value, &result.serverMaxWindowBits_);
+      } else if (name == "client_max_window_bits" && !(seen & 8)) {
+        // Without a value the client merely supports the parameter
+        seen |= 8;
+        valid = eq == string_view::npos ||
+                parseBits(value, &result.clientMaxWindowBits_);
+      } else {
+        valid = false;
+      }
+      if (semicolon == string_view::npos) break;
+      entry = entry.substr(semicolon + 1);
+    }
+    if (valid) {
+      *params = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string PerMessageDeflateParams::toString() const {
+  std::string result = "permessage-deflate";
+  if (serverNoContextTakeover_) result += "; server_no_context_takeover";
+  if (clientNoContextTakeover_) result += "; client_no_context_takeover";
+  if (serverMaxWindowBits_ != 15) {
+    result += "; server_max_window_bits=";
+    result += std::to_string(serverMaxWindowBits_);
+  }
+  if (clientMaxWindowBits_ != 15) {
+    result += "; client_max_window_bits=";
+    result += std::to_string(clientMaxWindowBits_);
+  }
+  return result;
+}
+
+WebSocketCodec::WebSocketCodec(Role role, size_t maxMessageSize)
+    : role_(role), maxMessageSize_(maxMessageSize) {}
+
+WebSocketCodec::~WebSocketCodec() {
+  if (deflater_) (void)deflateEnd(deflater_.get());
+  if (inflater_) (void)inflateEnd(inflater_.get());
+}
+
+void WebSocketCodec::enableDeflate(const PerMessageDeflateParams &params,
+                                   int level) {
+  params_ = params;
+  // The peer may use any window up to 15 bits, a full window inflates all
+  inflater_.reset(new z_stream_s());
+  if (inflateInit2(inflater_.get(), -MAX_WBITS) != Z_OK) {
+    inflater_.reset();
+    return;
+  }
+  int windowBits = role_ == Role::kServer ? params.serverMaxWindowBits_
+                                          : params.clientMaxWindowBits_;
+  // zlib cannot deflate with a 256 byte window, such a peer only gets
+  // uncompressed messages, which permessage-deflate allows.
+  if (windowBits >= 9) deflater_ = newDeflater(windowBits, level);
+  if (deflater_) deflateWindowBits_ = windowBits;
+}
+
+void WebSocketCodec::resetDeflateContext() {
+  if (deflater_) (void)deflateReset(deflater_.get());
+}
+
+bool WebSocketCodec::inflateMessage(const char *data, size_t len) {
+  inflated_.clear();
+  auto stream = inflater_.get();
+  auto inflatePiece = [this, stream](const char *p, size_t n) {
+    stream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(p));
+    stream->avail_in = static_cast<uInt>(n);
+    while (stream->avail_in > 0) {
+      auto size = inflated_.size();
+      inflated_.resize(size + kChunkSize);
+      stream->next_out = reinterpret_cast<Bytef *>(&inflated_[size]);
+      stream->avail_out = static_cast<uInt>(kChunkSize);
+      auto ret = inflate(stream, Z_SYNC_FLUSH);
+      inflated_.resize(size + kChunkSize - stream->avail_out);
+      if (ret == Z_STREAM_END) {
+        // The peer closed its stream with a final block, start over
+        (void)inflateReset(stream);
+        break;
+      }
+      if (ret != Z_OK && ret != Z_BUF_ERROR) return fail(kInvalidPayload);
+      if (inflated_.size() > maxMessageSize_) return fail(kMessageTooBig);
+      if (ret == Z_BUF_ERROR && stream->avail_out > 0) break;
+    }
+    return true;
+  };
+  return inflatePiece(data, len) && inflatePiece(kDeflateTail, 4);
+}
+
+bool WebSocketCodec::deliver(WebSocketMessageType type, string_view message,
+                             const MessageCallback &callback) {
+  // Checked once the whole message is there, a character may span frames
+  if (type == WebSocketMessageType::Text && !isValidUtf8(message)) {
+    return fail(kInvalidPayload);
+  }
+  callback(type, message);
+  return true;
+}
+
+bool WebSocketCodec::decode(MsgBuffer *buffer,
+                            const MessageCallback &callback) {
+  while (!failed_) {
+    auto readable = buffer->readableBytes();
+    if (readable < 2) return true;
+    auto header = reinterpret_cast<const unsigned char *>(buffer->peek());
+    bool fin = header[0] & kFin;
+    bool rsv1 = header[0] & kRsv1;
+    int opcode = header[0] & 0x0f;
+    bool masked = header[1] & kMasked;
+    // RSV2 and RSV3 are not used by any extension we support
+    if (header[0] & 0x30) return fail(kProtocolError);
+    uint64_t len = header[1] & 0x7f;
+    size_t headerLen = 2;
+    if (len == 126) {
+      if (readable < 4) return true;
+      len = (uint64_t(header[2]) << 8) | header[3];
+      headerLen = 4;
+    } else if (len == 127) {
+      if (readable < 10) return true;
+      len = 0;
+      for (int i = 2; i < 10; ++i) len = (len << 8) | header[i];
+      headerLen = 10;
+    }
+    if (masked != (role_ == Role::kServer)) return fail(kProtocolError);
+    if (masked) headerLen += 4;
+    if (opcode & 0x08) {
+      if (!fin || rsv1 || len > 125 ||
+          toMessageType(opcode) == WebSocketMessageType::Unknown) {
+        return fail(kProtocolError);
+      }
+    } else {
+      if (opcode > kBinary || (opcode == kContinuation) != fragmented_ ||
+          (rsv1 && (opcode == kContinuation || !inflater_))) {
+        return fail(kProtocolError);
+      }
+      // Checked before the payload arrives, a huge frame is never buffered
+      if (len > maxMessageSize_ ||
+          (opcode == kContinuation &&
+           len + message_.size() > maxMessageSize_)) {
+        return fail(kMessageTooBig);
+      }
+    }
+    if (readable < headerLen + len) return true;
+
+    auto payload = const_cast<char *>(buffer->peek()) + headerLen;
+    auto payloadLen = static_cast<size_t>(len);
+    if (masked) {
+      maskWebSocketPayload(payload, payloadLen, header + headerLen - 4);
+    }
+    if (opcode & 0x08) {
+      callback(toMessageType(opcode), string_view(payload, payloadLen));
+    } else if (opcode != kContinuation && fin) {
+      // The common case, one frame per message
+      if (!rsv1) {
+        if (!deliver(toMessageType(opcode), string_view(payload, payloadLen),
+                     callback)) {
+          return false;
+        }
+      } else {
+        if (!inflateMessage(payload, payloadLen)) return false;
+        if (!deliver(toMessageType(opcode), inflated_, callback)) return false;
+      }
+    } else {
+      if (opcode != kContinuation) {
+        fragmented_ = true;
+        compressed_ = rsv1;
+        fragmentType_ = toMessageType(opcode);
+        message_.clear();
+      }
+      message_.append(payload, payloadLen);
+      if (fin) {
+        fragmented_ = false;
+        if (compressed_) {
+          if (!inflateMessage(message_.data(), message_.size())) return false;
+          if (!deliver(fragmentType_, inflated_, callback)) return false;
+        } else {
+          if (!deliver(fragmentType_, message_, callback)) return false;
+        }
+        message_.clear();
+      }
+    }
+    buffer->retrieve(headerLen + payloadLen);
+  }
+  return false;
+}
+
+void WebSocketCodec::encode(WebSocketMessageType type, const char *data,
+                            size_t len, MsgBuffer *output, bool compress) {
+  bool dataMessage = type == WebSocketMessageType::Text ||
+                     type == WebSocketMessageType::Binary;
+  if (compress && dataMessage && deflater_) {
+    MsgBuffer compressed(len / 2 + 64);
+    if (deflateWith(deflater_.get(), data, len, &compressed)) {
+      bool noContextTakeover = role_ == Role::kServer
+                                   ? params_.serverNoContextTakeover_
+                                   : params_.clientNoContextTakeover_;
+      if (noContextTakeover) (void)deflateReset(deflater_.get());
+      encodeFrame(type, compressed.peek(), compressed.readableBytes(),
+                  role_ == Role::kClient, true, output);
+      return;
+    }
+    // The context is unusable now, stop compressing
+    (void)deflateEnd(deflater_.get());
+    deflater_.reset();
+  }
+  encodeFrame(type, data, len, role_ == Role::kClient, false, output);
+}
+
+void WebSocketCodec::encodeFrame(WebSocketMessageType type, const char *data,
+                                 size_t len, bool mask, bool compressed,
+                                 MsgBuffer *output) {
+  unsigned char header[14];
+  size_t headerLen = 2;
+  header[0] = kFin | static_cast<unsigned char>(toOpcode(type));
+  if (compressed) header[0] |= kRsv1;
+  if (len < 126) {
+    header[1] = static_cast<unsigned char>(len);
+  } else if (len <= 0xffff) {
+    header[1] = 126;
+    header[2] = static_cast<unsigned char>(len >> 8);
+    header[3] = static_cast<unsigned char>(len);
+    headerLen = 4;
+  } else {
+    header[1] = 127;
+    for (int i = 0; i < 8; ++i) {
+      header[2 + i] = static_cast<unsigned char>(uint64_t(len) >> (56 - 8 * i));
+    }
+    headerLen = 10;
+  }
+  unsigned char key[4];
+  if (mask) {
+    static thread_local std::mt19937 generator{std::random_device{}()};
+    uint32_t random = generator();
+    memcpy(key, &random, 4);
+    header[1] |= kMasked;
+    memcpy(header + headerLen, key, 4);
+    headerLen += 4;
+  }
+  output->ensureWritableBytes(headerLen + len);
+  output->append(reinterpret_cast<const char *>(header), headerLen);
+  auto payload = output->beginWrite();
+  output->append(data, len);
+  if (mask) maskWebSocketPayload(payload, len, key);
+}
+
+std::string WebSocketCodec::closePayload(uint16_t code,
+                                         const std::string &reason) {
+  std::string payload;
+  payload.push_back(static_cast<char>(code >> 8));
+  payload.push_back(static_cast<char>(code & 0xff));
+  // Control frames carry at most 125 bytes
+  payload.append(reason, 0, 123);
+  return payload;
+}
+
+bool WebSocketCodec::deflateMessage(const char *data, size_t len,
+                                    MsgBuffer *output, int level) {
+  auto stream = newDeflater(MAX_WBITS, level);
+  if (!stream) return false;
+  bool ok = deflateWith(stream.get(), data, len, output);
+  (void)deflateEnd(stream.get());
+  return ok;
+}
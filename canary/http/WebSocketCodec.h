@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "HttpTypes.h"
+#include "MsgBuffer.h"
+#include "NonCopyable.h"
+#include "StringView.h"
+
+struct z_stream_s;
+
+namespace canary {
+
+// XORs len bytes in place with the 4 byte masking key. offset is the position
+// of data[0] in the payload, so a payload can be (un)masked piece by piece.
+// Uses SSE2 or AVX2 kernels picked by simdLevel(), or NEON, masking is the
+// hot loop of a server receiving many small frames.
+void maskWebSocketPayload(char *data, size_t len, const unsigned char *key,
+                          size_t offset = 0);
+
+// Returns the Sec-WebSocket-Accept value for a Sec-WebSocket-Key
+std::string webSocketAcceptKey(const std::string &key);
+
+// permessage-deflate (RFC 7692) parameters
+struct PerMessageDeflateParams {
+  bool serverNoContextTakeover_{false};
+  bool clientNoContextTakeover_{false};
+  int serverMaxWindowBits_{15};
+  int clientMaxWindowBits_{15};
+
+  // Parses the first valid permessage-deflate entry of a
+  // Sec-WebSocket-Extensions value, returns false if there is none.
+  static bool parse(string_view header, PerMessageDeflateParams *params);
+
+  // The Sec-WebSocket-Extensions value describing these parameters
+  std::string toString() const;
+};
+
+// Frame level WebSocket protocol. Frames are parsed in place on the receive
+// buffer: payloads are unmasked without copying, and a message made of one
+// uncompressed frame is handed out as a view of the buffer. Fragmented and
+// compressed messages are reassembled in an internal buffer.
+class WebSocketCodec : NonCopyable {
+ public:
+  // A server expects masked frames and sends unmasked ones, a client the
+  // other way round.
+  enum class Role { kServer = 0, kClient };
+
+  // The view is only valid during the callback
+  using MessageCallback =
+      std::function<void(WebSocketMessageType, string_view)>;
+
+  explicit WebSocketCodec(Role role, size_t maxMessageSize = 16 * 1024 * 1024);
+
+  ~WebSocketCodec();
+
+  Role role() const { return role_; }
+
+  // Turns on permessage-deflate after a successful negotiation
+  void enableDeflate(const PerMessageDeflateParams &params, int level = -1);
+
+  bool deflateEnabled() const { return static_cast<bool>(inflater_); }
+
+  // True if the peer can inflate messages from deflateMessage(), i.e. we
+  // compress with a full window.
+  bool acceptsSharedDeflate() const {
+    return deflater_ && deflateWindowBits_ == 15;
+  }
+
+  // Forget the compression history. Must be called after a message that
+  // was not compressed by this codec went out compressed: the peer's window
+  // then no longer matches ours.
+  void resetDeflateContext();
+
+  // Consumes all complete frames of buffer. Returns false on a protocol
+  // error or a text message that is not UTF-8, the connection should then
+  // be closed with closeCode().
+  bool decode(MsgBuffer *buffer, const MessageCallback &callback);
+
+  // The close status code describing the last decode error
+  uint16_t closeCode() const { return closeCode_; }
+
+  // Appends one message as a single frame. Data messages are compressed if
+  // permessage-deflate is enabled and compress is true.
+  void encode(WebSocketMessageType type, const char *data, size_t len,
+              MsgBuffer *output, bool compress = true);
+
+  // Appends a raw frame. mask must be true for client frames.
+  static void encodeFrame(WebSocketMessageType type, const char *data,
+                          size_t len, bool mask, bool compressed,
+                          MsgBuffer *output);
+
+  // The payload of a close frame
+  static std::string closePayload(uint16_t code, const std::string &reason);
+
+  // Compresses one message without any shared context, so that the result
+  // can be decompressed by every peer that negotiated permessage-deflate.
+  static bool deflateMessage(const char *data, size_t len, MsgBuffer *output,
+                             int level = -1);
+
+ private:
+  bool fail(uint16_t code) {
+    closeCode_ = code;
+    failed_ = true;
+    return false;
+  }
+
+  bool inflateMessage(const char *data, size_t len);
+
+  // Hands a complete data message out, failing with 1007 on a text message
+  // that is not UTF-8 (RFC 6455 8.1)
+  bool deliver(WebSocketMessageType type, string_view message,
+               const MessageCallback &callback);
+
+  const Role role_;
+  const size_t maxMessageSize_;
+  PerMessageDeflateParams params_;
+  std::unique_ptr<z_stream_s> deflater_;
+  int deflateWindowBits_{0};
+  std::unique_ptr<z_stream_s> inflater_;
+  // State of a fragmented (or compressed) message
+  bool fragmented_{false};
+  bool compressed_{false};
+  WebSocketMessageType fragmentType_{WebSocketMessageType::Unknown};
+  std::string message_;
+  std::string inflated_;
+  uint16_t closeCode_{0};
+  bool failed_{false};
+};
+
+}  // namespace canary
@@ -0,0 +1,327 @@
+#include "WebSocketConnection.h"
+
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+
+#include "Utility.h"
+
+using namespace canary;
+
+namespace canary {
+static constexpr size_t kMaxHeadSize{8 * 1024};
+static constexpr double kCloseTimeout{5.0};
+
+static string_view trim(string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+    s.remove_prefix(1);
+  }
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+    s.remove_suffix(1);
+  }
+  return s;
+}
+
+// Parses an HTTP/1.1 head at the front of buffer, 1 when done (the head is
+// consumed), 0 when more data is needed and -1 on malformed input.
+static int parseHead(MsgBuffer *buffer, std::string *firstLine,
+                     WebSocketHeaders *headers) {
+  static const char kEnd[] = "\r\n\r\n";
+  const char *bufferEnd = buffer->peek() + buffer->readableBytes();
+  auto end = std::search(buffer->peek(), bufferEnd, kEnd, kEnd + 4);
+  if (end == bufferEnd) {
+    return buffer->readableBytes() > kMaxHeadSize ? -1 : 0;
+  }
+  string_view head(buffer->peek(), end - buffer->peek() + 2);
+  auto pos = head.find("\r\n");
+  firstLine->assign(head.data(), pos);
+  head.remove_prefix(pos + 2);
+  while (!head.empty()) {
+    pos = head.find("\r\n");
+    auto line = head.substr(0, pos);
+    head.remove_prefix(pos + 2);
+    auto colon = line.find(':');
+    if (colon == string_view::npos || colon == 0) return -1;
+    std::string name(line.data(), colon);
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    auto value = trim(line.substr(colon + 1));
+    auto &field = (*headers)[name];
+    if (!field.empty()) field += ", ";
+    field.append(value.data(), value.size());
+  }
+  buffer->retrieveUntil(end + 4);
+  return 1;
+}
+
+// Case-insensitive search of token in a comma separated header value
+static bool hasToken(const WebSocketHeaders &headers, const std::string &name,
+                     string_view token) {
+  auto iter = headers.find(name);
+  if (iter == headers.end()) return false;
+  string_view value(iter->second);
+  while (!value.empty()) {
+    auto comma = value.find(',');
+    auto item = trim(value.substr(0, comma));
+    if (item.size() == token.size() &&
+        strncasecmp(item.data(), token.data(), token.size()) == 0) {
+      return true;
+    }
+    if (comma == string_view::npos) break;
+    value.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+static const std::string &headerValue(const WebSocketHeaders &headers,
+                                      const std::string &name) {
+  static const std::string empty;
+  auto iter = headers.find(name);
+  return iter == headers.end() ? empty : iter->second;
+}
+}  // namespace canary
+
+WebSocketSharedFrame WebSocketSharedFrame::make(const char *data, size_t len,
+                                                WebSocketMessageType type,
+                                                bool deflate) {
+  WebSocketSharedFrame frame;
+  frame.plain_ = std::make_shared<MsgBuffer>(len + 16);
+  WebSocketCodec::encodeFrame(type, data, len, false, false,
+                              frame.plain_.get());
+  if (deflate && (type == WebSocketMessageType::Text ||
+                  type == WebSocketMessageType::Binary)) {
+    MsgBuffer compressed(len / 2 + 64);
+    if (WebSocketCodec::deflateMessage(data, len, &compressed) &&
+        compressed.readableBytes() < len) {
+      frame.deflated_ =
+          std::make_shared<MsgBuffer>(compressed.readableBytes() + 16);
+      WebSocketCodec::encodeFrame(type, compressed.peek(),
+                                  compressed.readableBytes(), false, true,
+                                  frame.deflated_.get());
+    }
+  }
+  return frame;
+}
+
+WebSocketConnection::WebSocketConnection(const TcpConnectionPtr &conn,
+                                         WebSocketCodec::Role role,
+                                         size_t maxMessageSize)
+    : tcpConn_(conn), codec_(role, maxMessageSize) {}
+
+WebSocketConnection::HandshakeStatus WebSocketConnection::acceptUpgrade(
+    MsgBuffer *buffer, bool deflate, int level,
+    const WebSocketHandshakeCallback &callback) {
+  std::string requestLine;
+  WebSocketHeaders headers;
+  auto ret = parseHead(buffer, &requestLine, &headers);
+  if (ret == 0) return HandshakeStatus::kNeedMore;
+
+  auto reject = [this](const char *status, const char *extraHeaders = "") {
+    tcpConn_->send(std::string("HTTP/1.1 ") + status + "\r\n" + extraHeaders +
+                   "Connection: close\r\nContent-Length: 0\r\n\r\n");
+    tcpConn_->shutdown();
+    return HandshakeStatus::kFailed;
+  };
+  if (ret < 0) return reject("400 Bad Request");
+  auto items = utils::splitString(requestLine, " ");
+  if (items.size() != 3 || items[0] != "GET" || items[2] != "HTTP/1.1") {
+    return reject("400 Bad Request");
+  }
+  auto &key = headerValue(headers, "sec-websocket-key");
+  if (!hasToken(headers, "upgrade", "websocket") ||
+      !hasToken(headers, "connection", "upgrade") || key.length() != 24) {
+    return reject("400 Bad Request");
+  }
+  if (headerValue(headers, "sec-websocket-version") != "13") {
+    return reject("426 Upgrade Required", "Sec-WebSocket-Version: 13\r\n");
+  }
+  path_ = items[1];
+  if (callback && !callback(path_, headers)) return reject("403 Forbidden");
+
+  std::string response =
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: " +
+      webSocketAcceptKey(key) + "\r\n";
+  PerMessageDeflateParams params;
+  if (deflate &&
+      PerMessageDeflateParams::parse(
+          headerValue(headers, "sec-websocket-extensions"), &params) &&
+      params.serverMaxWindowBits_ >= 9) {
+    // The client window is only a hint from the client, we inflate with a
+    // full window whatever it uses.
+    params.clientMaxWindowBits_ = 15;
+    codec_.enableDeflate(params, level);
+    deflateEnabled_ = true;
+    response += "Sec-WebSocket-Extensions: " + params.toString() + "\r\n";
+  }
+  response += "\r\n";
+  tcpConn_->send(std::move(response));
+  upgraded_ = true;
+  return HandshakeStatus::kDone;
+}
+
+void WebSocketConnection::sendUpgradeRequest(const std::string &host,
+                                             const std::string &path,
+                                             bool deflate) {
+  unsigned char nonce[16];
+  if (!utils::secureRandomBytes(nonce, sizeof(nonce))) {
+    auto random = utils::genRandomString(sizeof(nonce));
+    memcpy(nonce, random.data(), sizeof(nonce));
+  }
+  auto key = utils::base64Encode(nonce, sizeof(nonce));
+  expectedAccept_ = webSocketAcceptKey(key);
+  deflateOffered_ = deflate;
+  path_ = path;
+  std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host +
+                        "\r\n"
+                        "Upgrade: websocket\r\n"
+                        "Connection: Upgrade\r\n"
+                        "Sec-WebSocket-Key: " +
+                        key +
+                        "\r\n"
+                        "Sec-WebSocket-Version: 13\r\n";
+  if (deflate) {
+    request +=
+        "Sec-WebSocket-Extensions: permessage-deflate; "
+        "client_max_window_bits\r\n";
+  }
+  request += "\r\n";
+  tcpConn_->send(std::move(request));
+}
+
+WebSocketConnection::HandshakeStatus WebSocketConnection::checkUpgradeResponse(
+    MsgBuffer *buffer) {
+  std::string statusLine;
+  WebSocketHeaders headers;
+  auto ret = parseHead(buffer, &statusLine, &headers);
+  if (ret == 0) return HandshakeStatus::kNeedMore;
+  if (ret < 0 || statusLine.compare(0, 13, "HTTP/1.1 101 ") != 0 ||
+      !hasToken(headers, "upgrade", "websocket") ||
+      !hasToken(headers, "connection", "upgrade") ||
+      headerValue(headers, "sec-websocket-accept") != expectedAccept_) {
+    return HandshakeStatus::kFailed;
+  }
+  auto &extensions = headerValue(headers, "sec-websocket-extensions");
+  if (!extensions.empty()) {
+    // Only what we offered may be accepted
+    PerMessageDeflateParams params;
+    if (!deflateOffered_ ||
+        !PerMessageDeflateParams::parse(extensions, &params)) {
+      return HandshakeStatus::kFailed;
+    }
+    codec_.enableDeflate(params);
+    deflateEnabled_ = true;
+  }
+  upgraded_ = true;
+  return HandshakeStatus::kDone;
+}
+
+void WebSocketConnection::onData(MsgBuffer *buffer,
+                                 const WebSocketMessageCallback &callback) {
+  auto thisPtr = shared_from_this();
+  bool closed = false;
+  auto ok = codec_.decode(buffer, [&](WebSocketMessageType type,
+                                      string_view message) {
+    if (closed) return;
+    if (type == WebSocketMessageType::Close) {
+      closed = true;
+      closing_ = true;
+      if (!closeSent_) {
+        // Echo the status code (RFC 6455 5.5.1)
+        uint16_t code = 1000;
+        if (message.size() >= 2) {
+          code = static_cast<uint16_t>(
+              (static_cast<unsigned char>(message[0]) << 8) |
+              static_cast<unsigned char>(message[1]));
+        }
+        sendClose(code, "");
+      }
+      tcpConn_->shutdown();
+      return;
+    }
+    if (type == WebSocketMessageType::Ping) {
+      sendInLoop(message.data(), message.size(), WebSocketMessageType::Pong);
+    }
+    if (callback) callback(thisPtr, message, type);
+  });
+  if (!ok) {
+    sendClose(codec_.closeCode(), "");
+    closing_ = true;
+    tcpConn_->shutdown();
+  }
+  if (closed || !ok) buffer->retrieveAll();
+}
+
+void WebSocketConnection::send(const char *msg, size_t len,
+                               WebSocketMessageType type) {
+  if (!upgraded_ || closing_) return;
+  auto loop = getLoop();
+  if (loop->isInLoopThread()) {
+    sendInLoop(msg, len, type);
+  } else {
+    auto thisPtr = shared_from_this();
+    loop->queueInLoop([thisPtr, message = std::string(msg, len), type]() {
+      thisPtr->sendInLoop(message.data(), message.length(), type);
+    });
+  }
+}
+
+void WebSocketConnection::send(const WebSocketSharedFrame &frame) {
+  if (!upgraded_ || closing_) return;
+  auto thisPtr = shared_from_this();
+  getLoop()->runInLoop([thisPtr, frame]() { thisPtr->sendInLoop(frame); });
+}
+
+void WebSocketConnection::sendInLoop(const WebSocketSharedFrame &frame) {
+  // Shared frames are not masked, they are for server connections only
+  assert(codec_.role() == WebSocketCodec::Role::kServer);
+  if (closeSent_ || !upgraded_) return;
+  if (frame.deflated_ && codec_.acceptsSharedDeflate()) {
+    tcpConn_->send(frame.deflated_);
+    codec_.resetDeflateContext();
+  } else {
+    tcpConn_->send(frame.plain_);
+  }
+}
+
+void WebSocketConnection::sendInLoop(const char *msg, size_t len,
+                                     WebSocketMessageType type) {
+  if (closeSent_) return;
+  MsgBuffer buffer(len + 16);
+  codec_.encode(type, msg, len, &buffer);
+  tcpConn_->send(std::move(buffer));
+}
+
+void WebSocketConnection::sendClose(uint16_t code, const std::string &reason) {
+  if (closeSent_) return;
+  auto payload = WebSocketCodec::closePayload(code, reason);
+  sendInLoop(payload.data(), payload.length(), WebSocketMessageType::Close);
+  closeSent_ = true;
+}
+
+void WebSocketConnection::shutdown(uint16_t code, const std::string &reason) {
+  auto thisPtr = shared_from_this();
+  getLoop()->runInLoop([thisPtr, code, reason]() {
+    if (thisPtr->closeSent_ || !thisPtr->tcpConn_->connected()) return;
+    thisPtr->closing_ = true;
+    if (!thisPtr->upgraded_) {
+      thisPtr->tcpConn_->shutdown();
+      return;
+    }
+    thisPtr->sendClose(code, reason);
+    // Do not wait forever for the peer to answer
+    std::weak_ptr<WebSocketConnection> weakPtr = thisPtr;
+    thisPtr->getLoop()->runAfter(kCloseTimeout, [weakPtr]() {
+      auto connPtr = weakPtr.lock();
+      if (connPtr) connPtr->forceClose();
+    });
+  });
+}
+
+void WebSocketConnection::forceClose() {
+  closing_ = true;
+  tcpConn_->forceClose();
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "NonCopyable.h"
+#include "TcpConnection.h"
+#include "WebSocketCodec.h"
+
+namespace canary {
+
+class WebSocketConnection;
+using WebSocketConnectionPtr = std::shared_ptr<WebSocketConnection>;
+
+// The view is only valid during the callback
+using WebSocketMessageCallback = std::function<void(
+    const WebSocketConnectionPtr &, string_view, WebSocketMessageType)>;
+
+// Called once the handshake is done and once the connection is closed
+using WebSocketConnectionCallback =
+    std::function<void(const WebSocketConnectionPtr &)>;
+
+// Header names are lower-cased
+using WebSocketHeaders = std::unordered_map<std::string, std::string>;
+
+// Return false to refuse the upgrade (403)
+using WebSocketHandshakeCallback =
+    std::function<bool(const std::string &path, const WebSocketHeaders &)>;
+
+// A message serialized once for any number of connections. Every connection
+// sends the same buffers, nothing is copied per connection.
+struct WebSocketSharedFrame {
+  std::shared_ptr<MsgBuffer> plain_;
+  // Compressed without context, for peers that negotiated permessage-deflate
+  std::shared_ptr<MsgBuffer> deflated_;
+
+  static WebSocketSharedFrame make(
+      const char *data, size_t len,
+      WebSocketMessageType type = WebSocketMessageType::Text,
+      bool deflate = false);
+};
+
+// A WebSocket on top of a TcpConnection, created by WebSocketServer and
+// WebSocketClient. send() may be called from any thread.
+class WebSocketConnection
+    : NonCopyable,
+      public std::enable_shared_from_this<WebSocketConnection> {
+ public:
+  WebSocketConnection(const TcpConnectionPtr &conn, WebSocketCodec::Role role,
+                      size_t maxMessageSize);
+
+  void send(const char *msg, size_t len,
+            WebSocketMessageType type = WebSocketMessageType::Text);
+
+  void send(const std::string &msg,
+            WebSocketMessageType type = WebSocketMessageType::Text) {
+    send(msg.data(), msg.length(), type);
+  }
+
+  void send(const WebSocketSharedFrame &frame);
+
+  // Starts the closing handshake
+  void shutdown(uint16_t code = 1000, const std::string &reason = "");
+
+  void forceClose();
+
+  bool connected() const {
+    return upgraded_ && !closing_ && tcpConn_->connected();
+  }
+
+  bool deflateEnabled() const { return deflateEnabled_; }
+
+  const InetAddress &localAddr() const { return tcpConn_->localAddr(); }
+
+  const InetAddress &peerAddr() const { return tcpConn_->peerAddr(); }
+
+  EventLoop *getLoop() const { return tcpConn_->getLoop(); }
+
+  const TcpConnectionPtr &tcpConnection() const { return tcpConn_; }
+
+  const std::string &path() const { return path_; }
+
+  void setContext(const std::shared_ptr<void> &context) {
+    contextPtr_ = context;
+  }
+
+  void setContext(std::shared_ptr<void> &&context) {
+    contextPtr_ = std::move(context);
+  }
+
+  template <typename T>
+  std::shared_ptr<T> getContext() const {
+    return std::static_pointer_cast<T>(contextPtr_);
+  }
+
+  bool hasContext() const { return (bool)contextPtr_; }
+
+  void clearContext() { contextPtr_.reset(); }
+
+ private:
+  friend class WebSocketServer;
+  friend class WebSocketClient;
+
+  enum class HandshakeStatus { kNeedMore = 0, kDone, kFailed };
+
+  // Server side, answers the upgrade request at the front of buffer
+  HandshakeStatus acceptUpgrade(MsgBuffer *buffer, bool deflate, int level,
+                                const WebSocketHandshakeCallback &callback);
+
+  // Client side
+  void sendUpgradeRequest(const std::string &host, const std::string &path,
+                          bool deflate);
+
+  HandshakeStatus checkUpgradeResponse(MsgBuffer *buffer);
+
+  // Decodes frames, answers pings and close frames
+  void onData(MsgBuffer *buffer, const WebSocketMessageCallback &callback);
+
+  void sendInLoop(const char *msg, size_t len, WebSocketMessageType type);
+
+  void sendInLoop(const WebSocketSharedFrame &frame);
+
+  void sendClose(uint16_t code, const std::string &reason);
+
+  TcpConnectionPtr tcpConn_;
+  WebSocketCodec codec_;
+  std::string path_;
+  std::string expectedAccept_;
+  std::atomic<bool> upgraded_{false};
+  std::atomic<bool> closing_{false};
+  std::atomic<bool> deflateEnabled_{false};
+  bool deflateOffered_{false};
+  bool closeSent_{false};
+  std::shared_ptr<void> contextPtr_;
+};
+
+}  // namespace canary
@@ -0,0 +1,79 @@
+#include "WebSocketServer.h"
+
+using namespace canary;
+using namespace std::placeholders;
+
+WebSocketServer::WebSocketServer(EventLoop *loop, const InetAddress &address,
+                                 const std::string &name, bool reUseAddr,
+                                 bool reUsePort)
+    : server_(loop, address, name, reUseAddr, reUsePort) {
+  server_.setConnectionCallback(
+      std::bind(&WebSocketServer::onConnection, this, _1));
+  server_.setRecvMessageCallback(
+      std::bind(&WebSocketServer::onMessage, this, _1, _2));
+}
+
+void WebSocketServer::start() {
+  if (ioLoopNum_ > 0) {
+    for (auto loop : server_.getIoLoops()) connections_[loop];
+  } else {
+    connections_[server_.getLoop()];
+  }
+  server_.start();
+}
+
+void WebSocketServer::onConnection(const TcpConnectionPtr &conn) {
+  if (conn->connected()) {
+    conn->setContext(std::make_shared<WebSocketConnection>(
+        conn, WebSocketCodec::Role::kServer, maxMessageSize_));
+    return;
+  }
+  auto wsConn = conn->getContext<WebSocketConnection>();
+  // The WebSocket holds the TcpConnection, break the cycle
+  conn->clearContext();
+  if (!wsConn || !wsConn->upgraded_) return;
+  wsConn->closing_ = true;
+  auto iter = connections_.find(conn->getLoop());
+  if (iter != connections_.end()) iter->second.erase(wsConn);
+  --connectionCount_;
+  if (connectionCallback_) connectionCallback_(wsConn);
+}
+
+void WebSocketServer::onMessage(const TcpConnectionPtr &conn,
+                                MsgBuffer *buffer) {
+  auto wsConn = conn->getContext<WebSocketConnection>();
+  if (!wsConn) {
+    buffer->retrieveAll();
+    return;
+  }
+  if (!wsConn->upgraded_) {
+    auto status = wsConn->acceptUpgrade(buffer, deflate_, deflateLevel_,
+                                        handshakeCallback_);
+    if (status == WebSocketConnection::HandshakeStatus::kNeedMore) return;
+    if (status == WebSocketConnection::HandshakeStatus::kFailed) {
+      buffer->retrieveAll();
+      return;
+    }
+    auto iter = connections_.find(conn->getLoop());
+    if (iter != connections_.end()) iter->second.insert(wsConn);
+    ++connectionCount_;
+    if (connectionCallback_) connectionCallback_(wsConn);
+    if (buffer->readableBytes() == 0) return;
+  }
+  wsConn->onData(buffer, messageCallback_);
+}
+
+void WebSocketServer::broadcast(const std::string &message,
+                                WebSocketMessageType type) {
+  broadcast(WebSocketSharedFrame::make(message.data(), message.length(), type,
+                                       deflate_));
+}
+
+void WebSocketServer::broadcast(const WebSocketSharedFrame &frame) {
+  for (auto &entry : connections_) {
+    auto connections = &entry.second;
+    entry.first->runInLoop([connections, frame]() {
+      for (auto &wsConn : *connections) wsConn->sendInLoop(frame);
+    });
+  }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "NonCopyable.h"
+#include "TcpServer.h"
+#include "WebSocketConnection.h"
+
+namespace canary {
+
+// Accepts WebSocket upgrades on a TcpServer. Connections are kept per IO
+// loop, so broadcasting a message costs one task per loop no matter how many
+// sockets there are, and every socket sends the same shared frame.
+class WebSocketServer : NonCopyable {
+ public:
+  WebSocketServer(EventLoop *loop, const InetAddress &address,
+                  const std::string &name = "WebSocketServer",
+                  bool reUseAddr = true, bool reUsePort = true);
+
+  void setIoLoopNum(size_t num) {
+    ioLoopNum_ = num;
+    server_.setIoLoopNum(num);
+  }
+
+  void start();
+
+  void stop() { server_.stop(); }
+
+  // Negotiate permessage-deflate with the clients that offer it
+  void enablePerMessageDeflate(bool on = true, int level = -1) {
+    deflate_ = on;
+    deflateLevel_ = level;
+  }
+
+  // Larger messages close the connection with 1009
+  void setMaxMessageSize(size_t size) { maxMessageSize_ = size; }
+
+  void setHandshakeCallback(const WebSocketHandshakeCallback &cb) {
+    handshakeCallback_ = cb;
+  }
+
+  void setHandshakeCallback(WebSocketHandshakeCallback &&cb) {
+    handshakeCallback_ = std::move(cb);
+  }
+
+  void setMessageCallback(const WebSocketMessageCallback &cb) {
+    messageCallback_ = cb;
+  }
+
+  void setMessageCallback(WebSocketMessageCallback &&cb) {
+    messageCallback_ = std::move(cb);
+  }
+
+  void setConnectionCallback(const WebSocketConnectionCallback &cb) {
+    connectionCallback_ = cb;
+  }
+
+  void setConnectionCallback(WebSocketConnectionCallback &&cb) {
+    connectionCallback_ = std::move(cb);
+  }
+
+  // Sends the message to every open connection, it is serialized (and
+  // compressed) only once. May be called from any thread after start().
+  void broadcast(const std::string &message,
+                 WebSocketMessageType type = WebSocketMessageType::Text);
+
+  void broadcast(const WebSocketSharedFrame &frame);
+
+  size_t connectionCount() const { return connectionCount_; }
+
+  const InetAddress &address() const { return server_.address(); }
+
+ private:
+  void onConnection(const TcpConnectionPtr &conn);
+
+  void onMessage(const TcpConnectionPtr &conn, MsgBuffer *buffer);
+
+  TcpServer server_;
+  size_t ioLoopNum_{0};
+  bool deflate_{false};
+  int deflateLevel_{-1};
+  size_t maxMessageSize_{16 * 1024 * 1024};
+  WebSocketHandshakeCallback handshakeCallback_;
+  WebSocketMessageCallback messageCallback_;
+  WebSocketConnectionCallback connectionCallback_;
+  // The keys are fixed by start(), each set is only touched in its loop
+  std::unordered_map<EventLoop *, std::unordered_set<WebSocketConnectionPtr>>
+      connections_;
+  std::atomic<size_t> connectionCount_{0};
+};
+
+}  // namespace canary
@@ -0,0 +1,112 @@
+#include "MysqlClient.h"
+
+using namespace canary;
+
+namespace canary {
+static constexpr double kReconnectDelay{1.0};
+
+static MysqlResultPtr noConnection() {
+  return MysqlResult::newError(kMysqlConnectionError,
+                               "No connection to MySQL server");
+}
+}  // namespace canary
+
+MysqlClientPtr MysqlClient::newMysqlClient(
+    const std::vector<EventLoop *> &loops, const InetAddress &serverAddr,
+    const std::string &user, const std::string &password,
+    const std::string &database, size_t connectionsPerLoop) {
+  return std::make_shared<MysqlClient>(loops, serverAddr, user, password,
+                                       database, connectionsPerLoop);
+}
+
+MysqlClient::MysqlClient(const std::vector<EventLoop *> &loops,
+                         const InetAddress &serverAddr,
+                         const std::string &user, const std::string &password,
+                         const std::string &database,
+                         size_t connectionsPerLoop) {
+  if (connectionsPerLoop == 0) connectionsPerLoop = 1;
+  pool_ = ConnectionPool<MysqlConnection>::newConnectionPool(
+      loops,
+      [serverAddr, user, password, database](EventLoop *loop) {
+        return std::make_shared<MysqlConnection>(loop, serverAddr, user,
+                                                 password, database);
+      },
+      connectionsPerLoop, connectionsPerLoop);
+  pool_->setReconnectDelay(kReconnectDelay);
+}
+
+MysqlClient::~MysqlClient() {
+  // The connections close when they go away
+}
+
+void MysqlClient::query(const std::string &sql, MysqlCallback &&callback) {
+  pool_->get([sql, callback = std::move(callback)](
+                 const MysqlConnectionPtr &connection) mutable {
+    if (!connection) {
+      callback(noConnection());
+      return;
+    }
+    connection->query(sql, std::move(callback));
+  });
+}
+
+std::future<MysqlResultPtr> MysqlClient::query(const std::string &sql) {
+  auto promise = std::make_shared<std::promise<MysqlResultPtr>>();
+  auto future = promise->get_future();
+  query(sql, [promise](const MysqlResultPtr &result) {
+    promise->set_value(result);
+  });
+  return future;
+}
+
+void MysqlClient::execute(const std::string &sql,
+                          std::vector<MysqlParam> params,
+                          MysqlCallback &&callback) {
+  pool_->get([sql, params = std::move(params), callback = std::move(callback)](
+                 const MysqlConnectionPtr &connection) mutable {
+    if (!connection) {
+      callback(noConnection());
+      return;
+    }
+    connection->execute(sql, std::move(params), std::move(callback));
+  });
+}
+
+std::future<MysqlResultPtr> MysqlClient::execute(
+    const std::string &sql, std::vector<MysqlParam> params) {
+  auto promise = std::make_shared<std::promise<MysqlResultPtr>>();
+  auto future = promise->get_future();
+  execute(sql, std::move(params), [promise](const MysqlResultPtr &result) {
+    promise->set_value(result);
+  });
+  return future;
+}
+
+void MysqlClient::executeBatch(const std::string &sql,
+                               std::vector<std::vector<MysqlParam>> paramSets,
+                               MysqlBatchCallback &&callback) {
+  pool_->get([sql, paramSets = std::move(paramSets),
+              callback = std::move(callback)](
+                 const MysqlConnectionPtr &connection) mutable {
+    if (!connection) {
+      callback(std::vector<MysqlResultPtr>(paramSets.size(), noConnection()));
+      return;
+    }
+    connection->executeBatch(sql, std::move(paramSets), std::move(callback));
+  });
+}
+
+void MysqlClient::queryStream(const std::string &sql,
+                              MysqlCallback &&rowsCallback,
+                              MysqlCallback &&doneCallback) {
+  pool_->get([sql, rowsCallback = std::move(rowsCallback),
+              doneCallback = std::move(doneCallback)](
+                 const MysqlConnectionPtr &connection) mutable {
+    if (!connection) {
+      doneCallback(noConnection());
+      return;
+    }
+    connection->queryStream(sql, std::move(rowsCallback),
+                            std::move(doneCallback));
+  });
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ConnectionPool.h"
+#include "MysqlConnection.h"
+
+namespace canary {
+
+class MysqlClient;
+using MysqlClientPtr = std::shared_ptr<MysqlClient>;
+
+// A pool of connections to one MySQL server spread over several loops,
+// e.g. the ones of an EventLoopThreadPool. Each loop has its own
+// connections; a command issued in one of the loops stays there, one issued
+// elsewhere goes to the loops in turn, and then to the open connection of
+// the loop with the fewest results outstanding. A closed connection is
+// replaced after a second. Prepared statements are cached per connection.
+// Callbacks are called in the loop that ran the command.
+class MysqlClient : NonCopyable,
+                    public std::enable_shared_from_this<MysqlClient> {
+ public:
+  static MysqlClientPtr newMysqlClient(const std::vector<EventLoop *> &loops,
+                                       const InetAddress &serverAddr,
+                                       const std::string &user,
+                                       const std::string &password = "",
+                                       const std::string &database = "",
+                                       size_t connectionsPerLoop = 1);
+
+  MysqlClient(const std::vector<EventLoop *> &loops,
+              const InetAddress &serverAddr, const std::string &user,
+              const std::string &password, const std::string &database,
+              size_t connectionsPerLoop);
+
+  ~MysqlClient();
+
+  void query(const std::string &sql, MysqlCallback &&callback);
+
+  // Must not be waited on in the loops
+  std::future<MysqlResultPtr> query(const std::string &sql);
+
+  // A prepared statement, prepared once per connection
+  void execute(const std::string &sql, std::vector<MysqlParam> params,
+               MysqlCallback &&callback);
+
+  // Must not be waited on in the loops
+  std::future<MysqlResultPtr> execute(const std::string &sql,
+                                      std::vector<MysqlParam> params);
+
+  // Runs a prepared statement once for each parameter set, pipelined on
+  // one connection
+  void executeBatch(const std::string &sql,
+                    std::vector<std::vector<MysqlParam>> paramSets,
+                    MysqlBatchCallback &&callback);
+
+  // See MysqlConnection::queryStream()
+  void queryStream(const std::string &sql, MysqlCallback &&rowsCallback,
+                   MysqlCallback &&doneCallback);
+
+  // Connections authenticated and not closed
+  size_t connectionCount() const { return pool_->connectionCount(); }
+
+ private:
+  std::shared_ptr<ConnectionPool<MysqlConnection>> pool_;
+};
+
+}  // namespace canary
@@ -0,0 +1,839 @@
+#include "MysqlConnection.h"
+
+#include <algorithm>
+
+using namespace canary;
+using namespace canary::mysql;
+
+namespace canary {
+static const char kNativePassword[] = "mysql_native_password";
+static const char kCachingSha2Password[] = "caching_sha2_password";
+// caching_sha2_password: the scramble was found in the cache of the
+// server, or the password itself has to be sent
+static constexpr char kFastAuthSuccess{3};
+static constexpr char kFullAuthRequired{4};
+
+static MysqlResultPtr serverLost() {
+  return MysqlResult::newError(kMysqlServerLost,
+                               "Lost connection to MySQL server");
+}
+
+static MysqlResultPtr malformedPacket() {
+  return MysqlResult::newError(kMysqlMalformedPacket, "Malformed packet");
+}
+}  // namespace canary
+
+MysqlConnection::MysqlConnection(EventLoop *loop,
+                                 const InetAddress &serverAddr,
+                                 const std::string &user,
+                                 const std::string &password,
+                                 const std::string &database)
+    : loop_(loop),
+      serverAddr_(serverAddr),
+      user_(user),
+      password_(password),
+      database_(database) {}
+
+MysqlConnection::~MysqlConnection() {
+  // The TcpClient closes the connection when it goes away
+}
+
+void MysqlConnection::connect() {
+  auto thisPtr = shared_from_this();
+  loop_->runInLoop([thisPtr]() { thisPtr->connectInLoop(); });
+}
+
+void MysqlConnection::connectInLoop() {
+  if (status_ != Status::kNone) return;
+  status_ = Status::kConnecting;
+  std::weak_ptr<MysqlConnection> weakPtr = shared_from_this();
+  tcpClient_ =
+      std::make_shared<TcpClient>(loop_, serverAddr_, "MysqlConnection");
+  tcpClient_->setConnectionCallback([weakPtr](const TcpConnectionPtr &conn) {
+    auto thisPtr = weakPtr.lock();
+    if (!thisPtr || thisPtr->closed()) return;
+    if (conn->connected()) {
+      // The server speaks first
+      conn->setTcpNoDelay(true);
+      thisPtr->conn_ = conn;
+    } else {
+      thisPtr->close(serverLost());
+    }
+  });
+  tcpClient_->setMessageCallback(
+      [weakPtr](const TcpConnectionPtr &, MsgBuffer *buffer) {
+        auto thisPtr = weakPtr.lock();
+        if (thisPtr) {
+          thisPtr->onMessage(buffer);
+        } else {
+          buffer->retrieveAll();
+        }
+      });
+  tcpClient_->setConnectionErrorCallback([weakPtr]() {
+    auto thisPtr = weakPtr.lock();
+    if (thisPtr) {
+      thisPtr->close(MysqlResult::newError(
+          kMysqlConnectionError, "Can't connect to MySQL server on " +
+                                     thisPtr->serverAddr_.toIpPort()));
+    }
+  });
+  tcpClient_->connect();
+}
+
+void MysqlConnection::disconnect() {
+  auto thisPtr = shared_from_this();
+  loop_->runInLoop([thisPtr]() {
+    if (thisPtr->status_ == Status::kConnected) {
+      appendCommandPacket(&thisPtr->output_, kComQuit, string_view());
+      thisPtr->flush();
+      // Results on the way are still read
+      thisPtr->tcpClient_->disconnect();
+    } else {
+      thisPtr->close(serverLost());
+    }
+  });
+}
+
+void MysqlConnection::query(const std::string &sql, MysqlCallback &&callback) {
+  sendQuery(sql, Command{kComQuery, std::move(callback), nullptr,
+                         std::string(), nullptr});
+}
+
+void MysqlConnection::queryStream(const std::string &sql,
+                                  MysqlCallback &&rowsCallback,
+                                  MysqlCallback &&doneCallback) {
+  sendQuery(sql, Command{kComQuery, std::move(doneCallback), nullptr,
+                         std::string(), std::move(rowsCallback)});
+}
+
+void MysqlConnection::sendQuery(const std::string &sql, Command &&command) {
+  if (loop_->isInLoopThread()) {
+    if (closed()) {
+      fail(command, closeError_);
+      return;
+    }
+    // Straight into the output buffer
+    appendCommandPacket(&output_, kComQuery, sql);
+    enqueue(std::move(command));
+    return;
+  }
+  MsgBuffer packet;
+  appendCommandPacket(&packet, kComQuery, sql);
+  sendCommand(std::move(packet), std::move(command));
+}
+
+void MysqlConnection::prepare(const std::string &sql,
+                              MysqlPrepareCallback &&callback) {
+  if (loop_->isInLoopThread()) {
+    prepareInLoop(sql, std::move(callback));
+    return;
+  }
+  MsgBuffer packet;
+  appendCommandPacket(&packet, kComStmtPrepare, sql);
+  sendCommand(std::move(packet), Command{kComStmtPrepare, nullptr,
+                                         std::move(callback), sql, nullptr});
+}
+
+void MysqlConnection::prepareInLoop(const std::string &sql,
+                                    MysqlPrepareCallback &&callback) {
+  Command command{kComStmtPrepare, nullptr, std::move(callback), sql,
+                  nullptr};
+  if (closed()) {
+    fail(command, closeError_);
+    return;
+  }
+  appendCommandPacket(&output_, kComStmtPrepare, sql);
+  enqueue(std::move(command));
+}
+
+MysqlResultPtr MysqlConnection::checkExecute(
+    const MysqlStatementPtr &statement,
+    const std::vector<MysqlParam> &params) const {
+  if (!statement || statement->owner_ != this) {
+    return MysqlResult::newError(kMysqlNoPreparedStatement,
+                                 "Statement not prepared on this connection");
+  }
+  if (params.size() != statement->paramCount()) {
+    return MysqlResult::newError(
+        kMysqlParameterCount,
+        "Statement expects " + std::to_string(statement->paramCount()) +
+            " parameters, got " + std::to_string(params.size()));
+  }
+  return nullptr;
+}
+
+void MysqlConnection::execute(const MysqlStatementPtr &statement,
+                              const std::vector<MysqlParam> &params,
+                              MysqlCallback &&callback) {
+  sendExecute(statement, params,
+              Command{kComStmtExecute, std::move(callback), nullptr,
+                      std::string(), nullptr});
+}
+
+void MysqlConnection::executeStream(const MysqlStatementPtr &statement,
+                                    const std::vector<MysqlParam> &params,
+                                    MysqlCallback &&rowsCallback,
+                                    MysqlCallback &&doneCallback) {
+  sendExecute(statement, params,
+              Command{kComStmtExecute, std::move(doneCallback), nullptr,
+                      std::string(), std::move(rowsCallback)});
+}
+
+void MysqlConnection::sendExecute(const MysqlStatementPtr &statement,
+                                  const std::vector<MysqlParam> &params,
+                                  Command &&command) {
+  if (loop_->isInLoopThread()) {
+    executeInLoop(statement, params, std::move(command));
+    return;
+  }
+  auto error = checkExecute(statement, params);
+  if (error) {
+    auto thisPtr = shared_from_this();
+    loop_->queueInLoop([thisPtr, command = std::move(command),
+                        error]() mutable { thisPtr->fail(command, error); });
+    return;
+  }
+  MsgBuffer packet;
+  appendPacket(&packet, statement->executePayload(params), 0);
+  sendCommand(std::move(packet), std::move(command));
+}
+
+void MysqlConnection::executeInLoop(const MysqlStatementPtr &statement,
+                                    const std::vector<MysqlParam> &params,
+                                    Command &&command) {
+  auto error = closed() ? closeError_ : checkExecute(statement, params);
+  if (error) {
+    fail(command, error);
+    return;
+  }
+  appendPacket(&output_, statement->executePayload(params), 0);
+  enqueue(std::move(command));
+}
+
+void MysqlConnection::execute(const std::string &sql,
+                              std::vector<MysqlParam> params,
+                              MysqlCallback &&callback) {
+  auto thisPtr = shared_from_this();
+  auto run = [thisPtr, sql, params = std::move(params),
+              callback = std::move(callback)]() mutable {
+    thisPtr->prepareCached(
+        sql, [thisPtr, params = std::move(params),
+              callback = std::move(callback)](
+                 const MysqlResultPtr &result,
+                 const MysqlStatementPtr &statement) mutable {
+          if (!statement) {
+            if (callback) callback(result);
+            return;
+          }
+          thisPtr->executeInLoop(statement, params,
+                                 Command{kComStmtExecute, std::move(callback),
+                                         nullptr, std::string(), nullptr});
+        });
+  };
+  if (loop_->isInLoopThread()) {
+    run();
+  } else {
+    loop_->queueInLoop(std::move(run));
+  }
+}
+
+void MysqlConnection::executeBatch(
+    const MysqlStatementPtr &statement,
+    std::vector<std::vector<MysqlParam>> paramSets,
+    MysqlBatchCallback &&callback) {
+  if (loop_->isInLoopThread()) {
+    executeBatchInLoop(statement, paramSets, std::move(callback));
+    return;
+  }
+  auto thisPtr = shared_from_this();
+  loop_->queueInLoop([thisPtr, statement, paramSets = std::move(paramSets),
+                      callback = std::move(callback)]() mutable {
+    thisPtr->executeBatchInLoop(statement, paramSets, std::move(callback));
+  });
+}
+
+void MysqlConnection::executeBatch(
+    const std::string &sql, std::vector<std::vector<MysqlParam>> paramSets,
+    MysqlBatchCallback &&callback) {
+  auto thisPtr = shared_from_this();
+  auto run = [thisPtr, sql, paramSets = std::move(paramSets),
+              callback = std::move(callback)]() mutable {
+    thisPtr->prepareCached(
+        sql, [thisPtr, paramSets = std::move(paramSets),
+              callback = std::move(callback)](
+                 const MysqlResultPtr &result,
+                 const MysqlStatementPtr &statement) mutable {
+          if (!statement) {
+            if (callback) {
+              callback(std::vector<MysqlResultPtr>(paramSets.size(), result));
+            }
+            return;
+          }
+          thisPtr->executeBatchInLoop(statement, paramSets,
+                                      std::move(callback));
+        });
+  };
+  if (loop_->isInLoopThread()) {
+    run();
+  } else {
+    loop_->queueInLoop(std::move(run));
+  }
+}
+
+void MysqlConnection::executeBatchInLoop(
+    const MysqlStatementPtr &statement,
+    const std::vector<std::vector<MysqlParam>> &paramSets,
+    MysqlBatchCallback &&callback) {
+  struct Gathered {
+    std::vector<MysqlResultPtr> results_;
+    size_t left_;
+    MysqlBatchCallback callback_;
+  };
+  if (paramSets.empty()) {
+    if (callback) callback(std::vector<MysqlResultPtr>());
+    return;
+  }
+  auto gathered = std::make_shared<Gathered>();
+  gathered->results_.resize(paramSets.size());
+  gathered->left_ = paramSets.size();
+  gathered->callback_ = std::move(callback);
+  // The executions queue up in output_ and are flushed together
+  for (size_t i = 0; i < paramSets.size(); ++i) {
+    executeInLoop(
+        statement, paramSets[i],
+        Command{kComStmtExecute,
+                [gathered, i](const MysqlResultPtr &result) {
+                  gathered->results_[i] = result;
+                  if (--gathered->left_ == 0 && gathered->callback_) {
+                    gathered->callback_(gathered->results_);
+                  }
+                },
+                nullptr, std::string(), nullptr});
+  }
+}
+
+void MysqlConnection::prepareCached(const std::string &sql,
+                                    MysqlPrepareCallback &&callback) {
+  auto &cached = statements_[sql];
+  if (cached.statement_) {
+    callback(nullptr, cached.statement_);
+    return;
+  }
+  cached.waiting_.push_back(std::move(callback));
+  // Already being prepared
+  if (cached.waiting_.size() > 1) return;
+  std::weak_ptr<MysqlConnection> weakPtr = shared_from_this();
+  prepareInLoop(sql, [weakPtr, sql](const MysqlResultPtr &result,
+                                    const MysqlStatementPtr &statement) {
+    auto thisPtr = weakPtr.lock();
+    if (!thisPtr) return;
+    auto iter = thisPtr->statements_.find(sql);
+    if (iter == thisPtr->statements_.end()) return;
+    auto waiting = std::move(iter->second.waiting_);
+    iter->second.waiting_.clear();
+    if (statement) {
+      iter->second.statement_ = statement;
+    } else {
+      thisPtr->statements_.erase(iter);
+    }
+    for (auto &use : waiting) use(result, statement);
+  });
+}
+
+void MysqlConnection::closeStatement(const MysqlStatementPtr &statement) {
+  if (!statement || statement->owner_ != this) return;
+  auto thisPtr = shared_from_this();
+  auto id = statement->id();
+  auto sql = statement->sql();
+  loop_->runInLoop([thisPtr, id, sql]() {
+    auto iter = thisPtr->statements_.find(sql);
+    if (iter != thisPtr->statements_.end() && iter->second.statement_ &&
+        iter->second.statement_->id() == id) {
+      thisPtr->statements_.erase(iter);
+    }
+    if (thisPtr->closed()) return;
+    std::string payload(1, static_cast<char>(kComStmtClose));
+    appendInt(&payload, id, 4);
+    appendPacket(&thisPtr->output_, payload, 0);
+    if (!thisPtr->flushQueued_ && thisPtr->status_ == Status::kConnected) {
+      thisPtr->flushQueued_ = true;
+      thisPtr->loop_->queueInLoop([thisPtr]() { thisPtr->flush(); });
+    }
+  });
+}
+
+void MysqlConnection::sendCommand(MsgBuffer &&packet, Command &&command) {
+  auto thisPtr = shared_from_this();
+  loop_->runInLoop([thisPtr, packet = std::move(packet),
+                    command = std::move(command)]() mutable {
+    if (thisPtr->closed()) {
+      thisPtr->fail(command, thisPtr->closeError_);
+      return;
+    }
+    thisPtr->output_.append(packet);
+    thisPtr->enqueue(std::move(command));
+  });
+}
+
+void MysqlConnection::enqueue(Command &&command) {
+  commands_.push_back(std::move(command));
+  ++outstanding_;
+  // Everything issued until the functors queued in this iteration of the
+  // loop have run goes out in one write.
+  if (!flushQueued_ && status_ == Status::kConnected) {
+    flushQueued_ = true;
+    auto thisPtr = shared_from_this();
+    loop_->queueInLoop([thisPtr]() { thisPtr->flush(); });
+  }
+}
+
+void MysqlConnection::flush() {
+  flushQueued_ = false;
+  if (!conn_ || output_.readableBytes() == 0) return;
+  MsgBuffer output;
+  output.swap(output_);
+  conn_->send(std::move(output));
+}
+
+void MysqlConnection::fail(Command &command, const MysqlResultPtr &error) {
+  if (command.prepareCallback_) {
+    command.prepareCallback_(error, nullptr);
+  } else if (command.callback_) {
+    command.callback_(error);
+  }
+}
+
+bool MysqlConnection::nextPacket(MsgBuffer *buffer, string_view *payload,
+                                 bool *joined) {
+  // Packets of kMaxPacketLength bytes are continued by the next one
+  size_t offset = scanned_;
+  size_t parts = 0;
+  size_t len = 0;
+  uint8_t seq = 0;
+  do {
+    if (buffer->readableBytes() < offset + 4) return false;
+    auto header = reinterpret_cast<const uint8_t *>(buffer->peek() + offset);
+    len = header[0] | (header[1] << 8) | (header[2] << 16);
+    seq = header[3];
+    if (buffer->readableBytes() < offset + 4 + len) return false;
+    offset += 4 + len;
+    ++parts;
+  } while (len == kMaxPacketLength);
+
+  if (parts == 1) {
+    *payload = string_view(buffer->peek() + scanned_ + 4, len);
+    *joined = false;
+  } else {
+    largePayload_.clear();
+    for (auto p = scanned_; p < offset; p += 4 + kMaxPacketLength) {
+      largePayload_.append(buffer->peek() + p + 4,
+                           std::min(kMaxPacketLength, offset - p - 4));
+    }
+    *payload = largePayload_;
+    *joined = true;
+  }
+  scanned_ = offset;
+  seq_ = seq + 1;
+  return true;
+}
+
+void MysqlConnection::onMessage(MsgBuffer *buffer) {
+  // A callback may drop the last reference to this connection
+  auto thisPtr = shared_from_this();
+  string_view payload;
+  bool joined = false;
+  while (!closed() && nextPacket(buffer, &payload, &joined)) {
+    if (state_ == ReadState::kHandshake || state_ == ReadState::kAuth) {
+      onAuthPacket(payload);
+      if (closed()) return;
+      buffer->retrieve(scanned_);
+      scanned_ = 0;
+      continue;
+    }
+    if (commands_.empty() || !onResponsePacket(buffer, payload, joined)) {
+      buffer->retrieveAll();
+      close(malformedPacket());
+      return;
+    }
+  }
+  if (!closed() && state_ == ReadState::kRows &&
+      commands_.front().rowsCallback_ && !result_->rows_.empty()) {
+    emitRows(buffer);
+  }
+}
+
+void MysqlConnection::onAuthPacket(string_view payload) {
+  PayloadReader reader(payload);
+  auto first = reader.readInt1();
+  if (first == kErrPacket) {
+    auto error = std::make_shared<MysqlResult>();
+    error->setError(payload);
+    close(error);
+    return;
+  }
+
+  if (state_ == ReadState::kHandshake) {
+    // Protocol::HandshakeV10, first is the protocol version
+    reader.readNullTerminated();  // server version
+    reader.readInt4();            // connection id
+    nonce_ = std::string(reader.readBytes(8));
+    reader.skip(1);
+    uint32_t capabilities = reader.readInt2();
+    plugin_ = kNativePassword;
+    if (!reader.atEnd()) {
+      reader.readInt1();  // character set
+      reader.readInt2();  // status flags
+      capabilities |= uint32_t(reader.readInt2()) << 16;
+      size_t nonceLength = reader.readInt1();
+      reader.skip(10);
+      if (capabilities & kClientSecureConnection) {
+        auto rest = nonceLength > 8 ? nonceLength - 8 : 0;
+        nonce_.append(reader.readBytes(std::max<size_t>(13, rest)).data(),
+                      std::max<size_t>(13, rest));
+      }
+      if ((capabilities & kClientPluginAuth) && !reader.atEnd()) {
+        // Some servers leave out the terminating zero
+        auto rest = reader.readRest();
+        plugin_ = std::string(rest.substr(0, rest.find('\0')));
+      }
+    }
+    if (!reader.ok() || first != 10 || !(capabilities & kClientProtocol41) ||
+        !(capabilities & kClientSecureConnection)) {
+      close(malformedPacket());
+      return;
+    }
+    if (!nonce_.empty() && nonce_.back() == '\0') nonce_.pop_back();
+    capabilities_ = capabilities &
+                    (kClientLongPassword | kClientLongFlag | kClientProtocol41 |
+                     kClientTransactions | kClientSecureConnection |
+                     kClientPluginAuth | kClientPluginAuthLenencData |
+                     (database_.empty() ? 0 : kClientConnectWithDb));
+    state_ = ReadState::kAuth;
+    sendAuthResponse(plugin_, false);
+    return;
+  }
+
+  if (first == kOkPacket) {
+    state_ = ReadState::kFirst;
+    status_ = Status::kConnected;
+    flush();
+    if (connectionCallback_) connectionCallback_(shared_from_this());
+    return;
+  }
+  if (first == kEofPacket) {
+    // Auth switch request: another plugin with a new nonce
+    auto rest = reader.readRest();
+    auto zero = rest.find('\0');
+    if (zero == string_view::npos) {
+      close(MysqlResult::newError(kMysqlAuthPluginError,
+                                  "The old password authentication is not "
+                                  "supported"));
+      return;
+    }
+    plugin_ = std::string(rest.substr(0, zero));
+    nonce_ = std::string(rest.substr(zero + 1));
+    if (!nonce_.empty() && nonce_.back() == '\0') nonce_.pop_back();
+    sendAuthResponse(plugin_, true);
+    return;
+  }
+  if (first == kAuthMoreData && plugin_ == kCachingSha2Password &&
+      reader.remaining() > 0) {
+    auto rest = reader.readRest();
+    if (keyRequested_) {
+      // The public key of the server
+      keyRequested_ = false;
+      sendEncryptedPassword(rest);
+      return;
+    }
+    // The OK packet follows a fast authentication
+    if (rest[0] == kFastAuthSuccess) return;
+    if (rest[0] == kFullAuthRequired) {
+      if (!serverKey_.empty()) {
+        sendEncryptedPassword(serverKey_);
+        return;
+      }
+      keyRequested_ = true;
+      MsgBuffer packet;
+      appendPacket(&packet, std::string(1, kRequestPublicKey), seq_);
+      conn_->send(std::move(packet));
+      return;
+    }
+  }
+  close(malformedPacket());
+}
+
+void MysqlConnection::sendEncryptedPassword(string_view pemKey) {
+  auto encrypted = rsaEncryptPassword(password_, nonce_, pemKey);
+  if (encrypted.empty()) {
+    close(MysqlResult::newError(kMysqlAuthPluginError,
+                                "Cannot encrypt the password with the "
+                                "public key of the server"));
+    return;
+  }
+  MsgBuffer packet;
+  appendPacket(&packet, encrypted, seq_);
+  conn_->send(std::move(packet));
+}
+
+void MysqlConnection::sendAuthResponse(const std::string &plugin,
+                                       bool switched) {
+  std::string scramble;
+  if (plugin == kNativePassword) {
+    scramble = nativePasswordScramble(password_, nonce_);
+  } else if (plugin == kCachingSha2Password) {
+    scramble = cachingSha2Scramble(password_, nonce_);
+  } else {
+    close(MysqlResult::newError(kMysqlAuthPluginError,
+                                "Authentication plugin '" + plugin +
+                                    "' is not supported"));
+    return;
+  }
+
+  std::string payload;
+  if (switched) {
+    // The answer to an auth switch request is the bare scramble
+    payload = std::move(scramble);
+  } else {
+    // Protocol::HandshakeResponse41
+    appendInt(&payload, capabilities_, 4);
+    appendInt(&payload, kMaxPacketLength, 4);
+    payload.push_back(static_cast<char>(kUtf8mb4GeneralCi));
+    payload.append(23, '\0');
+    payload.append(user_);
+    payload.push_back('\0');
+    if (capabilities_ & kClientPluginAuthLenencData) {
+      appendLenencString(&payload, scramble);
+    } else {
+      payload.push_back(static_cast<char>(scramble.size()));
+      payload.append(scramble);
+    }
+    if (capabilities_ & kClientConnectWithDb) {
+      payload.append(database_);
+      payload.push_back('\0');
+    }
+    if (capabilities_ & kClientPluginAuth) {
+      payload.append(plugin);
+      payload.push_back('\0');
+    }
+  }
+  MsgBuffer packet;
+  appendPacket(&packet, payload, seq_);
+  conn_->send(std::move(packet));
+}
+
+bool MysqlConnection::onResponsePacket(MsgBuffer *buffer, string_view payload,
+                                       bool joined) {
+  auto &command = commands_.front();
+  PayloadReader reader(payload);
+  auto first = reader.readInt1();
+  switch (state_) {
+    case ReadState::kFirst:
+      result_ = std::make_shared<MysqlResult>();
+      if (first == kErrPacket) {
+        result_->setError(payload);
+        complete(buffer);
+      } else if (first == kOkPacket && command.type_ == kComStmtPrepare) {
+        // COM_STMT_PREPARE_OK
+        auto id = reader.readInt4();
+        columnsLeft_ = reader.readInt2();
+        paramsLeft_ = reader.readInt2();
+        if (!reader.ok()) return false;
+        statement_ = std::make_shared<MysqlStatement>(this, id, command.sql_);
+        statement_->paramCount_ = paramsLeft_;
+        if (paramsLeft_ > 0) {
+          state_ = ReadState::kParams;
+        } else if (columnsLeft_ > 0) {
+          state_ = ReadState::kPrepareColumns;
+        } else {
+          complete(buffer);
+        }
+      } else if (first == kOkPacket) {
+        result_->setOk(payload);
+        complete(buffer);
+      } else {
+        PayloadReader count(payload);
+        columnsLeft_ = count.readLenenc();
+        // 0 columns would be a LOCAL INFILE request, never asked for
+        if (!count.ok() || columnsLeft_ == 0) return false;
+        result_->binary_ = command.type_ == kComStmtExecute;
+        result_->columns_->reserve(columnsLeft_);
+        state_ = ReadState::kColumns;
+      }
+      return true;
+
+    case ReadState::kParams:
+      // The definitions, then an EOF packet
+      if (paramsLeft_ > 0) {
+        --paramsLeft_;
+      } else if (columnsLeft_ > 0) {
+        state_ = ReadState::kPrepareColumns;
+      } else {
+        complete(buffer);
+      }
+      return true;
+
+    case ReadState::kPrepareColumns:
+      if (columnsLeft_ > 0) {
+        --columnsLeft_;
+        return result_->addColumn(payload);
+      }
+      complete(buffer);
+      return true;
+
+    case ReadState::kColumns:
+      if (columnsLeft_ > 0) {
+        --columnsLeft_;
+        return result_->addColumn(payload);
+      }
+      if (first != kEofPacket) return false;
+      state_ = ReadState::kRows;
+      return true;
+
+    case ReadState::kRows:
+      if (first == kEofPacket && payload.size() < 9) {
+        auto warnings = reader.readInt2();
+        auto status = reader.readInt2();
+        // The last batch, then the final result alone
+        if (command.rowsCallback_ && !result_->rows_.empty()) {
+          emitRows(buffer);
+          if (closed()) return true;
+        }
+        result_->warnings_ = warnings;
+        result_->status_ = status;
+        complete(buffer);
+      } else if (first == kErrPacket) {
+        // The query failed after sending some rows
+        result_->setError(payload);
+        result_->rows_.clear();
+        complete(buffer);
+      } else if (joined) {
+        result_->large_.push_back(std::move(largePayload_));
+        largePayload_.clear();
+        result_->rows_.push_back({0, 0, &result_->large_.back()});
+      } else {
+        result_->rows_.push_back(
+            {static_cast<size_t>(payload.data() - buffer->peek()),
+             payload.size(), nullptr});
+      }
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+void MysqlConnection::takeRows(MsgBuffer *buffer, MysqlResult *result) {
+  // The rows point into the first scanned_ bytes of the buffer, which are
+  // handed over to the result. The buffer itself is given away when what
+  // follows the response is shorter than the response.
+  auto used = scanned_;
+  scanned_ = 0;
+  MsgBuffer data;
+  auto rest = buffer->readableBytes() - used;
+  if (rest < used) {
+    data.swap(*buffer);
+    buffer->append(data.peek() + used, rest);
+    data.unwrite(rest);
+  } else {
+    data.append(buffer->peek(), used);
+    buffer->retrieve(used);
+  }
+  result->setData(std::move(data));
+}
+
+void MysqlConnection::emitRows(MsgBuffer *buffer) {
+  auto batch = std::move(result_);
+  result_ = std::make_shared<MysqlResult>();
+  result_->binary_ = batch->binary_;
+  result_->columns_ = batch->columns_;
+  takeRows(buffer, batch.get());
+
+  // The batch gives its bytes back to the backlog when it goes away,
+  // possibly in another thread
+  auto bytes = batch->dataBytes();
+  auto low = maxBacklog_ / 2;
+  backlog_->bytes_ += bytes;
+  std::weak_ptr<MysqlConnection> weakPtr = shared_from_this();
+  auto backlog = backlog_;
+  batch->releaseGuard_ = std::shared_ptr<void>(
+      nullptr, [weakPtr, backlog, bytes, low](void *) {
+        auto left = backlog->bytes_ -= bytes;
+        if (!backlog->paused_ || left > low) return;
+        auto thisPtr = weakPtr.lock();
+        if (thisPtr) {
+          thisPtr->loop_->queueInLoop(
+              [thisPtr]() { thisPtr->resumeReading(); });
+        }
+      });
+
+  auto rowsCallback = commands_.front().rowsCallback_;
+  rowsCallback(batch);
+  batch.reset();
+  if (closed() || backlog_->bytes_ <= maxBacklog_ || backlog_->paused_) {
+    return;
+  }
+  backlog_->paused_ = true;
+  conn_->stopRecv();
+  // Released before paused_ was set
+  if (backlog_->bytes_ <= low) resumeReading();
+}
+
+void MysqlConnection::resumeReading() {
+  if (!backlog_->paused_ || backlog_->bytes_ > maxBacklog_ / 2) return;
+  backlog_->paused_ = false;
+  if (!closed() && conn_) conn_->startRecv();
+}
+
+void MysqlConnection::complete(MsgBuffer *buffer) {
+  auto command = std::move(commands_.front());
+  commands_.pop_front();
+  --outstanding_;
+  state_ = ReadState::kFirst;
+  auto result = std::move(result_);
+  auto statement = std::move(statement_);
+  result_.reset();
+  statement_.reset();
+
+  if (!result->rows_.empty()) {
+    takeRows(buffer, result.get());
+  } else {
+    buffer->retrieve(scanned_);
+    scanned_ = 0;
+  }
+
+  if (command.type_ == kComStmtPrepare) {
+    if (statement) statement->columns_ = std::move(*result->columns_);
+    result->columns_->clear();
+    if (command.prepareCallback_) {
+      command.prepareCallback_(result, result->ok() ? statement : nullptr);
+    }
+  } else if (command.callback_) {
+    command.callback_(result);
+  }
+}
+
+void MysqlConnection::close(const MysqlResultPtr &error) {
+  if (closed()) return;
+  status_ = Status::kClosed;
+  closeError_ = error;
+  auto thisPtr = shared_from_this();
+  auto commands = std::move(commands_);
+  commands_.clear();
+  outstanding_ = 0;
+  output_.retrieveAll();
+  result_.reset();
+  statement_.reset();
+  if (conn_) {
+    conn_->forceClose();
+    // The socket is closed with the TcpConnection
+    conn_.reset();
+  }
+  // We may be inside a callback of the TcpClient, destroy it later
+  if (tcpClient_) {
+    loop_->queueInLoop([tcpClient = std::move(tcpClient_)]() {});
+  }
+  // The statements being prepared fail their waiting executions
+  for (auto &command : commands) fail(command, error);
+  statements_.clear();
+  if (connectionCallback_) connectionCallback_(thisPtr);
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "MysqlResult.h"
+#include "MysqlStatement.h"
+#include "NonCopyable.h"
+#include "TcpClient.h"
+
+namespace canary {
+
+// The result is never null, check ok() on it
+using MysqlCallback = std::function<void(const MysqlResultPtr &)>;
+
+// The statement is null when the result is an error
+using MysqlPrepareCallback =
+    std::function<void(const MysqlResultPtr &, const MysqlStatementPtr &)>;
+
+// The results of a batch, one per parameter set and in the same order
+using MysqlBatchCallback =
+    std::function<void(const std::vector<MysqlResultPtr> &)>;
+
+class MysqlConnection;
+using MysqlConnectionPtr = std::shared_ptr<MysqlConnection>;
+
+// One non-blocking connection to a MySQL server speaking the wire protocol
+// directly. Authenticates with mysql_native_password or
+// caching_sha2_password, runs text queries (COM_QUERY) and prepared
+// statements with the binary protocol. There is no TLS: when
+// caching_sha2_password needs the password itself, it is encrypted with the
+// RSA public key of the server, asked for unless set with
+// setServerPublicKey(). Commands are pipelined: they may be
+// issued before the connection is up, everything issued during one
+// iteration of the loop goes out in one write and the results come back in
+// order. Commands may be issued from any thread, callbacks are called in
+// the loop of the connection. Must be created with std::make_shared.
+//
+// A result set too large to be kept whole can be streamed: its rows are
+// handed over in batches as they are read, and reading stops while the
+// batches not yet released add up to more than the stream backlog.
+class MysqlConnection : NonCopyable,
+                        public std::enable_shared_from_this<MysqlConnection> {
+ public:
+  enum class Status { kNone = 0, kConnecting, kConnected, kClosed };
+
+  MysqlConnection(EventLoop *loop, const InetAddress &serverAddr,
+                  const std::string &user, const std::string &password = "",
+                  const std::string &database = "");
+
+  ~MysqlConnection();
+
+  void connect();
+
+  // Sends COM_QUIT after the commands issued so far
+  void disconnect();
+
+  Status status() const { return status_; }
+
+  bool closed() const { return status_ == Status::kClosed; }
+
+  // Commands waiting for their result
+  size_t outstanding() const { return outstanding_; }
+
+  EventLoop *getLoop() const { return loop_; }
+
+  // A text protocol query, every value of the rows is text
+  void query(const std::string &sql, MysqlCallback &&callback);
+
+  void prepare(const std::string &sql, MysqlPrepareCallback &&callback);
+
+  // Runs a statement prepared on this connection
+  void execute(const MysqlStatementPtr &statement,
+               const std::vector<MysqlParam> &params,
+               MysqlCallback &&callback);
+
+  // Prepares sql the first time it is used on this connection and keeps
+  // the statement. Until the statement is prepared its executions wait, so
+  // they may run after commands issued later.
+  void execute(const std::string &sql, std::vector<MysqlParam> params,
+               MysqlCallback &&callback);
+
+  // Runs statement once for each parameter set, all of them in one write
+  void executeBatch(const MysqlStatementPtr &statement,
+                    std::vector<std::vector<MysqlParam>> paramSets,
+                    MysqlBatchCallback &&callback);
+
+  // The same with a statement prepared and kept like execute(sql) does
+  void executeBatch(const std::string &sql,
+                    std::vector<std::vector<MysqlParam>> paramSets,
+                    MysqlBatchCallback &&callback);
+
+  // rowsCallback gets the rows in batches as they arrive, each batch owns
+  // its rows and may be kept, also in another thread. doneCallback gets the
+  // final result without rows, or the error that ended the result set.
+  void queryStream(const std::string &sql, MysqlCallback &&rowsCallback,
+                   MysqlCallback &&doneCallback);
+
+  void executeStream(const MysqlStatementPtr &statement,
+                     const std::vector<MysqlParam> &params,
+                     MysqlCallback &&rowsCallback,
+                     MysqlCallback &&doneCallback);
+
+  // The bytes of streamed batches kept before reading stops, 8MB by
+  // default. Reading resumes once half of them are released.
+  void setMaxStreamBacklog(size_t bytes) { maxBacklog_ = bytes; }
+
+  // The PEM RSA public key of the server for caching_sha2_password, e.g.
+  // its public_key.pem, set before connect(). Without it the key is asked
+  // for, which trusts the network not to swap it.
+  void setServerPublicKey(const std::string &pem) { serverKey_ = pem; }
+
+  // The server sends no reply to COM_STMT_CLOSE
+  void closeStatement(const MysqlStatementPtr &statement);
+
+  // Called once the connection is authenticated and once it is closed
+  void setConnectionCallback(
+      const std::function<void(const MysqlConnectionPtr &)> &cb) {
+    connectionCallback_ = cb;
+  }
+
+ private:
+  enum class ReadState {
+    kHandshake,
+    kAuth,
+    kFirst,           // the first packet of a response
+    kParams,          // parameter definitions of a prepared statement
+    kPrepareColumns,  // column definitions of a prepared statement
+    kColumns,
+    kRows
+  };
+
+  struct Command {
+    uint8_t type_;
+    MysqlCallback callback_;
+    MysqlPrepareCallback prepareCallback_;
+    std::string sql_;
+    // Set when the rows are streamed, callback_ gets the final result
+    MysqlCallback rowsCallback_;
+  };
+
+  struct CachedStatement {
+    MysqlStatementPtr statement_;
+    // Uses issued while the statement is being prepared
+    std::vector<MysqlPrepareCallback> waiting_;
+  };
+
+  // The streamed rows not released yet, shared with the batches
+  struct Backlog {
+    std::atomic<size_t> bytes_{0};
+    std::atomic<bool> paused_{false};
+  };
+
+  void connectInLoop();
+
+  void prepareInLoop(const std::string &sql, MysqlPrepareCallback &&callback);
+
+  void sendQuery(const std::string &sql, Command &&command);
+
+  void sendExecute(const MysqlStatementPtr &statement,
+                   const std::vector<MysqlParam> &params, Command &&command);
+
+  void executeInLoop(const MysqlStatementPtr &statement,
+                     const std::vector<MysqlParam> &params,
+                     Command &&command);
+
+  void executeBatchInLoop(const MysqlStatementPtr &statement,
+                          const std::vector<std::vector<MysqlParam>> &paramSets,
+                          MysqlBatchCallback &&callback);
+
+  // Calls callback with the statement of sql, preparing it the first time.
+  // The result is null when the statement was prepared already.
+  void prepareCached(const std::string &sql, MysqlPrepareCallback &&callback);
+
+  // Null if statement can be executed with params
+  MysqlResultPtr checkExecute(const MysqlStatementPtr &statement,
+                              const std::vector<MysqlParam> &params) const;
+
+  void sendCommand(MsgBuffer &&packet, Command &&command);
+
+  // The command is in output_ already
+  void enqueue(Command &&command);
+
+  void flush();
+
+  void fail(Command &command, const MysqlResultPtr &error);
+
+  void onMessage(MsgBuffer *buffer);
+
+  // Finds the next whole payload after scanned_, joining a payload split
+  // over several packets into largePayload_
+  bool nextPacket(MsgBuffer *buffer, string_view *payload, bool *joined);
+
+  void onAuthPacket(string_view payload);
+
+  // switched: the answer to an auth switch request
+  void sendAuthResponse(const std::string &plugin, bool switched);
+
+  // The full caching_sha2_password authentication
+  void sendEncryptedPassword(string_view pemKey);
+
+  // Returns false on a malformed packet
+  bool onResponsePacket(MsgBuffer *buffer, string_view payload, bool joined);
+
+  // Moves the bytes of the rows read so far from buffer into result
+  void takeRows(MsgBuffer *buffer, MysqlResult *result);
+
+  // Hands the rows read so far to the streaming command
+  void emitRows(MsgBuffer *buffer);
+
+  // Starts reading again once enough streamed rows are released
+  void resumeReading();
+
+  // The response of the first command is complete
+  void complete(MsgBuffer *buffer);
+
+  // Fails every command waiting for a result
+  void close(const MysqlResultPtr &error);
+
+  EventLoop *loop_;
+  const InetAddress serverAddr_;
+  const std::string user_;
+  const std::string password_;
+  const std::string database_;
+  std::shared_ptr<TcpClient> tcpClient_;
+  TcpConnectionPtr conn_;
+  std::atomic<Status> status_{Status::kNone};
+  std::atomic<size_t> outstanding_{0};
+  std::function<void(const MysqlConnectionPtr &)> connectionCallback_;
+
+  // Only touched in the loop
+  MsgBuffer output_;
+  bool flushQueued_{false};
+  std::deque<Command> commands_;
+  std::unordered_map<std::string, CachedStatement> statements_;
+  // What the commands issued after the close get
+  MysqlResultPtr closeError_;
+
+  // The state of the response being read
+  ReadState state_{ReadState::kHandshake};
+  uint8_t seq_{0};
+  std::string nonce_;
+  std::string plugin_;
+  std::string serverKey_;
+  bool keyRequested_{false};
+  uint32_t capabilities_{0};
+  MysqlResultPtr result_;
+  MysqlStatementPtr statement_;
+  uint64_t paramsLeft_{0};
+  uint64_t columnsLeft_{0};
+  // The bytes of the buffer that belong to the current response
+  size_t scanned_{0};
+  std::string largePayload_;
+
+  std::shared_ptr<Backlog> backlog_{std::make_shared<Backlog>()};
+  std::atomic<size_t> maxBacklog_{8 * 1024 * 1024};
+};
+
+}  // namespace canary
@@ -0,0 +1,376 @@
+#include "MysqlProtocol.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "Sha1.h"
+#include "Sha256.h"
+#include "Utility.h"
+
+using namespace canary;
+using namespace canary::mysql;
+
+namespace canary {
+template <typename Hash>
+static std::string scramble(string_view password, string_view nonce,
+                            bool nonceFirst) {
+  if (password.empty()) return std::string();
+  auto stage1 = Hash::digest(password.data(), password.size());
+  auto stage2 = Hash::digest(stage1.data(), stage1.size());
+  Hash hash;
+  if (nonceFirst) hash.update(nonce.data(), nonce.size());
+  hash.update(stage2.data(), stage2.size());
+  if (!nonceFirst) hash.update(nonce.data(), nonce.size());
+  std::string result(Hash::kDigestLength, '\0');
+  hash.final(reinterpret_cast<unsigned char *>(&result[0]));
+  for (size_t i = 0; i < result.size(); ++i) result[i] ^= stage1[i];
+  return result;
+}
+
+// Little endian 32 bit limbs
+using Limbs = std::vector<uint32_t>;
+
+static Limbs toLimbs(string_view bytes, size_t count) {
+  Limbs limbs(count, 0);
+  for (size_t i = 0; i < bytes.size() && i / 4 < count; ++i) {
+    auto byte = static_cast<uint8_t>(bytes[bytes.size() - 1 - i]);
+    limbs[i / 4] |= uint32_t(byte) << (8 * (i % 4));
+  }
+  return limbs;
+}
+
+static bool lessThan(const Limbs &a, const Limbs &b) {
+  for (size_t i = a.size(); i-- > 0;) {
+    if (a[i] != b[i]) return a[i] < b[i];
+  }
+  return false;
+}
+
+// a -= b, modulo 2^(32 * size)
+static void subtract(Limbs *a, const Limbs &b) {
+  uint64_t borrow = 0;
+  for (size_t i = 0; i < a->size(); ++i) {
+    uint64_t d = uint64_t((*a)[i]) - b[i] - borrow;
+    (*a)[i] = static_cast<uint32_t>(d);
+    borrow = (d >> 32) & 1;
+  }
+}
+
+// Montgomery multiplication: a * b / 2^(32 * size) mod n, with
+// nInv = -1 / n mod 2^32
+static Limbs montMul(const Limbs &a, const Limbs &b, const Limbs &n,
+                     uint32_t nInv) {
+  size_t k = n.size();
+  Limbs t(k + 2, 0);
+  for (size_t i = 0; i < k; ++i) {
+    uint64_t c = 0;
+    for (size_t j = 0; j < k; ++j) {
+      uint64_t s = t[j] + uint64_t(a[j]) * b[i] + c;
+      t[j] = static_cast<uint32_t>(s);
+      c = s >> 32;
+    }
+    uint64_t s = t[k] + c;
+    t[k] = static_cast<uint32_t>(s);
+    t[k + 1] = static_cast<uint32_t>(s >> 32);
+    uint32_t m = t[0] * nInv;
+    c = (t[0] + uint64_t(m) * n[0]) >> 32;
+    for (size_t j = 1; j < k; ++j) {
+      s = t[j] + uint64_t(m) * n[j] + c;
+      t[j - 1] = static_cast<uint32_t>(s);
+      c = s >> 32;
+    }
+    s = t[k] + c;
+    t[k - 1] = static_cast<uint32_t>(s);
+    t[k] = t[k + 1] + static_cast<uint32_t>(s >> 32);
+  }
+  bool carry = t[k] != 0;
+  t.resize(k);
+  if (carry || !lessThan(t, n)) subtract(&t, n);
+  return t;
+}
+
+// a * 2^(32 * size) mod n, for a < n
+static Limbs toMontgomery(Limbs a, const Limbs &n) {
+  for (size_t bit = 0; bit < 32 * n.size(); ++bit) {
+    bool carry = a.back() >> 31;
+    for (size_t i = a.size(); i-- > 1;) a[i] = a[i] << 1 | a[i - 1] >> 31;
+    a[0] <<= 1;
+    if (carry || !lessThan(a, n)) subtract(&a, n);
+  }
+  return a;
+}
+
+static void mgf1Xor(string_view seed, char *out, size_t len) {
+  for (uint32_t counter = 0; len > 0; ++counter) {
+    Sha1 hash;
+    hash.update(seed.data(), seed.size());
+    unsigned char c[4] = {static_cast<unsigned char>(counter >> 24),
+                          static_cast<unsigned char>(counter >> 16),
+                          static_cast<unsigned char>(counter >> 8),
+                          static_cast<unsigned char>(counter)};
+    hash.update(c, 4);
+    unsigned char mask[Sha1::kDigestLength];
+    hash.final(mask);
+    auto n = std::min(len, Sha1::kDigestLength);
+    for (size_t i = 0; i < n; ++i) out[i] ^= mask[i];
+    out += n;
+    len -= n;
+  }
+}
+
+// Takes a DER element of the given tag off the front of der
+static bool readDer(string_view *der, uint8_t tag, string_view *contents) {
+  if (der->size() < 2 || static_cast<uint8_t>((*der)[0]) != tag) {
+    return false;
+  }
+  size_t len = static_cast<uint8_t>((*der)[1]);
+  size_t header = 2;
+  if (len & 0x80) {
+    size_t bytes = len & 0x7f;
+    if (bytes == 0 || bytes > 3 || der->size() < 2 + bytes) return false;
+    len = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+      len = len << 8 | static_cast<uint8_t>((*der)[2 + i]);
+    }
+    header += bytes;
+  }
+  if (der->size() - header < len) return false;
+  *contents = der->substr(header, len);
+  der->remove_prefix(header + len);
+  return true;
+}
+
+// The modulus and the public exponent of a PEM SubjectPublicKeyInfo or
+// PKCS#1 RSAPublicKey
+static bool parsePublicKey(string_view pem, std::string *modulus,
+                           std::string *exponent) {
+  auto begin = pem.find("-----BEGIN");
+  if (begin == string_view::npos) return false;
+  begin = pem.find('\n', begin);
+  auto end = pem.find("-----END", begin);
+  if (end == string_view::npos) return false;
+  std::string encoded;
+  for (auto c : pem.substr(begin, end - begin)) {
+    if (!isspace(static_cast<unsigned char>(c))) encoded.push_back(c);
+  }
+  auto der = utils::base64Decode(encoded);
+  string_view rest(der), key, n, e;
+  if (!readDer(&rest, 0x30, &key)) return false;
+  if (!key.empty() && key[0] == 0x30) {
+    // The algorithm, then the RSAPublicKey in a bit string
+    string_view algorithm, bits;
+    if (!readDer(&key, 0x30, &algorithm) || !readDer(&key, 0x03, &bits) ||
+        bits.empty() || bits[0] != 0) {
+      return false;
+    }
+    bits.remove_prefix(1);
+    if (!readDer(&bits, 0x30, &key)) return false;
+  }
+  if (!readDer(&key, 0x02, &n) || !readDer(&key, 0x02, &e)) return false;
+  while (!n.empty() && n[0] == 0) n.remove_prefix(1);
+  while (!e.empty() && e[0] == 0) e.remove_prefix(1);
+  if (n.empty() || e.empty() || !(n.back() & 1)) return false;
+  *modulus = std::string(n);
+  *exponent = std::string(e);
+  return true;
+}
+}  // namespace canary
+
+uint64_t PayloadReader::readInt(size_t bytes) {
+  if (!ok_ || remaining() < bytes) {
+    ok_ = false;
+    return 0;
+  }
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; ++i) {
+    value |= uint64_t(static_cast<uint8_t>(p_[i])) << (8 * i);
+  }
+  p_ += bytes;
+  return value;
+}
+
+uint64_t PayloadReader::readLenenc(bool *isNull) {
+  if (isNull) *isNull = false;
+  auto first = readInt1();
+  switch (first) {
+    case 0xfb:
+      if (isNull) *isNull = true;
+      return 0;
+    case 0xfc:
+      return readInt(2);
+    case 0xfd:
+      return readInt(3);
+    case 0xfe:
+      return readInt(8);
+    case 0xff:
+      ok_ = false;
+      return 0;
+    default:
+      return first;
+  }
+}
+
+string_view PayloadReader::readBytes(size_t len) {
+  if (!ok_ || remaining() < len) {
+    ok_ = false;
+    return string_view();
+  }
+  string_view result(p_, len);
+  p_ += len;
+  return result;
+}
+
+string_view PayloadReader::readLenencString(bool *isNull) {
+  auto len = readLenenc(isNull);
+  return readBytes(len);
+}
+
+string_view PayloadReader::readNullTerminated() {
+  auto zero = std::find(p_, end_, '\0');
+  if (!ok_ || zero == end_) {
+    ok_ = false;
+    return string_view();
+  }
+  string_view result(p_, zero - p_);
+  p_ = zero + 1;
+  return result;
+}
+
+string_view PayloadReader::readRest() {
+  string_view result(p_, end_ - p_);
+  p_ = end_;
+  return result;
+}
+
+void mysql::appendInt(std::string *payload, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; ++i) {
+    payload->push_back(static_cast<char>(value >> (8 * i)));
+  }
+}
+
+void mysql::appendLenenc(std::string *payload, uint64_t value) {
+  if (value < 0xfb) {
+    payload->push_back(static_cast<char>(value));
+  } else if (value <= 0xffff) {
+    payload->push_back(static_cast<char>(0xfc));
+    appendInt(payload, value, 2);
+  } else if (value <= 0xffffff) {
+    payload->push_back(static_cast<char>(0xfd));
+    appendInt(payload, value, 3);
+  } else {
+    payload->push_back(static_cast<char>(0xfe));
+    appendInt(payload, value, 8);
+  }
+}
+
+void mysql::appendLenencString(std::string *payload, string_view value) {
+  appendLenenc(payload, value.size());
+  payload->append(value.data(), value.size());
+}
+
+uint8_t mysql::appendPacket(MsgBuffer *output, string_view payload,
+                            uint8_t seq) {
+  // A payload of exactly n * kMaxPacketLength ends with an empty packet
+  while (true) {
+    auto len = std::min(payload.size(), kMaxPacketLength);
+    char header[4] = {static_cast<char>(len), static_cast<char>(len >> 8),
+                      static_cast<char>(len >> 16), static_cast<char>(seq++)};
+    output->append(header, 4);
+    output->append(payload.data(), len);
+    payload.remove_prefix(len);
+    if (len < kMaxPacketLength) return seq;
+  }
+}
+
+void mysql::appendCommandPacket(MsgBuffer *output, uint8_t command,
+                                string_view body) {
+  auto len = body.size() + 1;
+  if (len >= kMaxPacketLength) {
+    std::string payload(1, static_cast<char>(command));
+    payload.append(body.data(), body.size());
+    appendPacket(output, payload, 0);
+    return;
+  }
+  char header[5] = {static_cast<char>(len), static_cast<char>(len >> 8),
+                    static_cast<char>(len >> 16), 0,
+                    static_cast<char>(command)};
+  output->append(header, 5);
+  output->append(body.data(), body.size());
+}
+
+std::string mysql::nativePasswordScramble(string_view password,
+                                          string_view nonce) {
+  return scramble<Sha1>(password, nonce, true);
+}
+
+std::string mysql::cachingSha2Scramble(string_view password,
+                                       string_view nonce) {
+  return scramble<Sha256>(password, nonce, false);
+}
+
+std::string mysql::modPow(string_view base, string_view exponent,
+                          string_view modulus) {
+  size_t k = (modulus.size() + 3) / 4;
+  auto n = toLimbs(modulus, k);
+  // Newton's iteration doubles the correct low bits of the inverse
+  uint32_t inverse = n[0];
+  for (int i = 0; i < 4; ++i) inverse *= 2 - n[0] * inverse;
+  uint32_t nInv = 0 - inverse;
+
+  auto b = toLimbs(base, k);
+  Limbs one(k, 0);
+  one[0] = 1;
+  auto x = toMontgomery(one, n);
+  b = toMontgomery(b, n);
+  for (auto c : exponent) {
+    for (int bit = 7; bit >= 0; --bit) {
+      x = montMul(x, x, n, nInv);
+      if ((static_cast<uint8_t>(c) >> bit) & 1) x = montMul(x, b, n, nInv);
+    }
+  }
+  x = montMul(x, one, n, nInv);
+
+  std::string result(modulus.size(), '\0');
+  for (size_t i = 0; i < result.size(); ++i) {
+    result[result.size() - 1 - i] =
+        static_cast<char>(x[i / 4] >> (8 * (i % 4)));
+  }
+  return result;
+}
+
+std::string mysql::rsaEncryptPassword(string_view password,
+                                      string_view nonce,
+                                      string_view pemKey) {
+  std::string modulus, exponent;
+  if (nonce.empty() || !parsePublicKey(pemKey, &modulus, &exponent)) {
+    return std::string();
+  }
+  std::string message(password);
+  message.push_back('\0');
+  for (size_t i = 0; i < message.size(); ++i) {
+    message[i] ^= nonce[i % nonce.size()];
+  }
+
+  // EME-OAEP: 0, the masked seed, then the masked SHA1("") || zeros || 1
+  // || message
+  const size_t hashLength = Sha1::kDigestLength;
+  const size_t k = modulus.size();
+  if (k < 2 * hashLength + 2 || message.size() > k - 2 * hashLength - 2) {
+    return std::string();
+  }
+  std::string block(k, '\0');
+  char *seed = &block[1];
+  char *db = seed + hashLength;
+  const size_t dbLength = k - hashLength - 1;
+  auto emptyHash = Sha1::digest("", 0);
+  memcpy(db, emptyHash.data(), hashLength);
+  db[dbLength - message.size() - 1] = 1;
+  memcpy(db + dbLength - message.size(), message.data(), message.size());
+  if (!utils::secureRandomBytes(seed, hashLength)) return std::string();
+  mgf1Xor(string_view(seed, hashLength), db, dbLength);
+  mgf1Xor(string_view(db, dbLength), seed, hashLength);
+  return modPow(block, exponent, modulus);
+}
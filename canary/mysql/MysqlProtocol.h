@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "MsgBuffer.h"
+#include "StringView.h"
+
+namespace canary {
+
+// Column types of the client/server protocol
+enum class MysqlFieldType : uint8_t {
+  kDecimal = 0x00,
+  kTiny = 0x01,
+  kShort = 0x02,
+  kLong = 0x03,
+  kFloat = 0x04,
+  kDouble = 0x05,
+  kNull = 0x06,
+  kTimestamp = 0x07,
+  kLongLong = 0x08,
+  kInt24 = 0x09,
+  kDate = 0x0a,
+  kTime = 0x0b,
+  kDateTime = 0x0c,
+  kYear = 0x0d,
+  kVarchar = 0x0f,
+  kBit = 0x10,
+  kJson = 0xf5,
+  kNewDecimal = 0xf6,
+  kEnum = 0xf7,
+  kSet = 0xf8,
+  kTinyBlob = 0xf9,
+  kMediumBlob = 0xfa,
+  kLongBlob = 0xfb,
+  kBlob = 0xfc,
+  kVarString = 0xfd,
+  kString = 0xfe,
+  kGeometry = 0xff
+};
+
+namespace mysql {
+
+// Capability flags
+constexpr uint32_t kClientLongPassword = 0x00000001;
+constexpr uint32_t kClientLongFlag = 0x00000004;
+constexpr uint32_t kClientConnectWithDb = 0x00000008;
+constexpr uint32_t kClientProtocol41 = 0x00000200;
+constexpr uint32_t kClientTransactions = 0x00002000;
+constexpr uint32_t kClientSecureConnection = 0x00008000;
+constexpr uint32_t kClientPluginAuth = 0x00080000;
+constexpr uint32_t kClientPluginAuthLenencData = 0x00200000;
+
+// Commands
+constexpr uint8_t kComQuit = 0x01;
+constexpr uint8_t kComQuery = 0x03;
+constexpr uint8_t kComPing = 0x0e;
+constexpr uint8_t kComStmtPrepare = 0x16;
+constexpr uint8_t kComStmtExecute = 0x17;
+constexpr uint8_t kComStmtClose = 0x19;
+
+// The first byte of generic response packets
+constexpr uint8_t kOkPacket = 0x00;
+constexpr uint8_t kEofPacket = 0xfe;
+constexpr uint8_t kErrPacket = 0xff;
+constexpr uint8_t kAuthMoreData = 0x01;
+// caching_sha2_password: asks for the RSA public key of the server
+constexpr uint8_t kRequestPublicKey = 0x02;
+constexpr uint8_t kNullValue = 0xfb;
+
+constexpr uint16_t kUnsignedFlag = 0x0020;
+
+// A payload longer than this is split into several packets
+constexpr size_t kMaxPacketLength = 0xffffff;
+
+constexpr uint8_t kUtf8mb4GeneralCi = 45;
+
+// Reads the fields of a payload. Reading past the end sets a sticky error
+// flag and returns zeros, so a packet is checked once after parsing it.
+class PayloadReader {
+ public:
+  explicit PayloadReader(string_view payload)
+      : p_(payload.data()), end_(payload.data() + payload.size()) {}
+
+  bool ok() const { return ok_; }
+
+  bool atEnd() const { return p_ == end_; }
+
+  size_t remaining() const { return end_ - p_; }
+
+  const char *position() const { return p_; }
+
+  uint64_t readInt(size_t bytes);
+
+  uint8_t readInt1() { return static_cast<uint8_t>(readInt(1)); }
+
+  uint16_t readInt2() { return static_cast<uint16_t>(readInt(2)); }
+
+  uint32_t readInt4() { return static_cast<uint32_t>(readInt(4)); }
+
+  uint64_t readInt8() { return readInt(8); }
+
+  // A length encoded integer; *isNull is set for the 0xfb NULL marker
+  uint64_t readLenenc(bool *isNull = nullptr);
+
+  string_view readBytes(size_t len);
+
+  string_view readLenencString(bool *isNull = nullptr);
+
+  string_view readNullTerminated();
+
+  string_view readRest();
+
+  void skip(size_t len) { readBytes(len); }
+
+ private:
+  const char *p_;
+  const char *end_;
+  bool ok_{true};
+};
+
+void appendInt(std::string *payload, uint64_t value, size_t bytes);
+
+void appendLenenc(std::string *payload, uint64_t value);
+
+void appendLenencString(std::string *payload, string_view value);
+
+// Frames payload as packets starting with sequence id seq, splitting it at
+// kMaxPacketLength. Returns the sequence id of the next packet.
+uint8_t appendPacket(MsgBuffer *output, string_view payload, uint8_t seq);
+
+// The packets of a command whose payload is the command byte followed by
+// body, without copying body into a payload first
+void appendCommandPacket(MsgBuffer *output, uint8_t command,
+                         string_view body);
+
+// SHA1(password) XOR SHA1(nonce + SHA1(SHA1(password))), empty for an
+// empty password
+std::string nativePasswordScramble(string_view password, string_view nonce);
+
+// SHA256(password) XOR SHA256(SHA256(SHA256(password)) + nonce), empty
+// for an empty password
+std::string cachingSha2Scramble(string_view password, string_view nonce);
+
+// base^exponent mod modulus of big endian numbers, as long as modulus.
+// modulus has to be odd and base smaller than it.
+std::string modPow(string_view base, string_view exponent,
+                   string_view modulus);
+
+// What caching_sha2_password sends for a full authentication over an
+// insecure connection: (password + '\0') XOR nonce, encrypted with
+// RSA-OAEP (SHA-1 and MGF1) under pemKey, a PEM RSA public key. Empty if
+// the key cannot be parsed or the password does not fit.
+std::string rsaEncryptPassword(string_view password, string_view nonce,
+                               string_view pemKey);
+
+}  // namespace mysql
+
+}  // namespace canary
@@ -0,0 +1,283 @@
+#include "MysqlResult.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Utility.h"
+
+using namespace canary;
+using namespace canary::mysql;
+
+namespace canary {
+// The size of a binary value of type, 0 for a length encoded string and -1
+// for the length prefixed dates and times
+static int binarySize(MysqlFieldType type) {
+  switch (type) {
+    case MysqlFieldType::kNull:
+      return 0;
+    case MysqlFieldType::kTiny:
+      return 1;
+    case MysqlFieldType::kShort:
+    case MysqlFieldType::kYear:
+      return 2;
+    case MysqlFieldType::kLong:
+    case MysqlFieldType::kInt24:
+    case MysqlFieldType::kFloat:
+      return 4;
+    case MysqlFieldType::kLongLong:
+    case MysqlFieldType::kDouble:
+      return 8;
+    case MysqlFieldType::kDate:
+    case MysqlFieldType::kDateTime:
+    case MysqlFieldType::kTimestamp:
+    case MysqlFieldType::kTime:
+      return -1;
+    default:
+      return 0;
+  }
+}
+}  // namespace canary
+
+bool MysqlField::binaryNumber() const {
+  if (!binary_) return false;
+  auto size = binarySize(column_->type_);
+  return size > 0;
+}
+
+long long MysqlField::asInt64() const {
+  if (isNull_) return 0;
+  if (!binaryNumber()) {
+    return strtoll(std::string(data_).c_str(), nullptr, 10);
+  }
+  PayloadReader reader(data_);
+  switch (column_->type_) {
+    case MysqlFieldType::kFloat:
+    case MysqlFieldType::kDouble:
+      return static_cast<long long>(asDouble());
+    case MysqlFieldType::kTiny:
+      return column_->isUnsigned()
+                 ? static_cast<long long>(reader.readInt1())
+                 : static_cast<int8_t>(reader.readInt1());
+    case MysqlFieldType::kShort:
+    case MysqlFieldType::kYear:
+      return column_->isUnsigned() ||
+                     column_->type_ == MysqlFieldType::kYear
+                 ? static_cast<long long>(reader.readInt2())
+                 : static_cast<int16_t>(reader.readInt2());
+    case MysqlFieldType::kLong:
+    case MysqlFieldType::kInt24:
+      return column_->isUnsigned()
+                 ? static_cast<long long>(reader.readInt4())
+                 : static_cast<int32_t>(reader.readInt4());
+    default:
+      return static_cast<long long>(reader.readInt8());
+  }
+}
+
+unsigned long long MysqlField::asUInt64() const {
+  if (isNull_) return 0;
+  if (binaryNumber() && column_->type_ == MysqlFieldType::kLongLong) {
+    return PayloadReader(data_).readInt8();
+  }
+  if (!binaryNumber()) {
+    return strtoull(std::string(data_).c_str(), nullptr, 10);
+  }
+  return static_cast<unsigned long long>(asInt64());
+}
+
+double MysqlField::asDouble() const {
+  if (isNull_) return 0;
+  if (!binaryNumber()) return strtod(std::string(data_).c_str(), nullptr);
+  if (column_->type_ == MysqlFieldType::kDouble) {
+    auto bits = PayloadReader(data_).readInt8();
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+  if (column_->type_ == MysqlFieldType::kFloat) {
+    auto bits = PayloadReader(data_).readInt4();
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+  if (column_->type_ == MysqlFieldType::kLongLong && column_->isUnsigned()) {
+    return static_cast<double>(asUInt64());
+  }
+  return static_cast<double>(asInt64());
+}
+
+std::string MysqlField::asString() const {
+  if (isNull_) return std::string();
+  if (!binary_) return std::string(data_);
+  auto type = column_->type_;
+  if (binaryNumber()) {
+    if (type == MysqlFieldType::kFloat || type == MysqlFieldType::kDouble) {
+      // The shortest digits of the value in its own precision
+      char buf[utils::kMaxDoubleLength];
+      auto length =
+          type == MysqlFieldType::kFloat
+              ? utils::formatFloat(static_cast<float>(asDouble()), buf)
+              : utils::formatDouble(asDouble(), buf);
+      return std::string(buf, length);
+    }
+    if (column_->isUnsigned()) return std::to_string(asUInt64());
+    return std::to_string(asInt64());
+  }
+  if (binarySize(type) == 0) return std::string(data_);
+
+  PayloadReader reader(data_);
+  char buf[64];
+  if (type == MysqlFieldType::kTime) {
+    bool negative = false;
+    unsigned int days = 0, hours = 0, minutes = 0, seconds = 0, micros = 0;
+    if (!data_.empty()) {
+      negative = reader.readInt1() != 0;
+      days = reader.readInt4();
+      hours = reader.readInt1();
+      minutes = reader.readInt1();
+      seconds = reader.readInt1();
+      if (data_.size() > 8) micros = reader.readInt4();
+    }
+    int n = snprintf(buf, sizeof(buf), "%s%02u:%02u:%02u", negative ? "-" : "",
+                     days * 24 + hours, minutes, seconds);
+    if (micros) snprintf(buf + n, sizeof(buf) - n, ".%06u", micros);
+    return buf;
+  }
+  unsigned int year = 0, month = 0, day = 0, hours = 0, minutes = 0,
+               seconds = 0, micros = 0;
+  if (data_.size() >= 4) {
+    year = reader.readInt2();
+    month = reader.readInt1();
+    day = reader.readInt1();
+  }
+  if (data_.size() >= 7) {
+    hours = reader.readInt1();
+    minutes = reader.readInt1();
+    seconds = reader.readInt1();
+  }
+  if (data_.size() >= 11) micros = reader.readInt4();
+  int n = snprintf(buf, sizeof(buf), "%04u-%02u-%02u", year, month, day);
+  if (type == MysqlFieldType::kDate) return buf;
+  n += snprintf(buf + n, sizeof(buf) - n, " %02u:%02u:%02u", hours, minutes,
+                seconds);
+  if (micros) snprintf(buf + n, sizeof(buf) - n, ".%06u", micros);
+  return buf;
+}
+
+MysqlResultPtr MysqlResult::newError(unsigned int code,
+                                     const std::string &message,
+                                     const std::string &sqlState) {
+  auto result = std::make_shared<MysqlResult>();
+  result->errorCode_ = code;
+  result->errorMessage_ = message;
+  result->sqlState_ = sqlState;
+  return result;
+}
+
+int MysqlResult::columnIndex(string_view name) const {
+  auto &columns = *columns_;
+  for (size_t i = 0; i < columns.size(); ++i) {
+    if (columns[i].name_ == name) return static_cast<int>(i);
+  }
+  return -1;
+}
+
+MysqlRow MysqlResult::operator[](size_t index) const {
+  MysqlRow row;
+  auto &columns = *columns_;
+  row.fields_.reserve(columns.size());
+  PayloadReader reader(rowViews_[index]);
+  if (!binary_) {
+    for (auto &column : columns) {
+      bool isNull = false;
+      auto value = reader.readLenencString(&isNull);
+      row.fields_.emplace_back(&column, value, isNull, false);
+    }
+    return row;
+  }
+  // 0x00, then a null bitmap with an offset of two bits
+  reader.skip(1);
+  auto bitmap = reader.readBytes((columns.size() + 7 + 2) / 8);
+  for (size_t i = 0; i < columns.size(); ++i) {
+    auto &column = columns[i];
+    bool isNull = reader.ok() &&
+                  (static_cast<uint8_t>(bitmap[(i + 2) / 8]) >> ((i + 2) % 8)) &
+                      1;
+    string_view value;
+    if (!isNull) {
+      auto size = binarySize(column.type_);
+      if (size > 0) {
+        value = reader.readBytes(size);
+      } else if (size < 0) {
+        value = reader.readBytes(reader.readInt1());
+      } else if (column.type_ != MysqlFieldType::kNull) {
+        value = reader.readLenencString();
+      }
+    }
+    row.fields_.emplace_back(&column, value, isNull, true);
+  }
+  return row;
+}
+
+void MysqlResult::setError(string_view payload) {
+  PayloadReader reader(payload);
+  reader.skip(1);
+  errorCode_ = reader.readInt2();
+  if (reader.remaining() > 0 && *reader.position() == '#') {
+    reader.skip(1);
+    sqlState_ = std::string(reader.readBytes(5));
+  }
+  errorMessage_ = std::string(reader.readRest());
+  if (!reader.ok() || errorCode_ == 0) {
+    errorCode_ = kMysqlMalformedPacket;
+    errorMessage_ = "Malformed packet";
+  }
+}
+
+void MysqlResult::setOk(string_view payload) {
+  PayloadReader reader(payload);
+  reader.skip(1);
+  affectedRows_ = reader.readLenenc();
+  insertId_ = reader.readLenenc();
+  status_ = reader.readInt2();
+  warnings_ = reader.readInt2();
+}
+
+bool MysqlResult::addColumn(string_view payload) {
+  PayloadReader reader(payload);
+  MysqlColumn column;
+  reader.readLenencString();  // catalog
+  reader.readLenencString();  // schema
+  column.table_ = std::string(reader.readLenencString());
+  reader.readLenencString();  // original table
+  column.name_ = std::string(reader.readLenencString());
+  reader.readLenencString();  // original name
+  reader.readLenenc();        // length of the fixed fields
+  column.charset_ = reader.readInt2();
+  column.length_ = reader.readInt4();
+  column.type_ = static_cast<MysqlFieldType>(reader.readInt1());
+  column.flags_ = reader.readInt2();
+  column.decimals_ = reader.readInt1();
+  if (!reader.ok()) return false;
+  columns_->push_back(std::move(column));
+  return true;
+}
+
+size_t MysqlResult::dataBytes() const {
+  auto bytes = data_.readableBytes();
+  for (auto &row : large_) bytes += row.size();
+  return bytes;
+}
+
+void MysqlResult::setData(MsgBuffer &&data) {
+  data_.swap(data);
+  rowViews_.reserve(rows_.size());
+  for (auto &row : rows_) {
+    if (row.joined_) {
+      rowViews_.emplace_back(*row.joined_);
+    } else {
+      rowViews_.emplace_back(data_.peek() + row.offset_, row.length_);
+    }
+  }
+}
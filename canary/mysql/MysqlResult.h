@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MsgBuffer.h"
+#include "MysqlProtocol.h"
+#include "StringView.h"
+
+namespace canary {
+
+// Client side error codes, the same numbers as the ones of libmysqlclient
+enum MysqlClientError : unsigned int {
+  kMysqlConnectionError = 2003,  // CR_CONN_HOST_ERROR
+  kMysqlServerLost = 2013,       // CR_SERVER_LOST
+  kMysqlMalformedPacket = 2027,  // CR_MALFORMED_PACKET
+  kMysqlNoPreparedStatement = 2030,
+  kMysqlParameterCount = 2034,
+  kMysqlAuthPluginError = 2059
+};
+
+struct MysqlColumn {
+  std::string table_;
+  std::string name_;
+  MysqlFieldType type_{MysqlFieldType::kNull};
+  uint16_t flags_{0};
+  uint16_t charset_{0};
+  uint32_t length_{0};
+  uint8_t decimals_{0};
+
+  bool isUnsigned() const { return (flags_ & mysql::kUnsignedFlag) != 0; }
+};
+
+// One value of a row. Values of the text protocol are always text; the
+// binary protocol of prepared statements sends numbers, dates and times
+// in binary form, asString() formats them the way the text protocol would.
+class MysqlField {
+ public:
+  MysqlField(const MysqlColumn *column, string_view data, bool isNull,
+             bool binary)
+      : column_(column), data_(data), isNull_(isNull), binary_(binary) {}
+
+  bool isNull() const { return isNull_; }
+
+  const MysqlColumn &column() const { return *column_; }
+
+  // The bytes on the wire: the text, or the raw value of a binary number
+  string_view asStringView() const { return data_; }
+
+  std::string asString() const;
+
+  long long asInt64() const;
+
+  unsigned long long asUInt64() const;
+
+  double asDouble() const;
+
+ private:
+  bool binaryNumber() const;
+
+  const MysqlColumn *column_;
+  string_view data_;
+  bool isNull_;
+  bool binary_;
+};
+
+// The values of a row, split when the row is looked at
+class MysqlRow {
+ public:
+  size_t size() const { return fields_.size(); }
+
+  const MysqlField &operator[](size_t index) const { return fields_[index]; }
+
+  std::vector<MysqlField>::const_iterator begin() const {
+    return fields_.begin();
+  }
+
+  std::vector<MysqlField>::const_iterator end() const {
+    return fields_.end();
+  }
+
+ private:
+  friend class MysqlResult;
+
+  std::vector<MysqlField> fields_;
+};
+
+class MysqlResult;
+using MysqlResultPtr = std::shared_ptr<MysqlResult>;
+
+// The result of a command: an error, an OK packet or a result set. The rows
+// stay in the packets they arrived in, the receive buffer of the connection
+// is handed over to the result when possible, and a row is only split into
+// its values when it is accessed.
+class MysqlResult {
+ public:
+  static MysqlResultPtr newError(unsigned int code, const std::string &message,
+                                 const std::string &sqlState = "HY000");
+
+  bool ok() const { return errorCode_ == 0; }
+
+  // A server error code, a MysqlClientError or 0
+  unsigned int errorCode() const { return errorCode_; }
+
+  const std::string &errorMessage() const { return errorMessage_; }
+
+  const std::string &sqlState() const { return sqlState_; }
+
+  uint64_t affectedRows() const { return affectedRows_; }
+
+  uint64_t insertId() const { return insertId_; }
+
+  uint16_t warnings() const { return warnings_; }
+
+  // Columns of the result set, empty after a statement without one
+  const std::vector<MysqlColumn> &columns() const { return *columns_; }
+
+  // The index of the column or -1
+  int columnIndex(string_view name) const;
+
+  size_t size() const { return rows_.size(); }
+
+  bool empty() const { return rows_.empty(); }
+
+  MysqlRow operator[](size_t index) const;
+
+  // The bytes kept for the rows, what a streamed batch counts against the
+  // backlog of its connection
+  size_t dataBytes() const;
+
+ private:
+  friend class MysqlConnection;
+
+  // The payload of a row, relative to the buffer it arrived in
+  struct RowRef {
+    size_t offset_;
+    size_t length_;
+    // A row of several packets is copied out into large_
+    const std::string *joined_;
+  };
+
+  void setError(string_view payload);
+
+  void setOk(string_view payload);
+
+  bool addColumn(string_view payload);
+
+  // Points the rows at data, the bytes of the whole response
+  void setData(MsgBuffer &&data);
+
+  unsigned int errorCode_{0};
+  std::string errorMessage_;
+  std::string sqlState_;
+  uint64_t affectedRows_{0};
+  uint64_t insertId_{0};
+  uint16_t warnings_{0};
+  uint16_t status_{0};
+  bool binary_{false};
+  // Shared by the batches of a streamed result set
+  std::shared_ptr<std::vector<MysqlColumn>> columns_ =
+      std::make_shared<std::vector<MysqlColumn>>();
+  std::vector<RowRef> rows_;
+  std::vector<string_view> rowViews_;
+  MsgBuffer data_{0};
+  std::deque<std::string> large_;
+  // Released with the result, tells the connection when a streamed batch
+  // is gone
+  std::shared_ptr<void> releaseGuard_;
+};
+
+}  // namespace canary
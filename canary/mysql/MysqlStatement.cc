@@ -0,0 +1,46 @@
+#include "MysqlStatement.h"
+
+#include <string.h>
+
+using namespace canary;
+using namespace canary::mysql;
+
+std::string MysqlStatement::executePayload(
+    const std::vector<MysqlParam> &params) const {
+  std::string payload;
+  payload.push_back(static_cast<char>(kComStmtExecute));
+  appendInt(&payload, id_, 4);
+  payload.push_back(0);     // no cursor
+  appendInt(&payload, 1, 4);  // iteration count
+  if (params.empty()) return payload;
+
+  std::string bitmap((params.size() + 7) / 8, '\0');
+  for (size_t i = 0; i < params.size(); ++i) {
+    if (params[i].isNull()) bitmap[i / 8] |= static_cast<char>(1 << (i % 8));
+  }
+  payload.append(bitmap);
+  payload.push_back(1);  // types follow
+  for (auto &param : params) {
+    payload.push_back(static_cast<char>(param.type_));
+    payload.push_back(param.unsigned_ ? static_cast<char>(0x80) : 0);
+  }
+  for (auto &param : params) {
+    switch (param.type_) {
+      case MysqlFieldType::kLongLong:
+        appendInt(&payload, param.integer_, 8);
+        break;
+      case MysqlFieldType::kDouble: {
+        uint64_t bits;
+        memcpy(&bits, &param.double_, sizeof(bits));
+        appendInt(&payload, bits, 8);
+        break;
+      }
+      case MysqlFieldType::kVarString:
+        appendLenencString(&payload, param.string_);
+        break;
+      default:
+        break;
+    }
+  }
+  return payload;
+}
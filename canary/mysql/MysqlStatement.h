@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "MysqlResult.h"
+
+namespace canary {
+
+// A parameter of a prepared statement, sent in binary form
+class MysqlParam {
+ public:
+  MysqlParam() = default;
+
+  MysqlParam(std::nullptr_t) {}
+
+  template <typename T, typename std::enable_if<std::is_integral<T>::value,
+                                                int>::type = 0>
+  MysqlParam(T value)
+      : type_(MysqlFieldType::kLongLong),
+        unsigned_(std::is_unsigned<T>::value),
+        integer_(static_cast<uint64_t>(value)) {}
+
+  MysqlParam(double value) : type_(MysqlFieldType::kDouble), double_(value) {}
+
+  MysqlParam(string_view value)
+      : type_(MysqlFieldType::kVarString), string_(value) {}
+
+  MysqlParam(const std::string &value)
+      : type_(MysqlFieldType::kVarString), string_(value) {}
+
+  MysqlParam(std::string &&value)
+      : type_(MysqlFieldType::kVarString), string_(std::move(value)) {}
+
+  MysqlParam(const char *value)
+      : type_(MysqlFieldType::kVarString), string_(value) {}
+
+  bool isNull() const { return type_ == MysqlFieldType::kNull; }
+
+ private:
+  friend class MysqlStatement;
+
+  MysqlFieldType type_{MysqlFieldType::kNull};
+  bool unsigned_{false};
+  uint64_t integer_{0};
+  double double_{0};
+  std::string string_;
+};
+
+class MysqlStatement;
+using MysqlStatementPtr = std::shared_ptr<MysqlStatement>;
+
+// A statement prepared on one connection, it can only be executed there
+class MysqlStatement {
+ public:
+  MysqlStatement(const void *owner, uint32_t id, std::string sql)
+      : owner_(owner), id_(id), sql_(std::move(sql)) {}
+
+  uint32_t id() const { return id_; }
+
+  const std::string &sql() const { return sql_; }
+
+  size_t paramCount() const { return paramCount_; }
+
+  // The columns of the rows it returns, as told by the prepare response
+  const std::vector<MysqlColumn> &columns() const { return columns_; }
+
+  // The payload of COM_STMT_EXECUTE with params, which must be as many as
+  // paramCount()
+  std::string executePayload(const std::vector<MysqlParam> &params) const;
+
+ private:
+  friend class MysqlConnection;
+
+  const void *owner_;
+  const uint32_t id_;
+  const std::string sql_;
+  size_t paramCount_{0};
+  std::vector<MysqlColumn> columns_;
+};
+
+}  // namespace canary
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <assert.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "EventLoop.h"
+#include "NonCopyable.h"
+
+namespace canary {
+
+// A pool of multiplexed client connections spread over several loops, e.g.
+// the ones of an EventLoopThreadPool. Every loop has connections of its
+// own, and a connection is only handed out in its loop, so a checkout never
+// crosses threads. Connection is a protocol connection over a TcpClient,
+// such as MysqlConnection or RedisConnection. It takes requests while it is
+// connecting and has
+//
+//   void connect();
+//   void disconnect();
+//   bool closed() const;
+//   size_t outstanding() const;  // requests waiting for their response
+//   void setConnectionCallback(
+//       const std::function<void(const std::shared_ptr<Connection> &)> &);
+//
+// with the callback called once the connection is ready and once it is
+// closed.
+//
+// A loop opens minPerLoop connections with start() or its first checkout.
+// A checkout gets the open connection with the fewest requests
+// outstanding, preferring the ready ones. When every connection has
+// maxOutstanding requests or more, another one is opened, up to
+// maxPerLoop. A closed connection is replaced after the reconnect delay
+// while the loop has fewer than minPerLoop. With setHealthCheck(), idle
+// connections are checked every interval, and the ones beyond minPerLoop
+// not checked out since the previous check are closed.
+template <typename Connection>
+class ConnectionPool
+    : NonCopyable,
+      public std::enable_shared_from_this<ConnectionPool<Connection>> {
+ public:
+  using ConnectionPtr = std::shared_ptr<Connection>;
+  // Creates a connection in the loop, connect() is called by the pool
+  using ConnectionFactory = std::function<ConnectionPtr(EventLoop *)>;
+  // Calls done with false to close the connection, in the loop of it
+  using HealthCheck = std::function<void(const ConnectionPtr &,
+                                         std::function<void(bool)> &&done)>;
+
+  static std::shared_ptr<ConnectionPool> newConnectionPool(
+      const std::vector<EventLoop *> &loops, ConnectionFactory &&factory,
+      size_t minPerLoop = 1, size_t maxPerLoop = 1) {
+    return std::make_shared<ConnectionPool>(loops, std::move(factory),
+                                            minPerLoop, maxPerLoop);
+  }
+
+  ConnectionPool(const std::vector<EventLoop *> &loops,
+                 ConnectionFactory &&factory, size_t minPerLoop,
+                 size_t maxPerLoop)
+      : factory_(std::move(factory)),
+        minPerLoop_(minPerLoop),
+        maxPerLoop_(std::max<size_t>(std::max<size_t>(minPerLoop, maxPerLoop),
+                                     1)) {
+    assert(!loops.empty());
+    for (auto loop : loops) {
+      loops_.emplace_back(new LoopState{loop, false, InvalidTimerId, 0, {}});
+    }
+  }
+
+  ~ConnectionPool() {
+    // The connections close when they go away
+    for (auto &state : loops_) {
+      if (state->timerId_ != InvalidTimerId) {
+        state->loop_->invalidateTimer(state->timerId_);
+      }
+    }
+  }
+
+  // The setters are to be called before the first checkout
+
+  // 1 by default: a connection is opened as soon as all are busy
+  void setMaxOutstanding(size_t requests) {
+    maxOutstanding_ = requests ? requests : 1;
+  }
+
+  // 1 second by default
+  void setReconnectDelay(double seconds) { reconnectDelay_ = seconds; }
+
+  // check may be null, then idle connections are only closed
+  void setHealthCheck(double interval, HealthCheck &&check) {
+    checkInterval_ = interval;
+    healthCheck_ = std::move(check);
+  }
+
+  // Warms the pool up: opens minPerLoop connections in every loop
+  void start() {
+    auto thisPtr = this->shared_from_this();
+    for (auto &state : loops_) {
+      auto statePtr = state.get();
+      state->loop_->runInLoop(
+          [thisPtr, statePtr]() { thisPtr->startInLoop(statePtr); });
+    }
+  }
+
+  // A connection of the loop of the current thread, which must be one of
+  // the loops. Null when that loop has no open connection.
+  ConnectionPtr get() {
+    for (auto &state : loops_) {
+      if (state->loop_->isInLoopThread()) return select(state.get());
+    }
+    assert(false);
+    return nullptr;
+  }
+
+  // Calls callback with a connection, possibly null, in the loop of the
+  // current thread or else in the next loop in turn
+  template <typename Callback>
+  void get(Callback &&callback) {
+    for (auto &state : loops_) {
+      if (state->loop_->isInLoopThread()) {
+        callback(select(state.get()));
+        return;
+      }
+    }
+    auto state = loops_[nextLoop_++ % loops_.size()].get();
+    auto thisPtr = this->shared_from_this();
+    state->loop_->queueInLoop([thisPtr, state,
+                               callback = std::forward<Callback>(
+                                   callback)]() mutable {
+      callback(thisPtr->select(state));
+    });
+  }
+
+  // Connections ready and not closed
+  size_t connectionCount() const { return connectionCount_; }
+
+ private:
+  struct Slot {
+    ConnectionPtr connection_;
+    bool ready_;
+    // Checked out since the last health check
+    bool used_;
+  };
+
+  struct LoopState {
+    EventLoop *loop_;
+    bool started_;
+    TimerId timerId_;
+    // Replacements waiting for the reconnect delay
+    size_t replacing_;
+    // Only touched in loop_
+    std::vector<Slot> slots_;
+  };
+
+  void startInLoop(LoopState *state) {
+    if (state->started_) return;
+    state->started_ = true;
+    for (size_t i = 0; i < minPerLoop_; ++i) open(state);
+    if (checkInterval_ > 0) {
+      std::weak_ptr<ConnectionPool> weakPtr = this->shared_from_this();
+      state->timerId_ =
+          state->loop_->runEvery(checkInterval_, [weakPtr, state]() {
+            auto thisPtr = weakPtr.lock();
+            if (thisPtr) thisPtr->check(state);
+          });
+    }
+  }
+
+  ConnectionPtr select(LoopState *state) {
+    state->loop_->assertInLoopThread();
+    startInLoop(state);
+    Slot *best = nullptr;
+    for (auto &slot : state->slots_) {
+      if (slot.connection_->closed()) continue;
+      if (!best || (slot.ready_ && !best->ready_) ||
+          (slot.ready_ == best->ready_ &&
+           slot.connection_->outstanding() <
+               best->connection_->outstanding())) {
+        best = &slot;
+      }
+    }
+    ConnectionPtr connection;
+    if (best) {
+      best->used_ = true;
+      connection = best->connection_;
+    }
+    if ((!connection || connection->outstanding() >= maxOutstanding_) &&
+        state->slots_.size() + state->replacing_ < maxPerLoop_) {
+      // Busy or not, a ready connection is sooner than a new one
+      auto opened = open(state, !connection);
+      if (!connection) connection = std::move(opened);
+    }
+    return connection;
+  }
+
+  ConnectionPtr open(LoopState *state, bool used = false) {
+    auto connection = factory_(state->loop_);
+    std::weak_ptr<ConnectionPool> weakPtr = this->shared_from_this();
+    connection->setConnectionCallback(
+        [weakPtr, state](const ConnectionPtr &conn) {
+          auto thisPtr = weakPtr.lock();
+          if (thisPtr) thisPtr->onConnection(state, conn);
+        });
+    state->slots_.push_back(Slot{connection, false, used});
+    connection->connect();
+    return connection;
+  }
+
+  void onConnection(LoopState *state, const ConnectionPtr &connection) {
+    auto iter = find(state, connection);
+    if (iter == state->slots_.end()) return;
+    if (!connection->closed()) {
+      iter->ready_ = true;
+      ++connectionCount_;
+      return;
+    }
+    remove(state, iter);
+  }
+
+  typename std::vector<Slot>::iterator find(
+      LoopState *state, const ConnectionPtr &connection) {
+    return std::find_if(
+        state->slots_.begin(), state->slots_.end(),
+        [&connection](const Slot &slot) {
+          return slot.connection_ == connection;
+        });
+  }
+
+  void remove(LoopState *state, typename std::vector<Slot>::iterator iter) {
+    if (iter->ready_) --connectionCount_;
+    state->slots_.erase(iter);
+    if (state->slots_.size() + state->replacing_ >= minPerLoop_) return;
+    ++state->replacing_;
+    std::weak_ptr<ConnectionPool> weakPtr = this->shared_from_this();
+    state->loop_->runAfter(reconnectDelay_, [weakPtr, state]() {
+      auto thisPtr = weakPtr.lock();
+      if (!thisPtr) return;
+      --state->replacing_;
+      if (state->slots_.size() + state->replacing_ < thisPtr->minPerLoop_) {
+        thisPtr->open(state);
+      }
+    });
+  }
+
+  // Taken out of the pool at once, its requests in flight still complete
+  void retire(LoopState *state, const ConnectionPtr &connection) {
+    auto iter = find(state, connection);
+    if (iter == state->slots_.end()) return;
+    remove(state, iter);
+    connection->disconnect();
+  }
+
+  void check(LoopState *state) {
+    std::vector<ConnectionPtr> idle, checked;
+    auto kept = state->slots_.size();
+    for (auto &slot : state->slots_) {
+      auto used = slot.used_;
+      slot.used_ = false;
+      if (!slot.ready_ || slot.connection_->closed() ||
+          slot.connection_->outstanding() > 0) {
+        continue;
+      }
+      if (!used && kept > minPerLoop_) {
+        idle.push_back(slot.connection_);
+        --kept;
+      } else if (healthCheck_) {
+        checked.push_back(slot.connection_);
+      }
+    }
+    for (auto &connection : idle) retire(state, connection);
+    std::weak_ptr<ConnectionPool> weakPtr = this->shared_from_this();
+    for (auto &connection : checked) {
+      std::weak_ptr<Connection> weakConnection = connection;
+      healthCheck_(connection, [weakPtr, weakConnection, state](bool healthy) {
+        auto thisPtr = weakPtr.lock();
+        auto connection = weakConnection.lock();
+        if (!healthy && thisPtr && connection) {
+          thisPtr->retire(state, connection);
+        }
+      });
+    }
+  }
+
+  const ConnectionFactory factory_;
+  const size_t minPerLoop_;
+  const size_t maxPerLoop_;
+  size_t maxOutstanding_{1};
+  double reconnectDelay_{1.0};
+  double checkInterval_{0};
+  HealthCheck healthCheck_;
+  std::vector<std::unique_ptr<LoopState>> loops_;
+  std::atomic<size_t> nextLoop_{0};
+  std::atomic<size_t> connectionCount_{0};
+};
+
+}  // namespace canary
@@ -0,0 +1,479 @@
+#pragma once
+
+// An opt-in C++20 coroutine layer over the callbacks, available when the
+// including code is built as C++20. The library itself needs no more than
+// C++17: everything here is in the header.
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define CANARY_HAS_COROUTINE 1
+#endif
+
+#ifdef CANARY_HAS_COROUTINE
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "EventLoop.h"
+#include "NonCopyable.h"
+#include "TcpClient.h"
+#include "TcpConnection.h"
+#include "TcpServer.h"
+
+namespace canary {
+
+template <typename T = void>
+class Task;
+
+namespace internal {
+
+// Resumes the awaiting coroutine, if any, straight from the finished one
+struct FinalAwaiter {
+  bool await_ready() const noexcept { return false; }
+
+  template <typename Promise>
+  std::coroutine_handle<> await_suspend(
+      std::coroutine_handle<Promise> handle) noexcept {
+    auto continuation = handle.promise().continuation_;
+    return continuation ? continuation : std::noop_coroutine();
+  }
+
+  void await_resume() const noexcept {}
+};
+
+struct PromiseBase {
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+
+  void unhandled_exception() { exception_ = std::current_exception(); }
+
+  void rethrow() {
+    if (exception_) std::rethrow_exception(exception_);
+  }
+
+  std::coroutine_handle<> continuation_;
+  std::exception_ptr exception_;
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+  Task<T> get_return_object();
+
+  template <typename U>
+  void return_value(U &&value) {
+    value_.emplace(std::forward<U>(value));
+  }
+
+  T result() {
+    rethrow();
+    return std::move(*value_);
+  }
+
+  std::optional<T> value_;
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+  Task<void> get_return_object();
+
+  void return_void() const noexcept {}
+
+  void result() { rethrow(); }
+};
+
+// Started right away and never awaited, exceptions escaping it terminate
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() const noexcept { return {}; }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+};
+
+}  // namespace internal
+
+// A coroutine returning T. It starts when it is awaited and resumes the
+// awaiting coroutine in the thread it finishes in, exceptions included.
+template <typename T>
+class [[nodiscard]] Task {
+ public:
+  using promise_type = internal::Promise<T>;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  explicit Task(Handle handle) : handle_(handle) {}
+
+  Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (handle_) handle_.destroy();
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+
+  ~Task() {
+    if (handle_) handle_.destroy();
+  }
+
+  bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+
+  std::coroutine_handle<> await_suspend(
+      std::coroutine_handle<> awaiting) noexcept {
+    handle_.promise().continuation_ = awaiting;
+    return handle_;
+  }
+
+  T await_resume() { return handle_.promise().result(); }
+
+ private:
+  Handle handle_;
+};
+
+template <typename T>
+Task<T> internal::Promise<T>::get_return_object() {
+  using Handle = typename Task<T>::Handle;
+  return Task<T>(Handle::from_promise(*this));
+}
+
+inline Task<void> internal::Promise<void>::get_return_object() {
+  return Task<void>(Task<void>::Handle::from_promise(*this));
+}
+
+// Runs the task to its end without waiting for it, e.g. from a callback
+inline void asyncRun(Task<> task) {
+  [](Task<> task) -> internal::DetachedTask {
+    co_await std::move(task);
+  }(std::move(task));
+}
+
+// Blocks until the task is done and returns its result. Not to be called in
+// a loop thread the task needs.
+template <typename T>
+T syncWait(Task<T> task) {
+  std::promise<T> result;
+  auto future = result.get_future();
+  [](Task<T> task, std::promise<T> &result) -> internal::DetachedTask {
+    try {
+      if constexpr (std::is_void_v<T>) {
+        co_await std::move(task);
+        result.set_value();
+      } else {
+        result.set_value(co_await std::move(task));
+      }
+    } catch (...) {
+      result.set_exception(std::current_exception());
+    }
+  }(std::move(task), result);
+  return future.get();
+}
+
+// co_await sleepCoro(loop, 0.5) resumes in the loop after half a second
+inline auto sleepCoro(EventLoop *loop, double seconds) {
+  struct Awaiter {
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+      loop_->runAfter(seconds_, [handle]() { handle.resume(); });
+    }
+
+    void await_resume() const noexcept {}
+
+    EventLoop *loop_;
+    double seconds_;
+  };
+  return Awaiter{loop, seconds};
+}
+
+inline auto sleepCoro(EventLoop *loop,
+                      const std::chrono::duration<double> &delay) {
+  return sleepCoro(loop, delay.count());
+}
+
+// Moves the coroutine to the loop, does nothing when it is already there
+inline auto switchToLoop(EventLoop *loop) {
+  struct Awaiter {
+    bool await_ready() const noexcept { return loop_->isInLoopThread(); }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+      loop_->queueInLoop([handle]() { handle.resume(); });
+    }
+
+    void await_resume() const noexcept {}
+
+    EventLoop *loop_;
+  };
+  return Awaiter{loop};
+}
+
+class TcpStream;
+using TcpStreamPtr = std::shared_ptr<TcpStream>;
+
+// A connection read and written by a coroutine. It is used in the loop of
+// the connection, where the awaiting coroutine is resumed straight from the
+// callbacks of the connection. The stream takes the high water mark and
+// drain callbacks of the connection; its owner passes the messages and the
+// close on with onMessage() and onClose(), as connect() and serve() do. One
+// read and one write may be awaited at a time.
+class TcpStream : NonCopyable, public std::enable_shared_from_this<TcpStream> {
+ public:
+  // Keeps owner, e.g. the TcpClient of the connection, while it lives
+  explicit TcpStream(const TcpConnectionPtr &conn,
+                     std::shared_ptr<void> owner = nullptr)
+      : conn_(conn), owner_(std::move(owner)), closed_(!conn->connected()) {
+    conn_->setHighWaterMarkCallback(
+        [this](const TcpConnectionPtr &, size_t) { buffered_ = true; }, 0);
+    conn_->setDrainCallback([this](const TcpConnectionPtr &) {
+      buffered_ = false;
+      wakeWriter();
+    });
+  }
+
+  ~TcpStream() {
+    conn_->setHighWaterMarkCallback(nullptr, 0);
+    conn_->setDrainCallback(nullptr);
+    if (owner_) {
+      // The owner may be calling back right now
+      conn_->getLoop()->queueInLoop([owner = std::move(owner_)]() {});
+    }
+  }
+
+  // Exactly length bytes, fewer when the connection closed first
+  auto read(size_t length) {
+    return ReadAwaiter(shared_from_this(), ReadMode::Length, length);
+  }
+
+  // Up to and including delimiter, or what is left when the connection
+  // closed first
+  auto readUntil(std::string delimiter) {
+    return ReadAwaiter(shared_from_this(), ReadMode::Delimiter, 0,
+                       std::move(delimiter));
+  }
+
+  // What has been received, empty only when the connection is closed
+  auto readSome() {
+    return ReadAwaiter(shared_from_this(), ReadMode::Some, 0);
+  }
+
+  // Sends data at once, the awaiting coroutine resumes when the kernel has
+  // taken all of it. Resolves to false when the connection is closed.
+  auto write(std::string data) {
+    if (!closed_) conn_->send(std::move(data));
+    return WriteAwaiter{shared_from_this()};
+  }
+
+  // Closes the writing side once the output is sent
+  void shutdown() { conn_->shutdown(); }
+
+  bool closed() const { return closed_; }
+
+  const TcpConnectionPtr &connection() const { return conn_; }
+
+  void onMessage() { wakeReader(); }
+
+  void onClose() {
+    closed_ = true;
+    auto thisPtr = shared_from_this();
+    wakeReader();
+    wakeWriter();
+  }
+
+  // Connects the client, whose callbacks are taken by the stream. Null when
+  // the connection failed.
+  static Task<TcpStreamPtr> connect(std::shared_ptr<TcpClient> client) {
+    // Named, as GCC 12 may destroy an awaited braced temporary twice
+    ConnectAwaiter awaiter{std::make_shared<ConnectState>()};
+    awaiter.state_->client_ = std::move(client);
+    auto stream = co_await awaiter;
+    co_return stream;
+  }
+
+  // Handles every connection of the server with a coroutine, started in the
+  // loop of the connection. The connection is shut down when it returns.
+  static void serve(TcpServer &server,
+                    std::function<Task<>(TcpStreamPtr)> handler) {
+    server.setConnectionCallback([handler = std::move(handler)](
+                                     const TcpConnectionPtr &conn) {
+      if (conn->connected()) {
+        auto stream = std::make_shared<TcpStream>(conn);
+        conn->setContext(stream);
+        asyncRun([](TcpStreamPtr stream, Task<> task) -> Task<> {
+          co_await std::move(task);
+          stream->shutdown();
+        }(stream, handler(stream)));
+      } else if (conn->hasContext()) {
+        auto stream = conn->getContext<TcpStream>();
+        conn->clearContext();
+        stream->onClose();
+      }
+    });
+    server.setRecvMessageCallback(
+        [](const TcpConnectionPtr &conn, MsgBuffer *) {
+          auto stream = conn->getContext<TcpStream>();
+          if (stream) stream->onMessage();
+        });
+  }
+
+ private:
+  enum class ReadMode { Length, Delimiter, Some };
+
+  struct ReadAwaiter {
+    ReadAwaiter(TcpStreamPtr stream, ReadMode mode, size_t length,
+                std::string delimiter = {})
+        : stream_(std::move(stream)),
+          mode_(mode),
+          length_(length),
+          delimiter_(std::move(delimiter)) {}
+
+    bool await_ready() { return stream_->take(*this); }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+      stream_->reader_ = this;
+      stream_->readerHandle_ = handle;
+    }
+
+    std::string await_resume() { return std::move(result_); }
+
+    TcpStreamPtr stream_;
+    ReadMode mode_;
+    size_t length_;
+    std::string delimiter_;
+    // Where the search for the delimiter goes on
+    size_t searched_{0};
+    std::string result_;
+  };
+
+  struct WriteAwaiter {
+    bool await_ready() const noexcept {
+      return !stream_->buffered_ || stream_->closed_;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+      stream_->writerHandle_ = handle;
+    }
+
+    bool await_resume() const noexcept { return !stream_->closed_; }
+
+    TcpStreamPtr stream_;
+  };
+
+  // Holds the client while it connects, then the stream holds it
+  struct ConnectState {
+    std::shared_ptr<TcpClient> client_;
+    std::coroutine_handle<> handle_;
+    TcpStreamPtr result_;
+    std::weak_ptr<TcpStream> stream_;
+  };
+
+  struct ConnectAwaiter {
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+      auto state = state_;
+      auto client = state->client_;
+      state->handle_ = handle;
+      client->setConnectionCallback(
+          [state](const TcpConnectionPtr &conn) {
+            if (conn->connected() && state->client_) {
+              auto stream = std::make_shared<TcpStream>(
+                  conn, std::move(state->client_));
+              state->stream_ = stream;
+              state->result_ = std::move(stream);
+              std::exchange(state->handle_, {}).resume();
+            } else if (auto stream = state->stream_.lock()) {
+              stream->onClose();
+            }
+          });
+      client->setConnectionErrorCallback([state]() {
+        if (!state->client_) return;
+        // The client is calling back right now
+        auto loop = state->client_->getLoop();
+        loop->queueInLoop([client = std::move(state->client_)]() {});
+        std::exchange(state->handle_, {}).resume();
+      });
+      client->setMessageCallback(
+          [state](const TcpConnectionPtr &, MsgBuffer *) {
+            if (auto stream = state->stream_.lock()) stream->onMessage();
+          });
+      client->connect();
+    }
+
+    TcpStreamPtr await_resume() { return std::move(state_->result_); }
+
+    std::shared_ptr<ConnectState> state_;
+  };
+
+  // Takes the result of the read out of the buffer, false while it is not
+  // there yet
+  bool take(ReadAwaiter &read) {
+    auto buffer = conn_->getRecvBuffer();
+    auto readable = buffer->readableBytes();
+    size_t length = readable;
+    switch (read.mode_) {
+      case ReadMode::Length:
+        if (readable < read.length_ && !closed_) return false;
+        length = std::min(read.length_, readable);
+        break;
+      case ReadMode::Delimiter: {
+        auto &delimiter = read.delimiter_;
+        auto end = buffer->peek() + readable;
+        auto found = std::search(buffer->peek() + read.searched_, end,
+                                 delimiter.begin(), delimiter.end());
+        if (found != end) {
+          length = found - buffer->peek() + delimiter.size();
+        } else if (!closed_) {
+          read.searched_ = readable >= delimiter.size()
+                               ? readable - delimiter.size() + 1
+                               : 0;
+          return false;
+        }
+        break;
+      }
+      case ReadMode::Some:
+        if (readable == 0 && !closed_) return false;
+        break;
+    }
+    read.result_.assign(buffer->peek(), length);
+    buffer->retrieve(length);
+    return true;
+  }
+
+  void wakeReader() {
+    if (reader_ && take(*reader_)) {
+      reader_ = nullptr;
+      std::exchange(readerHandle_, {}).resume();
+    }
+  }
+
+  void wakeWriter() {
+    if (writerHandle_ && (!buffered_ || closed_)) {
+      std::exchange(writerHandle_, {}).resume();
+    }
+  }
+
+  TcpConnectionPtr conn_;
+  std::shared_ptr<void> owner_;
+  bool closed_;
+  // Output is waiting in the buffer of the connection
+  bool buffered_{false};
+  ReadAwaiter *reader_{nullptr};
+  std::coroutine_handle<> readerHandle_;
+  std::coroutine_handle<> writerHandle_;
+};
+
+}  // namespace canary
+
+#endif  // CANARY_HAS_COROUTINE
@@ -13,6 +13,7 @@
 #include <thread>
 
 #include "Channel.h"
+#include "Clock.h"
 #include "inner/Poller.h"
 #include "inner/TimerQueue.h"
 
@@ -119,11 +120,15 @@ void EventLoop::loop() {
   std::exception_ptr loopException;
   try {
 
-    auto loopFlagCleaner = makeScopeExit(
-        [this]() { looping_.store(false, std::memory_order_release); });
+    auto loopFlagCleaner = makeScopeExit([this]() {
+      looping_.store(false, std::memory_order_release);
+      CachedClock::invalidate();
+    });
     while (!quit_.load(std::memory_order_acquire)) {
       activeChannels_.clear();
       poller_->poll(kPollTimeMs, &activeChannels_);
+      // One reading of the clocks for the whole iteration
+      CachedClock::update();
 
       eventHandling_ = true;
       for (auto it = activeChannels_.begin(); it != activeChannels_.end();
@@ -193,25 +198,32 @@ TimerId EventLoop::runAt(const Date &time, Func &&cb) {
   return timerQueue_->addTimer(std::move(cb), tp, std::chrono::microseconds(0));
 }
 
+// The delay counts from the cached time of the iteration
 TimerId EventLoop::runAfter(double delay, const Func &cb) {
-  return runAt(Date::date().after(delay), cb);
+  std::chrono::microseconds dur(
+      static_cast<std::chrono::microseconds::rep>(delay * 1000000));
+  auto tp = CachedClock::steadyNow() + dur;
+  return timerQueue_->addTimer(cb, tp, std::chrono::microseconds(0));
 }
 
 TimerId EventLoop::runAfter(double delay, Func &&cb) {
-  return runAt(Date::date().after(delay), std::move(cb));
+  std::chrono::microseconds dur(
+      static_cast<std::chrono::microseconds::rep>(delay * 1000000));
+  auto tp = CachedClock::steadyNow() + dur;
+  return timerQueue_->addTimer(std::move(cb), tp, std::chrono::microseconds(0));
 }
 
 TimerId EventLoop::runEvery(double interval, const Func &cb) {
   std::chrono::microseconds dur(
       static_cast<std::chrono::microseconds::rep>(interval * 1000000));
-  auto tp = std::chrono::steady_clock::now() + dur;
+  auto tp = CachedClock::steadyNow() + dur;
   return timerQueue_->addTimer(cb, tp, dur);
 }
 
 TimerId EventLoop::runEvery(double interval, Func &&cb) {
   std::chrono::microseconds dur(
       static_cast<std::chrono::microseconds::rep>(interval * 1000000));
-  auto tp = std::chrono::steady_clock::now() + dur;
+  auto tp = CachedClock::steadyNow() + dur;
   return timerQueue_->addTimer(std::move(cb), tp, dur);
 }
 
@@ -0,0 +1,618 @@
+#include "Resolver.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+
+#include "Channel.h"
+
+using namespace canary;
+
+namespace canary {
+static constexpr uint16_t kTypeA{1};
+static constexpr uint16_t kTypeCname{5};
+static constexpr uint16_t kTypeSoa{6};
+static constexpr uint16_t kTypeAaaa{28};
+static constexpr uint16_t kClassIn{1};
+static constexpr int kNoError{0};
+static constexpr int kNxDomain{3};
+// The queries of a lookup, in the order of Lookup::ids_
+static constexpr uint16_t kQueryTypes[2] = {kTypeA, kTypeAaaa};
+static constexpr uint32_t kNoTtl{std::numeric_limits<uint32_t>::max()};
+// Expired entries are dropped when the cache grows beyond this
+static constexpr size_t kCachePurgeSize{4096};
+// Like MAXNS of glibc
+static constexpr size_t kMaxServers{3};
+
+struct CacheEntry {
+  std::vector<InetAddress> addresses_;
+  Date expiry_;
+};
+
+static std::mutex &cacheMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+// Shared by the resolvers, keyed by the servers asked and the name
+static std::unordered_map<std::string, CacheEntry> &cache() {
+  static std::unordered_map<std::string, CacheEntry> entries;
+  return entries;
+}
+
+static std::string toLower(string_view text) {
+  std::string result(text);
+  for (auto &c : result) {
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+  }
+  return result;
+}
+
+static std::string readFile(const std::string &path) {
+  std::ifstream file(path);
+  std::stringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
+// A numeric IPv4 or IPv6 address, the latter possibly in brackets
+static bool parseAddress(string_view text, InetAddress *address) {
+  if (text.size() > 2 && text.front() == '[' && text.back() == ']') {
+    text = text.substr(1, text.size() - 2);
+  }
+  std::string ip(text);
+  struct sockaddr_in6 addr6;
+  memset(&addr6, 0, sizeof(addr6));
+  if (::inet_pton(AF_INET6, ip.c_str(), &addr6.sin6_addr) == 1) {
+    addr6.sin6_family = AF_INET6;
+    *address = InetAddress(addr6);
+    return true;
+  }
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  if (::inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) == 1) {
+    addr.sin_family = AF_INET;
+    *address = InetAddress(addr);
+    return true;
+  }
+  return false;
+}
+
+static void appendInt16(std::string *out, uint16_t value) {
+  out->push_back(static_cast<char>(value >> 8));
+  out->push_back(static_cast<char>(value & 0xff));
+}
+
+// The name in labels, false if it is no valid domain name
+static bool appendName(std::string *out, string_view name) {
+  if (name.empty() || name.size() > 253) return false;
+  size_t start = 0;
+  while (start <= name.size()) {
+    auto dot = name.find('.', start);
+    if (dot == string_view::npos) dot = name.size();
+    auto length = dot - start;
+    if (length == 0 || length > 63) return false;
+    out->push_back(static_cast<char>(length));
+    out->append(name.data() + start, length);
+    start = dot + 1;
+  }
+  out->push_back('\0');
+  return true;
+}
+
+static std::string buildQuery(uint16_t id, const std::string &name,
+                              uint16_t type) {
+  std::string query;
+  appendInt16(&query, id);
+  appendInt16(&query, 0x0100);  // recursion desired
+  appendInt16(&query, 1);
+  appendInt16(&query, 0);
+  appendInt16(&query, 0);
+  appendInt16(&query, 0);
+  appendName(&query, name);
+  appendInt16(&query, type);
+  appendInt16(&query, kClassIn);
+  return query;
+}
+
+// Reads a DNS message, the reads after the end of it fail and return 0
+class DnsReader {
+ public:
+  DnsReader(const uint8_t *data, size_t length, size_t position = 0)
+      : data_(data), length_(length), position_(position) {}
+
+  bool ok() const { return ok_; }
+
+  size_t position() const { return position_; }
+
+  uint16_t readInt16() {
+    if (!check(2)) return 0;
+    uint16_t value = (data_[position_] << 8) | data_[position_ + 1];
+    position_ += 2;
+    return value;
+  }
+
+  uint32_t readInt32() {
+    uint32_t high = readInt16();
+    return (high << 16) | readInt16();
+  }
+
+  void skip(size_t length) {
+    if (check(length)) position_ += length;
+  }
+
+  // A name in lower case, following compression pointers
+  std::string readName() {
+    std::string name;
+    size_t position = position_;
+    bool jumped = false;
+    for (int hops = 0; ok_;) {
+      if (position >= length_) break;
+      uint8_t length = data_[position];
+      if ((length & 0xc0) == 0xc0) {
+        if (position + 1 >= length_ || ++hops > 64) break;
+        if (!jumped) position_ = position + 2;
+        jumped = true;
+        position = ((length & 0x3f) << 8) | data_[position + 1];
+        continue;
+      }
+      if ((length & 0xc0) != 0 || position + 1 + length > length_) break;
+      if (length == 0) {
+        if (!jumped) position_ = position + 1;
+        return name;
+      }
+      if (!name.empty()) name.push_back('.');
+      name += toLower(string_view(
+          reinterpret_cast<const char *>(data_) + position + 1, length));
+      position += 1 + length;
+    }
+    ok_ = false;
+    return std::string();
+  }
+
+ private:
+  bool check(size_t length) {
+    if (ok_ && position_ + length <= length_) return true;
+    ok_ = false;
+    return false;
+  }
+
+  const uint8_t *data_;
+  size_t length_;
+  size_t position_;
+  bool ok_{true};
+};
+
+struct DnsResponse {
+  uint16_t id_{0};
+  int rcode_{0};
+  bool truncated_{false};
+  std::string name_;
+  uint16_t type_{0};
+  std::vector<InetAddress> addresses_;
+  uint32_t ttl_{kNoTtl};
+  // From the SOA record of a negative answer
+  bool hasSoa_{false};
+  uint32_t negativeTtl_{kNoTtl};
+};
+
+static bool parseResponse(const char *data, size_t length,
+                          DnsResponse *response) {
+  auto bytes = reinterpret_cast<const uint8_t *>(data);
+  DnsReader reader(bytes, length);
+  response->id_ = reader.readInt16();
+  auto flags = reader.readInt16();
+  auto questions = reader.readInt16();
+  auto answers = reader.readInt16();
+  auto authorities = reader.readInt16();
+  reader.readInt16();  // additional records
+  if (!reader.ok() || !(flags & 0x8000) || questions != 1) return false;
+  response->rcode_ = flags & 0x0f;
+  response->truncated_ = (flags & 0x0200) != 0;
+  response->name_ = reader.readName();
+  response->type_ = reader.readInt16();
+  reader.readInt16();  // class
+
+  // The addresses of the name and of the names it is an alias of
+  std::vector<std::string> names{response->name_};
+  for (uint16_t i = 0; i < answers && reader.ok(); ++i) {
+    auto owner = reader.readName();
+    auto type = reader.readInt16();
+    auto rrClass = reader.readInt16();
+    auto ttl = reader.readInt32();
+    auto rdLength = reader.readInt16();
+    auto rdata = reader.position();
+    reader.skip(rdLength);
+    if (!reader.ok() || rrClass != kClassIn ||
+        std::find(names.begin(), names.end(), owner) == names.end()) {
+      continue;
+    }
+    if (type == kTypeCname) {
+      DnsReader target(bytes, rdata + rdLength, rdata);
+      auto alias = target.readName();
+      if (target.ok()) names.push_back(std::move(alias));
+      continue;
+    }
+    if (type != response->type_) continue;
+    if (type == kTypeA && rdLength == 4) {
+      struct sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      memcpy(&addr.sin_addr, bytes + rdata, 4);
+      response->addresses_.emplace_back(addr);
+    } else if (type == kTypeAaaa && rdLength == 16) {
+      struct sockaddr_in6 addr6;
+      memset(&addr6, 0, sizeof(addr6));
+      addr6.sin6_family = AF_INET6;
+      memcpy(&addr6.sin6_addr, bytes + rdata, 16);
+      response->addresses_.emplace_back(addr6);
+    } else {
+      continue;
+    }
+    response->ttl_ = std::min(response->ttl_, ttl);
+  }
+  for (uint16_t i = 0; i < authorities && reader.ok(); ++i) {
+    reader.readName();
+    auto type = reader.readInt16();
+    reader.readInt16();
+    auto ttl = reader.readInt32();
+    auto rdLength = reader.readInt16();
+    auto rdata = reader.position();
+    reader.skip(rdLength);
+    if (!reader.ok() || type != kTypeSoa) continue;
+    // The names of the server and of the mailbox, four times and the
+    // minimum TTL
+    DnsReader soa(bytes, rdata + rdLength, rdata);
+    soa.readName();
+    soa.readName();
+    soa.skip(16);
+    auto minimum = soa.readInt32();
+    if (soa.ok()) {
+      response->hasSoa_ = true;
+      response->negativeTtl_ = std::min(ttl, minimum);
+    }
+  }
+  return reader.ok();
+}
+}  // namespace canary
+
+ResolverPtr Resolver::newResolver(EventLoop *loop) {
+  auto config = parseResolvConf(readFile("/etc/resolv.conf"));
+  auto resolver = std::make_shared<Resolver>(loop, config.servers_);
+  resolver->setTimeout(config.timeout_);
+  resolver->setAttempts(config.attempts_);
+  return resolver;
+}
+
+Resolver::Resolver(EventLoop *loop, const std::vector<InetAddress> &servers,
+                   const std::string &hostsPath)
+    : loop_(loop), random_(std::random_device()()) {
+  for (auto &server : servers) {
+    servers_.push_back(server);
+    cacheKey_ += server.toIpPort();
+    cacheKey_ += ' ';
+  }
+  if (!hostsPath.empty()) hosts_ = parseHosts(readFile(hostsPath));
+}
+
+Resolver::~Resolver() {
+  for (auto &lookup : lookups_) closeSocket(lookup.second);
+}
+
+Resolver::Config Resolver::parseResolvConf(string_view text) {
+  Config config;
+  std::istringstream lines{std::string(text)};
+  std::string line;
+  while (std::getline(lines, line)) {
+    auto comment = line.find_first_of("#;");
+    if (comment != std::string::npos) line.resize(comment);
+    std::istringstream words(line);
+    std::string keyword, value;
+    words >> keyword;
+    if (keyword == "nameserver" && words >> value) {
+      // A scope of an IPv6 address is not kept
+      value = value.substr(0, value.find('%'));
+      InetAddress address;
+      if (config.servers_.size() < kMaxServers &&
+          parseAddress(value, &address)) {
+        address.setPortNetEndian(htons(53));
+        config.servers_.push_back(address);
+      }
+    } else if (keyword == "options") {
+      while (words >> value) {
+        if (value.compare(0, 8, "timeout:") == 0) {
+          config.timeout_ =
+              std::min(std::max(atoi(value.c_str() + 8), 1), 30);
+        } else if (value.compare(0, 9, "attempts:") == 0) {
+          config.attempts_ = std::min(std::max(atoi(value.c_str() + 9), 1), 5);
+        }
+      }
+    }
+  }
+  if (config.servers_.empty()) {
+    config.servers_.push_back(InetAddress("127.0.0.1", 53));
+  }
+  return config;
+}
+
+std::unordered_map<std::string, std::vector<InetAddress>> Resolver::parseHosts(
+    string_view text) {
+  std::unordered_map<std::string, std::vector<InetAddress>> hosts;
+  std::istringstream lines{std::string(text)};
+  std::string line;
+  while (std::getline(lines, line)) {
+    auto comment = line.find('#');
+    if (comment != std::string::npos) line.resize(comment);
+    std::istringstream words(line);
+    std::string ip, name;
+    InetAddress address;
+    if (!(words >> ip) || !parseAddress(ip, &address)) continue;
+    while (words >> name) {
+      auto &addresses = hosts[toLower(name)];
+      auto same = std::find_if(addresses.begin(), addresses.end(),
+                               [&address](const InetAddress &other) {
+                                 return other.toIp() == address.toIp();
+                               });
+      if (same == addresses.end()) addresses.push_back(address);
+    }
+  }
+  for (auto &host : hosts) {
+    std::stable_partition(
+        host.second.begin(), host.second.end(),
+        [](const InetAddress &address) { return !address.isIpV6(); });
+  }
+  return hosts;
+}
+
+void Resolver::clearCache() {
+  std::lock_guard<std::mutex> lock(cacheMutex());
+  cache().clear();
+}
+
+void Resolver::resolve(const std::string &name, Callback &&callback) {
+  if (loop_->isInLoopThread()) {
+    resolveInLoop(name, std::move(callback));
+    return;
+  }
+  auto thisPtr = shared_from_this();
+  loop_->queueInLoop(
+      [thisPtr, name, callback = std::move(callback)]() mutable {
+        thisPtr->resolveInLoop(name, std::move(callback));
+      });
+}
+
+void Resolver::resolveInLoop(const std::string &name, Callback &&callback) {
+  InetAddress address;
+  if (parseAddress(name, &address)) {
+    callback({address});
+    return;
+  }
+  auto key = toLower(name);
+  if (!key.empty() && key.back() == '.') key.pop_back();
+  auto host = hosts_.find(key);
+  if (host != hosts_.end()) {
+    callback(host->second);
+    return;
+  }
+
+  std::vector<InetAddress> cached;
+  bool found = false;
+  {
+    std::lock_guard<std::mutex> lock(cacheMutex());
+    auto iter = cache().find(cacheKey_ + key);
+    if (iter != cache().end()) {
+      if (iter->second.expiry_ > Date::now()) {
+        cached = iter->second.addresses_;
+        found = true;
+      } else {
+        cache().erase(iter);
+      }
+    }
+  }
+  if (found) {
+    callback(cached);
+    return;
+  }
+
+  auto pending = lookups_.find(key);
+  if (pending != lookups_.end()) {
+    pending->second->callbacks_.push_back(std::move(callback));
+    return;
+  }
+  std::string question;
+  if (servers_.empty() || !appendName(&question, key)) {
+    callback({});
+    return;
+  }
+  auto lookup = std::make_shared<Lookup>();
+  lookup->name_ = key;
+  for (int i = 0; i < 2; ++i) {
+    lookup->ids_[i] = 0;
+    lookup->done_[i] = false;
+    lookup->negative_[i] = false;
+  }
+  lookup->ttl_ = kNoTtl;
+  lookup->tries_ = 0;
+  lookup->fd_ = -1;
+  lookup->timerId_ = InvalidTimerId;
+  lookup->callbacks_.push_back(std::move(callback));
+  lookups_[key] = lookup;
+  send(lookup);
+}
+
+int Resolver::openSocket(const LookupPtr &lookup,
+                         const InetAddress &server) {
+  closeSocket(lookup);
+  int fd = ::socket(server.family(), SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    0);
+  if (fd < 0) return -1;
+  // Answers from elsewhere are dropped by the kernel
+  socklen_t length = server.isIpV6() ? sizeof(struct sockaddr_in6)
+                                     : sizeof(struct sockaddr_in);
+  if (::connect(fd, server.getSockAddr(), length) < 0) {
+    ::close(fd);
+    return -1;
+  }
+  lookup->fd_ = fd;
+  lookup->channel_ = std::make_shared<Channel>(loop_, fd);
+  std::weak_ptr<Resolver> weakPtr = shared_from_this();
+  std::weak_ptr<Lookup> weakLookup = lookup;
+  auto onRead = [weakPtr, weakLookup]() {
+    auto thisPtr = weakPtr.lock();
+    auto lookup = weakLookup.lock();
+    if (thisPtr && lookup) thisPtr->onRead(lookup);
+  };
+  // An ICMP error is read and dropped, the query times out
+  lookup->channel_->setReadCallback(onRead);
+  lookup->channel_->setErrorCallback(onRead);
+  lookup->channel_->enableReading();
+  return fd;
+}
+
+void Resolver::closeSocket(const LookupPtr &lookup) {
+  if (!lookup->channel_) return;
+  // The channel may be among the active ones of this iteration of the
+  // loop, it goes away later
+  std::shared_ptr<Channel> channel = std::move(lookup->channel_);
+  int fd = lookup->fd_;
+  lookup->fd_ = -1;
+  loop_->queueInLoop([channel, fd]() {
+    channel->disableAll();
+    channel->remove();
+    ::close(fd);
+  });
+}
+
+void Resolver::send(const LookupPtr &lookup) {
+  auto &server = servers_[lookup->tries_ % servers_.size()];
+  ++lookup->tries_;
+  // Answers to the earlier queries are not taken any more
+  int fd = openSocket(lookup, server);
+  for (int i = 0; i < 2; ++i) {
+    if (lookup->done_[i]) continue;
+    auto old = queries_.find(lookup->ids_[i]);
+    if (old != queries_.end() && old->second == lookup) queries_.erase(old);
+    uint16_t id;
+    do {
+      id = static_cast<uint16_t>(random_());
+    } while (queries_.find(id) != queries_.end());
+    lookup->ids_[i] = id;
+    queries_[id] = lookup;
+    if (fd < 0) continue;
+    auto query = buildQuery(id, lookup->name_, kQueryTypes[i]);
+    ::send(fd, query.data(), query.size(), 0);
+  }
+  std::weak_ptr<Resolver> weakPtr = shared_from_this();
+  lookup->timerId_ = loop_->runAfter(timeout_, [weakPtr, lookup]() {
+    auto thisPtr = weakPtr.lock();
+    if (thisPtr) thisPtr->onTimeout(lookup);
+  });
+}
+
+void Resolver::onTimeout(const LookupPtr &lookup) {
+  auto iter = lookups_.find(lookup->name_);
+  if (iter == lookups_.end() || iter->second != lookup) return;
+  lookup->timerId_ = InvalidTimerId;
+  if (lookup->tries_ >= attempts_ * servers_.size()) {
+    finish(lookup);
+  } else {
+    send(lookup);
+  }
+}
+
+void Resolver::onRead(const LookupPtr &lookup) {
+  char buffer[4096];
+  // Until a response finishes the lookup or sends its queries again
+  int fd = lookup->fd_;
+  while (fd >= 0 && lookup->fd_ == fd) {
+    auto n = ::recv(fd, buffer, sizeof(buffer), 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      // EAGAIN, or an ICMP error of a query
+      return;
+    }
+    onResponse(lookup, buffer, static_cast<size_t>(n));
+  }
+}
+
+void Resolver::onResponse(const LookupPtr &lookup, const char *data,
+                          size_t length) {
+  DnsResponse response;
+  if (!parseResponse(data, length, &response)) return;
+  auto iter = queries_.find(response.id_);
+  if (iter == queries_.end() || iter->second != lookup) return;
+  int index = lookup->ids_[0] == response.id_ ? 0 : 1;
+  if (lookup->ids_[index] != response.id_ || lookup->done_[index] ||
+      response.name_ != lookup->name_ ||
+      response.type_ != kQueryTypes[index]) {
+    return;
+  }
+  queries_.erase(iter);
+
+  bool answered = response.rcode_ == kNoError || response.rcode_ == kNxDomain;
+  if (response.truncated_ && response.addresses_.empty()) answered = false;
+  if (!answered) {
+    // SERVFAIL, REFUSED and the like: the next server
+    loop_->invalidateTimer(lookup->timerId_);
+    lookup->timerId_ = InvalidTimerId;
+    if (lookup->tries_ >= attempts_ * servers_.size()) {
+      finish(lookup);
+    } else {
+      send(lookup);
+    }
+    return;
+  }
+  lookup->done_[index] = true;
+  if (!response.addresses_.empty()) {
+    lookup->ttl_ = std::min(lookup->ttl_, response.ttl_);
+    lookup->addresses_[index] = std::move(response.addresses_);
+  } else if (response.hasSoa_) {
+    lookup->negative_[index] = true;
+    lookup->ttl_ = std::min(lookup->ttl_, response.negativeTtl_);
+  }
+  if (lookup->done_[0] && lookup->done_[1]) finish(lookup);
+}
+
+void Resolver::finish(const LookupPtr &lookup) {
+  if (lookup->timerId_ != InvalidTimerId) {
+    loop_->invalidateTimer(lookup->timerId_);
+  }
+  for (auto id : lookup->ids_) {
+    auto iter = queries_.find(id);
+    if (iter != queries_.end() && iter->second == lookup) queries_.erase(iter);
+  }
+  lookups_.erase(lookup->name_);
+  closeSocket(lookup);
+
+  auto addresses = std::move(lookup->addresses_[0]);
+  addresses.insert(addresses.end(), lookup->addresses_[1].begin(),
+                   lookup->addresses_[1].end());
+  // What the servers did not answer is not cached
+  bool cacheable = !addresses.empty() ||
+                   (lookup->negative_[0] && lookup->negative_[1]);
+  if (cacheable && lookup->ttl_ > 0 && lookup->ttl_ != kNoTtl) {
+    auto now = Date::now();
+    std::lock_guard<std::mutex> lock(cacheMutex());
+    auto &entries = cache();
+    if (entries.size() >= kCachePurgeSize) {
+      for (auto iter = entries.begin(); iter != entries.end();) {
+        if (iter->second.expiry_ <= now) {
+          iter = entries.erase(iter);
+        } else {
+          ++iter;
+        }
+      }
+    }
+    entries[cacheKey_ + lookup->name_] =
+        CacheEntry{addresses, now.after(lookup->ttl_)};
+  }
+  auto callbacks = std::move(lookup->callbacks_);
+  for (auto &callback : callbacks) callback(addresses);
+}
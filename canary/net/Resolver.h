@@ -0,0 +1,131 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "NonCopyable.h"
+#include "StringView.h"
+
+namespace canary {
+
+class Channel;
+class Resolver;
+using ResolverPtr = std::shared_ptr<Resolver>;
+
+// A non-blocking stub resolver working in one loop. A name is looked up in
+// the hosts file, then in a cache shared by all the resolvers asking the
+// same name servers, and last with A and AAAA queries sent over UDP to the
+// name servers in turn. Answers are cached for their TTL; names without an
+// address are cached for the TTL of the SOA record of the negative answer
+// (RFC 2308). Concurrent lookups of a name share their queries. Names are
+// used as given, search domains are not applied, and truncated answers are
+// not retried over TCP. Every round of queries goes out from a socket of its
+// own, so an answer has to guess the port picked by the kernel as well as
+// the query id.
+class Resolver : NonCopyable, public std::enable_shared_from_this<Resolver> {
+ public:
+  // The addresses have port 0, the IPv4 ones first. Empty when the name
+  // has no address or the servers did not answer.
+  using Callback = std::function<void(const std::vector<InetAddress> &)>;
+
+  struct Config {
+    // 127.0.0.1 when resolv.conf names none
+    std::vector<InetAddress> servers_;
+    double timeout_{5.0};
+    int attempts_{2};
+  };
+
+  // With the name servers and options of /etc/resolv.conf and the names of
+  // /etc/hosts, read here
+  static ResolverPtr newResolver(EventLoop *loop);
+
+  // The hosts file is read here, an empty path reads none
+  Resolver(EventLoop *loop, const std::vector<InetAddress> &servers,
+           const std::string &hostsPath = "/etc/hosts");
+
+  ~Resolver();
+
+  // Numeric addresses are returned as they are. May be called in any
+  // thread, the callback is called in the loop.
+  void resolve(const std::string &name, Callback &&callback);
+
+  // The setters are to be called before the first lookup
+
+  // How long each server is waited for, 5 seconds by default
+  void setTimeout(double seconds) { timeout_ = seconds; }
+
+  // Rounds over the servers, 2 by default
+  void setAttempts(int attempts) { attempts_ = attempts > 0 ? attempts : 1; }
+
+  EventLoop *getLoop() const { return loop_; }
+
+  static Config parseResolvConf(string_view text);
+
+  // The names are in lower case
+  static std::unordered_map<std::string, std::vector<InetAddress>> parseHosts(
+      string_view text);
+
+  // Empties the cache shared by the resolvers
+  static void clearCache();
+
+ private:
+  // The lookup of a name, an A and an AAAA query
+  struct Lookup {
+    std::string name_;
+    uint16_t ids_[2];
+    bool done_[2];
+    // An answer saying there is no such address
+    bool negative_[2];
+    std::vector<InetAddress> addresses_[2];
+    // The TTL of the answers so far
+    uint32_t ttl_;
+    // Queries sent so far, the server is tries_ % servers_.size()
+    size_t tries_;
+    // The socket of the latest queries, connected to their server
+    int fd_;
+    std::shared_ptr<Channel> channel_;
+    TimerId timerId_;
+    std::vector<Callback> callbacks_;
+  };
+  using LookupPtr = std::shared_ptr<Lookup>;
+
+  void resolveInLoop(const std::string &name, Callback &&callback);
+
+  // Sends the queries not answered yet to the next server
+  void send(const LookupPtr &lookup);
+
+  void onTimeout(const LookupPtr &lookup);
+
+  void onRead(const LookupPtr &lookup);
+
+  void onResponse(const LookupPtr &lookup, const char *data, size_t length);
+
+  void finish(const LookupPtr &lookup);
+
+  // Replaces the socket of lookup with a new one connected to server,
+  // returns -1 on failure
+  int openSocket(const LookupPtr &lookup, const InetAddress &server);
+
+  void closeSocket(const LookupPtr &lookup);
+
+  EventLoop *loop_;
+  std::vector<InetAddress> servers_;
+  // Identifies the servers in the shared cache
+  std::string cacheKey_;
+  std::unordered_map<std::string, std::vector<InetAddress>> hosts_;
+  double timeout_{5.0};
+  int attempts_{2};
+
+  // Only touched in the loop
+  std::unordered_map<std::string, LookupPtr> lookups_;
+  std::unordered_map<uint16_t, LookupPtr> queries_;
+  std::mt19937 random_;
+};
+
+}  // namespace canary
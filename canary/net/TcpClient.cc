@@ -33,8 +33,13 @@ static void defaultMessageCallback(const TcpConnectionPtr &, MsgBuffer *buf) {
 
 TcpClient::TcpClient(EventLoop *loop, const InetAddress &serverAddr,
                      const std::string &nameArg)
+    : TcpClient(loop, std::vector<InetAddress>{serverAddr}, nameArg) {}
+
+TcpClient::TcpClient(EventLoop *loop,
+                     const std::vector<InetAddress> &serverAddrs,
+                     const std::string &nameArg)
     : loop_(loop),
-      connector_(new Connector(loop, serverAddr, false)),
+      connector_(new Connector(loop, serverAddrs, false)),
       name_(nameArg),
       connectionCallback_(defaultConnectionCallback),
       messageCallback_(defaultMessageCallback),
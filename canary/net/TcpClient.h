@@ -5,6 +5,7 @@
 #include <atomic>
 #include <functional>
 #include <thread>
+#include <vector>
 
 #include "EventLoop.h"
 #include "InetAddress.h"
@@ -20,6 +21,11 @@ class TcpClient : NonCopyable, public std::enable_shared_from_this<TcpClient> {
  public:
   TcpClient(EventLoop *loop, const InetAddress &serverAddr,
             const std::string &nameArg);
+
+  // Connects to the first of the addresses of a server to answer, IPv6 and
+  // IPv4 raced as in RFC 8305, e.g. the addresses given by a Resolver
+  TcpClient(EventLoop *loop, const std::vector<InetAddress> &serverAddrs,
+            const std::string &nameArg);
   ~TcpClient();
 
   void connect();
@@ -6,6 +6,7 @@
 
 #include "Callback.h"
 #include "EventLoop.h"
+#include "GzipStream.h"
 #include "InetAddress.h"
 #include "MsgBuffer.h"
 #include "NonCopyable.h"
@@ -34,6 +35,9 @@ class TcpConnection {
   virtual void send(const std::shared_ptr<std::string> &msgPtr) = 0;
   virtual void send(const std::shared_ptr<MsgBuffer> &msgPtr) = 0;
 
+  // Sends a file in the kernel. A pipe or a device is sent as it is read
+  // until its end when no length is given, spliced through a pipe; a
+  // device splice() does not read ends at once, and the next send goes on.
   virtual void sendFile(const char *fileName, size_t offset = 0,
                         size_t length = 0) = 0;
 
@@ -43,6 +47,21 @@ class TcpConnection {
   virtual void sendStream(
       std::function<std::size_t(char *, std::size_t)> callback) = 0;
 
+  // Like sendStream(), but the data is gzip compressed on the fly with
+  // constant memory, the callback produces the uncompressed bytes.
+  void sendGzipStream(std::function<std::size_t(char *, std::size_t)> callback,
+                      int level = -1) {
+    sendStream(GzipEncoder::wrapStream(std::move(callback), level));
+  }
+
+  // Forwards what is received from now on, the receive buffer first, to
+  // another unencrypted connection in the same loop with splice(), the
+  // bytes never reach user space and the receive callback is not called.
+  // Call it on both sides for a proxy, and shut one side down when the
+  // other disconnects; once to has closed, what is received is dropped.
+  // Without a descriptor to spare for the pipe the bytes are copied.
+  virtual void forward(const TcpConnectionPtr &to) = 0;
+
   virtual const InetAddress &localAddr() const = 0;
 
   virtual const InetAddress &peerAddr() const = 0;
@@ -56,8 +75,35 @@ class TcpConnection {
   virtual void setHighWaterMarkCallback(const HighWaterMarkCallback &cb,
                                         size_t markLen) = 0;
 
+  // Called every time the output buffer has been completely flushed, after
+  // the owner's write complete callback, and once more when the connection
+  // closes, disconnected() being true then. Together with the high water
+  // mark callback this lets a producer pause and resume.
+  virtual void setDrainCallback(const WriteCompleteCallback &cb) = 0;
+
+  // The callbacks set above, for whoever borrows them to put them back
+  virtual const HighWaterMarkCallback &highWaterMarkCallback() const = 0;
+
+  virtual size_t highWaterMarkLength() const = 0;
+
+  virtual const WriteCompleteCallback &drainCallback() const = 0;
+
   virtual void setTcpNoDelay(bool on) = 0;
 
+  // Sends the messages of at least threshold bytes given by shared_ptr or
+  // moved in with MSG_ZEROCOPY: the kernel reads them in place, so they
+  // must not change, and they are released when it is done with them. It
+  // pays from some tens of KiB, and turns itself off when the kernel copies
+  // anyway, as on loopback. 0 turns it off.
+  virtual void setZeroCopyThreshold(size_t threshold) = 0;
+
+  // Stops and resumes reading the socket, for a consumer that falls behind.
+  // What is already in the receive buffer is not handed over again when
+  // reading resumes, only new data is.
+  virtual void stopRecv() = 0;
+
+  virtual void startRecv() = 0;
+
   virtual void shutdown() = 0;
 
   virtual void forceClose() = 0;
@@ -0,0 +1,149 @@
+#include "WorkerPool.h"
+
+#include <sys/prctl.h>
+
+#include <chrono>
+#include <random>
+
+using namespace canary;
+
+namespace canary {
+
+enum JobState { kPending, kRunning, kStopping, kCancelled };
+
+struct WorkerPool::JobHandle::Job {
+  std::function<void()> func_;
+  std::atomic<int> state_{kPending};
+  // Released once the job ran or was dropped, which expires the handles
+  std::shared_ptr<Job> self_;
+};
+
+// The pool and worker of the current thread
+static thread_local WorkerPool *t_pool = nullptr;
+static thread_local size_t t_worker = 0;
+
+}  // namespace canary
+
+thread_local WorkerPool::Job *WorkerPool::currentJob_ = nullptr;
+
+bool WorkerPool::JobHandle::cancel() {
+  auto job = job_.lock();
+  if (!job) return false;
+  int expected = kPending;
+  if (job->state_.compare_exchange_strong(expected, kCancelled)) return true;
+  if (expected == kRunning) {
+    job->state_.compare_exchange_strong(expected, kStopping);
+  }
+  return false;
+}
+
+WorkerPool::WorkerPool(size_t threadNum, const std::string &name) {
+  if (threadNum == 0) threadNum = 1;
+  for (size_t i = 0; i < threadNum; ++i) {
+    workers_.emplace_back(new Worker);
+  }
+  // Started once all exist, they steal from each other
+  for (size_t i = 0; i < threadNum; ++i) {
+    workers_[i]->thread_ = std::thread([this, i, name]() { run(i, name); });
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  for (auto &worker : workers_) worker->thread_.join();
+  // The owners are gone, this thread may pop their deques
+  auto drop = [](Job *job) { auto self = std::move(job->self_); };
+  for (size_t p = 0; p < kPriorities; ++p) {
+    for (auto &worker : workers_) {
+      while (auto job = worker->deques_[p].pop()) drop(job);
+    }
+    for (auto job : queues_[p]) drop(job);
+  }
+}
+
+bool WorkerPool::cancelled() {
+  return currentJob_ &&
+         currentJob_->state_.load(std::memory_order_relaxed) == kStopping;
+}
+
+WorkerPool::JobHandle WorkerPool::submit(std::function<void()> &&func,
+                                         Priority priority) {
+  auto job = std::make_shared<Job>();
+  job->func_ = std::move(func);
+  job->self_ = job;
+  auto p = static_cast<size_t>(priority);
+  if (t_pool == this) {
+    workers_[t_worker]->deques_[p].push(job.get());
+  } else {
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    queues_[p].push_back(job.get());
+    ++queueSizes_[p];
+  }
+  ++queued_;
+  if (idle_ > 0) {
+    // Taking the mutex orders this with a worker going to sleep
+    std::lock_guard<std::mutex> lock(mutex_);
+    cond_.notify_one();
+  }
+  return JobHandle(job);
+}
+
+void WorkerPool::run(size_t index, const std::string &name) {
+  auto threadName = name + std::to_string(index);
+  ::prctl(PR_SET_NAME, threadName.c_str());
+  t_pool = this;
+  t_worker = index;
+  for (;;) {
+    auto job = take(index);
+    if (job) {
+      execute(job);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++idle_;
+    // The timeout only bounds the damage of a missed wakeup
+    cond_.wait_for(lock, std::chrono::milliseconds(100),
+                   [this]() { return stop_ || queued_ > 0; });
+    --idle_;
+    if (stop_) return;
+  }
+}
+
+WorkerPool::Job *WorkerPool::take(size_t index) {
+  static thread_local std::minstd_rand random{std::random_device{}()};
+  auto count = workers_.size();
+  for (size_t p = 0; p < kPriorities; ++p) {
+    auto job = workers_[index]->deques_[p].pop();
+    if (!job && queueSizes_[p] > 0) {
+      std::lock_guard<std::mutex> lock(queueMutex_);
+      if (!queues_[p].empty()) {
+        job = queues_[p].front();
+        queues_[p].pop_front();
+        --queueSizes_[p];
+      }
+    }
+    // Starting from a random victim spreads the thieves
+    for (size_t i = 0, start = random(); !job && i < count; ++i) {
+      auto victim = (start + i) % count;
+      if (victim != index) job = workers_[victim]->deques_[p].steal();
+    }
+    if (job) {
+      --queued_;
+      return job;
+    }
+  }
+  return nullptr;
+}
+
+void WorkerPool::execute(Job *job) {
+  auto self = std::move(job->self_);
+  int expected = kPending;
+  if (!job->state_.compare_exchange_strong(expected, kRunning)) return;
+  currentJob_ = job;
+  job->func_();
+  currentJob_ = nullptr;
+}
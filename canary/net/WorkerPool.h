@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "EventLoop.h"
+#include "LockFreeQueue.h"
+#include "NonCopyable.h"
+
+namespace canary {
+
+// Threads for CPU-heavy work, such as encoding or compressing large
+// responses, so that the IO loops are never blocked by it. Every worker has
+// a Chase-Lev deque per priority: jobs submitted by a job go to the deque of
+// its worker, the others to a shared queue, and idle workers steal from the
+// deques of the busy ones. Every worker takes the higher priorities first.
+class WorkerPool : NonCopyable {
+ public:
+  enum class Priority { High, Normal, Low };
+
+  // Cancels the job it was returned for
+  class JobHandle {
+   public:
+    JobHandle() = default;
+
+    // True when the job will not run. A running job is only told, see
+    // cancelled(), and its result is not delivered to the loop.
+    bool cancel();
+
+   private:
+    friend class WorkerPool;
+    struct Job;
+
+    explicit JobHandle(const std::shared_ptr<Job> &job) : job_(job) {}
+
+    std::weak_ptr<Job> job_;
+  };
+
+  explicit WorkerPool(size_t threadNum = std::thread::hardware_concurrency(),
+                      const std::string &name = "WorkerPool");
+
+  // Jobs not started are dropped, the running ones are waited for
+  ~WorkerPool();
+
+  // Runs job on a worker, may be called in any thread
+  JobHandle submit(std::function<void()> &&job,
+                   Priority priority = Priority::Normal);
+
+  // Runs work on a worker, then done in loop with what work returned, if
+  // anything. Both are copied into a std::function.
+  template <typename Work, typename Done>
+  JobHandle submit(EventLoop *loop, Work &&work, Done &&done,
+                   Priority priority = Priority::Normal) {
+    using Result = std::invoke_result_t<std::decay_t<Work> &>;
+    return submit(
+        [loop, work = std::forward<Work>(work),
+         done = std::forward<Done>(done)]() mutable {
+          if constexpr (std::is_void_v<Result>) {
+            work();
+            if (!cancelled()) loop->queueInLoop(std::move(done));
+          } else {
+            auto result = work();
+            if (cancelled()) return;
+            loop->queueInLoop([done = std::move(done),
+                               result = std::move(result)]() mutable {
+              done(std::move(result));
+            });
+          }
+        },
+        priority);
+  }
+
+  // In a running job, whether it has been cancelled; long jobs may poll it
+  static bool cancelled();
+
+  size_t size() const { return workers_.size(); }
+
+ private:
+  static constexpr size_t kPriorities = 3;
+
+  using Job = JobHandle::Job;
+
+  struct Worker {
+    std::thread thread_;
+    WorkStealingDeque<Job *> deques_[kPriorities];
+  };
+
+  void run(size_t index, const std::string &name);
+
+  // A job to run from the own deque, the shared queue or another worker
+  Job *take(size_t index);
+
+  void execute(Job *job);
+
+  static thread_local Job *currentJob_;
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  std::mutex queueMutex_;
+  std::deque<Job *> queues_[kPriorities];  // @GuardedBy queueMutex_
+  std::atomic<size_t> queueSizes_[kPriorities]{};
+
+  // Jobs waiting in the deques and the shared queue
+  std::atomic<size_t> queued_{0};
+  std::atomic<size_t> idle_{0};
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stop_{false};  // @GuardedBy mutex_
+};
+
+}  // namespace canary
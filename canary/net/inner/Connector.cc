@@ -1,198 +1,250 @@
 #include "Connector.h"
 
+#include <algorithm>
+
 #include "Channel.h"
 #include "Socket.h"
 
 using namespace canary;
 
 Connector::Connector(EventLoop *loop, const InetAddress &addr, bool retry)
-    : loop_(loop), serverAddr_(addr), retry_(retry) {}
+    : Connector(loop, std::vector<InetAddress>{addr}, retry) {}
 
 Connector::Connector(EventLoop *loop, InetAddress &&addr, bool retry)
-    : loop_(loop), serverAddr_(std::move(addr)), retry_(retry) {}
+    : Connector(loop, std::vector<InetAddress>{std::move(addr)}, retry) {}
+
+Connector::Connector(EventLoop *loop, const std::vector<InetAddress> &addrs,
+                     bool retry)
+    : loop_(loop),
+      serverAddrs_(interleave(addrs)),
+      retry_(retry),
+      random_(std::random_device{}()) {}
 
 Connector::~Connector() {
-  if (socketHanded_ == false && fd_ != -1) {
-    ::close(fd_);
+  for (auto &attempt : attempts_) {
+    ::close(attempt.channel_->fd());
+  }
+}
+
+std::vector<InetAddress> Connector::interleave(
+    const std::vector<InetAddress> &addrs) {
+  std::vector<InetAddress> families[2];
+  for (auto &addr : addrs) families[addr.isIpV6() ? 0 : 1].push_back(addr);
+  std::vector<InetAddress> ordered;
+  ordered.reserve(addrs.size());
+  for (size_t i = 0; ordered.size() < addrs.size(); ++i) {
+    for (auto &family : families) {
+      if (i < family.size()) ordered.push_back(family[i]);
+    }
   }
+  return ordered;
+}
+
+const InetAddress &Connector::serverAddress() const {
+  static const InetAddress none;
+  return serverAddrs_.empty() ? none : serverAddrs_[connected_];
 }
 
 void Connector::start() {
   connect_ = true;
-  loop_->runInLoop([this]() { startInLoop(); });
+  loop_->runInLoop(
+      [thisPtr = shared_from_this()]() { thisPtr->startInLoop(); });
 }
 
-void Connector::restart() {}
+void Connector::restart() {
+  loop_->assertInLoopThread();
+  stopInLoop();
+  retryInterval_ = initRetryDelayMs_;
+  connect_ = true;
+  startInLoop();
+}
 
 void Connector::stop() {
+  connect_ = false;
   status_ = Status::Disconnected;
   if (loop_->isInLoopThread()) {
-    removeAndResetChannel();
+    stopInLoop();
   } else {
     loop_->queueInLoop(
-        [thisPtr = shared_from_this()]() { thisPtr->removeAndResetChannel(); });
+        [thisPtr = shared_from_this()]() { thisPtr->stopInLoop(); });
   }
 }
 
 void Connector::startInLoop() {
   loop_->assertInLoopThread();
-  assert(status_ == Status::Disconnected);
-  if (connect_) {
-    connect();
-  } else {
+  // Connected means the socket was handed out, a new one may be made
+  if (!connect_ || status_ == Status::Connecting) {
     // LOG_TRACE << "do not connect";
+    return;
   }
+  status_ = Status::Connecting;
+  next_ = 0;
+  connect();
 }
+
+void Connector::stopInLoop() {
+  loop_->assertInLoopThread();
+  status_ = Status::Disconnected;
+  if (attemptTimerId_ != InvalidTimerId) {
+    loop_->invalidateTimer(attemptTimerId_);
+    attemptTimerId_ = InvalidTimerId;
+  }
+  if (retryTimerId_ != InvalidTimerId) {
+    loop_->invalidateTimer(retryTimerId_);
+    retryTimerId_ = InvalidTimerId;
+  }
+  cancelAttempts();
+}
+
 void Connector::connect() {
-  socketHanded_ = false;
-  fd_ = Socket::createNonblockingSocketOrDie(serverAddr_.family());
-  errno = 0;
-  int ret = Socket::connect(fd_, serverAddr_);
-  int savedErrno = (ret == 0) ? 0 : errno;
-  switch (savedErrno) {
-    case 0:
-    case EINPROGRESS:
-    case EINTR:
-    case EISCONN:
-      // LOG_TRACE << "connecting";
-      connecting(fd_);
-      break;
-
-    case EAGAIN:
-    case EADDRINUSE:
-    case EADDRNOTAVAIL:
-    case ECONNREFUSED:
-    case ENETUNREACH:
-      if (retry_) {
-        retry(fd_);
-      }
-      break;
-
-    case EACCES:
-    case EPERM:
-    case EAFNOSUPPORT:
-    case EALREADY:
-    case EBADF:
-    case EFAULT:
-    case ENOTSOCK:
-      // LOG_SYSERR << "connect error in Connector::startInLoop "
-      //            << savedErrno;
-      socketHanded_ = true;
-      ::close(fd_);
-      if (errorCallback_) errorCallback_();
-      break;
-
-    default:
-      // LOG_SYSERR << "Unexpected error in Connector::startInLoop "
-      //            << savedErrno;
-      socketHanded_ = true;
-      ::close(fd_);
-      if (errorCallback_) errorCallback_();
-      break;
+  while (next_ < serverAddrs_.size()) {
+    auto index = next_++;
+    const auto &addr = serverAddrs_[index];
+    // Not fatal, the host may lack the address family
+    int sockfd = ::socket(addr.family(),
+                          SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          IPPROTO_TCP);
+    if (sockfd < 0) {
+      // LOG_SYSERR << "socket error in Connector::connect";
+      continue;
+    }
+    errno = 0;
+    int ret = Socket::connect(sockfd, addr);
+    int savedErrno = (ret == 0) ? 0 : errno;
+    if (savedErrno != 0 && savedErrno != EINPROGRESS && savedErrno != EINTR &&
+        savedErrno != EISCONN) {
+      // LOG_TRACE << "connect error in Connector::connect " << savedErrno;
+      ::close(sockfd);
+      continue;
+    }
+    // LOG_TRACE << "connecting:" << sockfd;
+    auto id = nextAttemptId_++;
+    auto channel = std::make_shared<Channel>(loop_, sockfd);
+    channel->setWriteCallback(
+        std::bind(&Connector::handleWrite, shared_from_this(), id));
+    channel->setErrorCallback(
+        std::bind(&Connector::handleError, shared_from_this(), id));
+    channel->setCloseCallback(
+        std::bind(&Connector::handleError, shared_from_this(), id));
+    attempts_.push_back(Attempt{id, index, channel});
+    channel->enableWriting();
+    if (next_ < serverAddrs_.size()) {
+      std::weak_ptr<Connector> weakPtr = shared_from_this();
+      attemptTimerId_ = loop_->runAfter(attemptDelay_, [weakPtr]() {
+        auto thisPtr = weakPtr.lock();
+        if (!thisPtr) return;
+        thisPtr->attemptTimerId_ = InvalidTimerId;
+        if (thisPtr->status_ == Status::Connecting) thisPtr->connect();
+      });
+    }
+    return;
   }
+  if (attempts_.empty()) retry();
 }
 
-void Connector::connecting(int sockfd) {
-  status_ = Status::Connecting;
-  assert(!channelPtr_);
-  channelPtr_.reset(new Channel(loop_, sockfd));
-  channelPtr_->setWriteCallback(
-      std::bind(&Connector::handleWrite, shared_from_this()));
-  channelPtr_->setErrorCallback(
-      std::bind(&Connector::handleError, shared_from_this()));
-  channelPtr_->setCloseCallback(
-      std::bind(&Connector::handleError, shared_from_this()));
-  // LOG_TRACE << "connecting:" << sockfd;
-  channelPtr_->enableWriting();
+void Connector::handleWrite(uint64_t id) {
+  auto iter = std::find_if(
+      attempts_.begin(), attempts_.end(),
+      [id](const Attempt &attempt) { return attempt.id_ == id; });
+  if (status_ != Status::Connecting || iter == attempts_.end()) {
+    // has been stopped or failed
+    return;
+  }
+  int sockfd = iter->channel_->fd();
+  int err = Socket::getSocketError(sockfd);
+  if (err) {
+    // LOG_WARN << "Connector::handleWrite - SO_ERROR = " << err << " "
+    //          << strerror_tl(err);
+    fail(id);
+    return;
+  }
+  if (Socket::isSelfConnect(sockfd)) {
+    // LOG_WARN << "Connector::handleWrite - Self connect";
+    fail(id);
+    return;
+  }
+  removeAttempt(id, &connected_);
+  if (attemptTimerId_ != InvalidTimerId) {
+    loop_->invalidateTimer(attemptTimerId_);
+    attemptTimerId_ = InvalidTimerId;
+  }
+  cancelAttempts();
+  status_ = Status::Connected;
+  retryInterval_ = initRetryDelayMs_;
+  if (connect_) {
+    newConnectionCallback_(sockfd);
+  } else {
+    ::close(sockfd);
+  }
 }
 
-int Connector::removeAndResetChannel() {
-  if (!channelPtr_) {
-    return -1;
-  }
-  channelPtr_->disableAll();
-  channelPtr_->remove();
-  int sockfd = channelPtr_->fd();
-  // Can't reset channel_ here, because we are inside Channel::handleEvent
-  loop_->queueInLoop([channelPtr = channelPtr_]() {});
-  channelPtr_.reset();
-  return sockfd;
+void Connector::handleError(uint64_t id) {
+  if (status_ == Status::Connecting) fail(id);
 }
 
-void Connector::handleWrite() {
-  socketHanded_ = true;
-  if (status_ == Status::Connecting) {
-    int sockfd = removeAndResetChannel();
-    int err = Socket::getSocketError(sockfd);
-    if (err) {
-      // LOG_WARN << "Connector::handleWrite - SO_ERROR = " << err << " "
-      //          << strerror_tl(err);
-      if (retry_) {
-        retry(sockfd);
-      } else {
-        socketHanded_ = true;
-        ::close(sockfd);
-      }
-      if (errorCallback_) {
-        errorCallback_();
-      }
-    } else if (Socket::isSelfConnect(sockfd)) {
-      // LOG_WARN << "Connector::handleWrite - Self connect";
-      if (retry_) {
-        retry(sockfd);
-      } else {
-        socketHanded_ = true;
-        ::close(sockfd);
-      }
-      if (errorCallback_) {
-        errorCallback_();
-      }
-    } else {
-      status_ = Status::Connected;
-      if (connect_) {
-        newConnectionCallback_(sockfd);
-      } else {
-        socketHanded_ = true;
-        ::close(sockfd);
-      }
+void Connector::fail(uint64_t id) {
+  int sockfd = removeAttempt(id);
+  if (sockfd < 0) return;
+  // LOG_TRACE << "SO_ERROR = " << Socket::getSocketError(sockfd);
+  ::close(sockfd);
+  if (next_ < serverAddrs_.size()) {
+    // The next address need not wait for the attempt delay
+    if (attemptTimerId_ != InvalidTimerId) {
+      loop_->invalidateTimer(attemptTimerId_);
+      attemptTimerId_ = InvalidTimerId;
     }
-  } else {
-    // has been stopped
-    assert(status_ == Status::Disconnected);
+    connect();
+  } else if (attempts_.empty()) {
+    retry();
   }
 }
 
-void Connector::handleError() {
-  socketHanded_ = true;
-  if (status_ == Status::Connecting) {
-    status_ = Status::Disconnected;
-    int sockfd = removeAndResetChannel();
-    int err = Socket::getSocketError(sockfd);
-    // LOG_TRACE << "SO_ERROR = " << err << " " << strerror_tl(err);
-    if (retry_) {
-      retry(sockfd);
-    } else {
-      ::close(sockfd);
-    }
-    if (errorCallback_) {
-      errorCallback_();
-    }
+int Connector::removeAttempt(uint64_t id, size_t *index) {
+  auto iter = std::find_if(
+      attempts_.begin(), attempts_.end(),
+      [id](const Attempt &attempt) { return attempt.id_ == id; });
+  if (iter == attempts_.end()) return -1;
+  if (index) *index = iter->index_;
+  auto channelPtr = std::move(iter->channel_);
+  attempts_.erase(iter);
+  channelPtr->disableAll();
+  channelPtr->remove();
+  // Can't reset the channel here, because we may be inside
+  // Channel::handleEvent
+  loop_->queueInLoop([channelPtr]() {});
+  return channelPtr->fd();
+}
+
+void Connector::cancelAttempts() {
+  while (!attempts_.empty()) {
+    ::close(removeAttempt(attempts_.back().id_));
   }
 }
 
-void Connector::retry(int sockfd) {
-  assert(retry_);
-  ::close(sockfd);
+void Connector::retry() {
   status_ = Status::Disconnected;
-  if (connect_) {
+  // An empty list does not fill up by waiting
+  if (retry_ && connect_ && !serverAddrs_.empty()) {
+    // The jitter keeps clients that lost a server at once from coming
+    // back at once
+    std::uniform_int_distribution<int> delay(retryInterval_ / 2,
+                                             retryInterval_);
+    auto delayMs = delay(random_);
     // LOG_INFO << "Connector::retry - Retry connecting to "
-    //          << serverAddr_.toIpPort() << " in " << retryInterval_
+    //          << serverAddress().toIpPort() << " in " << delayMs
     //          << " milliseconds. ";
-    loop_->runAfter(retryInterval_ / 1000.0,
-                    std::bind(&Connector::startInLoop, shared_from_this()));
-    retryInterval_ = retryInterval_ * 2;
-    if (retryInterval_ > maxRetryInterval_) retryInterval_ = maxRetryInterval_;
+    std::weak_ptr<Connector> weakPtr = shared_from_this();
+    retryTimerId_ = loop_->runAfter(delayMs / 1000.0, [weakPtr]() {
+      auto thisPtr = weakPtr.lock();
+      if (!thisPtr) return;
+      thisPtr->retryTimerId_ = InvalidTimerId;
+      thisPtr->startInLoop();
+    });
+    retryInterval_ = std::min(retryInterval_ * 2, maxRetryDelayMs_);
   } else {
     // LOG_TRACE << "do not connect";
   }
+  if (errorCallback_) {
+    errorCallback_();
+  }
 }
@@ -2,12 +2,22 @@
 
 #include <atomic>
 #include <memory>
+#include <random>
+#include <vector>
 
 #include "EventLoop.h"
 #include "InetAddress.h"
 
 namespace canary {
 
+// Connects to one of several addresses of a server, racing them as in
+// RFC 8305 (happy eyeballs): the addresses are tried in turn, IPv6 and IPv4
+// alternating, each one started when the previous one failed or has not
+// connected within the attempt delay. The first to connect wins and the
+// others are cancelled, so a blackholed address family only costs the
+// attempt delay. When every address failed, the connector tries again after
+// an exponential backoff with jitter, if retry is enabled. An empty list,
+// as a failed resolve gives, fails every start at once and never retries.
 class Connector : public NonCopyable,
                   public std::enable_shared_from_this<Connector> {
  public:
@@ -16,6 +26,8 @@ class Connector : public NonCopyable,
 
   Connector(EventLoop *loop, const InetAddress &addr, bool retry = true);
   Connector(EventLoop *loop, InetAddress &&addr, bool retry = true);
+  Connector(EventLoop *loop, const std::vector<InetAddress> &addrs,
+            bool retry = true);
   ~Connector();
 
   void setNewConnectionCallback(const NewConnectionCallback &cb) {
@@ -26,6 +38,7 @@ class Connector : public NonCopyable,
     newConnectionCallback_ = std::move(cb);
   }
 
+  // Called every time all the addresses failed
   void setErrorCallback(const ConnectionErrorCallback &cb) {
     errorCallback_ = cb;
   }
@@ -34,7 +47,29 @@ class Connector : public NonCopyable,
     errorCallback_ = std::move(cb);
   }
 
-  const InetAddress &serverAddress() const { return serverAddr_; }
+  // The setters are to be called before start()
+
+  // How long an attempt runs alone before the next address is tried too,
+  // 250 milliseconds by default
+  void setAttemptDelay(double seconds) { attemptDelay_ = seconds; }
+
+  // The backoff of the retries doubles from initial up to max seconds, and
+  // every delay is drawn between the half and the whole of it. 0.5 and 30
+  // seconds by default.
+  void setRetryDelay(double initial, double max) {
+    initRetryDelayMs_ = static_cast<int>(initial * 1000);
+    maxRetryDelayMs_ = static_cast<int>(max * 1000);
+    retryInterval_ = initRetryDelayMs_;
+  }
+
+  // The address connected last, else the first one to try, a default
+  // address when there is none
+  const InetAddress &serverAddress() const;
+
+  // In the order they are tried
+  const std::vector<InetAddress> &serverAddresses() const {
+    return serverAddrs_;
+  }
 
   void start();
 
@@ -42,33 +77,61 @@ class Connector : public NonCopyable,
 
   void stop();
 
+  // Orders the addresses as RFC 8305 does: IPv6 first, then the families
+  // alternating, each family keeping its order
+  static std::vector<InetAddress> interleave(
+      const std::vector<InetAddress> &addrs);
+
  private:
+  // A connection in progress to serverAddrs_[index_]. A Channel may call
+  // back after its attempt is gone, and the fd may be another attempt's by
+  // then, hence the id.
+  struct Attempt {
+    uint64_t id_;
+    size_t index_;
+    std::shared_ptr<Channel> channel_;
+  };
+
   void startInLoop();
+  void stopInLoop();
+  // Starts connecting to the next address
   void connect();
-  void connecting(int sockfd);
-  int removeAndResetChannel();
-  void handleWrite();
-  void handleError();
-  void retry(int sockfd);
+  void handleWrite(uint64_t id);
+  void handleError(uint64_t id);
+  // Closes the attempt, which is not handed out
+  void fail(uint64_t id);
+  // Takes the attempt out and returns its socket, -1 when it is gone
+  int removeAttempt(uint64_t id, size_t *index = nullptr);
+  void cancelAttempts();
+  void retry();
 
   NewConnectionCallback newConnectionCallback_;
   ConnectionErrorCallback errorCallback_;
   enum class Status { Disconnected, Connecting, Connected };
   static constexpr int kMaxRetryDelayMs = 30 * 1000;
   static constexpr int kInitRetryDelayMs = 500;
-  std::shared_ptr<Channel> channelPtr_;
   EventLoop *loop_;
-  InetAddress serverAddr_;
+  std::vector<InetAddress> serverAddrs_;
+  size_t connected_{0};
 
   std::atomic_bool connect_{false};
   std::atomic<Status> status_{Status::Disconnected};
 
+  double attemptDelay_{0.25};
+  int initRetryDelayMs_{kInitRetryDelayMs};
+  int maxRetryDelayMs_{kMaxRetryDelayMs};
   int retryInterval_{kInitRetryDelayMs};
-  int maxRetryInterval_{kMaxRetryDelayMs};
 
   bool retry_;
-  bool socketHanded_{false};
-  int fd_{-1};
+
+  // Only touched in the loop
+  std::vector<Attempt> attempts_;
+  uint64_t nextAttemptId_{0};
+  // The next address to try
+  size_t next_{0};
+  TimerId attemptTimerId_{InvalidTimerId};
+  TimerId retryTimerId_{InvalidTimerId};
+  std::mt19937 random_;
 };
 
 }  // namespace canary
@@ -128,6 +128,12 @@ void Socket::setKeepAlive(bool on) {
                static_cast<socklen_t>(sizeof optval));
 }
 
+bool Socket::setZeroCopy(bool on) {
+  int optval = on ? 1 : 0;
+  return ::setsockopt(sockFd_, SOL_SOCKET, SO_ZEROCOPY, &optval,
+                      static_cast<socklen_t>(sizeof optval)) == 0;
+}
+
 int Socket::getSocketError() {
   int optval;
 
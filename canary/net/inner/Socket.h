@@ -72,6 +72,9 @@ class Socket : NonCopyable {
 
   void setKeepAlive(bool on);
 
+  // False when the kernel does not have it, before 4.14
+  bool setZeroCopy(bool on);
+
   int getSocketError();
 
  protected:
@@ -1,12 +1,20 @@
 #include "TcpConnectionImpl.h"
 
 #include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/ioctl.h>
 #include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <limits>
+
 #include "Channel.h"
+#include "Clock.h"
 #include "Socket.h"
 #include "Utility.h"
 
@@ -21,6 +29,87 @@ std::shared_ptr<SSLContext> newSSLServerContext(
   // LOG_FATAL << "OpenSSL is not found in your system!";
   throw std::runtime_error("OpenSSL is not found in your system!");
 }
+
+// Asked for the pipe of a forward(), the default is 64 KiB
+static const int kForwardPipeSize = 256 * 1024;
+
+static bool pipeIsEmpty(int fd) {
+  int bytes = 0;
+  return ioctl(fd, FIONREAD, &bytes) == 0 && bytes == 0;
+}
+
+// How often the error queue is read when the socket has nothing else to
+// tell, and how long a closed connection waits for the peer to take what
+// the kernel still sends from its messages
+static constexpr double kZeroCopyPollInterval{0.05};
+static constexpr double kZeroCopyLinger{60.0};
+
+using ZeroCopyPending = std::deque<std::pair<uint32_t, std::shared_ptr<void>>>;
+
+// Drops the messages the kernel is done with. Returns false when it copied
+// them after all, which costs more than a plain send.
+static bool readZeroCopyCompletions(int fd, ZeroCopyPending *pending) {
+  bool zeroCopied = true;
+  char control[128];
+  for (;;) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) return zeroCopied;
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+          !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+        continue;
+      auto err = reinterpret_cast<struct sock_extended_err *>(CMSG_DATA(cmsg));
+      if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+      if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) zeroCopied = false;
+      // The calls from ee_info to ee_data are done, in order for TCP
+      while (!pending->empty() &&
+             static_cast<int32_t>(pending->front().first - err->ee_data) <=
+                 0) {
+        pending->pop_front();
+      }
+    }
+  }
+}
+
+// The messages of a destroyed connection the kernel may still send from
+// are kept, with the socket open on a duplicate, until their completions.
+// A peer not taking the bytes for kZeroCopyLinger gets a reset, which has
+// the kernel drop them.
+static void lingerZeroCopy(EventLoop *loop, int fd, ZeroCopyPending &&pending) {
+  struct Linger {
+    int fd_;
+    ZeroCopyPending pending_;
+    TimerId timerId_{InvalidTimerId};
+    int polls_{0};
+  };
+  auto linger = std::make_shared<Linger>();
+  linger->fd_ = fd;
+  linger->pending_ = std::move(pending);
+  loop->runInLoop([loop, linger]() {
+    linger->timerId_ = loop->runEvery(kZeroCopyPollInterval, [loop, linger]() {
+      if (linger->fd_ < 0) return;
+      readZeroCopyCompletions(linger->fd_, &linger->pending_);
+      if (!linger->pending_.empty() &&
+          ++linger->polls_ * kZeroCopyPollInterval < kZeroCopyLinger) {
+        return;
+      }
+      if (!linger->pending_.empty()) {
+        struct linger option = {1, 0};
+        ::setsockopt(linger->fd_, SOL_SOCKET, SO_LINGER, &option,
+                     sizeof(option));
+      }
+      ::close(linger->fd_);
+      linger->fd_ = -1;
+      linger->pending_.clear();
+      loop->invalidateTimer(linger->timerId_);
+    });
+  });
+}
 }  // namespace canary
 
 TcpConnectionImpl::TcpConnectionImpl(EventLoop *loop, int socketfd,
@@ -45,7 +134,22 @@ TcpConnectionImpl::TcpConnectionImpl(EventLoop *loop, int socketfd,
   name_ = localAddr.toIpPort() + "--" + peerAddr.toIpPort();
 }
 
-TcpConnectionImpl::~TcpConnectionImpl() {}
+TcpConnectionImpl::~TcpConnectionImpl() {
+  // The kernel may still send from the messages after the socket closes
+  if (zeroCopyPending_.empty()) return;
+  readZeroCopyCompletions();
+  if (zeroCopyPending_.empty()) return;
+  int fd = ::dup(socketPtr_->fd());
+  if (fd >= 0) {
+    lingerZeroCopy(loop_, fd, std::move(zeroCopyPending_));
+    return;
+  }
+  // Reset then, the kernel drops what it holds before the close returns
+  struct linger option = {1, 0};
+  ::setsockopt(socketPtr_->fd(), SOL_SOCKET, SO_LINGER, &option,
+               sizeof(option));
+  socketPtr_.reset();
+}
 
 void TcpConnectionImpl::startServerEncryption(
     const std::shared_ptr<SSLContext> &ctx, std::function<void()> callback) {
@@ -76,6 +180,10 @@ void TcpConnectionImpl::readCallback() {
   // LOG_TRACE<<"read Callback";
 
   loop_->assertInLoopThread();
+  if (forwardNode_) {
+    spliceCallback();
+    return;
+  }
   int ret = 0;
 
   ssize_t n = readBuffer_.readFd(socketPtr_->fd(), &ret);
@@ -101,7 +209,14 @@ void TcpConnectionImpl::readCallback() {
   extendLife();
   if (n > 0) {
     bytesReceived_ += n;
-    if (recvMsgCallback_) {
+    if (forwarding_) {
+      // Forwarded without a pipe, or dropped once the other side is gone
+      auto to = forwardTo_.lock();
+      if (to && to->connected()) {
+        to->send(readBuffer_.peek(), readBuffer_.readableBytes());
+      }
+      readBuffer_.retrieveAll();
+    } else if (recvMsgCallback_) {
       recvMsgCallback_(shared_from_this(), &readBuffer_);
     }
   }
@@ -109,7 +224,7 @@ void TcpConnectionImpl::readCallback() {
 
 void TcpConnectionImpl::extendLife() {
   if (idleTimeout_ > 0) {
-    auto now = Date::date();
+    auto now = CachedClock::now();
     if (now < lastTimingWheelUpdateTime_.after(1.0)) return;
     lastTimingWheelUpdateTime_ = now;
     auto entry = kickoffEntry_.lock();
@@ -136,6 +251,7 @@ void TcpConnectionImpl::writeCallback() {
           ioChannelPtr_->disableWriting();
           if (writeCompleteCallback_)
             writeCompleteCallback_(shared_from_this());
+          if (drainCallback_) drainCallback_(shared_from_this());
           if (status_ == ConnStatus::Disconnecting) {
             socketPtr_->closeWrite();
           }
@@ -174,6 +290,7 @@ void TcpConnectionImpl::writeCallback() {
           ioChannelPtr_->disableWriting();
           if (writeCompleteCallback_)
             writeCompleteCallback_(shared_from_this());
+          if (drainCallback_) drainCallback_(shared_from_this());
           if (status_ == ConnStatus::Disconnecting) {
             socketPtr_->closeWrite();
           }
@@ -232,8 +349,21 @@ void TcpConnectionImpl::handleClose() {
   loop_->assertInLoopThread();
   status_ = ConnStatus::Disconnected;
   ioChannelPtr_->disableAll();
+  closePipeChannel();
+  if (forwardNode_) {
+    forwardNode_->splicePipe_->eof_ = true;
+    pushForward();
+  }
+  // The connections forwarding here may be paused on a full pipe
+  for (auto &node : writeBufferList_) {
+    if (!node->splicePipe_) continue;
+    auto source = node->splicePipe_->source_.lock();
+    if (source && source->forwardNode_ == node) source->dropForward();
+  }
   //  ioChannelPtr_->remove();
   auto guardThis = shared_from_this();
+  // A producer paused on the output waits for a drain that will not come
+  if (drainCallback_) drainCallback_(guardThis);
   if (connectionCallback_) connectionCallback_(guardThis);
   if (closeCallback_) {
     // LOG_TRACE << "to call close callback";
@@ -242,6 +372,8 @@ void TcpConnectionImpl::handleClose() {
 }
 
 void TcpConnectionImpl::handleError() {
+  // The kernel tells when it is done with zero copy sends by the error queue
+  if (zeroCopyEnabled_) readZeroCopyCompletions();
   int err = socketPtr_->getSocketError();
   if (err == 0) return;
   if (err == EPIPE || err == EBADMSG ||  // ??? 104=EBADMSG
@@ -258,14 +390,69 @@ void TcpConnectionImpl::setTcpNoDelay(bool on) {
   socketPtr_->setTcpNoDelay(on);
 }
 
+void TcpConnectionImpl::setZeroCopyThreshold(size_t threshold) {
+  auto thisPtr = shared_from_this();
+  loop_->runInLoop([thisPtr, threshold]() {
+    if (threshold > 0 && !thisPtr->zeroCopyEnabled_) {
+      thisPtr->zeroCopyEnabled_ = thisPtr->socketPtr_->setZeroCopy(true);
+    }
+    thisPtr->zeroCopyThreshold_.store(
+        thisPtr->zeroCopyEnabled_ ? threshold : 0, std::memory_order_relaxed);
+  });
+}
+
+void TcpConnectionImpl::readZeroCopyCompletions() {
+  if (!canary::readZeroCopyCompletions(socketPtr_->fd(), &zeroCopyPending_)) {
+    zeroCopyThreshold_.store(0, std::memory_order_relaxed);
+  }
+}
+
+// The error queue wakes the loop only while the socket is polled for
+// something, so it is read on a timer too until nothing is pending
+void TcpConnectionImpl::watchZeroCopyCompletions() {
+  if (zeroCopyWatched_ || zeroCopyPending_.empty()) return;
+  zeroCopyWatched_ = true;
+  std::weak_ptr<TcpConnectionImpl> weakPtr = shared_from_this();
+  loop_->runAfter(kZeroCopyPollInterval, [weakPtr]() {
+    // The destructor hands the pending messages on
+    auto thisPtr = weakPtr.lock();
+    if (!thisPtr) return;
+    thisPtr->zeroCopyWatched_ = false;
+    thisPtr->readZeroCopyCompletions();
+    thisPtr->watchZeroCopyCompletions();
+  });
+}
+
+void TcpConnectionImpl::stopRecv() {
+  auto thisPtr = shared_from_this();
+  loop_->runInLoop([thisPtr]() {
+    if (thisPtr->status_ == ConnStatus::Connected &&
+        thisPtr->ioChannelPtr_->isReading()) {
+      thisPtr->ioChannelPtr_->disableReading();
+    }
+  });
+}
+
+void TcpConnectionImpl::startRecv() {
+  auto thisPtr = shared_from_this();
+  loop_->runInLoop([thisPtr]() {
+    if (thisPtr->status_ == ConnStatus::Connected &&
+        !thisPtr->ioChannelPtr_->isReading()) {
+      thisPtr->ioChannelPtr_->enableReading();
+    }
+  });
+}
+
 void TcpConnectionImpl::connectDestroyed() {
   loop_->assertInLoopThread();
   if (status_ == ConnStatus::Connected) {
     status_ = ConnStatus::Disconnected;
     ioChannelPtr_->disableAll();
 
+    if (drainCallback_) drainCallback_(shared_from_this());
     connectionCallback_(shared_from_this());
   }
+  closePipeChannel();
   ioChannelPtr_->remove();
 }
 
@@ -274,7 +461,8 @@ void TcpConnectionImpl::shutdown() {
   loop_->runInLoop([thisPtr]() {
     if (thisPtr->status_ == ConnStatus::Connected) {
       thisPtr->status_ = ConnStatus::Disconnecting;
-      if (!thisPtr->ioChannelPtr_->isWriting()) {
+      if (!thisPtr->ioChannelPtr_->isWriting() &&
+          !thisPtr->waitingForPipe_) {
         thisPtr->socketPtr_->closeWrite();
       }
     }
@@ -342,17 +530,43 @@ void TcpConnectionImpl::sendInLoop(const void *buffer, size_t length) {
   }
 }
 
+// Sends a message kept alive by its owner, in place when it is large
+void TcpConnectionImpl::sendInLoop(const std::shared_ptr<void> &owner,
+                                   const char *data, size_t length) {
+  if (!isZeroCopySize(length)) {
+    sendInLoop(data, length);
+    return;
+  }
+  loop_->assertInLoopThread();
+  if (status_ != ConnStatus::Connected) {
+    // LOG_WARN << "Connection is not connected,give up sending";
+    return;
+  }
+  extendLife();
+  BufferNodePtr node = std::make_shared<BufferNode>();
+  node->zeroCopyOwner_ = owner;
+  node->zeroCopyData_ = data;
+  node->fileBytesToSend_ = static_cast<ssize_t>(length);
+  writeBufferList_.push_back(node);
+  if (writeBufferList_.size() == 1) sendFileInLoop(node);
+  if (highWaterMarkCallback_ && node->fileBytesToSend_ > 0 &&
+      static_cast<size_t>(node->fileBytesToSend_) > highWaterMarkLen_) {
+    highWaterMarkCallback_(shared_from_this(),
+                           static_cast<size_t>(node->fileBytesToSend_));
+  }
+}
+
 // The order of data sending should be same as the order of calls of send()
 void TcpConnectionImpl::send(const std::shared_ptr<std::string> &msgPtr) {
   if (loop_->isInLoopThread()) {
     std::lock_guard<std::mutex> guard(sendNumMutex_);
     if (sendNum_ == 0) {
-      sendInLoop(msgPtr->data(), msgPtr->length());
+      sendInLoop(msgPtr, msgPtr->data(), msgPtr->length());
     } else {
       ++sendNum_;
       auto thisPtr = shared_from_this();
       loop_->queueInLoop([thisPtr, msgPtr]() {
-        thisPtr->sendInLoop(msgPtr->data(), msgPtr->length());
+        thisPtr->sendInLoop(msgPtr, msgPtr->data(), msgPtr->length());
         std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
         --thisPtr->sendNum_;
       });
@@ -362,7 +576,7 @@ void TcpConnectionImpl::send(const std::shared_ptr<std::string> &msgPtr) {
     std::lock_guard<std::mutex> guard(sendNumMutex_);
     ++sendNum_;
     loop_->queueInLoop([thisPtr, msgPtr]() {
-      thisPtr->sendInLoop(msgPtr->data(), msgPtr->length());
+      thisPtr->sendInLoop(msgPtr, msgPtr->data(), msgPtr->length());
       std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
       --thisPtr->sendNum_;
     });
@@ -374,12 +588,12 @@ void TcpConnectionImpl::send(const std::shared_ptr<MsgBuffer> &msgPtr) {
   if (loop_->isInLoopThread()) {
     std::lock_guard<std::mutex> guard(sendNumMutex_);
     if (sendNum_ == 0) {
-      sendInLoop(msgPtr->peek(), msgPtr->readableBytes());
+      sendInLoop(msgPtr, msgPtr->peek(), msgPtr->readableBytes());
     } else {
       ++sendNum_;
       auto thisPtr = shared_from_this();
       loop_->queueInLoop([thisPtr, msgPtr]() {
-        thisPtr->sendInLoop(msgPtr->peek(), msgPtr->readableBytes());
+        thisPtr->sendInLoop(msgPtr, msgPtr->peek(), msgPtr->readableBytes());
         std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
         --thisPtr->sendNum_;
       });
@@ -389,7 +603,7 @@ void TcpConnectionImpl::send(const std::shared_ptr<MsgBuffer> &msgPtr) {
     std::lock_guard<std::mutex> guard(sendNumMutex_);
     ++sendNum_;
     loop_->queueInLoop([thisPtr, msgPtr]() {
-      thisPtr->sendInLoop(msgPtr->peek(), msgPtr->readableBytes());
+      thisPtr->sendInLoop(msgPtr, msgPtr->peek(), msgPtr->readableBytes());
       std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
       --thisPtr->sendNum_;
     });
@@ -481,6 +695,10 @@ void TcpConnectionImpl::send(const std::string &msg) {
 }
 
 void TcpConnectionImpl::send(std::string &&msg) {
+  if (isZeroCopySize(msg.length())) {
+    send(std::make_shared<std::string>(std::move(msg)));
+    return;
+  }
   if (loop_->isInLoopThread()) {
     std::lock_guard<std::mutex> guard(sendNumMutex_);
     if (sendNum_ == 0) {
@@ -533,6 +751,10 @@ void TcpConnectionImpl::send(const MsgBuffer &buffer) {
 }
 
 void TcpConnectionImpl::send(MsgBuffer &&buffer) {
+  if (isZeroCopySize(buffer.readableBytes())) {
+    send(std::make_shared<MsgBuffer>(std::move(buffer)));
+    return;
+  }
   if (loop_->isInLoopThread()) {
     std::lock_guard<std::mutex> guard(sendNumMutex_);
     if (sendNum_ == 0) {
@@ -588,52 +810,32 @@ void TcpConnectionImpl::sendFile(const wchar_t *fileName, size_t offset,
 }
 
 void TcpConnectionImpl::sendFile(int sfd, size_t offset, size_t length) {
-  assert(length > 0);
   assert(sfd >= 0);
   BufferNodePtr node = std::make_shared<BufferNode>();
   node->sendFd_ = sfd;
   node->offset_ = static_cast<off_t>(offset);
-  node->fileBytesToSend_ = length;
-  if (loop_->isInLoopThread()) {
-    std::lock_guard<std::mutex> guard(sendNumMutex_);
-    if (sendNum_ == 0) {
-      writeBufferList_.push_back(node);
-      if (writeBufferList_.size() == 1) {
-        sendFileInLoop(writeBufferList_.front());
-        return;
-      }
-    } else {
-      ++sendNum_;
-      auto thisPtr = shared_from_this();
-      loop_->queueInLoop([thisPtr, node]() {
-        thisPtr->writeBufferList_.push_back(node);
-        {
-          std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-          --thisPtr->sendNum_;
-        }
-
-        if (thisPtr->writeBufferList_.size() == 1) {
-          thisPtr->sendFileInLoop(thisPtr->writeBufferList_.front());
-        }
-      });
+  // Until the end when the size is not known
+  node->fileBytesToSend_ =
+      length > 0 ? length : std::numeric_limits<ssize_t>::max();
+  struct stat filestat;
+  node->isPipe_ = fstat(sfd, &filestat) == 0 && !S_ISREG(filestat.st_mode);
+  if (node->isPipe_ && !S_ISFIFO(filestat.st_mode)) {
+    // A socket or a device, spliced through a pipe of its own and read as
+    // it comes, the loop does not wait on it
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+      // LOG_SYSERR << "pipe2";
+      return;  // the node closes sfd
     }
-  } else {
-    auto thisPtr = shared_from_this();
-    std::lock_guard<std::mutex> guard(sendNumMutex_);
-    ++sendNum_;
-    loop_->queueInLoop([thisPtr, node]() {
-      // LOG_TRACE << "Push sendfile to list";
-      thisPtr->writeBufferList_.push_back(node);
-      {
-        std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
-        --thisPtr->sendNum_;
-      }
-
-      if (thisPtr->writeBufferList_.size() == 1) {
-        thisPtr->sendFileInLoop(thisPtr->writeBufferList_.front());
-      }
-    });
+    fcntl(sfd, F_SETFL, fcntl(sfd, F_GETFL) | O_NONBLOCK);
+    auto relay = std::make_shared<SplicePipe>();
+    relay->readFd_ = fds[0];
+    relay->writeFd_ = fds[1];
+    auto capacity = fcntl(fds[1], F_GETPIPE_SZ);
+    relay->capacity_ = capacity > 0 ? capacity : 64 * 1024;
+    node->relay_ = std::move(relay);
   }
+  sendNode(node);
 }
 
 void TcpConnectionImpl::sendStream(
@@ -642,6 +844,98 @@ void TcpConnectionImpl::sendStream(
   node->offset_ = 0;  // not used, the offset should be handled by the callback
   node->fileBytesToSend_ = 1;  // force to > 0 until stream sent
   node->streamCallback_ = std::move(callback);
+  sendNode(node);
+}
+
+void TcpConnectionImpl::forward(const TcpConnectionPtr &to) {
+  auto sink = std::dynamic_pointer_cast<TcpConnectionImpl>(to);
+  assert(sink);
+  auto thisPtr = shared_from_this();
+  loop_->runInLoop([thisPtr, sink]() { thisPtr->forwardInLoop(sink); });
+}
+
+void TcpConnectionImpl::forwardInLoop(
+    const std::shared_ptr<TcpConnectionImpl> &to) {
+  loop_->assertInLoopThread();
+  assert(to->loop_ == loop_);
+  assert(!isEncrypted_ && !to->isEncrypted_);
+  if (forwarding_ || status_ != ConnStatus::Connected) return;
+  forwarding_ = true;
+  forwardTo_ = to;
+  if (readBuffer_.readableBytes() > 0) {
+    to->send(readBuffer_.peek(), readBuffer_.readableBytes());
+    readBuffer_.retrieveAll();
+  }
+  int fds[2];
+  if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+    // LOG_SYSERR << "pipe2";
+    // Out of descriptors, readCallback() copies the bytes then
+    return;
+  }
+  auto pipe = std::make_shared<SplicePipe>();
+  pipe->readFd_ = fds[0];
+  pipe->writeFd_ = fds[1];
+  fcntl(fds[1], F_SETPIPE_SZ, kForwardPipeSize);
+  auto capacity = fcntl(fds[1], F_GETPIPE_SZ);
+  pipe->capacity_ = capacity > 0 ? capacity : 64 * 1024;
+  pipe->source_ = shared_from_this();
+  forwardNode_ = std::make_shared<BufferNode>();
+  forwardNode_->fileBytesToSend_ = 1;  // until this side closes
+  forwardNode_->splicePipe_ = std::move(pipe);
+  to->sendNode(forwardNode_);
+}
+
+// The other side closed: what is received from now on is dropped, reading
+// on so that the close of the peer is still seen
+void TcpConnectionImpl::dropForward() {
+  forwardNode_.reset();
+  if (status_ != ConnStatus::Disconnected && !ioChannelPtr_->isReading()) {
+    ioChannelPtr_->enableReading();
+  }
+}
+
+void TcpConnectionImpl::spliceCallback() {
+  auto &pipe = *forwardNode_->splicePipe_;
+  auto n = splice(socketPtr_->fd(), nullptr, pipe.writeFd_, nullptr,
+                  pipe.capacity_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (n == 0) {
+    // socket closed by peer
+    handleClose();
+    return;
+  }
+  if (n < 0) {
+    if (errno == EAGAIN) {
+      // The pipe is full, or there was nothing to read after all; reading
+      // resumes when the other side has taken some
+      if (pipe.bytes_ > 0) {
+        pipe.sourcePaused_ = true;
+        ioChannelPtr_->disableReading();
+      }
+      return;
+    }
+    if (errno == EPIPE || errno == ECONNRESET) return;
+    // LOG_SYSERR << "splice from socket error";
+    handleClose();
+    return;
+  }
+  extendLife();
+  bytesReceived_ += n;
+  pipe.bytes_ += n;
+  pushForward();
+}
+
+// Has the other side send what is in the pipe, if it is its turn
+void TcpConnectionImpl::pushForward() {
+  auto to = forwardTo_.lock();
+  if (to && to->status_ != ConnStatus::Disconnected &&
+      !to->writeBufferList_.empty() &&
+      to->writeBufferList_.front() == forwardNode_) {
+    to->sendFileInLoop(forwardNode_);
+  }
+}
+
+// Queues a file, a stream or a pipe after what is being sent
+void TcpConnectionImpl::sendNode(const BufferNodePtr &node) {
   if (loop_->isInLoopThread()) {
     std::lock_guard<std::mutex> guard(sendNumMutex_);
     if (sendNum_ == 0) {
@@ -670,9 +964,8 @@ void TcpConnectionImpl::sendStream(
     std::lock_guard<std::mutex> guard(sendNumMutex_);
     ++sendNum_;
     loop_->queueInLoop([thisPtr, node]() {
-      // LOG_TRACE << "Push sendstream to list";
+      // LOG_TRACE << "Push sendfile to list";
       thisPtr->writeBufferList_.push_back(node);
-
       {
         std::lock_guard<std::mutex> guard1(thisPtr->sendNumMutex_);
         --thisPtr->sendNum_;
@@ -688,25 +981,52 @@ void TcpConnectionImpl::sendStream(
 void TcpConnectionImpl::sendFileInLoop(const BufferNodePtr &filePtr) {
   loop_->assertInLoopThread();
   assert(filePtr->isFile());
+  waitingForPipe_ = false;
+  if (filePtr->splicePipe_) {
+    sendPipeInLoop(filePtr);
+    return;
+  }
+  if (filePtr->zeroCopyOwner_) {
+    sendZeroCopyInLoop(filePtr);
+    return;
+  }
+  if (!isEncrypted_ && filePtr->relay_) {
+    sendRelayInLoop(filePtr);
+    return;
+  }
   if (!isEncrypted_ && !filePtr->streamCallback_) {
-    // LOG_TRACE << "send file in loop using linux kernel sendfile()";
-    auto bytesSent = sendfile(socketPtr_->fd(), filePtr->sendFd_,
-                              &filePtr->offset_, filePtr->fileBytesToSend_);
+    ssize_t bytesSent;
+    if (filePtr->isPipe_) {
+      // LOG_TRACE << "send pipe in loop using linux kernel splice()";
+      // sendfile() does not read pipes
+      bytesSent = splice(filePtr->sendFd_, nullptr, socketPtr_->fd(), nullptr,
+                         filePtr->fileBytesToSend_,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } else {
+      // LOG_TRACE << "send file in loop using linux kernel sendfile()";
+      bytesSent = sendfile(socketPtr_->fd(), filePtr->sendFd_,
+                           &filePtr->offset_, filePtr->fileBytesToSend_);
+    }
     if (bytesSent < 0) {
       if (errno != EAGAIN) {
         // LOG_SYSERR << "TcpConnectionImpl::sendFileInLoop";
         if (ioChannelPtr_->isWriting()) ioChannelPtr_->disableWriting();
+        closePipeChannel();
+        return;
       }
-      return;
-    }
-    if (bytesSent < filePtr->fileBytesToSend_) {
-      if (bytesSent == 0) {
-        // LOG_SYSERR << "TcpConnectionImpl::sendFileInLoop";
+      // Either the socket is full or the pipe is empty
+      if (filePtr->isPipe_ && pipeIsEmpty(filePtr->sendFd_)) {
+        waitForPipe(filePtr);
         return;
       }
+      bytesSent = 0;
+    } else if (bytesSent == 0) {
+      // The end of a pipe, or of a file cut short
+      filePtr->fileBytesToSend_ = 0;
     }
     // LOG_TRACE << "sendfile() " << bytesSent << " bytes sent";
     filePtr->fileBytesToSend_ -= bytesSent;
+    if (filePtr->fileBytesToSend_ <= 0) closePipeChannel();
     if (!ioChannelPtr_->isWriting()) {
       ioChannelPtr_->enableWriting();
     }
@@ -844,6 +1164,156 @@ void TcpConnectionImpl::sendFileInLoop(const BufferNodePtr &filePtr) {
   }
 }
 
+void TcpConnectionImpl::sendPipeInLoop(const BufferNodePtr &filePtr) {
+  auto &pipe = *filePtr->splicePipe_;
+  bool drained = false;
+  while (pipe.bytes_ > 0) {
+    auto n = splice(pipe.readFd_, nullptr, socketPtr_->fd(), nullptr,
+                    pipe.bytes_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      pipe.bytes_ -= n;
+      bytesSent_ += n;
+      drained = true;
+      continue;
+    }
+    if (n < 0 && errno == EAGAIN) break;
+    // LOG_SYSERR << "splice to socket error";
+    // The peer is gone, nothing more goes out
+    filePtr->fileBytesToSend_ = 0;
+    if (ioChannelPtr_->isWriting()) ioChannelPtr_->disableWriting();
+    return;
+  }
+  if (pipe.eof_ && pipe.bytes_ == 0) filePtr->fileBytesToSend_ = 0;
+  if (pipe.bytes_ == 0 && filePtr->fileBytesToSend_ > 0) {
+    // Waits for the other side to fill the pipe
+    waitingForPipe_ = true;
+    if (ioChannelPtr_->isWriting()) ioChannelPtr_->disableWriting();
+  } else if (!ioChannelPtr_->isWriting()) {
+    ioChannelPtr_->enableWriting();
+  }
+  if (drained && pipe.sourcePaused_) {
+    pipe.sourcePaused_ = false;
+    auto source = pipe.source_.lock();
+    if (source && source->status_ == ConnStatus::Connected) {
+      source->ioChannelPtr_->enableReading();
+    }
+  }
+}
+
+void TcpConnectionImpl::sendRelayInLoop(const BufferNodePtr &filePtr) {
+  auto &relay = *filePtr->relay_;
+  auto toRead = [&filePtr, &relay]() {
+    return std::min(relay.capacity_ - relay.bytes_,
+                    static_cast<size_t>(filePtr->fileBytesToSend_) -
+                        relay.bytes_);
+  };
+  while (true) {
+    if (!relay.eof_ && toRead() > 0) {
+      auto n = splice(filePtr->sendFd_, nullptr, relay.writeFd_, nullptr,
+                      toRead(), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n > 0) {
+        relay.bytes_ += n;
+      } else if (n == 0 || errno != EAGAIN) {
+        // The end, or a device splice() does not read: what is in the
+        // pipe goes out, then the next node
+        // LOG_SYSERR << "splice from file error";
+        relay.eof_ = true;
+      }
+    }
+    if (relay.bytes_ == 0) break;
+    auto n = splice(relay.readFd_, nullptr, socketPtr_->fd(), nullptr,
+                    relay.bytes_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      relay.bytes_ -= n;
+      bytesSent_ += n;
+      filePtr->fileBytesToSend_ -= n;
+      continue;
+    }
+    if (n < 0 && errno == EAGAIN) {
+      // The socket is full
+      if (!ioChannelPtr_->isWriting()) ioChannelPtr_->enableWriting();
+      return;
+    }
+    // LOG_SYSERR << "splice to socket error";
+    if (ioChannelPtr_->isWriting()) ioChannelPtr_->disableWriting();
+    closePipeChannel();
+    return;
+  }
+  if (relay.eof_ || filePtr->fileBytesToSend_ <= 0) {
+    filePtr->fileBytesToSend_ = 0;
+    closePipeChannel();
+    if (!ioChannelPtr_->isWriting()) ioChannelPtr_->enableWriting();
+    return;
+  }
+  // Nothing to read for now
+  waitForPipe(filePtr);
+}
+
+void TcpConnectionImpl::sendZeroCopyInLoop(const BufferNodePtr &filePtr) {
+  while (filePtr->fileBytesToSend_ > 0) {
+    auto data = filePtr->zeroCopyData_ + filePtr->offset_;
+    auto length = static_cast<size_t>(filePtr->fileBytesToSend_);
+    ssize_t n;
+    if (zeroCopyThreshold_.load(std::memory_order_relaxed) > 0) {
+      n = ::send(socketPtr_->fd(), data, length, MSG_ZEROCOPY);
+      if (n > 0) {
+        bytesSent_ += n;
+        // Every call sending something takes the next number
+        if (zeroCopyPending_.empty() ||
+            zeroCopyPending_.back().second != filePtr->zeroCopyOwner_) {
+          zeroCopyPending_.emplace_back(zeroCopyNext_,
+                                        filePtr->zeroCopyOwner_);
+        } else {
+          zeroCopyPending_.back().first = zeroCopyNext_;
+        }
+        ++zeroCopyNext_;
+        watchZeroCopyCompletions();
+      } else if (n < 0 && errno == ENOBUFS) {
+        // Too many completions pending, copied this time
+        n = writeInLoop(data, length);
+      }
+    } else {
+      n = writeInLoop(data, length);
+    }
+    if (n < 0) {
+      if (errno != EWOULDBLOCK) {
+        if (errno == EPIPE || errno == ECONNRESET) {
+          // LOG_TRACE << "EPIPE or ECONNRESET, errno=" << errno;
+          return;
+        }
+        // LOG_SYSERR << "Unexpected error(" << errno << ")";
+        return;
+      }
+      break;
+    }
+    filePtr->offset_ += static_cast<off_t>(n);
+    filePtr->fileBytesToSend_ -= n;
+  }
+  if (!ioChannelPtr_->isWriting()) ioChannelPtr_->enableWriting();
+}
+
+void TcpConnectionImpl::waitForPipe(const BufferNodePtr &filePtr) {
+  waitingForPipe_ = true;
+  if (ioChannelPtr_->isWriting()) ioChannelPtr_->disableWriting();
+  if (!pipeChannelPtr_) {
+    pipeChannelPtr_ = std::make_shared<Channel>(loop_, filePtr->sendFd_);
+    pipeChannelPtr_->tie(shared_from_this());
+    pipeChannelPtr_->setEventCallback([this]() {
+      pipeChannelPtr_->disableReading();
+      if (!writeBufferList_.empty()) sendFileInLoop(writeBufferList_.front());
+    });
+  }
+  pipeChannelPtr_->enableReading();
+}
+
+void TcpConnectionImpl::closePipeChannel() {
+  if (!pipeChannelPtr_) return;
+  pipeChannelPtr_->disableAll();
+  pipeChannelPtr_->remove();
+  // Not destroyed in its own callback
+  loop_->queueInLoop([channel = std::move(pipeChannelPtr_)]() {});
+}
+
 ssize_t TcpConnectionImpl::writeInLoop(const void *buffer, size_t length) {
   int nWritten = write(socketPtr_->fd(), buffer, length);
   if (nWritten > 0) bytesSent_ += nWritten;
@@ -3,6 +3,8 @@
 #include <unistd.h>
 
 #include <array>
+#include <atomic>
+#include <deque>
 #include <list>
 #include <mutex>
 #include <thread>
@@ -62,6 +64,7 @@ class TcpConnectionImpl
                         size_t length = 0) override;
   virtual void sendStream(
       std::function<std::size_t(char *, std::size_t)> callback) override;
+  virtual void forward(const TcpConnectionPtr &to) override;
 
   virtual const InetAddress &localAddr() const override { return localAddr_; }
   virtual const InetAddress &peerAddr() const override { return peerAddr_; }
@@ -82,6 +85,22 @@ class TcpConnectionImpl
     highWaterMarkLen_ = markLen;
   }
 
+  virtual void setDrainCallback(const WriteCompleteCallback &cb) override {
+    drainCallback_ = cb;
+  }
+
+  virtual const HighWaterMarkCallback &highWaterMarkCallback() const override {
+    return highWaterMarkCallback_;
+  }
+
+  virtual size_t highWaterMarkLength() const override {
+    return highWaterMarkLen_;
+  }
+
+  virtual const WriteCompleteCallback &drainCallback() const override {
+    return drainCallback_;
+  }
+
   virtual void keepAlive() override {
     idleTimeout_ = 0;
     auto entry = kickoffEntry_.lock();
@@ -94,6 +113,12 @@ class TcpConnectionImpl
 
   virtual void setTcpNoDelay(bool on) override;
 
+  virtual void setZeroCopyThreshold(size_t threshold) override;
+
+  virtual void stopRecv() override;
+
+  virtual void startRecv() override;
+
   virtual void shutdown() override;
 
   virtual void forceClose() override;
@@ -166,17 +191,43 @@ class TcpConnectionImpl
   virtual void connectEstablished();
 
  protected:
+  // The pipe between the two sockets of a forward(), or between a device
+  // and the socket, splice() needs a pipe on one side
+  struct SplicePipe {
+    int readFd_{-1};
+    int writeFd_{-1};
+    size_t capacity_{0};
+    size_t bytes_{0};
+    bool eof_{false};
+    bool sourcePaused_{false};
+    std::weak_ptr<TcpConnectionImpl> source_;
+    ~SplicePipe() {
+      if (readFd_ >= 0) close(readFd_);
+      if (writeFd_ >= 0) close(writeFd_);
+    }
+  };
+
   struct BufferNode {
     int sendFd_{-1};
     off_t offset_{0};
+    // Not a regular file, which sendfile() does not read: a FIFO is
+    // spliced straight to the socket, anything else through relay_
+    bool isPipe_{false};
 
     ssize_t fileBytesToSend_{0};
     std::function<std::size_t(char *, std::size_t)> streamCallback_;
     std::size_t nDataWritten_{0};
     std::shared_ptr<MsgBuffer> msgBuffer_;
+    std::shared_ptr<SplicePipe> splicePipe_;
+    std::shared_ptr<SplicePipe> relay_;
+    // A message sent in place with MSG_ZEROCOPY from offset_ on
+    std::shared_ptr<void> zeroCopyOwner_;
+    const char *zeroCopyData_{nullptr};
     bool isFile() const {
       if (streamCallback_) return true;
       if (sendFd_ >= 0) return true;
+      if (splicePipe_) return true;
+      if (zeroCopyOwner_) return true;
       return false;
     }
     ~BufferNode() {
@@ -192,8 +243,26 @@ class TcpConnectionImpl
   void handleClose();
   void handleError();
 
+  void sendNode(const BufferNodePtr &node);
   void sendFileInLoop(const BufferNodePtr &file);
+  void sendPipeInLoop(const BufferNodePtr &file);
+  void sendRelayInLoop(const BufferNodePtr &file);
+  void waitForPipe(const BufferNodePtr &file);
+  void closePipeChannel();
+  void forwardInLoop(const std::shared_ptr<TcpConnectionImpl> &to);
+  void spliceCallback();
+  void pushForward();
+  void dropForward();
   void sendInLoop(const void *buffer, size_t length);
+  void sendInLoop(const std::shared_ptr<void> &owner, const char *data,
+                  size_t length);
+  void sendZeroCopyInLoop(const BufferNodePtr &node);
+  void readZeroCopyCompletions();
+  void watchZeroCopyCompletions();
+  bool isZeroCopySize(size_t length) const {
+    auto threshold = zeroCopyThreshold_.load(std::memory_order_relaxed);
+    return threshold > 0 && length >= threshold;
+  }
   ssize_t writeInLoop(const void *buffer, size_t length);
 
   enum class ConnStatus { Disconnected, Connecting, Connected, Disconnecting };
@@ -212,9 +281,10 @@ class TcpConnectionImpl
   CloseCallback closeCallback_;
   WriteCompleteCallback writeCompleteCallback_;
   HighWaterMarkCallback highWaterMarkCallback_;
+  WriteCompleteCallback drainCallback_;
   SSLErrorCallback sslErrorCallback_;
 
-  size_t highWaterMarkLen_;
+  size_t highWaterMarkLen_{0};
   std::string name_;
 
   uint64_t sendNum_{0};
@@ -224,6 +294,25 @@ class TcpConnectionImpl
   size_t bytesReceived_{0};
 
   std::unique_ptr<std::vector<char>> fileBufferPtr_;
+
+  // Watches a pipe being sent while it is empty
+  std::shared_ptr<Channel> pipeChannelPtr_;
+  bool waitingForPipe_{false};
+
+  // Messages sent with MSG_ZEROCOPY, each with the number of the last call
+  // sending from it, kept until the kernel says it is done with them, past
+  // the destruction of the connection if need be
+  std::atomic<size_t> zeroCopyThreshold_{0};
+  bool zeroCopyEnabled_{false};
+  bool zeroCopyWatched_{false};
+  uint32_t zeroCopyNext_{0};
+  std::deque<std::pair<uint32_t, std::shared_ptr<void>>> zeroCopyPending_;
+
+  // Where forward() sends what is received: spliced through the pipe of
+  // forwardNode_, or copied without one
+  bool forwarding_{false};
+  BufferNodePtr forwardNode_;
+  std::weak_ptr<TcpConnectionImpl> forwardTo_;
 };
 
 using TcpConnectionImplPtr = std::shared_ptr<TcpConnectionImpl>;
@@ -30,7 +30,7 @@ void Timer::restart(const TimePoint &now) {
   if (repeat_) {
     when_ = now + interval_;
   } else {
-    when_ = std::chrono::steady_clock::now();
+    when_ = now;
   }
 }
 
@@ -7,6 +7,7 @@
 #include <iostream>
 
 #include "Channel.h"
+#include "Clock.h"
 #include "EventLoop.h"
 
 using namespace canary;
@@ -56,10 +57,16 @@ static void readTimerfd(int timerfd, const TimePoint &) {
 
 void TimerQueue::handleRead() {
   loop_->assertInLoopThread();
-  const auto now = std::chrono::steady_clock::now();
+  // Timers due by the poll's return run now, later ones rearm the timerfd
+  auto now = CachedClock::steadyNow();
   readTimerfd(timerfd_, now);
 
   std::vector<TimerPtr> expired = getExpired(now);
+  if (expired.empty()) {
+    // A reading derived from the TSC may lag the clock the timerfd follows
+    now = std::chrono::steady_clock::now();
+    expired = getExpired(now);
+  }
 
   callingExpiredTimers_ = true;
   // cancelingTimers_.clear();
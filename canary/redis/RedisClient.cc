@@ -0,0 +1,95 @@
+#include "RedisClient.h"
+
+using namespace canary;
+
+namespace canary {
+static constexpr double kReconnectDelay{1.0};
+}  // namespace canary
+
+RedisClientPtr RedisClient::newRedisClient(EventLoop *loop,
+                                           const InetAddress &serverAddr,
+                                           size_t connectionNum,
+                                           const std::string &password,
+                                           unsigned int db) {
+  return std::make_shared<RedisClient>(loop, serverAddr, connectionNum,
+                                       password, db);
+}
+
+RedisClient::RedisClient(EventLoop *loop, const InetAddress &serverAddr,
+                         size_t connectionNum, const std::string &password,
+                         unsigned int db)
+    : loop_(loop) {
+  if (connectionNum == 0) connectionNum = 1;
+  auto protocol = protocol_;
+  auto timeout = timeout_;
+  pool_ = ConnectionPool<RedisConnection>::newConnectionPool(
+      {loop},
+      [serverAddr, password, db, protocol, timeout](EventLoop *loop) {
+        auto connection = std::make_shared<RedisConnection>(
+            loop, serverAddr, password, db, *protocol);
+        connection->setCommandTimeout(*timeout);
+        return connection;
+      },
+      connectionNum, connectionNum);
+  pool_->setReconnectDelay(kReconnectDelay);
+}
+
+RedisClient::~RedisClient() {
+  // The connections close when they go away
+}
+
+void RedisClient::execCommand(RedisCallback &&callback,
+                              std::initializer_list<string_view> args) {
+  if (loop_->isInLoopThread()) {
+    auto connection = pool_->get();
+    if (!connection) {
+      callback(RedisResult::kNetworkFailure, RedisReply());
+      return;
+    }
+    connection->execCommand(std::move(callback), args);
+    return;
+  }
+  MsgBuffer command;
+  appendRedisCommand(args, &command);
+  sendInLoop(std::move(command), std::move(callback));
+}
+
+void RedisClient::execCommand(RedisCallback &&callback,
+                              const std::vector<std::string> &args) {
+  if (loop_->isInLoopThread()) {
+    auto connection = pool_->get();
+    if (!connection) {
+      callback(RedisResult::kNetworkFailure, RedisReply());
+      return;
+    }
+    connection->execCommand(std::move(callback), args);
+    return;
+  }
+  MsgBuffer command;
+  appendRedisCommand(args, &command);
+  sendInLoop(std::move(command), std::move(callback));
+}
+
+std::future<std::pair<RedisResult, RedisReply>> RedisClient::execCommand(
+    std::initializer_list<string_view> args) {
+  auto promise =
+      std::make_shared<std::promise<std::pair<RedisResult, RedisReply>>>();
+  auto future = promise->get_future();
+  execCommand(
+      [promise](RedisResult result, const RedisReply &reply) {
+        promise->set_value(std::make_pair(result, reply.detach()));
+      },
+      args);
+  return future;
+}
+
+void RedisClient::sendInLoop(MsgBuffer &&command, RedisCallback &&callback) {
+  pool_->get([command = std::move(command), callback = std::move(callback)](
+                 const RedisConnectionPtr &connection) mutable {
+    if (!connection) {
+      callback(RedisResult::kNetworkFailure, RedisReply());
+      return;
+    }
+    connection->sendCommand(std::move(command), std::move(callback));
+  });
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <future>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ConnectionPool.h"
+#include "RedisConnection.h"
+
+namespace canary {
+
+class RedisClient;
+using RedisClientPtr = std::shared_ptr<RedisClient>;
+
+// A pool of multiplexed connections to one Redis server, a ConnectionPool
+// in a single loop. Each command goes to the open connection with the
+// fewest replies outstanding; with one connection every caller shares a
+// single pipelined connection. A closed connection is replaced after a
+// second. Commands may be issued from any thread, callbacks are called in
+// the loop of the client.
+class RedisClient : NonCopyable,
+                    public std::enable_shared_from_this<RedisClient> {
+ public:
+  static RedisClientPtr newRedisClient(EventLoop *loop,
+                                       const InetAddress &serverAddr,
+                                       size_t connectionNum = 1,
+                                       const std::string &password = "",
+                                       unsigned int db = 0);
+
+  RedisClient(EventLoop *loop, const InetAddress &serverAddr,
+              size_t connectionNum, const std::string &password,
+              unsigned int db);
+
+  ~RedisClient();
+
+  // Must be called before the first command
+  void enableResp3() { *protocol_ = 3; }
+
+  // See RedisConnection::setCommandTimeout(), a connection closed by a
+  // timeout is replaced like any other. Must be called before the first
+  // command.
+  void setCommandTimeout(double timeout) { *timeout_ = timeout; }
+
+  void execCommand(RedisCallback &&callback,
+                   std::initializer_list<string_view> args);
+
+  void execCommand(RedisCallback &&callback,
+                   const std::vector<std::string> &args);
+
+  // The reply is detached. Must not be waited on in the loop of the client.
+  std::future<std::pair<RedisResult, RedisReply>> execCommand(
+      std::initializer_list<string_view> args);
+
+  EventLoop *getLoop() const { return loop_; }
+
+ private:
+  void sendInLoop(MsgBuffer &&command, RedisCallback &&callback);
+
+  EventLoop *loop_;
+  // Read by the pool when it opens a connection
+  std::shared_ptr<int> protocol_{std::make_shared<int>(2)};
+  std::shared_ptr<double> timeout_{std::make_shared<double>(0)};
+  std::shared_ptr<ConnectionPool<RedisConnection>> pool_;
+};
+
+}  // namespace canary
@@ -0,0 +1,398 @@
+#include "RedisClusterClient.h"
+
+#include <assert.h>
+
+#include <map>
+
+#include "Crc.h"
+
+using namespace canary;
+
+namespace canary {
+static constexpr int kMaxRedirects{5};
+
+// "127.0.0.1:7000", "::1:7000"
+static bool parseNode(string_view text, InetAddress *addr) {
+  auto colon = text.rfind(':');
+  if (colon == string_view::npos || colon == 0) return false;
+  std::string ip(text.substr(0, colon));
+  int port = 0;
+  for (char c : text.substr(colon + 1)) {
+    if (c < '0' || c > '9' || port > 65535) return false;
+    port = port * 10 + (c - '0');
+  }
+  if (port == 0 || port > 65535) return false;
+  *addr = InetAddress(ip, static_cast<uint16_t>(port),
+                      ip.find(':') != std::string::npos);
+  return !addr->isUnspecified();
+}
+}  // namespace canary
+
+RedisClusterClientPtr RedisClusterClient::newRedisClusterClient(
+    const std::vector<EventLoop *> &loops,
+    const std::vector<InetAddress> &seeds, const std::string &password) {
+  return std::make_shared<RedisClusterClient>(loops, seeds, password);
+}
+
+RedisClusterClient::RedisClusterClient(const std::vector<EventLoop *> &loops,
+                                       const std::vector<InetAddress> &seeds,
+                                       const std::string &password)
+    : seeds_(seeds), password_(password) {
+  assert(!loops.empty() && !seeds.empty());
+  for (auto loop : loops) {
+    loops_.emplace_back(new LoopState{loop});
+  }
+}
+
+RedisClusterClient::~RedisClusterClient() {
+  if (refreshTimer_ != InvalidTimerId) {
+    loops_[0]->loop_->invalidateTimer(refreshTimer_);
+  }
+}
+
+uint16_t RedisClusterClient::keySlot(string_view key) {
+  // Only the part between the first { and the next } is hashed, if it is
+  // not empty: {user1}.name and {user1}.mail live in the same slot.
+  auto open = key.find('{');
+  if (open != string_view::npos) {
+    auto close = key.find('}', open + 1);
+    if (close != string_view::npos && close > open + 1) {
+      key = key.substr(open + 1, close - open - 1);
+    }
+  }
+  return Crc16::checksum(key.data(), key.size()) & (kSlotCount - 1);
+}
+
+InetAddress RedisClusterClient::nodeOfSlot(uint16_t slot) const {
+  auto map = slotMap();
+  if (!map || map->slots_[slot] == kNoNode) return seeds_[0];
+  return map->nodes_[map->slots_[slot]];
+}
+
+const RedisClusterClient::SlotMap *RedisClusterClient::slotMap(
+    LoopState *state) {
+  state->loop_->assertInLoopThread();
+  if (mapVersion_.load(std::memory_order_acquire) != state->mapVersion_) {
+    std::lock_guard<std::mutex> lock(mapMutex_);
+    state->map_ = slotMap_;
+    state->mapVersion_ = mapVersion_.load(std::memory_order_relaxed);
+  }
+  return state->map_.get();
+}
+
+void RedisClusterClient::publishLocked(SlotMapPtr map) {
+  slotMap_ = std::move(map);
+  mapVersion_.fetch_add(1, std::memory_order_release);
+}
+
+void RedisClusterClient::moveSlot(LoopState *state, uint16_t slot,
+                                  const InetAddress &target) {
+  {
+    std::lock_guard<std::mutex> lock(mapMutex_);
+    pendingMoves_.emplace_back(slot, target);
+    if (pendingMoves_.size() > 1) return;
+  }
+  // After the other replies of the same read, which likely are MOVED too
+  auto thisPtr = shared_from_this();
+  state->loop_->queueInLoop([thisPtr]() { thisPtr->applyMoves(); });
+}
+
+void RedisClusterClient::applyMoves() {
+  std::lock_guard<std::mutex> lock(mapMutex_);
+  if (pendingMoves_.empty()) return;
+  auto patched = slotMap_ ? std::make_shared<SlotMap>(*slotMap_)
+                          : std::make_shared<SlotMap>();
+  for (auto &move : pendingMoves_) {
+    auto ipPort = move.second.toIpPort();
+    size_t index = 0;
+    while (index < patched->nodes_.size() &&
+           patched->nodes_[index].toIpPort() != ipPort) {
+      ++index;
+    }
+    if (index == patched->nodes_.size()) patched->nodes_.push_back(move.second);
+    patched->slots_[move.first] = static_cast<uint16_t>(index);
+  }
+  pendingMoves_.clear();
+  publishLocked(std::move(patched));
+}
+
+void RedisClusterClient::start(double refreshInterval) {
+  refresh();
+  if (refreshInterval > 0) {
+    std::weak_ptr<RedisClusterClient> weakPtr = shared_from_this();
+    refreshTimer_ = loops_[0]->loop_->runEvery(refreshInterval, [weakPtr]() {
+      auto thisPtr = weakPtr.lock();
+      if (thisPtr) thisPtr->refresh();
+    });
+  }
+}
+
+RedisClusterClient::LoopState *RedisClusterClient::pickLoop() {
+  for (auto &state : loops_) {
+    if (state->loop_->isInLoopThread()) return state.get();
+  }
+  return loops_[nextLoop_++ % loops_.size()].get();
+}
+
+void RedisClusterClient::execCommand(RedisCallback &&callback,
+                                     const std::vector<std::string> &args) {
+  auto cmd = std::make_shared<Command>();
+  cmd->args_ = args;
+  cmd->callback_ = std::move(callback);
+  cmd->slot_ = args.size() > 1 ? keySlot(args[1]) : 0;
+  auto state = pickLoop();
+  auto thisPtr = shared_from_this();
+  state->loop_->runInLoop(
+      [thisPtr, state, cmd]() { thisPtr->send(state, cmd, nullptr, false); });
+}
+
+std::future<std::pair<RedisResult, RedisReply>>
+RedisClusterClient::execCommand(const std::vector<std::string> &args) {
+  auto promise =
+      std::make_shared<std::promise<std::pair<RedisResult, RedisReply>>>();
+  auto future = promise->get_future();
+  execCommand(
+      [promise](RedisResult result, const RedisReply &reply) {
+        promise->set_value(std::make_pair(result, reply.detach()));
+      },
+      args);
+  return future;
+}
+
+void RedisClusterClient::mget(const std::vector<std::string> &keys,
+                              MultiCallback &&callback) {
+  struct Gather {
+    std::vector<RedisReply> values_;
+    size_t left_{0};
+    RedisResult result_{RedisResult::kOk};
+    MultiCallback callback_;
+  };
+  auto gather = std::make_shared<Gather>();
+  gather->values_.resize(keys.size());
+  gather->callback_ = std::move(callback);
+  std::map<uint16_t, std::vector<size_t>> groups;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    groups[keySlot(keys[i])].push_back(i);
+  }
+  gather->left_ = groups.size();
+  if (groups.empty()) {
+    gather->callback_(RedisResult::kOk, gather->values_);
+    return;
+  }
+  // Every group runs in the same loop, the gathering needs no lock
+  auto state = pickLoop();
+  auto thisPtr = shared_from_this();
+  for (auto &group : groups) {
+    auto cmd = std::make_shared<Command>();
+    cmd->slot_ = group.first;
+    cmd->args_.reserve(group.second.size() + 1);
+    cmd->args_.push_back("MGET");
+    for (auto index : group.second) cmd->args_.push_back(keys[index]);
+    cmd->callback_ = [gather, indexes = std::move(group.second)](
+                         RedisResult result, const RedisReply &reply) {
+      if (result != RedisResult::kOk) {
+        gather->result_ = result;
+      } else if (reply.type() == RedisReplyType::kArray &&
+                 reply.size() == indexes.size()) {
+        for (size_t i = 0; i < indexes.size(); ++i) {
+          gather->values_[indexes[i]] = reply[i].detach();
+        }
+      } else {
+        // An error reply stands for the value of each key of its slot
+        auto detached = reply.detach();
+        for (auto index : indexes) gather->values_[index] = detached;
+      }
+      if (--gather->left_ == 0) {
+        gather->callback_(gather->result_, gather->values_);
+      }
+    };
+    state->loop_->runInLoop(
+        [thisPtr, state, cmd]() { thisPtr->send(state, cmd, nullptr, false); });
+  }
+}
+
+void RedisClusterClient::del(
+    const std::vector<std::string> &keys,
+    std::function<void(RedisResult, long long)> &&callback) {
+  struct Gather {
+    long long removed_{0};
+    size_t left_{0};
+    RedisResult result_{RedisResult::kOk};
+    std::function<void(RedisResult, long long)> callback_;
+  };
+  auto gather = std::make_shared<Gather>();
+  gather->callback_ = std::move(callback);
+  std::map<uint16_t, std::vector<std::string>> groups;
+  for (auto &key : keys) groups[keySlot(key)].push_back(key);
+  gather->left_ = groups.size();
+  if (groups.empty()) {
+    gather->callback_(RedisResult::kOk, 0);
+    return;
+  }
+  auto state = pickLoop();
+  auto thisPtr = shared_from_this();
+  for (auto &group : groups) {
+    auto cmd = std::make_shared<Command>();
+    cmd->slot_ = group.first;
+    cmd->args_.push_back("DEL");
+    cmd->args_.insert(cmd->args_.end(), group.second.begin(),
+                      group.second.end());
+    cmd->callback_ = [gather](RedisResult result, const RedisReply &reply) {
+      if (result != RedisResult::kOk) {
+        gather->result_ = result;
+      } else if (reply.type() == RedisReplyType::kInteger) {
+        gather->removed_ += reply.asInteger();
+      } else {
+        gather->result_ = RedisResult::kBadReply;
+      }
+      if (--gather->left_ == 0) {
+        gather->callback_(gather->result_, gather->removed_);
+      }
+    };
+    state->loop_->runInLoop(
+        [thisPtr, state, cmd]() { thisPtr->send(state, cmd, nullptr, false); });
+  }
+}
+
+RedisConnection *RedisClusterClient::connectionFor(LoopState *state,
+                                                   const InetAddress &addr) {
+  auto &connection = state->connections_[addr.toIpPort()];
+  if (!connection || connection->closed()) {
+    connection =
+        std::make_shared<RedisConnection>(state->loop_, addr, password_);
+    connection->connect();
+  }
+  return connection.get();
+}
+
+void RedisClusterClient::send(LoopState *state, const CommandPtr &cmd,
+                              const InetAddress *addr, bool asking) {
+  InetAddress target;
+  if (addr) {
+    target = *addr;
+  } else {
+    auto map = slotMap(state);
+    if (!map || map->slots_[cmd->slot_] == kNoNode) {
+      target = seeds_[0];
+    } else {
+      target = map->nodes_[map->slots_[cmd->slot_]];
+    }
+  }
+  auto connection = connectionFor(state, target);
+  // ASKING only holds for the command right after it, the pipeline keeps
+  // the two together.
+  if (asking) connection->execCommand(RedisCallback(), {"ASKING"});
+  auto thisPtr = shared_from_this();
+  connection->execCommand(
+      [thisPtr, state, cmd](RedisResult result, const RedisReply &reply) {
+        thisPtr->onReply(state, cmd, result, reply);
+      },
+      cmd->args_);
+}
+
+void RedisClusterClient::onReply(LoopState *state, const CommandPtr &cmd,
+                                 RedisResult result, const RedisReply &reply) {
+  if (result == RedisResult::kNetworkFailure) {
+    // The node may have failed over, the refresh tells where the slot went
+    bool again = cmd->redirects_ < kMaxRedirects;
+    if (again) {
+      ++cmd->redirects_;
+      state->resends_.push_back(cmd);
+    }
+    refresh();
+    if (again) return;
+  } else if (result == RedisResult::kOk && reply.isError() &&
+             cmd->redirects_ < kMaxRedirects) {
+    // MOVED 3999 127.0.0.1:6381, ASK 3999 127.0.0.1:6381
+    auto text = reply.asStringView();
+    bool moved = text.substr(0, 6) == "MOVED ";
+    bool ask = text.substr(0, 4) == "ASK ";
+    auto space = text.rfind(' ');
+    InetAddress target;
+    if ((moved || ask) && parseNode(text.substr(space + 1), &target)) {
+      ++cmd->redirects_;
+      if (moved) {
+        // Patch the map soon, the refresh brings the rest
+        moveSlot(state, cmd->slot_, target);
+        refresh();
+      }
+      send(state, cmd, &target, ask);
+      return;
+    }
+  }
+  cmd->callback_(result, reply);
+}
+
+void RedisClusterClient::refresh() {
+  if (refreshing_.exchange(true)) return;
+  auto thisPtr = shared_from_this();
+  auto state = loops_[0].get();
+  state->loop_->runInLoop([thisPtr, state]() { thisPtr->askSlots(state, 0); });
+}
+
+void RedisClusterClient::askSlots(LoopState *state, size_t asked) {
+  // Ask the known nodes in turn, so that a dead one is not asked forever,
+  // and the next one at once when one does not answer
+  std::vector<InetAddress> nodes;
+  auto map = slotMap();
+  if (map) nodes = map->nodes_;
+  nodes.insert(nodes.end(), seeds_.begin(), seeds_.end());
+  auto node = nodes[nextRefreshNode_++ % nodes.size()];
+  auto connection = connectionFor(state, node);
+  auto thisPtr = shared_from_this();
+  connection->execCommand(
+      [thisPtr, state, node, asked, count = nodes.size()](
+          RedisResult result, const RedisReply &reply) {
+        if (result == RedisResult::kOk &&
+            reply.type() == RedisReplyType::kArray) {
+          thisPtr->applySlots(reply, node);
+          ++thisPtr->refreshCount_;
+        } else if (asked + 1 < count) {
+          thisPtr->askSlots(state, asked + 1);
+          return;
+        }
+        thisPtr->refreshing_ = false;
+        // Whatever the outcome, a command failing again asks for another
+        for (auto &loopState : thisPtr->loops_) {
+          auto loop = loopState.get();
+          loop->loop_->runInLoop([thisPtr, loop]() { thisPtr->resend(loop); });
+        }
+      },
+      {"CLUSTER", "SLOTS"});
+}
+
+void RedisClusterClient::resend(LoopState *state) {
+  auto resends = std::move(state->resends_);
+  state->resends_.clear();
+  for (auto &cmd : resends) send(state, cmd, nullptr, false);
+}
+
+void RedisClusterClient::applySlots(const RedisReply &reply,
+                                    const InetAddress &from) {
+  // [[start, end, [ip, port, id], replicas...], ...]
+  auto map = std::make_shared<SlotMap>();
+  for (auto &range : reply.elements()) {
+    if (range.size() < 3 || range[2].size() < 2) continue;
+    auto start = range[0].asInteger();
+    auto end = range[1].asInteger();
+    if (start < 0 || end >= kSlotCount || start > end) continue;
+    auto ip = range[2][0].asString();
+    // An empty ip is the one of the node that answered
+    if (ip.empty()) ip = from.toIp();
+    InetAddress addr(ip, static_cast<uint16_t>(range[2][1].asInteger()),
+                     ip.find(':') != std::string::npos);
+    if (addr.isUnspecified()) continue;
+    auto ipPort = addr.toIpPort();
+    size_t index = 0;
+    while (index < map->nodes_.size() &&
+           map->nodes_[index].toIpPort() != ipPort) {
+      ++index;
+    }
+    if (index == map->nodes_.size()) map->nodes_.push_back(addr);
+    for (auto slot = start; slot <= end; ++slot) {
+      map->slots_[slot] = static_cast<uint16_t>(index);
+    }
+  }
+  std::lock_guard<std::mutex> lock(mapMutex_);
+  publishLocked(std::move(map));
+}
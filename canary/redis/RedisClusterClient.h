@@ -0,0 +1,161 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "RedisConnection.h"
+
+namespace canary {
+
+class RedisClusterClient;
+using RedisClusterClientPtr = std::shared_ptr<RedisClusterClient>;
+
+// Client of a Redis Cluster. The slot map is an immutable snapshot with a
+// version number; each loop keeps its own reference to it and only takes
+// the lock to pick up a new one when the version has moved, so routing a
+// command costs one atomic load. Each loop has its own
+// pipelined connection to each node; a command issued in one of the loops
+// stays there, one issued elsewhere goes to the loops in turn. MOVED
+// redirects resend the command, patch the map, all the redirects read
+// together in one copy, and trigger a refresh of the topology (CLUSTER
+// SLOTS); ASK redirects are followed for one command. A command that
+// loses its connection is sent again once the topology is refreshed, in
+// case the node failed over, so it may run twice. Redirects and resends
+// together are bounded.
+// Callbacks are called in the loop that ran the command.
+class RedisClusterClient
+    : NonCopyable,
+      public std::enable_shared_from_this<RedisClusterClient> {
+ public:
+  static constexpr uint16_t kSlotCount{16384};
+
+  using MultiCallback =
+      std::function<void(RedisResult, const std::vector<RedisReply> &)>;
+
+  static RedisClusterClientPtr newRedisClusterClient(
+      const std::vector<EventLoop *> &loops,
+      const std::vector<InetAddress> &seeds,
+      const std::string &password = "");
+
+  RedisClusterClient(const std::vector<EventLoop *> &loops,
+                     const std::vector<InetAddress> &seeds,
+                     const std::string &password);
+
+  ~RedisClusterClient();
+
+  // Loads the slot map, then refreshes it every refreshInterval seconds
+  void start(double refreshInterval = 30.0);
+
+  // The key is the second argument, commands without one go to any node
+  void execCommand(RedisCallback &&callback,
+                   const std::vector<std::string> &args);
+
+  // The reply is detached. Must not be waited on in the loops.
+  std::future<std::pair<RedisResult, RedisReply>> execCommand(
+      const std::vector<std::string> &args);
+
+  // MGET over keys of any slots: one MGET per slot, all in parallel. The
+  // values are detached and in the order of keys.
+  void mget(const std::vector<std::string> &keys, MultiCallback &&callback);
+
+  // DEL over keys of any slots, gives the number of keys removed
+  void del(const std::vector<std::string> &keys,
+           std::function<void(RedisResult, long long)> &&callback);
+
+  // CRC16 of the key (or of its {hash tag}) modulo 16384
+  static uint16_t keySlot(string_view key);
+
+  // The node serving slot according to the current map, takes the lock
+  InetAddress nodeOfSlot(uint16_t slot) const;
+
+  // Topology refreshes done so far
+  size_t refreshCount() const { return refreshCount_; }
+
+ private:
+  static constexpr uint16_t kNoNode{0xffff};
+
+  struct SlotMap {
+    std::vector<InetAddress> nodes_;
+    std::vector<uint16_t> slots_ = std::vector<uint16_t>(kSlotCount, kNoNode);
+  };
+  using SlotMapPtr = std::shared_ptr<const SlotMap>;
+
+  struct Command {
+    std::vector<std::string> args_;
+    RedisCallback callback_;
+    uint16_t slot_{0};
+    int redirects_{0};
+  };
+  using CommandPtr = std::shared_ptr<Command>;
+
+  struct LoopState {
+    EventLoop *loop_{nullptr};
+    // ip:port -> connection, only touched in loop_
+    std::unordered_map<std::string, RedisConnectionPtr> connections_{};
+    // The map as of mapVersion_, only touched in loop_
+    SlotMapPtr map_{};
+    uint64_t mapVersion_{0};
+    // Commands that lost their connection, sent again after the refresh,
+    // only touched in loop_
+    std::vector<CommandPtr> resends_{};
+  };
+
+  LoopState *pickLoop();
+
+  // Sends cmd to addr, or to the owner of its slot when addr is null
+  void send(LoopState *state, const CommandPtr &cmd, const InetAddress *addr,
+            bool asking);
+
+  RedisConnection *connectionFor(LoopState *state, const InetAddress &addr);
+
+  void onReply(LoopState *state, const CommandPtr &cmd, RedisResult result,
+               const RedisReply &reply);
+
+  void refresh();
+
+  // Asks a node for CLUSTER SLOTS, asked nodes did not answer so far
+  void askSlots(LoopState *state, size_t asked);
+
+  // Sends the commands waiting for the refresh
+  void resend(LoopState *state);
+
+  void applySlots(const RedisReply &reply, const InetAddress &from);
+
+  SlotMapPtr slotMap() const {
+    std::lock_guard<std::mutex> lock(mapMutex_);
+    return slotMap_;
+  }
+
+  // The map seen by the loop of state, without locking while it is current
+  const SlotMap *slotMap(LoopState *state);
+
+  // Under mapMutex_
+  void publishLocked(SlotMapPtr map);
+
+  void moveSlot(LoopState *state, uint16_t slot, const InetAddress &target);
+
+  void applyMoves();
+
+  std::vector<std::unique_ptr<LoopState>> loops_;
+  const std::vector<InetAddress> seeds_;
+  const std::string password_;
+  mutable std::mutex mapMutex_;
+  SlotMapPtr slotMap_;
+  std::atomic<uint64_t> mapVersion_{0};
+  // MOVED redirects not in the map yet
+  std::vector<std::pair<uint16_t, InetAddress>> pendingMoves_;
+  std::atomic<bool> refreshing_{false};
+  std::atomic<size_t> nextLoop_{0};
+  std::atomic<size_t> nextRefreshNode_{0};
+  std::atomic<size_t> refreshCount_{0};
+  TimerId refreshTimer_{InvalidTimerId};
+};
+
+}  // namespace canary
@@ -0,0 +1,264 @@
+#include "RedisConnection.h"
+
+#include <algorithm>
+
+#include "Clock.h"
+
+using namespace canary;
+
+RedisConnection::RedisConnection(EventLoop *loop,
+                                 const InetAddress &serverAddr,
+                                 const std::string &password, unsigned int db,
+                                 int protocol)
+    : loop_(loop),
+      serverAddr_(serverAddr),
+      password_(password),
+      db_(db),
+      protocol_(protocol) {}
+
+RedisConnection::~RedisConnection() {
+  // The TcpClient closes the connection when it goes away
+}
+
+void RedisConnection::connect() {
+  auto thisPtr = shared_from_this();
+  loop_->runInLoop([thisPtr]() { thisPtr->connectInLoop(); });
+}
+
+void RedisConnection::connectInLoop() {
+  if (status_ != Status::kNone) return;
+  status_ = Status::kConnecting;
+
+  // The handshake goes before the commands issued so far
+  MsgBuffer handshake;
+  std::deque<Pending> handshakeCallbacks;
+  std::weak_ptr<RedisConnection> weakPtr = shared_from_this();
+  auto check = [weakPtr](RedisResult result, const RedisReply &reply) {
+    auto thisPtr = weakPtr.lock();
+    if (thisPtr && result == RedisResult::kOk && reply.isError()) {
+      thisPtr->close(RedisResult::kNetworkFailure);
+    }
+  };
+  auto db = std::to_string(db_);
+  auto now = CachedClock::steadyNow();
+  if (protocol_ == 3) {
+    if (password_.empty()) {
+      appendRedisCommand({"HELLO", "3"}, &handshake);
+    } else {
+      appendRedisCommand({"HELLO", "3", "AUTH", "default", password_},
+                         &handshake);
+    }
+    handshakeCallbacks.push_back({check, now});
+  } else if (!password_.empty()) {
+    appendRedisCommand({"AUTH", password_}, &handshake);
+    handshakeCallbacks.push_back({check, now});
+  }
+  if (db_ != 0) {
+    appendRedisCommand({"SELECT", db}, &handshake);
+    handshakeCallbacks.push_back({check, now});
+  }
+  if (!handshakeCallbacks.empty()) {
+    handshake.append(output_);
+    output_.swap(handshake);
+    callbacks_.insert(callbacks_.begin(),
+                      std::make_move_iterator(handshakeCallbacks.begin()),
+                      std::make_move_iterator(handshakeCallbacks.end()));
+    outstanding_ += handshakeCallbacks.size();
+    watchTimeout();
+  }
+
+  tcpClient_ =
+      std::make_shared<TcpClient>(loop_, serverAddr_, "RedisConnection");
+  tcpClient_->setConnectionCallback([weakPtr](const TcpConnectionPtr &conn) {
+    auto thisPtr = weakPtr.lock();
+    if (!thisPtr || thisPtr->closed()) return;
+    if (conn->connected()) {
+      conn->setTcpNoDelay(true);
+      thisPtr->conn_ = conn;
+      thisPtr->status_ = Status::kConnected;
+      thisPtr->flush();
+      if (thisPtr->connectionCallback_) thisPtr->connectionCallback_(thisPtr);
+    } else {
+      thisPtr->close(RedisResult::kNetworkFailure);
+    }
+  });
+  tcpClient_->setMessageCallback(
+      [weakPtr](const TcpConnectionPtr &, MsgBuffer *buffer) {
+        auto thisPtr = weakPtr.lock();
+        if (thisPtr) {
+          thisPtr->onMessage(buffer);
+        } else {
+          buffer->retrieveAll();
+        }
+      });
+  tcpClient_->setConnectionErrorCallback([weakPtr]() {
+    auto thisPtr = weakPtr.lock();
+    if (thisPtr) thisPtr->close(RedisResult::kNetworkFailure);
+  });
+  tcpClient_->connect();
+}
+
+void RedisConnection::disconnect() {
+  auto thisPtr = shared_from_this();
+  loop_->runInLoop([thisPtr]() {
+    if (thisPtr->tcpClient_) {
+      // Replies on the way are still read
+      thisPtr->tcpClient_->disconnect();
+    } else {
+      thisPtr->close(RedisResult::kNetworkFailure);
+    }
+  });
+}
+
+void RedisConnection::execCommand(RedisCallback &&callback,
+                                  std::initializer_list<string_view> args) {
+  if (loop_->isInLoopThread()) {
+    if (closed()) {
+      callback(RedisResult::kNetworkFailure, RedisReply());
+      return;
+    }
+    // Straight into the output buffer, no copy
+    appendRedisCommand(args, &output_);
+    enqueue(std::move(callback));
+    return;
+  }
+  MsgBuffer command;
+  appendRedisCommand(args, &command);
+  sendCommand(std::move(command), std::move(callback));
+}
+
+void RedisConnection::execCommand(RedisCallback &&callback,
+                                  const std::vector<std::string> &args) {
+  if (loop_->isInLoopThread()) {
+    if (closed()) {
+      callback(RedisResult::kNetworkFailure, RedisReply());
+      return;
+    }
+    appendRedisCommand(args, &output_);
+    enqueue(std::move(callback));
+    return;
+  }
+  MsgBuffer command;
+  appendRedisCommand(args, &command);
+  sendCommand(std::move(command), std::move(callback));
+}
+
+void RedisConnection::sendCommand(MsgBuffer &&command,
+                                  RedisCallback &&callback) {
+  auto thisPtr = shared_from_this();
+  loop_->runInLoop([thisPtr, command = std::move(command),
+                    callback = std::move(callback)]() mutable {
+    if (thisPtr->closed()) {
+      callback(RedisResult::kNetworkFailure, RedisReply());
+      return;
+    }
+    thisPtr->output_.append(command);
+    thisPtr->enqueue(std::move(callback));
+  });
+}
+
+void RedisConnection::enqueue(RedisCallback &&callback) {
+  callbacks_.push_back({std::move(callback), CachedClock::steadyNow()});
+  ++outstanding_;
+  watchTimeout();
+  // Everything issued until the functors queued in this iteration of the
+  // loop have run goes out in one write.
+  if (!flushQueued_ && conn_) {
+    flushQueued_ = true;
+    auto thisPtr = shared_from_this();
+    loop_->queueInLoop([thisPtr]() { thisPtr->flush(); });
+  }
+}
+
+void RedisConnection::watchTimeout() {
+  double timeout = timeout_;
+  if (timeout <= 0 || timerId_ != InvalidTimerId || callbacks_.empty()) {
+    return;
+  }
+  // One timer, for the oldest command, rearmed for the next one when it
+  // got its reply in time
+  auto waited = std::chrono::duration<double>(CachedClock::steadyNow() -
+                                              callbacks_.front().issued_)
+                    .count();
+  std::weak_ptr<RedisConnection> weakPtr = shared_from_this();
+  timerId_ = loop_->runAfter(std::max(timeout - waited, 0.0), [weakPtr]() {
+    auto thisPtr = weakPtr.lock();
+    if (!thisPtr) return;
+    thisPtr->timerId_ = InvalidTimerId;
+    if (thisPtr->closed() || thisPtr->callbacks_.empty()) return;
+    auto deadline = thisPtr->callbacks_.front().issued_ +
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::duration<double>(thisPtr->timeout_));
+    if (CachedClock::steadyNow() >= deadline) {
+      thisPtr->close(RedisResult::kTimeout);
+    } else {
+      thisPtr->watchTimeout();
+    }
+  });
+}
+
+void RedisConnection::flush() {
+  flushQueued_ = false;
+  if (!conn_ || output_.readableBytes() == 0) return;
+  MsgBuffer output;
+  output.swap(output_);
+  conn_->send(std::move(output));
+}
+
+void RedisConnection::onMessage(MsgBuffer *buffer) {
+  // A callback may drop the last reference to this connection
+  auto thisPtr = shared_from_this();
+  while (!closed() && buffer->readableBytes() > 0 &&
+         buffer->readableBytes() >= needed_) {
+    RedisReply reply;
+    size_t needed = 0;
+    auto len = RespParser::parse(
+        buffer->peek(), buffer->peek() + buffer->readableBytes(), &reply,
+        &needed);
+    if (len == 0) {
+      needed_ = needed;
+      return;
+    }
+    needed_ = 0;
+    if (len < 0 ||
+        (reply.type() != RedisReplyType::kPush && callbacks_.empty())) {
+      buffer->retrieveAll();
+      close(RedisResult::kBadReply);
+      return;
+    }
+    if (reply.type() == RedisReplyType::kPush) {
+      if (pushCallback_) pushCallback_(reply);
+    } else {
+      auto callback = std::move(callbacks_.front().callback_);
+      callbacks_.pop_front();
+      --outstanding_;
+      if (callback) callback(RedisResult::kOk, reply);
+    }
+    // The reply points into the buffer until here
+    buffer->retrieve(len);
+  }
+}
+
+void RedisConnection::close(RedisResult result) {
+  if (closed()) return;
+  status_ = Status::kClosed;
+  auto thisPtr = shared_from_this();
+  auto callbacks = std::move(callbacks_);
+  callbacks_.clear();
+  outstanding_ = 0;
+  if (timerId_ != InvalidTimerId) {
+    loop_->invalidateTimer(timerId_);
+    timerId_ = InvalidTimerId;
+  }
+  output_.retrieveAll();
+  if (conn_) conn_->forceClose();
+  // We may be inside a callback of the TcpClient, destroy it later
+  if (tcpClient_) {
+    loop_->queueInLoop([tcpClient = std::move(tcpClient_)]() {});
+  }
+  RedisReply nil;
+  for (auto &pending : callbacks) {
+    if (pending.callback_) pending.callback_(result, nil);
+  }
+  if (connectionCallback_) connectionCallback_(thisPtr);
+}
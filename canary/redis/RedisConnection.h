@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "NonCopyable.h"
+#include "RedisReply.h"
+#include "TcpClient.h"
+
+namespace canary {
+
+enum class RedisResult {
+  kOk = 0,  // the reply may still be an error reply of the server
+  kNetworkFailure,
+  kBadReply,
+  kTimeout  // see setCommandTimeout()
+};
+
+// The reply is nil unless the result is kOk
+using RedisCallback = std::function<void(RedisResult, const RedisReply &)>;
+
+class RedisConnection;
+using RedisConnectionPtr = std::shared_ptr<RedisConnection>;
+
+// One connection to a Redis server, shared by any number of callers: the
+// replies come back in the order of the commands. Commands are pipelined
+// automatically, everything issued during one iteration of the loop goes
+// out in a single write, and may be issued before the connection is up.
+// Commands may be issued from any thread, callbacks are called in the loop
+// of the connection. Must be created with std::make_shared.
+class RedisConnection : NonCopyable,
+                        public std::enable_shared_from_this<RedisConnection> {
+ public:
+  enum class Status { kNone = 0, kConnecting, kConnected, kClosed };
+
+  // protocol is 2 or 3, RESP3 is asked for with HELLO
+  RedisConnection(EventLoop *loop, const InetAddress &serverAddr,
+                  const std::string &password = "", unsigned int db = 0,
+                  int protocol = 2);
+
+  ~RedisConnection();
+
+  void connect();
+
+  void disconnect();
+
+  Status status() const { return status_; }
+
+  bool closed() const { return status_ == Status::kClosed; }
+
+  // Commands waiting for their reply
+  size_t outstanding() const { return outstanding_; }
+
+  // A command without its reply after timeout seconds closes the
+  // connection, failing it and every command behind it with kTimeout: the
+  // replies come in order, so the later ones cannot be told apart. The
+  // time counts from when the command is issued. 0, the default, waits
+  // forever.
+  void setCommandTimeout(double timeout) { timeout_ = timeout; }
+
+  EventLoop *getLoop() const { return loop_; }
+
+  void execCommand(RedisCallback &&callback,
+                   std::initializer_list<string_view> args);
+
+  void execCommand(RedisCallback &&callback,
+                   const std::vector<std::string> &args);
+
+  // A command serialized with appendRedisCommand()
+  void sendCommand(MsgBuffer &&command, RedisCallback &&callback);
+
+  // Called once the connection is up and once it is closed
+  void setConnectionCallback(
+      const std::function<void(const RedisConnectionPtr &)> &cb) {
+    connectionCallback_ = cb;
+  }
+
+  // RESP3 push messages
+  void setPushCallback(const std::function<void(const RedisReply &)> &cb) {
+    pushCallback_ = cb;
+  }
+
+ private:
+  void connectInLoop();
+
+  // The command is in output_ already
+  void enqueue(RedisCallback &&callback);
+
+  // Runs the timer for the oldest command, if there is a timeout
+  void watchTimeout();
+
+  void flush();
+
+  void onMessage(MsgBuffer *buffer);
+
+  // Fails every command waiting for a reply
+  void close(RedisResult result);
+
+  EventLoop *loop_;
+  const InetAddress serverAddr_;
+  const std::string password_;
+  const unsigned int db_;
+  const int protocol_;
+  std::shared_ptr<TcpClient> tcpClient_;
+  TcpConnectionPtr conn_;
+  std::atomic<Status> status_{Status::kNone};
+  std::atomic<size_t> outstanding_{0};
+  std::atomic<double> timeout_{0};
+  // Only touched in the loop
+  MsgBuffer output_;
+  bool flushQueued_{false};
+  // The commands waiting for their reply, with when they were issued
+  struct Pending {
+    RedisCallback callback_;
+    std::chrono::steady_clock::time_point issued_;
+  };
+  std::deque<Pending> callbacks_;
+  TimerId timerId_{InvalidTimerId};
+  size_t needed_{0};
+  std::function<void(const RedisConnectionPtr &)> connectionCallback_;
+  std::function<void(const RedisReply &)> pushCallback_;
+};
+
+}  // namespace canary
@@ -0,0 +1,257 @@
+#include "RedisReply.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "Utility.h"
+
+using namespace canary;
+
+namespace canary {
+static constexpr int kMaxDepth{32};
+static constexpr long long kMaxBulkLength{512LL * 1024 * 1024};
+
+static bool parseInteger(const char *begin, const char *end,
+                         long long *value) {
+  bool negative = false;
+  if (begin < end && (*begin == '-' || *begin == '+')) {
+    negative = *begin == '-';
+    ++begin;
+  }
+  if (begin == end) return false;
+  unsigned long long result = 0;
+  for (; begin < end; ++begin) {
+    if (*begin < '0' || *begin > '9') return false;
+    result = result * 10 + (*begin - '0');
+    if (result > static_cast<unsigned long long>(
+                     std::numeric_limits<long long>::max())) {
+      return false;
+    }
+  }
+  *value = negative ? -static_cast<long long>(result)
+                    : static_cast<long long>(result);
+  return true;
+}
+
+template <typename Container>
+static void appendCommand(const Container &args, MsgBuffer *output) {
+  char head[utils::kMaxInt64Length + 3];
+  head[0] = '*';
+  size_t n = 1 + utils::formatUint64(args.size(), head + 1);
+  memcpy(head + n, "\r\n", 2);
+  output->append(head, n + 2);
+  head[0] = '$';
+  for (auto &arg : args) {
+    n = 1 + utils::formatUint64(arg.size(), head + 1);
+    memcpy(head + n, "\r\n", 2);
+    output->append(head, n + 2);
+    output->append(arg.data(), arg.size());
+    output->append("\r\n", 2);
+  }
+}
+}  // namespace canary
+
+double RedisReply::asDouble() const {
+  if (type_ == RedisReplyType::kInteger) return static_cast<double>(integer_);
+  // str_ is not null terminated
+  std::string text(str_);
+  if (text == "inf") return std::numeric_limits<double>::infinity();
+  if (text == "-inf") return -std::numeric_limits<double>::infinity();
+  return strtod(text.c_str(), nullptr);
+}
+
+RedisReply RedisReply::detach() const {
+  if (storage_) return *this;
+  RedisReply reply;
+  auto storage = std::make_shared<std::string>(raw_.data(), raw_.size());
+  RespParser::parse(storage->data(), storage->data() + storage->size(),
+                    &reply);
+  reply.storage_ = std::move(storage);
+  return reply;
+}
+
+std::string RedisReply::toString() const {
+  switch (type_) {
+    case RedisReplyType::kNil:
+      return "nil";
+    case RedisReplyType::kInteger:
+    case RedisReplyType::kBoolean: {
+      char buf[utils::kMaxInt64Length];
+      return std::string(buf, utils::formatInt64(integer_, buf));
+    }
+    case RedisReplyType::kError:
+      return "(error) " + std::string(str_);
+    case RedisReplyType::kDouble:
+    case RedisReplyType::kBigNumber:
+      return std::string(str_);
+    case RedisReplyType::kString:
+    case RedisReplyType::kStatus:
+      return "\"" + std::string(str_) + "\"";
+    default: {
+      std::string result = "[";
+      for (size_t i = 0; i < elements_.size(); ++i) {
+        if (i > 0) result += ", ";
+        result += elements_[i].toString();
+      }
+      return result + "]";
+    }
+  }
+}
+
+long RespParser::parse(const char *begin, const char *end, RedisReply *reply,
+                       size_t *needed) {
+  const char *p = begin;
+  int ret = parseOne(p, end, reply, 0, begin, needed);
+  if (ret <= 0) return ret;
+  return p - begin;
+}
+
+int RespParser::parseOne(const char *&p, const char *end, RedisReply *reply,
+                         int depth, const char *start, size_t *needed) {
+  const char *begin = p;
+  int ret = parseValue(p, end, reply, depth, start, needed);
+  // Every element can be detached on its own
+  if (ret > 0) reply->raw_ = string_view(begin, p - begin);
+  return ret;
+}
+
+int RespParser::parseValue(const char *&p, const char *end, RedisReply *reply,
+                           int depth, const char *start, size_t *needed) {
+  if (depth > kMaxDepth) return -1;
+  if (end - p < 3) return 0;
+  const char *cr = static_cast<const char *>(memchr(p, '\r', end - p));
+  if (!cr || cr + 1 >= end) return 0;
+  if (cr[1] != '\n') return -1;
+  const char prefix = *p;
+  const char *line = p + 1;
+  const char *next = cr + 2;
+  long long length = 0;
+  switch (prefix) {
+    case '+':
+    case '-':
+      reply->type_ = prefix == '+' ? RedisReplyType::kStatus
+                                   : RedisReplyType::kError;
+      reply->str_ = string_view(line, cr - line);
+      p = next;
+      return 1;
+    case ':':
+      reply->type_ = RedisReplyType::kInteger;
+      if (!parseInteger(line, cr, &reply->integer_)) return -1;
+      p = next;
+      return 1;
+    case '_':
+      if (cr != line) return -1;
+      reply->type_ = RedisReplyType::kNil;
+      p = next;
+      return 1;
+    case ',':
+      reply->type_ = RedisReplyType::kDouble;
+      reply->str_ = string_view(line, cr - line);
+      p = next;
+      return 1;
+    case '(':
+      reply->type_ = RedisReplyType::kBigNumber;
+      reply->str_ = string_view(line, cr - line);
+      p = next;
+      return 1;
+    case '#':
+      if (cr - line != 1 || (*line != 't' && *line != 'f')) return -1;
+      reply->type_ = RedisReplyType::kBoolean;
+      reply->integer_ = *line == 't';
+      p = next;
+      return 1;
+    case '$':
+    case '!':
+    case '=': {
+      if (!parseInteger(line, cr, &length)) return -1;
+      if (length < 0) {
+        if (prefix != '$' || length != -1) return -1;
+        reply->type_ = RedisReplyType::kNil;
+        p = next;
+        return 1;
+      }
+      if (length > kMaxBulkLength) return -1;
+      if (end - next < length + 2) {
+        if (needed) *needed = (next - start) + length + 2;
+        return 0;
+      }
+      if (next[length] != '\r' || next[length + 1] != '\n') return -1;
+      reply->type_ = prefix == '!' ? RedisReplyType::kError
+                                   : RedisReplyType::kString;
+      reply->str_ = string_view(next, length);
+      // A verbatim string starts with its format, "txt:"
+      if (prefix == '=') {
+        if (length < 4 || next[3] != ':') return -1;
+        reply->str_.remove_prefix(4);
+      }
+      p = next + length + 2;
+      return 1;
+    }
+    case '*':
+    case '%':
+    case '~':
+    case '>':
+    case '|': {
+      if (!parseInteger(line, cr, &length)) return -1;
+      if (length < 0) {
+        if (prefix != '*' || length != -1) return -1;
+        reply->type_ = RedisReplyType::kNil;
+        p = next;
+        return 1;
+      }
+      long long count = prefix == '%' || prefix == '|' ? length * 2 : length;
+      // Every element takes 3 bytes at least
+      if (count > kMaxBulkLength / 3) return -1;
+      if (prefix == '|') {
+        // Attributes describe the reply that follows, they are skipped
+        RedisReply attribute;
+        for (long long i = 0; i < count; ++i) {
+          int ret = parseOne(next, end, &attribute, depth + 1, start, needed);
+          if (ret <= 0) return ret;
+        }
+        p = next;
+        return parseOne(p, end, reply, depth, start, needed);
+      }
+      switch (prefix) {
+        case '%':
+          reply->type_ = RedisReplyType::kMap;
+          break;
+        case '~':
+          reply->type_ = RedisReplyType::kSet;
+          break;
+        case '>':
+          reply->type_ = RedisReplyType::kPush;
+          break;
+        default:
+          reply->type_ = RedisReplyType::kArray;
+          break;
+      }
+      reply->elements_.clear();
+      reply->elements_.reserve(std::min<long long>(count, 1024));
+      for (long long i = 0; i < count; ++i) {
+        reply->elements_.emplace_back();
+        int ret = parseOne(next, end, &reply->elements_.back(), depth + 1,
+                           start, needed);
+        if (ret <= 0) return ret;
+      }
+      p = next;
+      return 1;
+    }
+    default:
+      // Streamed aggregates ('?') are not supported
+      return -1;
+  }
+}
+
+void canary::appendRedisCommand(std::initializer_list<string_view> args,
+                                MsgBuffer *output) {
+  appendCommand(args, output);
+}
+
+void canary::appendRedisCommand(const std::vector<std::string> &args,
+                                MsgBuffer *output) {
+  appendCommand(args, output);
+}
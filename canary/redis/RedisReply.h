@@ -0,0 +1,103 @@
+#pragma once
+
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MsgBuffer.h"
+#include "StringView.h"
+
+namespace canary {
+
+enum class RedisReplyType {
+  kNil = 0,
+  kString,     // bulk string, RESP3 verbatim string
+  kStatus,     // simple string
+  kError,      // error, RESP3 blob error
+  kInteger,
+  kDouble,     // RESP3, the text is kept, see asDouble()
+  kBoolean,    // RESP3
+  kBigNumber,  // RESP3, the digits are kept as a string
+  kArray,
+  kMap,  // RESP3, elements() holds key, value, key, value...
+  kSet,  // RESP3
+  kPush  // RESP3 out of band data (pub/sub messages, invalidations)
+};
+
+// One RESP2/RESP3 reply. The strings of a reply point into the receive
+// buffer of the connection, so a reply is only valid during the callback it
+// is handed to. detach() returns a copy that owns its data.
+class RedisReply {
+ public:
+  RedisReplyType type() const { return type_; }
+
+  bool isNil() const { return type_ == RedisReplyType::kNil; }
+
+  bool isError() const { return type_ == RedisReplyType::kError; }
+
+  // The text of strings, statuses, errors, doubles and big numbers
+  string_view asStringView() const { return str_; }
+
+  std::string asString() const { return std::string(str_); }
+
+  long long asInteger() const { return integer_; }
+
+  double asDouble() const;
+
+  bool asBool() const { return integer_ != 0; }
+
+  const std::vector<RedisReply> &elements() const { return elements_; }
+
+  size_t size() const { return elements_.size(); }
+
+  const RedisReply &operator[](size_t index) const {
+    return elements_[index];
+  }
+
+  RedisReply detach() const;
+
+  // For logs and tests, e.g. ["OK", 1, nil]
+  std::string toString() const;
+
+ private:
+  friend class RespParser;
+
+  RedisReplyType type_{RedisReplyType::kNil};
+  string_view str_;
+  long long integer_{0};
+  std::vector<RedisReply> elements_;
+  // The whole serialized reply, for detach()
+  string_view raw_;
+  std::shared_ptr<std::string> storage_;
+};
+
+// Zero-copy RESP decoder
+class RespParser {
+ public:
+  // Parses the reply at the front of [begin, end) and returns its length,
+  // 0 if it is not complete yet and -1 on a protocol error. When it is
+  // incomplete and needed is not null, *needed is set to a lower bound of
+  // the length of the reply, so a large bulk string is not parsed again
+  // for every piece of it that arrives.
+  static long parse(const char *begin, const char *end, RedisReply *reply,
+                    size_t *needed = nullptr);
+
+ private:
+  static int parseOne(const char *&p, const char *end, RedisReply *reply,
+                      int depth, const char *start, size_t *needed);
+
+  static int parseValue(const char *&p, const char *end, RedisReply *reply,
+                        int depth, const char *start, size_t *needed);
+};
+
+// Appends a command as a RESP array of bulk strings, arguments are binary
+// safe.
+void appendRedisCommand(std::initializer_list<string_view> args,
+                        MsgBuffer *output);
+
+void appendRedisCommand(const std::vector<std::string> &args,
+                        MsgBuffer *output);
+
+}  // namespace canary
@@ -0,0 +1,48 @@
+# * Try to find Brotli Once done this will define
+#
+# Brotli_FOUND - system has Brotli
+# Brotli_INCLUDE_DIRS - the Brotli include directory
+# Brotli_LIBRARIES - Link these to use Brotli (encoder, decoder and common)
+#
+# An imported interface target Brotli_lib is created when Brotli is found.
+
+find_path(BROTLI_INCLUDE_DIR
+          NAMES brotli/encode.h brotli/decode.h
+          HINTS ${BROTLI_DIR}/include $ENV{BROTLI_DIR}/include
+          PATHS /usr/local/include /usr/include /opt/local/include)
+
+find_library(BROTLICOMMON_LIBRARY
+             NAMES brotlicommon brotlicommon-static
+             HINTS ${BROTLI_DIR}/lib $ENV{BROTLI_DIR}/lib)
+find_library(BROTLIDEC_LIBRARY
+             NAMES brotlidec brotlidec-static
+             HINTS ${BROTLI_DIR}/lib $ENV{BROTLI_DIR}/lib)
+find_library(BROTLIENC_LIBRARY
+             NAMES brotlienc brotlienc-static
+             HINTS ${BROTLI_DIR}/lib $ENV{BROTLI_DIR}/lib)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Brotli
+                                  DEFAULT_MSG
+                                  BROTLI_INCLUDE_DIR
+                                  BROTLICOMMON_LIBRARY
+                                  BROTLIDEC_LIBRARY
+                                  BROTLIENC_LIBRARY)
+
+if(Brotli_FOUND)
+  set(Brotli_INCLUDE_DIRS ${BROTLI_INCLUDE_DIR})
+  # the encoder and the decoder both depend on brotlicommon, keep it last
+  set(Brotli_LIBRARIES ${BROTLIENC_LIBRARY} ${BROTLIDEC_LIBRARY}
+                       ${BROTLICOMMON_LIBRARY})
+  add_library(Brotli_lib INTERFACE IMPORTED)
+  set_target_properties(Brotli_lib
+                        PROPERTIES INTERFACE_INCLUDE_DIRECTORIES
+                                   "${Brotli_INCLUDE_DIRS}"
+                                   INTERFACE_LINK_LIBRARIES
+                                   "${Brotli_LIBRARIES}")
+endif()
+
+mark_as_advanced(BROTLI_INCLUDE_DIR
+                 BROTLICOMMON_LIBRARY
+                 BROTLIDEC_LIBRARY
+                 BROTLIENC_LIBRARY)
@@ -0,0 +1,52 @@
+// Measures base64 encoding and decoding at every SIMD level the CPU has,
+// for sizes from 64 bytes to 16 MB.
+#include <CpuFeatures.h>
+#include <Utility.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+
+using namespace canary;
+
+// Runs func over size bytes for about 0.2 second, returns MB/s
+template <typename Func>
+static double measure(size_t size, Func &&func) {
+  using Clock = std::chrono::steady_clock;
+  size_t rounds = 0;
+  auto start = Clock::now();
+  std::chrono::duration<double> elapsed{};
+  do {
+    for (int i = 0; i < 16; ++i) func();
+    rounds += 16;
+    elapsed = Clock::now() - start;
+  } while (elapsed.count() < 0.2);
+  return size * rounds / elapsed.count() / 1e6;
+}
+
+int main() {
+  const char *names[] = {"scalar", "ssse3", "avx2"};
+  auto best = simdLevel();
+  std::mt19937 random(0);
+  for (size_t size = 64; size <= 16 * 1024 * 1024; size *= 4) {
+    std::string bytes(size, '\0');
+    for (auto &c : bytes) c = static_cast<char>(random());
+    auto in = reinterpret_cast<const unsigned char *>(bytes.data());
+    std::string encoded(utils::base64EncodedLength(size), '\0');
+    std::string decoded(utils::base64DecodedLength(encoded.size()), '\0');
+    auto out = reinterpret_cast<unsigned char *>(&decoded[0]);
+    for (int level = 0; level <= static_cast<int>(best); ++level) {
+      limitSimd(static_cast<SimdLevel>(level));
+      auto encode = measure(size, [&] {
+        utils::base64Encode(in, size, &encoded[0]);
+      });
+      auto decode = measure(size, [&] {
+        utils::base64Decode(encoded.data(), encoded.size(), out);
+      });
+      std::cout << size << " bytes " << names[level] << ": encode " << encode
+                << " MB/s, decode " << decode << " MB/s" << std::endl;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,57 @@
+// Measures the hashes against getMd5(), with the CPU's instructions and
+// without, for sizes from 64 bytes to 16 MB.
+#include <CpuFeatures.h>
+#include <Crc.h>
+#include <Md5.h>
+#include <Sha1.h>
+#include <Sha256.h>
+#include <Utility.h>
+#include <XxHash3.h>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+
+using namespace canary;
+
+// Runs func over size bytes for about 0.2 second, returns MB/s
+static double measure(size_t size, const std::function<void()> &func) {
+  using Clock = std::chrono::steady_clock;
+  size_t rounds = 0;
+  auto start = Clock::now();
+  std::chrono::duration<double> elapsed{};
+  do {
+    for (int i = 0; i < 8; ++i) func();
+    rounds += 8;
+    elapsed = Clock::now() - start;
+  } while (elapsed.count() < 0.2);
+  return size * rounds / elapsed.count() / 1e6;
+}
+
+int main() {
+  volatile uint64_t sink = 0;
+  for (size_t size = 64; size <= 16 * 1024 * 1024; size *= 16) {
+    std::string data(size, 'x');
+    auto p = data.data();
+    for (auto level : {SimdLevel::Avx2, SimdLevel::Scalar}) {
+      limitSimd(level);
+      std::cout << size << " bytes"
+                << (level == SimdLevel::Scalar ? ", scalar" : "") << ":";
+      std::cout << " getMd5 "
+                << measure(size, [&] { sink += utils::getMd5(p, size)[0]; });
+      std::cout << ", Md5 "
+                << measure(size, [&] { sink += Md5::digest(p, size)[0]; });
+      std::cout << ", Sha1 "
+                << measure(size, [&] { sink += Sha1::digest(p, size)[0]; });
+      std::cout << ", Sha256 "
+                << measure(size, [&] { sink += Sha256::digest(p, size)[0]; });
+      std::cout << ", Crc32c "
+                << measure(size, [&] { sink += Crc32c::checksum(p, size); });
+      std::cout << ", XxHash3 "
+                << measure(size, [&] { sink += XxHash3::hash(p, size); });
+      std::cout << " MB/s" << std::endl;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+
+#include "CpuFeatures.h"
+#include "MsgBuffer.h"
+#include "Utility.h"
+
+using namespace canary;
+
+namespace {
+
+const SimdLevel kLevels[] = {SimdLevel::Scalar, SimdLevel::Ssse3,
+                             SimdLevel::Avx2};
+
+std::string randomBytes(size_t length, std::mt19937 &random) {
+  std::string bytes(length, '\0');
+  for (auto &c : bytes) c = static_cast<char>(random());
+  return bytes;
+}
+
+// The kernels are checked against the scalar code
+struct ScalarReference {
+  ScalarReference() { limitSimd(SimdLevel::Scalar); }
+  ~ScalarReference() { limitSimd(SimdLevel::Avx2); }
+};
+
+std::string encode(const std::string &bytes, bool urlSafe = false) {
+  return utils::base64Encode(
+      reinterpret_cast<const unsigned char *>(bytes.data()),
+      static_cast<unsigned int>(bytes.size()), urlSafe);
+}
+
+}  // namespace
+
+TEST(Base64, KnownAnswerTest) {
+  for (auto level : kLevels) {
+    limitSimd(level);
+    EXPECT_EQ("", encode(""));
+    EXPECT_EQ("Zg==", encode("f"));
+    EXPECT_EQ("Zm8=", encode("fo"));
+    EXPECT_EQ("Zm9v", encode("foo"));
+    EXPECT_EQ("Zm9vYg==", encode("foob"));
+    EXPECT_EQ("Zm9vYmE=", encode("fooba"));
+    EXPECT_EQ("Zm9vYmFy", encode("foobar"));
+    EXPECT_EQ("foobar", utils::base64Decode("Zm9vYmFy"));
+    EXPECT_EQ("fooba", utils::base64Decode("Zm9vYmE="));
+    EXPECT_EQ("foob", utils::base64Decode("Zm9vYg=="));
+    // Without padding
+    EXPECT_EQ("foob", utils::base64Decode("Zm9vYg"));
+  }
+  limitSimd(SimdLevel::Avx2);
+}
+
+TEST(Base64, RoundTripTest) {
+  std::mt19937 random(41);
+  for (size_t length = 0; length < 300; ++length) {
+    auto bytes = randomBytes(length, random);
+    for (bool urlSafe : {false, true}) {
+      std::string expected;
+      {
+        ScalarReference reference;
+        expected = encode(bytes, urlSafe);
+      }
+      ASSERT_EQ(utils::base64EncodedLength(length), expected.size());
+      for (auto level : kLevels) {
+        limitSimd(level);
+        ASSERT_EQ(expected, encode(bytes, urlSafe)) << length;
+        ASSERT_EQ(bytes, utils::base64Decode(expected)) << length;
+      }
+      limitSimd(SimdLevel::Avx2);
+    }
+  }
+}
+
+TEST(Base64, AlphabetTest) {
+  // Every value in both alphabets
+  std::string bytes;
+  for (int i = 0; i < 64; i += 4) {
+    int bits = i << 18 | (i + 1) << 12 | (i + 2) << 6 | (i + 3);
+    bytes += static_cast<char>(bits >> 16);
+    bytes += static_cast<char>(bits >> 8);
+    bytes += static_cast<char>(bits);
+  }
+  for (auto level : kLevels) {
+    limitSimd(level);
+    auto standard = encode(bytes);
+    auto urlSafe = encode(bytes, true);
+    EXPECT_EQ(
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+        standard);
+    EXPECT_EQ(
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_",
+        urlSafe);
+    EXPECT_EQ(bytes, utils::base64Decode(standard));
+    EXPECT_EQ(bytes, utils::base64Decode(urlSafe));
+  }
+  limitSimd(SimdLevel::Avx2);
+}
+
+TEST(Base64, StopTest) {
+  std::mt19937 random(42);
+  auto bytes = randomBytes(120, random);
+  auto encoded = encode(bytes);
+  // A bad char at every position, decoding stops before its group
+  for (size_t pos = 0; pos < encoded.size(); ++pos) {
+    for (char bad : {'=', '.', ' ', '\x80'}) {
+      auto corrupt = encoded;
+      corrupt[pos] = bad;
+      std::string expected;
+      {
+        ScalarReference reference;
+        expected = utils::base64Decode(corrupt);
+      }
+      auto whole = pos / 4 * 3;
+      auto partial = pos % 4 ? pos % 4 - 1 : 0;
+      ASSERT_EQ(bytes.substr(0, whole + partial), expected);
+      for (auto level : kLevels) {
+        limitSimd(level);
+        ASSERT_EQ(expected, utils::base64Decode(corrupt)) << pos;
+      }
+      limitSimd(SimdLevel::Avx2);
+    }
+  }
+}
+
+TEST(Base64, BufferTest) {
+  std::mt19937 random(43);
+  auto bytes = randomBytes(1000, random);
+  auto in = reinterpret_cast<const unsigned char *>(bytes.data());
+  std::string out(utils::base64EncodedLength(bytes.size()), '\0');
+  EXPECT_EQ(out.size(), utils::base64Encode(in, bytes.size(), &out[0]));
+  EXPECT_EQ(encode(bytes), out);
+
+  MsgBuffer buffer;
+  buffer.append("x", 1);
+  utils::base64Encode(in, bytes.size(), buffer, true);
+  EXPECT_EQ("x" + encode(bytes, true), std::string(buffer.peek(),
+                                                   buffer.readableBytes()));
+
+  buffer.retrieveAll();
+  utils::base64Decode(out.data(), out.size(), buffer);
+  EXPECT_EQ(bytes, std::string(buffer.peek(), buffer.readableBytes()));
+
+  std::vector<unsigned char> decoded(utils::base64DecodedLength(out.size()));
+  EXPECT_EQ(bytes.size(),
+            utils::base64Decode(out.data(), out.size(), decoded.data()));
+  EXPECT_EQ(0, memcmp(bytes.data(), decoded.data(), bytes.size()));
+
+  auto vec = utils::base64DecodeToVector(out);
+  EXPECT_EQ(bytes, std::string(vec.begin(), vec.end()));
+}
@@ -0,0 +1,260 @@
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <future>
+#include <string>
+#include <vector>
+
+#include "ChunkedEncoding.h"
+#include "EventLoopThread.h"
+#include "HttpBodyReader.h"
+#include "TcpServer.h"
+#include "Utility.h"
+
+using namespace canary;
+
+TEST(ChunkedEncoding, RoundTripTest) {
+  MsgBuffer encoded;
+  std::string body;
+  for (size_t len : {1, 15, 16, 4095, 70000}) {
+    auto piece = utils::genRandomString(len);
+    body += piece;
+    ChunkedEncoder::encodeChunk(piece.data(), piece.length(), &encoded);
+  }
+  ChunkedEncoder::encodeChunk("", 0, &encoded);
+  ChunkedEncoder::encodeLastChunk(&encoded, "Digest: none\r\n");
+  EXPECT_EQ(0, memcmp(encoded.peek(), "1\r\n", 3));
+  encoded.append("GET / HTTP/1.1\r\n");
+
+  // Fed one byte at a time the decoder must keep its state
+  ChunkedDecoder decoder;
+  std::string decoded;
+  MsgBuffer input;
+  auto status = ChunkedDecoder::Status::kNeedMore;
+  while (status == ChunkedDecoder::Status::kNeedMore) {
+    ASSERT_GT(encoded.readableBytes(), 0u);
+    input.append(encoded.peek(), 1);
+    encoded.retrieve(1);
+    status = decoder.decode(&input, [&](const char *data, size_t len) {
+      decoded.append(data, len);
+    });
+  }
+  EXPECT_EQ(ChunkedDecoder::Status::kDone, status);
+  EXPECT_EQ(body, decoded);
+  // The pipelined request is left alone
+  EXPECT_EQ(0u, input.readableBytes());
+  EXPECT_EQ("GET / HTTP/1.1\r\n", encoded.read(encoded.readableBytes()));
+}
+
+TEST(ChunkedEncoding, MalformedTest) {
+  std::vector<std::string> malformed{"zz\r\n", "5\r\nhelloXX", "\r\n",
+                                     "1234567890abcdef0\r\n",
+                                     std::string(5000, '1')};
+  // Too many trailer lines
+  std::string trailers = "0\r\n";
+  for (int i = 0; i < 100; ++i) trailers += "X-Trailer: 1\r\n";
+  malformed.push_back(trailers + "\r\n");
+  for (auto &bad : malformed) {
+    ChunkedDecoder decoder;
+    MsgBuffer input;
+    input.append(bad);
+    EXPECT_EQ(ChunkedDecoder::Status::kError,
+              decoder.decode(&input, [](const char *, size_t) {}))
+        << bad;
+  }
+  ChunkedDecoder decoder;
+  MsgBuffer input;
+  input.append("4;name=value\r\nwiki\r\n0\r\n\r\n");
+  std::string decoded;
+  EXPECT_EQ(ChunkedDecoder::Status::kDone,
+            decoder.decode(&input, [&](const char *data, size_t len) {
+              decoded.append(data, len);
+            }));
+  EXPECT_EQ("wiki", decoded);
+}
+
+TEST(ChunkedEncoding, WrapStreamTest) {
+  std::string data = utils::genRandomString(100000);
+  size_t offset = 0;
+  auto callback = ChunkedEncoder::wrapStream([&](char *buf, size_t len) {
+    if (!buf) return size_t(0);
+    auto n = std::min(len, data.length() - offset);
+    memcpy(buf, data.data() + offset, n);
+    offset += n;
+    return n;
+  });
+  MsgBuffer encoded;
+  char buf[1000];
+  size_t n;
+  while ((n = callback(buf, sizeof(buf))) > 0) encoded.append(buf, n);
+  callback(nullptr, 0);
+
+  ChunkedDecoder decoder;
+  std::string decoded;
+  EXPECT_EQ(ChunkedDecoder::Status::kDone,
+            decoder.decode(&encoded, [&](const char *data, size_t len) {
+              decoded.append(data, len);
+            }));
+  EXPECT_EQ(data, decoded);
+}
+
+TEST(ChunkedEncoding, BodyReaderTest) {
+  size_t received = 0;
+  HttpBodyReader reader(10, [&](const char *, size_t len) {
+    received += len;
+  });
+  MsgBuffer buffer;
+  buffer.append("01234");
+  EXPECT_TRUE(reader.feed(&buffer));
+  EXPECT_FALSE(reader.done());
+  EXPECT_EQ(0u, buffer.readableBytes());
+  buffer.append("56789next");
+  EXPECT_TRUE(reader.feed(&buffer));
+  EXPECT_TRUE(reader.done());
+  EXPECT_EQ(10u, received);
+  EXPECT_EQ("next", buffer.read(buffer.readableBytes()));
+
+  HttpBodyReader limited(100, nullptr);
+  limited.setMaxBodySize(50);
+  EXPECT_FALSE(limited.feed(&buffer));
+  EXPECT_TRUE(limited.tooLarge());
+
+  HttpBodyReader chunked(nullptr);
+  chunked.setMaxBodySize(5);
+  buffer.append("3\r\nabc\r\n3\r\ndef\r\n0\r\n\r\n");
+  EXPECT_FALSE(chunked.feed(&buffer));
+  EXPECT_TRUE(chunked.tooLarge());
+}
+
+TEST(ChunkedEncoding, WriterBackpressureTest) {
+  EventLoopThread loopThread;
+  loopThread.run();
+  auto loop = loopThread.getLoop();
+  const uint16_t port = 38291;
+  TcpServer server(loop, InetAddress("127.0.0.1", port), "chunked");
+  std::promise<void> paused, resumed;
+  std::shared_ptr<ChunkedWriter> writer;
+  std::string piece(16 * 1024, 'c');
+  size_t written = 0;
+  bool restored = false;
+  server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+    if (!conn->connected()) return;
+    // Put back once the body is written
+    conn->setHighWaterMarkCallback([](const TcpConnectionPtr &, size_t) {},
+                                   12345);
+    conn->setDrainCallback([](const TcpConnectionPtr &) {});
+    writer = std::make_shared<ChunkedWriter>(conn, 256 * 1024);
+    writer->setResumeCallback([&, conn]() {
+      // Drained, finish the body
+      writer->finish();
+      restored = conn->highWaterMarkLength() == 12345 &&
+                 conn->highWaterMarkCallback() && conn->drainCallback();
+      resumed.set_value();
+    });
+    while (writer->write(piece)) ++written;
+    ++written;
+    paused.set_value();
+  });
+  server.start();
+  std::promise<void> listening;
+  loop->queueInLoop([&]() { listening.set_value(); });
+  listening.get_future().wait();
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(fd, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr *>(&addr),
+                       sizeof(addr)));
+  // The peer is not reading yet, the producer has to stop
+  paused.get_future().wait();
+  EXPECT_TRUE(writer->paused());
+
+  ChunkedDecoder decoder;
+  MsgBuffer input;
+  size_t bodyLen = 0;
+  auto status = ChunkedDecoder::Status::kNeedMore;
+  char buf[64 * 1024];
+  while (status == ChunkedDecoder::Status::kNeedMore) {
+    auto n = read(fd, buf, sizeof(buf));
+    ASSERT_GT(n, 0);
+    input.append(buf, n);
+    status = decoder.decode(&input, [&](const char *, size_t len) {
+      bodyLen += len;
+    });
+  }
+  resumed.get_future().wait();
+  EXPECT_EQ(ChunkedDecoder::Status::kDone, status);
+  EXPECT_EQ(written * piece.length(), bodyLen);
+  EXPECT_TRUE(restored);
+  close(fd);
+  std::promise<void> stopped;
+  loop->runInLoop([&]() {
+    writer.reset();
+    server.stop();
+    stopped.set_value();
+  });
+  stopped.get_future().wait();
+}
+
+TEST(ChunkedEncoding, WriterCloseTest) {
+  EventLoopThread loopThread;
+  loopThread.run();
+  auto loop = loopThread.getLoop();
+  const uint16_t port = 38317;
+  TcpServer server(loop, InetAddress("127.0.0.1", port), "chunked");
+  std::promise<void> paused;
+  std::promise<std::pair<bool, bool>> resumed;
+  std::weak_ptr<ChunkedWriter> weakWriter;
+  std::string piece(16 * 1024, 'c');
+  server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+    if (!conn->connected()) return;
+    auto writer = std::make_shared<ChunkedWriter>(conn, 256 * 1024);
+    weakWriter = writer;
+    // The producer only holds on to the writer through its callback
+    writer->setResumeCallback([&, writer, piece]() {
+      resumed.set_value({writer->closed(), writer->write(piece)});
+    });
+    while (writer->write(piece)) {
+    }
+    paused.set_value();
+  });
+  server.start();
+  std::promise<void> listening;
+  loop->queueInLoop([&]() { listening.set_value(); });
+  listening.get_future().wait();
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(fd, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr *>(&addr),
+                       sizeof(addr)));
+  paused.get_future().wait();
+  // Gone without reading, the producer still hears of it
+  close(fd);
+  auto future = resumed.get_future();
+  ASSERT_EQ(std::future_status::ready,
+            future.wait_for(std::chrono::seconds(5)));
+  auto result = future.get();
+  EXPECT_TRUE(result.first);
+  EXPECT_FALSE(result.second);
+  std::promise<bool> released;
+  loop->runInLoop([&]() {
+    server.stop();
+    released.set_value(weakWriter.expired());
+  });
+  EXPECT_TRUE(released.get_future().get());
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
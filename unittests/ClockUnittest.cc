@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+#include "Clock.h"
+#include "EventLoop.h"
+
+using namespace canary;
+
+namespace {
+
+long long microsBetween(const Date &a, const Date &b) {
+  return std::llabs(a.microSecondsSinceEpoch() - b.microSecondsSinceEpoch());
+}
+
+}  // namespace
+
+TEST(CachedClock, PreciseOutsideLoopTest) {
+  auto first = CachedClock::steadyNow();
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  EXPECT_GT(CachedClock::steadyNow(), first);
+  EXPECT_LT(microsBetween(CachedClock::now(), Date::date()), 100000);
+}
+
+TEST(CachedClock, CachedInLoopTest) {
+  EventLoop loop;
+  Date first, second, next;
+  CachedClock::TimePoint steadyFirst, steadySecond;
+  loop.queueInLoop([&]() {
+    first = CachedClock::now();
+    steadyFirst = CachedClock::steadyNow();
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    second = CachedClock::now();
+    steadySecond = CachedClock::steadyNow();
+    loop.runAfter(0.01, [&]() {
+      next = CachedClock::now();
+      loop.quit();
+    });
+  });
+  loop.loop();
+  // One reading for the whole iteration, a new one in the next
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(steadyFirst, steadySecond);
+  EXPECT_GE(next.microSecondsSinceEpoch() - first.microSecondsSinceEpoch(),
+            10000);
+  // Precise again once the loop stopped
+  auto precise = CachedClock::steadyNow();
+  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  EXPECT_GT(CachedClock::steadyNow(), precise);
+}
+
+TEST(TscClock, MonotonicTest) {
+  long long tscStart = TscClock::nanoseconds();
+  auto steadyStart = std::chrono::steady_clock::now();
+  long long last = tscStart;
+  for (int i = 0; i < 100000; ++i) {
+    auto now = TscClock::nanoseconds();
+    ASSERT_GE(now, last);
+    last = now;
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  long long tscElapsed = TscClock::nanoseconds() - tscStart;
+  long long steadyElapsed =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - steadyStart)
+          .count();
+  // Within 5% of steady_clock
+  EXPECT_LT(std::llabs(tscElapsed - steadyElapsed), steadyElapsed / 20);
+}
+
+TEST(CachedClock, TscTest) {
+  if (!CachedClock::useTsc(true)) {
+    EXPECT_FALSE(TscClock::available());
+    return;
+  }
+  EventLoop loop;
+  long long maxSkew = 0;
+  long long maxSteadySkew = 0;
+  int runs = 0;
+  loop.runEvery(0.005, [&]() {
+    auto skew = microsBetween(CachedClock::now(), Date::date());
+    long long steadySkew =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - CachedClock::steadyNow())
+            .count();
+    maxSkew = std::max(maxSkew, skew);
+    maxSteadySkew = std::max(maxSteadySkew, std::llabs(steadySkew));
+    if (++runs == 40) loop.quit();
+  });
+  loop.loop();
+  CachedClock::useTsc(false);
+  // The readings lag the precise time by the iteration at most
+  EXPECT_LT(maxSkew, 5000);
+  EXPECT_LT(maxSteadySkew, 5000);
+}
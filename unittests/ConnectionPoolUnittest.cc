@@ -0,0 +1,311 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ConnectionPool.h"
+#include "EventLoopThread.h"
+#include "EventLoopThreadPool.h"
+#include "TcpClient.h"
+#include "TcpServer.h"
+
+using namespace canary;
+
+namespace {
+const uint16_t kPort = 38302;
+
+// Echoes every line but "hold", which never gets an answer
+class LineServer {
+ public:
+  LineServer()
+      : server_(thread_.getLoop(), InetAddress("127.0.0.1", kPort), "lines") {}
+
+  void start() {
+    thread_.run();
+    server_.setConnectionCallback([this](const TcpConnectionPtr &conn) {
+      if (conn->connected()) {
+        ++accepted_;
+        ++open_;
+      } else {
+        --open_;
+      }
+    });
+    server_.setRecvMessageCallback(
+        [](const TcpConnectionPtr &conn, MsgBuffer *buffer) {
+          const char *eol;
+          while ((eol = buffer->findCRLF()) != nullptr) {
+            std::string line(buffer->peek(), eol);
+            buffer->retrieveUntil(eol + 2);
+            if (line != "hold") conn->send(line + "\r\n");
+          }
+        });
+    server_.start();
+    std::promise<void> listening;
+    thread_.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+  }
+
+  ~LineServer() { server_.stop(); }
+
+  std::atomic<int> accepted_{0};
+  std::atomic<int> open_{0};
+
+ private:
+  EventLoopThread thread_;
+  TcpServer server_;
+};
+
+// A minimal pipelined line protocol, to be used in its loop only
+class LineConnection;
+using LineConnectionPtr = std::shared_ptr<LineConnection>;
+
+class LineConnection : NonCopyable,
+                       public std::enable_shared_from_this<LineConnection> {
+ public:
+  explicit LineConnection(EventLoop *loop) : loop_(loop) {}
+
+  void connect() {
+    std::weak_ptr<LineConnection> weakPtr = shared_from_this();
+    client_ = std::make_shared<TcpClient>(
+        loop_, InetAddress("127.0.0.1", kPort), "LineConnection");
+    client_->setConnectionCallback([weakPtr](const TcpConnectionPtr &conn) {
+      auto thisPtr = weakPtr.lock();
+      if (!thisPtr || thisPtr->closed_) return;
+      if (conn->connected()) {
+        thisPtr->conn_ = conn;
+        conn->send(thisPtr->pending_);
+        thisPtr->pending_.clear();
+        thisPtr->callback_(thisPtr);
+      } else {
+        thisPtr->close();
+      }
+    });
+    client_->setConnectionErrorCallback([weakPtr]() {
+      auto thisPtr = weakPtr.lock();
+      if (thisPtr) thisPtr->close();
+    });
+    client_->setMessageCallback(
+        [weakPtr](const TcpConnectionPtr &, MsgBuffer *buffer) {
+          auto thisPtr = weakPtr.lock();
+          const char *eol;
+          while (thisPtr && (eol = buffer->findCRLF()) != nullptr) {
+            std::string line(buffer->peek(), eol);
+            buffer->retrieveUntil(eol + 2);
+            auto callback = std::move(thisPtr->callbacks_.front());
+            thisPtr->callbacks_.pop_front();
+            callback(line);
+          }
+        });
+    client_->connect();
+  }
+
+  void disconnect() {
+    if (conn_) {
+      conn_->forceClose();
+    } else {
+      close();
+    }
+  }
+
+  bool closed() const { return closed_; }
+
+  size_t outstanding() const { return callbacks_.size(); }
+
+  EventLoop *getLoop() const { return loop_; }
+
+  void setConnectionCallback(
+      const std::function<void(const LineConnectionPtr &)> &cb) {
+    callback_ = cb;
+  }
+
+  void send(const std::string &line,
+            std::function<void(const std::string &)> &&callback) {
+    loop_->assertInLoopThread();
+    callbacks_.push_back(std::move(callback));
+    if (conn_) {
+      conn_->send(line + "\r\n");
+    } else {
+      pending_ += line + "\r\n";
+    }
+  }
+
+ private:
+  void close() {
+    if (closed_) return;
+    closed_ = true;
+    auto thisPtr = shared_from_this();
+    for (auto &callback : callbacks_) callback(std::string());
+    callbacks_.clear();
+    conn_.reset();
+    loop_->queueInLoop([client = std::move(client_)]() {});
+    callback_(thisPtr);
+  }
+
+  EventLoop *loop_;
+  std::shared_ptr<TcpClient> client_;
+  TcpConnectionPtr conn_;
+  bool closed_{false};
+  std::string pending_;
+  std::deque<std::function<void(const std::string &)>> callbacks_;
+  std::function<void(const LineConnectionPtr &)> callback_;
+};
+
+using LinePool = ConnectionPool<LineConnection>;
+
+std::shared_ptr<LinePool> newPool(const std::vector<EventLoop *> &loops,
+                                  size_t minPerLoop, size_t maxPerLoop) {
+  return LinePool::newConnectionPool(
+      loops,
+      [](EventLoop *loop) { return std::make_shared<LineConnection>(loop); },
+      minPerLoop, maxPerLoop);
+}
+
+template <typename Predicate>
+bool waitFor(Predicate predicate) {
+  for (int i = 0; i < 500 && !predicate(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return predicate();
+}
+
+// Runs func in loop and waits for it
+void runIn(EventLoop *loop, const std::function<void()> &func) {
+  std::promise<void> done;
+  loop->runInLoop([&]() {
+    func();
+    done.set_value();
+  });
+  done.get_future().wait();
+}
+}  // namespace
+
+TEST(ConnectionPool, WarmUpTest) {
+  LineServer server;
+  server.start();
+  EventLoopThreadPool loops(2);
+  loops.start();
+  auto pool = newPool(loops.getLoops(), 2, 4);
+  pool->setMaxOutstanding(64);
+  pool->start();
+  EXPECT_TRUE(waitFor([&]() { return pool->connectionCount() == 4; }));
+  EXPECT_EQ(4, server.accepted_);
+
+  // Checkouts from other threads run in the loop of the connection
+  std::vector<std::future<std::string>> replies;
+  for (int i = 0; i < 20; ++i) {
+    auto promise = std::make_shared<std::promise<std::string>>();
+    replies.push_back(promise->get_future());
+    pool->get([promise, i](const LineConnectionPtr &connection) {
+      ASSERT_TRUE(connection);
+      EXPECT_TRUE(connection->getLoop()->isInLoopThread());
+      connection->send("line" + std::to_string(i),
+                       [promise](const std::string &line) {
+                         promise->set_value(line);
+                       });
+    });
+  }
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_EQ("line" + std::to_string(i), replies[i].get());
+  }
+  EXPECT_EQ(4, server.accepted_);
+}
+
+TEST(ConnectionPool, GrowTest) {
+  LineServer server;
+  server.start();
+  EventLoopThread thread;
+  thread.run();
+  auto loop = thread.getLoop();
+  auto pool = newPool({loop}, 1, 3);
+  pool->setMaxOutstanding(2);
+  pool->setReconnectDelay(0.05);
+  pool->start();
+  EXPECT_TRUE(waitFor([&]() { return pool->connectionCount() == 1; }));
+
+  // A busy connection is used until the new ones are ready
+  auto hold = [&](int times) {
+    std::set<LineConnectionPtr> used;
+    runIn(loop, [&]() {
+      for (int i = 0; i < times; ++i) {
+        auto connection = pool->get();
+        ASSERT_TRUE(connection);
+        connection->send("hold", [](const std::string &) {});
+        used.insert(connection);
+      }
+    });
+    return used;
+  };
+  auto first = hold(8);
+  EXPECT_EQ(1u, first.size());
+  EXPECT_TRUE(waitFor([&]() { return pool->connectionCount() == 3; }));
+  EXPECT_TRUE(waitFor([&]() { return server.accepted_ == 3; }));
+
+  // Then the least busy one, no more than maxPerLoop
+  auto held = hold(8);
+  EXPECT_EQ(2u, held.size());
+  for (auto &connection : held) EXPECT_EQ(4u, connection->outstanding());
+  EXPECT_EQ(1u, hold(1).size());
+  EXPECT_EQ(3, server.accepted_);
+
+  // Closed connections are replaced up to minPerLoop
+  held.insert(first.begin(), first.end());
+  runIn(loop, [&]() {
+    for (auto &connection : held) connection->disconnect();
+  });
+  EXPECT_TRUE(waitFor([&]() { return server.accepted_ == 4; }));
+  EXPECT_TRUE(waitFor([&]() { return pool->connectionCount() == 1; }));
+  EXPECT_TRUE(waitFor([&]() { return server.open_ == 1; }));
+
+  // Idle connections beyond minPerLoop are closed. Checked in a pool of
+  // its own, so that the checks cannot close the idle connections above.
+  pool.reset();
+  EXPECT_TRUE(waitFor([&]() { return server.open_ == 0; }));
+  pool = newPool({loop}, 1, 3);
+  pool->setMaxOutstanding(2);
+  pool->setHealthCheck(0.1, nullptr);
+  pool->start();
+  EXPECT_TRUE(waitFor([&]() { return pool->connectionCount() == 1; }));
+  hold(4);
+  EXPECT_TRUE(waitFor([&]() { return server.accepted_ == 7; }));
+  EXPECT_TRUE(waitFor([&]() { return server.open_ == 1; }));
+  EXPECT_TRUE(waitFor([&]() { return pool->connectionCount() == 1; }));
+}
+
+TEST(ConnectionPool, HealthCheckTest) {
+  LineServer server;
+  server.start();
+  EventLoopThread thread;
+  thread.run();
+  auto loop = thread.getLoop();
+  std::atomic<bool> healthy{true};
+  std::atomic<int> checks{0};
+  auto pool = newPool({loop}, 2, 2);
+  pool->setReconnectDelay(0.05);
+  pool->setHealthCheck(0.05, [&](const LineConnectionPtr &connection,
+                                 std::function<void(bool)> &&done) {
+    ++checks;
+    connection->send("ping", [&, done = std::move(done)](
+                                 const std::string &line) {
+      done(line == "ping" && healthy);
+    });
+  });
+  pool->start();
+  EXPECT_TRUE(waitFor([&]() { return pool->connectionCount() == 2; }));
+  EXPECT_TRUE(waitFor([&]() { return checks >= 4; }));
+  EXPECT_EQ(2, server.accepted_);
+
+  // Failed checks close the connections, which are replaced
+  healthy = false;
+  EXPECT_TRUE(waitFor([&]() { return server.accepted_ >= 4; }));
+  healthy = true;
+  EXPECT_TRUE(waitFor([&]() { return pool->connectionCount() == 2; }));
+  EXPECT_TRUE(waitFor([&]() { return server.open_ == 2; }));
+}
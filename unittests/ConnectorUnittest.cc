@@ -0,0 +1,201 @@
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EventLoopThread.h"
+#include "TcpClient.h"
+#include "TcpServer.h"
+#include "inner/Connector.h"
+
+using namespace canary;
+
+namespace {
+const uint16_t kPort = 38305;
+const uint16_t kBlackholePort = 38306;
+const uint16_t kClosedPort = 38307;
+
+class Server {
+ public:
+  Server(const std::string &ip, uint16_t port)
+      : server_(thread_.getLoop(), InetAddress(ip, port, ip.find(':') !=
+                                                             std::string::npos),
+                "server") {}
+
+  void start() {
+    thread_.run();
+    server_.setConnectionCallback([this](const TcpConnectionPtr &conn) {
+      if (conn->connected()) ++accepted_;
+    });
+    server_.start();
+    std::promise<void> listening;
+    thread_.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+  }
+
+  ~Server() { server_.stop(); }
+
+  std::atomic<int> accepted_{0};
+
+ private:
+  EventLoopThread thread_;
+  TcpServer server_;
+};
+
+// A listener never accepting, with its queue full: connecting to it hangs
+// as to a blackholed address
+class Blackhole {
+ public:
+  explicit Blackhole(const InetAddress &addr) {
+    fd_ = ::socket(addr.family(), SOCK_STREAM, 0);
+    int on = 1;
+    ::setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    socklen_t length = addr.isIpV6() ? sizeof(sockaddr_in6)
+                                     : sizeof(sockaddr_in);
+    EXPECT_EQ(0, ::bind(fd_, addr.getSockAddr(), length));
+    EXPECT_EQ(0, ::listen(fd_, 0));
+    for (int i = 0; i < 8; ++i) {
+      int fd = ::socket(addr.family(), SOCK_STREAM | SOCK_NONBLOCK, 0);
+      ::connect(fd, addr.getSockAddr(), length);
+      fillers_.push_back(fd);
+      pollfd pfd{fd, POLLOUT, 0};
+      if (::poll(&pfd, 1, 100) == 0) return;
+    }
+    ADD_FAILURE() << "the queue never filled";
+  }
+
+  ~Blackhole() {
+    for (auto fd : fillers_) ::close(fd);
+    ::close(fd_);
+  }
+
+ private:
+  int fd_;
+  std::vector<int> fillers_;
+};
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// Connects a client and returns the peer port and the seconds it took
+std::pair<uint16_t, double> connect(const std::vector<InetAddress> &addrs) {
+  EventLoopThread thread;
+  thread.run();
+  auto client = std::make_shared<TcpClient>(thread.getLoop(), addrs, "client");
+  std::promise<uint16_t> port;
+  client->setConnectionCallback([&](const TcpConnectionPtr &conn) {
+    if (conn->connected()) port.set_value(conn->peerAddr().toPort());
+  });
+  client->setConnectionErrorCallback([&]() { port.set_value(0); });
+  auto start = std::chrono::steady_clock::now();
+  client->connect();
+  auto future = port.get_future();
+  EXPECT_EQ(std::future_status::ready,
+            future.wait_for(std::chrono::seconds(5)));
+  auto result = std::make_pair(future.get(), secondsSince(start));
+  client->disconnect();
+  thread.getLoop()->runInLoop([c = std::move(client)]() {});
+  return result;
+}
+}  // namespace
+
+TEST(Connector, InterleaveTest) {
+  std::vector<InetAddress> addrs{
+      InetAddress("10.0.0.1", 1), InetAddress("10.0.0.2", 1),
+      InetAddress("2001:db8::1", 1, true), InetAddress("2001:db8::2", 1, true),
+      InetAddress("10.0.0.3", 1)};
+  std::vector<std::string> ordered;
+  for (auto &addr : Connector::interleave(addrs)) {
+    ordered.push_back(addr.toIp());
+  }
+  EXPECT_EQ((std::vector<std::string>{"2001:db8::1", "10.0.0.1", "2001:db8::2",
+                                      "10.0.0.2", "10.0.0.3"}),
+            ordered);
+}
+
+TEST(Connector, FallbackTest) {
+  Server server("127.0.0.1", kPort);
+  server.start();
+  // A refused address is left at once
+  auto result = connect({InetAddress("127.0.0.1", kPort),
+                         InetAddress("::1", kClosedPort, true)});
+  EXPECT_EQ(kPort, result.first);
+  EXPECT_LT(result.second, 0.2);
+  EXPECT_EQ(1, server.accepted_);
+
+  // Nothing to connect to
+  EXPECT_EQ(0, connect({InetAddress("127.0.0.1", kClosedPort),
+                        InetAddress("::1", kClosedPort, true)})
+                   .first);
+}
+
+TEST(Connector, EmptyTest) {
+  // What a failed resolve hands over
+  EXPECT_EQ(0, connect({}).first);
+
+  EventLoopThread thread;
+  thread.run();
+  auto connector =
+      std::make_shared<Connector>(thread.getLoop(),
+                                  std::vector<InetAddress>{}, true);
+  connector->setRetryDelay(0.01, 0.01);
+  EXPECT_EQ(0, connector->serverAddress().toPort());
+  std::atomic<int> errors{0};
+  connector->setErrorCallback([&]() { ++errors; });
+  connector->start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  // Failed once, no retries
+  EXPECT_EQ(1, errors);
+  connector->stop();
+}
+
+TEST(Connector, BlackholeTest) {
+  Server server("127.0.0.1", kPort);
+  server.start();
+  Blackhole blackhole(InetAddress("::1", kBlackholePort, true));
+  // The IPv6 address goes first, the IPv4 one after the attempt delay
+  auto result = connect({InetAddress("127.0.0.1", kPort),
+                         InetAddress("::1", kBlackholePort, true)});
+  EXPECT_EQ(kPort, result.first);
+  EXPECT_GE(result.second, 0.2);
+  EXPECT_LT(result.second, 1.0);
+  EXPECT_EQ(1, server.accepted_);
+}
+
+TEST(Connector, RetryTest) {
+  EventLoopThread thread;
+  thread.run();
+  auto connector = std::make_shared<Connector>(
+      thread.getLoop(), InetAddress("127.0.0.1", kClosedPort), true);
+  connector->setRetryDelay(0.02, 0.08);
+  std::atomic<int> errors{0};
+  std::chrono::steady_clock::time_point firstError;
+  std::promise<int> connected;
+  connector->setErrorCallback([&]() {
+    if (errors++ == 0) firstError = std::chrono::steady_clock::now();
+  });
+  connector->setNewConnectionCallback(
+      [&](int sockfd) { connected.set_value(sockfd); });
+  connector->start();
+  while (errors < 5) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  // The backoff is no less than the half of 20, 40, 80 and 80 milliseconds
+  EXPECT_GE(secondsSince(firstError), 0.11);
+
+  Server server("127.0.0.1", kClosedPort);
+  server.start();
+  auto future = connected.get_future();
+  ASSERT_EQ(std::future_status::ready,
+            future.wait_for(std::chrono::seconds(2)));
+  ::close(future.get());
+  connector->stop();
+}
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+
+#include "ContentEncoding.h"
+#include "Utility.h"
+
+using namespace canary;
+
+TEST(ContentEncoding, AcceptEncodingTest) {
+  AcceptEncoding none;
+  EXPECT_FALSE(none.accepts(ContentEncoding::kGzip));
+  EXPECT_TRUE(none.accepts(ContentEncoding::kIdentity));
+  EXPECT_EQ(ContentEncoding::kIdentity, none.preferred());
+
+  AcceptEncoding gzipOnly("gzip, deflate");
+  EXPECT_TRUE(gzipOnly.accepts(ContentEncoding::kGzip));
+  EXPECT_FALSE(gzipOnly.accepts(ContentEncoding::kBrotli));
+  EXPECT_EQ(ContentEncoding::kGzip, gzipOnly.preferred());
+
+  AcceptEncoding weighted("br;q=0.2, GZIP;q=0.8, identity;q=0");
+  EXPECT_FLOAT_EQ(0.2f, weighted.weight(ContentEncoding::kBrotli));
+  EXPECT_FALSE(weighted.accepts(ContentEncoding::kIdentity));
+  EXPECT_EQ(ContentEncoding::kGzip, weighted.preferred());
+
+  AcceptEncoding star("*;q=0.5, gzip;q=0");
+  EXPECT_FALSE(star.accepts(ContentEncoding::kGzip));
+  EXPECT_TRUE(star.accepts(ContentEncoding::kBrotli));
+
+  AcceptEncoding both("gzip, br");
+  EXPECT_EQ(utils::brotliSupported() ? ContentEncoding::kBrotli
+                                     : ContentEncoding::kGzip,
+            both.preferred());
+}
+
+TEST(ContentEncoding, CompressionCacheTest) {
+  std::string catalog;
+  for (int i = 0; i < 1000; ++i) {
+    catalog.append("{\"id\":" + std::to_string(i) + ",\"name\":\"item\"},");
+  }
+  CompressionCache cache(64 * 1024);
+  auto gz = cache.get(ContentEncoding::kGzip, catalog);
+  ASSERT_TRUE(gz);
+  EXPECT_LT(gz->length(), catalog.length());
+  EXPECT_EQ(catalog, utils::gzipDecompress(gz->data(), gz->length()));
+  // A hit returns the same variant without compressing again
+  EXPECT_EQ(gz.get(), cache.get(ContentEncoding::kGzip, catalog).get());
+  EXPECT_EQ(1u, cache.count());
+  // Content of the same length is told apart by its bytes
+  auto other = catalog;
+  other[7] = '9';
+  auto otherGz = cache.get(ContentEncoding::kGzip, other);
+  ASSERT_TRUE(otherGz);
+  EXPECT_EQ(other, utils::gzipDecompress(otherGz->data(), otherGz->length()));
+  cache.clear();
+  gz = cache.get(ContentEncoding::kGzip, catalog);
+  EXPECT_EQ(1u, cache.count());
+
+  if (utils::brotliSupported()) {
+    auto br = cache.get(ContentEncoding::kBrotli, catalog);
+    ASSERT_TRUE(br);
+    EXPECT_EQ(catalog, utils::brotliDecompress(br->data(), br->length()));
+    EXPECT_EQ(2u, cache.count());
+  }
+
+  // Content that does not shrink is remembered as not worth compressing
+  std::string random = utils::genRandomString(16);
+  EXPECT_FALSE(cache.get(ContentEncoding::kGzip, random));
+  EXPECT_FALSE(cache.get(ContentEncoding::kIdentity, catalog));
+
+  // The cache never grows over its capacity
+  for (int i = 0; i < 100; ++i) {
+    cache.get(ContentEncoding::kGzip, catalog + std::to_string(i));
+    EXPECT_LE(cache.size(), cache.capacity());
+  }
+  cache.clear();
+  EXPECT_EQ(0u, cache.count());
+  EXPECT_EQ(0u, cache.size());
+}
+
+TEST(ContentEncoding, PrecompressedFileTest) {
+  char dir[] = "/tmp/canary_encodingXXXXXX";
+  ASSERT_TRUE(mkdtemp(dir));
+  std::string path = std::string(dir) + "/app.js";
+  std::ofstream(path) << "console.log('canary');";
+  std::ofstream(path + ".gz") << "gzipped";
+
+  ContentEncoding encoding;
+  EXPECT_EQ(path + ".gz",
+            findPrecompressedFile(path, AcceptEncoding("gzip, br"), &encoding));
+  EXPECT_EQ(ContentEncoding::kGzip, encoding);
+  EXPECT_EQ(path, findPrecompressedFile(path, AcceptEncoding(), &encoding));
+  EXPECT_EQ(ContentEncoding::kIdentity, encoding);
+
+  std::ofstream(path + ".br") << "brotli";
+  EXPECT_EQ(path + ".br",
+            findPrecompressedFile(path, AcceptEncoding("gzip, br"), &encoding));
+  EXPECT_EQ(ContentEncoding::kBrotli, encoding);
+
+  unlink((path + ".br").c_str());
+  unlink((path + ".gz").c_str());
+  unlink(path.c_str());
+  rmdir(dir);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
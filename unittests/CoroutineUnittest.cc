@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+
+#include "Coroutine.h"
+
+#ifdef CANARY_HAS_COROUTINE
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "EventLoopThread.h"
+
+using namespace canary;
+
+namespace {
+const uint16_t kPort = 38308;
+const uint16_t kClosedPort = 38309;
+
+Task<int> add(int a, int b) { co_return a + b; }
+
+Task<int> sum(int n) {
+  int total = 0;
+  for (int i = 1; i <= n; ++i) total = co_await add(total, i);
+  co_return total;
+}
+
+Task<> fail() {
+  co_await add(1, 2);
+  throw std::runtime_error("failed");
+}
+
+// Echoes what it reads until the peer shuts down
+Task<> echo(TcpStreamPtr stream) {
+  for (;;) {
+    auto data = co_await stream->readSome();
+    if (data.empty()) break;
+    co_await stream->write(std::move(data));
+  }
+}
+
+class EchoServer {
+ public:
+  EchoServer()
+      : server_(thread_.getLoop(), InetAddress("127.0.0.1", kPort), "echo") {
+    thread_.run();
+    TcpStream::serve(server_, echo);
+    server_.start();
+    std::promise<void> listening;
+    thread_.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+  }
+
+  ~EchoServer() { server_.stop(); }
+
+ private:
+  EventLoopThread thread_;
+  TcpServer server_;
+};
+}  // namespace
+
+TEST(Coroutine, TaskTest) {
+  EXPECT_EQ(5050, syncWait(sum(100)));
+  EXPECT_THROW(syncWait(fail()), std::runtime_error);
+}
+
+TEST(Coroutine, SleepTest) {
+  EventLoopThread thread;
+  thread.run();
+  auto loop = thread.getLoop();
+  auto elapsed = syncWait([](EventLoop *loop) -> Task<double> {
+    co_await switchToLoop(loop);
+    EXPECT_TRUE(loop->isInLoopThread());
+    auto start = std::chrono::steady_clock::now();
+    co_await sleepCoro(loop, std::chrono::milliseconds(50));
+    EXPECT_TRUE(loop->isInLoopThread());
+    co_return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            start)
+        .count();
+  }(loop));
+  EXPECT_GE(elapsed, 0.045);
+}
+
+TEST(Coroutine, StreamTest) {
+  EchoServer server;
+  EventLoopThread thread;
+  thread.run();
+  auto loop = thread.getLoop();
+  syncWait([](EventLoop *loop) -> Task<> {
+    co_await switchToLoop(loop);
+    auto stream = co_await TcpStream::connect(std::make_shared<TcpClient>(
+        loop, InetAddress("127.0.0.1", kPort), "client"));
+    EXPECT_TRUE(stream);
+    if (!stream) co_return;
+    EXPECT_TRUE(loop->isInLoopThread());
+
+    EXPECT_TRUE(co_await stream->write("hello\r\nworld\r\n"));
+    EXPECT_EQ("hello\r\n", co_await stream->readUntil("\r\n"));
+    EXPECT_EQ("world", co_await stream->read(5));
+    EXPECT_EQ("\r\n", co_await stream->readUntil("\r\n"));
+
+    // More than the socket buffers take: the write waits for the drain
+    std::string big(8 * 1024 * 1024, 'x');
+    for (size_t i = 0; i < big.size(); i += 4096) big[i] = 'a' + i % 26;
+    EXPECT_TRUE(co_await stream->write(big));
+    EXPECT_TRUE(stream->connection()->bytesSent() >= big.size());
+    EXPECT_EQ(big, co_await stream->read(big.size()));
+
+    // The server returns once the client shut down, then shuts down too
+    stream->shutdown();
+    EXPECT_EQ("", co_await stream->readSome());
+    EXPECT_TRUE(stream->closed());
+  }(loop));
+}
+
+TEST(Coroutine, ConnectFailTest) {
+  EventLoopThread thread;
+  thread.run();
+  auto loop = thread.getLoop();
+  auto stream = syncWait([](EventLoop *loop) -> Task<TcpStreamPtr> {
+    co_await switchToLoop(loop);
+    co_return co_await TcpStream::connect(std::make_shared<TcpClient>(
+        loop, InetAddress("127.0.0.1", kClosedPort), "client"));
+  }(loop));
+  EXPECT_FALSE(stream);
+}
+
+#endif  // CANARY_HAS_COROUTINE
@@ -1,9 +1,13 @@
 #include <gtest/gtest.h>
 
+#include <time.h>
+
 #include <iostream>
+#include <random>
 #include <string>
 
 #include "Date.h"
+#include "Utility.h"
 
 using namespace canary;
 
@@ -40,6 +44,75 @@ TEST(Date, DatabaseStringTest) {
   EXPECT_EQ(ms, 0);
 }
 
+TEST(Date, DateOnlyDbStringTest) {
+  EXPECT_EQ(canary::Date(2018, 3, 4),
+            canary::Date::fromDbStringLocal("2018-03-04"));
+  EXPECT_EQ("2018-03-04", canary::Date(2018, 3, 4).toDbStringLocal());
+  EXPECT_EQ(canary::Date(), canary::Date::fromDbStringLocal("not a date"));
+  auto now = canary::Date::now();
+  EXPECT_EQ(now, canary::Date::fromDbString(now.toDbString()));
+}
+
+// The rendering and parsing of the library against the C library's
+TEST(Date, MatchesLibcTest) {
+  std::mt19937_64 random(42);
+  std::uniform_int_distribution<int64_t> seconds(-2000000000LL, 4000000000LL);
+  for (int i = 0; i < 20000; ++i) {
+    // Runs of dates close together as well as far apart
+    time_t t = i % 4 ? static_cast<time_t>(seconds(random))
+                     : static_cast<time_t>(1500000000 + i * 37);
+    int microseconds = static_cast<int>(random() % 1000000);
+    canary::Date date(static_cast<int64_t>(t) * 1000000 + microseconds);
+    struct tm utc, local;
+    gmtime_r(&t, &utc);
+    localtime_r(&t, &local);
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%4d%02d%02d %02d:%02d:%02d.%06d",
+             utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour,
+             utc.tm_min, utc.tm_sec, microseconds);
+    ASSERT_EQ(buf, date.toFormattedString(true));
+    snprintf(buf, sizeof(buf), "%4d-%02d-%02d %02d:%02d:%02d.%06d",
+             local.tm_year + 1900, local.tm_mon + 1, local.tm_mday,
+             local.tm_hour, local.tm_min, local.tm_sec, microseconds);
+    ASSERT_EQ(buf, date.toDbStringLocal());
+    for (const char *format : {"%a, %d %b %Y %H:%M:%S GMT", "%F %T %y %e %%",
+                               "%Y-%m-%d %j"}) {
+      strftime(buf, sizeof(buf), format, &utc);
+      ASSERT_EQ(buf, date.toCustomedFormattedString(format));
+      strftime(buf, sizeof(buf), format, &local);
+      ASSERT_EQ(buf, date.toCustomedFormattedStringLocal(format));
+    }
+    ASSERT_EQ(canary::Date(static_cast<int64_t>(t) * 1000000),
+              utils::getHttpDate(utils::getHttpFullDate(date)));
+    struct tm fields = local;
+    fields.tm_isdst = -1;
+    time_t localSeconds = mktime(&fields);
+    ASSERT_EQ(localSeconds,
+              canary::Date(local.tm_year + 1900, local.tm_mon + 1,
+                           local.tm_mday, local.tm_hour, local.tm_min,
+                           local.tm_sec)
+                  .microSecondsSinceEpoch() /
+                  1000000);
+    // But for the hour repeated when the clocks go back
+    if (localSeconds == t) {
+      ASSERT_EQ(date,
+                canary::Date::fromDbStringLocal(date.toDbStringLocal()));
+    }
+  }
+  EXPECT_EQ("19691231 23:59:59.999999",
+            canary::Date(-1).toFormattedString(true));
+}
+
+TEST(Date, HttpDateTest) {
+  auto expected = canary::Date::fromUtc(1994, 11, 6, 8, 49, 37);
+  EXPECT_EQ(expected, utils::getHttpDate("Sun, 06 Nov 1994 08:49:37 GMT"));
+  EXPECT_EQ(expected, utils::getHttpDate("Sunday, 06-Nov-94 08:49:37 GMT"));
+  EXPECT_EQ(expected, utils::getHttpDate("Sun Nov  6 08:49:37 1994"));
+  EXPECT_EQ(expected, utils::getHttpDate("sun, 06 nov 1994 08:49:37 GMT"));
+  EXPECT_EQ(canary::Date((std::numeric_limits<int64_t>::max)()),
+            utils::getHttpDate("Sun, 06 Nov 1994"));
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "GzipStream.h"
+#include "Utility.h"
+
+using namespace canary;
+
+static std::string makeExport(size_t rows) {
+  std::string data;
+  for (size_t i = 0; i < rows; ++i) {
+    data.append(std::to_string(i) + ",canary,export row,");
+    data.append(utils::genRandomString(8) + "\n");
+  }
+  return data;
+}
+
+TEST(GzipStream, ChunkedRoundTripTest) {
+  auto data = makeExport(20000);
+  GzipEncoder encoder;
+  MsgBuffer compressed;
+  for (size_t pos = 0; pos < data.length(); pos += 1000) {
+    ASSERT_TRUE(encoder.update(data.data() + pos,
+                               std::min<size_t>(1000, data.length() - pos),
+                               &compressed));
+  }
+  ASSERT_TRUE(encoder.finish(&compressed));
+  EXPECT_LT(compressed.readableBytes(), data.length());
+  // Interoperates with the one-shot API
+  EXPECT_EQ(data, utils::gzipDecompress(compressed.peek(),
+                                        compressed.readableBytes()));
+
+  GzipDecoder decoder;
+  MsgBuffer decompressed;
+  while (compressed.readableBytes() > 0) {
+    auto n = std::min<size_t>(333, compressed.readableBytes());
+    ASSERT_TRUE(decoder.update(compressed.peek(), n, &decompressed));
+    compressed.retrieve(n);
+  }
+  EXPECT_TRUE(decoder.finished());
+  EXPECT_EQ(data, decompressed.read(decompressed.readableBytes()));
+}
+
+TEST(GzipStream, ReuseTest) {
+  GzipEncoder encoder(9);
+  MsgBuffer members;
+  std::string expected;
+  for (int i = 0; i < 3; ++i) {
+    auto data = makeExport(100 * (i + 1));
+    expected += data;
+    MsgBuffer member;
+    ASSERT_TRUE(encoder.update(data.data(), data.length(), &member));
+    ASSERT_TRUE(encoder.flush(&member));
+    ASSERT_TRUE(encoder.finish(&member));
+    EXPECT_EQ(data,
+              utils::gzipDecompress(member.peek(), member.readableBytes()));
+    members.append(member);
+  }
+  // Concatenated members decode as one stream
+  GzipDecoder decoder;
+  MsgBuffer decompressed;
+  ASSERT_TRUE(decoder.update(members, &decompressed));
+  EXPECT_TRUE(decoder.finished());
+  EXPECT_EQ(expected, decompressed.read(decompressed.readableBytes()));
+
+  std::string garbage(100, 'x');
+  EXPECT_FALSE(decoder.update(garbage.data(), garbage.length(), &decompressed));
+  decoder.reset();
+  ASSERT_TRUE(decoder.update(members, &decompressed));
+}
+
+TEST(GzipStream, WrapStreamTest) {
+  auto data = makeExport(5000);
+  size_t offset = 0;
+  bool cleanedUp = false;
+  auto callback = GzipEncoder::wrapStream([&](char *buf, size_t len) {
+    if (!buf) {
+      cleanedUp = true;
+      return size_t(0);
+    }
+    auto n = std::min(len, data.length() - offset);
+    memcpy(buf, data.data() + offset, n);
+    offset += n;
+    return n;
+  });
+  std::string compressed;
+  char buf[1000];
+  size_t n;
+  while ((n = callback(buf, sizeof(buf))) > 0) compressed.append(buf, n);
+  EXPECT_EQ(0u, callback(buf, sizeof(buf)));
+  callback(nullptr, 0);
+  EXPECT_TRUE(cleanedUp);
+  EXPECT_EQ(data,
+            utils::gzipDecompress(compressed.data(), compressed.length()));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
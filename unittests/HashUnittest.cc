@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+
+#include "CpuFeatures.h"
+#include "Crc.h"
+#include "MsgBuffer.h"
+#include "Sha1.h"
+#include "Sha256.h"
+#include "Utility.h"
+#include "XxHash3.h"
+
+using namespace canary;
+
+namespace {
+
+std::string hex(const std::string &digest) {
+  return utils::binaryStringToHex(
+      reinterpret_cast<const unsigned char *>(digest.data()), digest.size());
+}
+
+// Every test runs with the instructions of the CPU, then without
+class HashTest : public testing::TestWithParam<SimdLevel> {
+ protected:
+  void SetUp() override { limitSimd(GetParam()); }
+  void TearDown() override { limitSimd(SimdLevel::Avx2); }
+};
+
+const std::string kMillionA(1000000, 'a');
+
+}  // namespace
+
+TEST_P(HashTest, Sha1Test) {
+  EXPECT_EQ("DA39A3EE5E6B4B0D3255BFEF95601890AFD80709",
+            hex(Sha1::digest("", 0)));
+  EXPECT_EQ("A9993E364706816ABA3E25717850C26C9CD0D89D",
+            hex(Sha1::digest("abc", 3)));
+  std::string twoBlocks =
+      "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  EXPECT_EQ("84983E441C3BD26EBAAE4AA1F95129E5E54670F1",
+            hex(Sha1::digest(twoBlocks.data(), twoBlocks.size())));
+  EXPECT_EQ("34AA973CD4C4DAA4F61EEB2BDBAD27316534016F",
+            hex(Sha1::digest(kMillionA.data(), kMillionA.size())));
+}
+
+TEST_P(HashTest, Sha256Test) {
+  EXPECT_EQ("E3B0C44298FC1C149AFBF4C8996FB92427AE41E4649B934CA495991B7852B855",
+            hex(Sha256::digest("", 0)));
+  EXPECT_EQ("BA7816BF8F01CFEA414140DE5DAE2223B00361A396177A9CB410FF61F20015AD",
+            hex(Sha256::digest("abc", 3)));
+  EXPECT_EQ("CDC76E5C9914FB9281A1C7E284D73E67F1809A48A497200E046D39CCC7112CD0",
+            hex(Sha256::digest(kMillionA.data(), kMillionA.size())));
+}
+
+TEST_P(HashTest, IncrementalTest) {
+  std::mt19937 random(44);
+  std::string data(1000, '\0');
+  for (auto &c : data) c = static_cast<char>(random());
+  auto sha1 = Sha1::digest(data.data(), data.size());
+  auto sha256 = Sha256::digest(data.data(), data.size());
+  auto crc = Crc32c::checksum(data.data(), data.size());
+  auto xxh = XxHash3::hash(data.data(), data.size(), 7);
+  for (size_t chunk : {1, 3, 63, 64, 65, 200, 257}) {
+    Sha1 s1;
+    Sha256 s256;
+    Crc32c c;
+    XxHash3 x(7);
+    MsgBuffer buffer;
+    for (size_t i = 0; i < data.size(); i += chunk) {
+      buffer.retrieveAll();
+      buffer.append(data.data() + i, std::min(chunk, data.size() - i));
+      s1.update(buffer);
+      s256.update(buffer);
+      c.update(buffer);
+      x.update(buffer);
+    }
+    std::string digest(Sha1::kDigestLength, '\0');
+    s1.final(reinterpret_cast<unsigned char *>(&digest[0]));
+    EXPECT_EQ(sha1, digest) << chunk;
+    digest.assign(Sha256::kDigestLength, '\0');
+    s256.final(reinterpret_cast<unsigned char *>(&digest[0]));
+    EXPECT_EQ(sha256, digest) << chunk;
+    EXPECT_EQ(crc, c.value()) << chunk;
+    EXPECT_EQ(xxh, x.value()) << chunk;
+  }
+}
+
+TEST_P(HashTest, CrcTest) {
+  EXPECT_EQ(0x31c3, Crc16::checksum("123456789", 9));
+  EXPECT_EQ(0u, Crc32c::checksum("", 0));
+  EXPECT_EQ(0xe3069283u, Crc32c::checksum("123456789", 9));
+  // RFC 3720, B.4
+  std::string zeros(32, '\0');
+  EXPECT_EQ(0x8a9136aau, Crc32c::checksum(zeros.data(), zeros.size()));
+  std::string ones(32, '\xff');
+  EXPECT_EQ(0x62a8ab43u, Crc32c::checksum(ones.data(), ones.size()));
+  std::string ascending;
+  for (int i = 0; i < 32; ++i) ascending += static_cast<char>(i);
+  EXPECT_EQ(0x46dd794eu,
+            Crc32c::checksum(ascending.data(), ascending.size()));
+}
+
+TEST_P(HashTest, XxHash3Test) {
+  // The values of the reference implementation
+  std::string data(4096, '\0');
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<char>(i * 131 + (i >> 3));
+  }
+  struct Expected {
+    size_t length_;
+    uint64_t seed0_;
+    uint64_t seed42_;
+  };
+  const Expected expected[] = {
+      {0, 0x2d06800538d394c2, 0xb029411ff43d84d2},
+      {1, 0xc44bdff4074eecdb, 0x5cf10f10bf2dd245},
+      {3, 0x6811538b444fc6dc, 0x5b752c6469cf44a2},
+      {4, 0xed503340c589a28b, 0x2f74e382a3e43abd},
+      {8, 0xe5b43ab074c9c13b, 0x53530c4f98b32351},
+      {9, 0x98b5d7141ed79e34, 0x75dffbb73d592fd8},
+      {16, 0xac4b400b09fefc71, 0x22c6bf9e92e222e7},
+      {17, 0xe43948ad7d39cc4e, 0x1f3bd0d3d4729ae3},
+      {128, 0xabe5353db9741d3c, 0x9ac48c62afa72e8b},
+      {129, 0x62e851eb617ab82c, 0x2e97478cbc1ce099},
+      {240, 0x3b7fbc325f2fe844, 0x04c49cb37cb9be77},
+      {241, 0xa9d16963bf94ed57, 0xe04b6cef781b35ba},
+      {1024, 0x9de7f57ae046252a, 0x5043acd8eea8615b},
+      {4096, 0x8ec4fd24d736a164, 0xe53dab505c879701},
+  };
+  for (auto &e : expected) {
+    EXPECT_EQ(e.seed0_, XxHash3::hash(data.data(), e.length_)) << e.length_;
+    EXPECT_EQ(e.seed42_, XxHash3::hash(data.data(), e.length_, 42))
+        << e.length_;
+  }
+  // Streaming across the buffer, stripe and block edges
+  for (size_t len = 0; len <= 2100; len += 23) {
+    auto oneShot = XxHash3::hash(data.data(), len, 42);
+    for (size_t chunk : {1, 64, 255, 256, 1000}) {
+      XxHash3 x(42);
+      for (size_t i = 0; i < len; i += chunk) {
+        x.update(data.data() + i, std::min(chunk, len - i));
+      }
+      ASSERT_EQ(oneShot, x.value()) << len << " " << chunk;
+    }
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(Hash, HashTest,
+                         testing::Values(SimdLevel::Avx2, SimdLevel::Scalar));
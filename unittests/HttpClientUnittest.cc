@@ -0,0 +1,244 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "EventLoopThread.h"
+#include "HttpClient.h"
+#include "TcpServer.h"
+
+using namespace canary;
+
+namespace {
+const uint16_t kPort = 38294;
+
+// Answers "GET /x" with the body "/x", echoes POST bodies, never answers
+// "/slow" and closes the connection after "/close".
+class FakeServer {
+ public:
+  FakeServer() : server_(thread_.getLoop(), InetAddress("127.0.0.1", kPort),
+                         "fake") {}
+
+  void start() {
+    thread_.run();
+    server_.setConnectionCallback([this](const TcpConnectionPtr &conn) {
+      if (conn->connected()) ++connections_;
+    });
+    server_.setRecvMessageCallback(
+        [this](const TcpConnectionPtr &conn, MsgBuffer *buffer) {
+          onMessage(conn, buffer);
+        });
+    server_.start();
+    std::promise<void> listening;
+    thread_.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+  }
+
+  ~FakeServer() { server_.stop(); }
+
+  std::atomic<int> connections_{0};
+
+ private:
+  static void onMessage(const TcpConnectionPtr &conn, MsgBuffer *buffer) {
+    while (true) {
+      static const char kEnd[] = "\r\n\r\n";
+      const char *bufferEnd = buffer->peek() + buffer->readableBytes();
+      auto end = std::search(buffer->peek(), bufferEnd, kEnd, kEnd + 4);
+      if (end == bufferEnd) return;
+      std::string head(buffer->peek(), end);
+      size_t bodyLength = 0;
+      auto pos = head.find("Content-Length: ");
+      if (pos != std::string::npos) {
+        bodyLength = std::stoul(head.substr(pos + 16));
+      }
+      if (static_cast<size_t>(bufferEnd - end - 4) < bodyLength) return;
+      std::string body(end + 4, bodyLength);
+      buffer->retrieveUntil(end + 4 + bodyLength);
+
+      auto method = head.substr(0, head.find(' '));
+      auto path = head.substr(method.length() + 1);
+      path = path.substr(0, path.find(' '));
+      if (path == "/slow") continue;
+      if (path == "/close") {
+        conn->send("HTTP/1.1 200 OK\r\nConnection: close\r\n\r\nbye");
+        conn->shutdown();
+        return;
+      }
+      if (path == "/chunked") {
+        conn->send(
+            "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+            "3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n");
+        continue;
+      }
+      if (method != "POST") body = path;
+      conn->send("HTTP/1.1 200 OK\r\nContent-Length: " +
+                 std::to_string(body.length()) + "\r\n\r\n" + body);
+    }
+  }
+
+  EventLoopThread thread_;
+  TcpServer server_;
+};
+
+HttpRequestPtr newRequest(const std::string &path, HttpMethod method = Get) {
+  auto req = HttpRequest::newHttpRequest();
+  req->setPath(path);
+  req->setMethod(method);
+  return req;
+}
+}  // namespace
+
+TEST(HttpClient, ResponseParserTest) {
+  std::string wire =
+      "HTTP/1.1 100 Continue\r\n\r\n"
+      "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nX-A: 1\r\nx-a: 2\r\n\r\nhello"
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+      "3\r\nabc\r\n0\r\n\r\n"
+      "HTTP/1.1 304 Not Modified\r\nContent-Length: 10\r\n\r\n"
+      "HTTP/1.0 200 OK\r\n\r\nuntil close";
+  HttpResponseParser parser;
+  parser.reset();
+  MsgBuffer input;
+  std::vector<HttpResponsePtr> responses;
+  // One byte at a time
+  for (char c : wire) {
+    input.append(&c, 1);
+    auto status = parser.parse(&input);
+    ASSERT_NE(HttpResponseParser::Status::kError, status);
+    if (status == HttpResponseParser::Status::kDone) {
+      EXPECT_TRUE(parser.keepAlive());
+      responses.push_back(parser.release());
+      parser.reset();
+    }
+  }
+  ASSERT_EQ(HttpResponseParser::Status::kDone, parser.onClose());
+  EXPECT_FALSE(parser.keepAlive());
+  responses.push_back(parser.release());
+  ASSERT_EQ(4u, responses.size());
+  EXPECT_EQ(k200OK, responses[0]->statusCode());
+  EXPECT_EQ("hello", responses[0]->body());
+  EXPECT_EQ("1, 2", responses[0]->getHeader("x-a"));
+  EXPECT_EQ("abc", responses[1]->body());
+  EXPECT_EQ(k304NotModified, responses[2]->statusCode());
+  EXPECT_EQ(Version::kHttp10, responses[3]->version());
+  EXPECT_EQ("until close", responses[3]->body());
+
+  // A HEAD response has no body
+  parser.reset(true);
+  input.append("HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n");
+  EXPECT_EQ(HttpResponseParser::Status::kDone, parser.parse(&input));
+
+  for (const char *bad : {"HTTP/2 200 OK\r\n", "HTTP/1.1 2x0 OK\r\n",
+                          "HTTP/1.1 200 OK\r\nNoColon\r\n"}) {
+    parser.reset();
+    MsgBuffer badInput;
+    badInput.append(std::string(bad));
+    EXPECT_EQ(HttpResponseParser::Status::kError, parser.parse(&badInput))
+        << bad;
+  }
+}
+
+TEST(HttpClient, KeepAliveTest) {
+  FakeServer server;
+  server.start();
+  EventLoopThread clientThread;
+  clientThread.run();
+  auto client = HttpClient::newHttpClient("http://127.0.0.1:38294",
+                                          clientThread.getLoop());
+  for (int i = 0; i < 10; ++i) {
+    auto result = client->sendRequest(newRequest("/n" + std::to_string(i)), 5)
+                      .get();
+    ASSERT_EQ(ReqResult::Ok, result.first);
+    EXPECT_EQ("/n" + std::to_string(i), result.second->body());
+  }
+  auto post = newRequest("/echo", Post);
+  post->setBody("posted body");
+  auto result = client->sendRequest(post).get();
+  ASSERT_EQ(ReqResult::Ok, result.first);
+  EXPECT_EQ("posted body", result.second->body());
+  result = client->sendRequest(newRequest("/chunked")).get();
+  ASSERT_EQ(ReqResult::Ok, result.first);
+  EXPECT_EQ("abcde", result.second->body());
+  EXPECT_EQ(1, server.connections_);
+
+  // The server closes after this one, the next request reconnects
+  result = client->sendRequest(newRequest("/close")).get();
+  ASSERT_EQ(ReqResult::Ok, result.first);
+  EXPECT_EQ("bye", result.second->body());
+  result = client->sendRequest(newRequest("/again")).get();
+  ASSERT_EQ(ReqResult::Ok, result.first);
+  EXPECT_EQ(2, server.connections_);
+}
+
+TEST(HttpClient, PipeliningTest) {
+  FakeServer server;
+  server.start();
+  EventLoopThread clientThread;
+  clientThread.run();
+  auto client = HttpClient::newHttpClient(InetAddress("127.0.0.1", kPort),
+                                          clientThread.getLoop());
+  client->setMaxConnections(2);
+  client->setPipeliningDepth(8);
+  const int kRequests = 50;
+  std::atomic<int> ok{0};
+  std::promise<void> done;
+  for (int i = 0; i < kRequests; ++i) {
+    auto path = "/p" + std::to_string(i);
+    client->sendRequest(newRequest(path),
+                        [&, path](ReqResult result,
+                                  const HttpResponsePtr &response) {
+                          if (result == ReqResult::Ok &&
+                              response->body() == path) {
+                            ++ok;
+                          }
+                          if (ok == kRequests) done.set_value();
+                        });
+  }
+  ASSERT_EQ(std::future_status::ready,
+            done.get_future().wait_for(std::chrono::seconds(5)));
+  EXPECT_LE(server.connections_, 2);
+  EXPECT_LE(client->connectionCount(), 2u);
+}
+
+TEST(HttpClient, TimeoutTest) {
+  FakeServer server;
+  server.start();
+  EventLoopThread clientThread;
+  clientThread.run();
+  auto client = HttpClient::newHttpClient("127.0.0.1:38294",
+                                          clientThread.getLoop());
+  auto result = client->sendRequest(newRequest("/slow"), 0.2).get();
+  EXPECT_EQ(ReqResult::Timeout, result.first);
+  EXPECT_FALSE(result.second);
+  // The connection of the timed out request is not reused
+  result = client->sendRequest(newRequest("/fast"), 5).get();
+  ASSERT_EQ(ReqResult::Ok, result.first);
+  EXPECT_EQ(2, server.connections_);
+}
+
+TEST(HttpClient, FailureTest) {
+  EventLoopThread clientThread;
+  clientThread.run();
+  auto loop = clientThread.getLoop();
+  for (const char *host : {"https://127.0.0.1", "http://localhost:80",
+                           "127.0.0.1:99999", "[::1"}) {
+    auto client = HttpClient::newHttpClient(host, loop);
+    EXPECT_EQ(ReqResult::BadServerAddress,
+              client->sendRequest(newRequest("/")).get().first)
+        << host;
+  }
+  // Nothing listens there
+  auto client = HttpClient::newHttpClient("127.0.0.1:38295", loop);
+  auto first = client->sendRequest(newRequest("/a"), 5);
+  auto second = client->sendRequest(newRequest("/b"), 5);
+  EXPECT_EQ(ReqResult::NetworkFailure, first.get().first);
+  EXPECT_EQ(ReqResult::NetworkFailure, second.get().first);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
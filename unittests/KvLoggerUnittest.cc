@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "LogCollector.h"
+#include "Logger.h"
+
+using namespace canary;
+
+namespace {
+
+std::string output;
+
+void captureOutput() {
+  output.clear();
+  Logger::setOutputFunction(
+      [](const char *msg, const uint64_t len) { output.append(msg, len); },
+      []() {});
+}
+
+// The record without the fields every record has
+std::string fieldsOf(const std::string &record) {
+  auto event = record.find("event");
+  return event == std::string::npos ? record : record.substr(event - 1);
+}
+
+}  // namespace
+
+TEST(KvLogger, LogfmtTest) {
+  captureOutput();
+  KvLogger::setFormat(KvLogger::Format::kLogfmt);
+  int fd = 12;
+  size_t bytes = 1024;
+  std::string peer = "10.0.0.1:5000";
+  LOG_INFO_KV("accept", "conn", fd, "bytes", bytes, "peer", peer, "tls",
+              false, "ratio", 0.25, "note", "two words", "empty", "");
+  EXPECT_EQ(0u, output.find("ts="));
+  EXPECT_NE(std::string::npos, output.find(" level=info thread="));
+  EXPECT_NE(std::string::npos, output.find(" src=KvLoggerUnittest.cc:"));
+  EXPECT_EQ(
+      " event=accept conn=12 bytes=1024 peer=10.0.0.1:5000 tls=false "
+      "ratio=0.25 note=\"two words\" empty=\"\"\n",
+      fieldsOf(output));
+
+  captureOutput();
+  LOG_WARN_KV("odd", "text", "a=\"b\"\n\\\x01");
+  EXPECT_EQ(" event=odd text=\"a=\\\"b\\\"\\n\\\\\\u0001\"\n",
+            fieldsOf(output));
+}
+
+TEST(KvLogger, JsonTest) {
+  captureOutput();
+  KvLogger::setFormat(KvLogger::Format::kJson);
+  LOG_ERROR_KV("close", "conn", -3, "reason", "reset \"by\" peer", "nan",
+               0.0 / 0.0, "ok", true, "code", 'x');
+  KvLogger::setFormat(KvLogger::Format::kLogfmt);
+  EXPECT_EQ(0u, output.find("{\"ts\":\""));
+  EXPECT_NE(std::string::npos, output.find("Z\",\"level\":\"error\","));
+  EXPECT_EQ(
+      "event\":\"close\",\"conn\":-3,\"reason\":\"reset \\\"by\\\" peer\","
+      "\"nan\":null,\"ok\":true,\"code\":\"x\"}\n",
+      fieldsOf(output).substr(1));
+}
+
+TEST(KvLogger, LevelTest) {
+  captureOutput();
+  auto level = Logger::logLevel();
+  Logger::setLogLevel(Logger::kInfo);
+  LOG_DEBUG_KV("hidden", "n", 1);
+  Logger::setLogLevel(level);
+  EXPECT_TRUE(output.empty());
+}
+
+TEST(LogCollector, BatchTest) {
+  std::string path = "/tmp/canary_log_collector_" + std::to_string(getpid());
+  int fd = ::socket(AF_UNIX, SOCK_DGRAM, 0);
+  ASSERT_GE(fd, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  ::unlink(path.c_str());
+  ASSERT_EQ(0, ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)));
+
+  {
+    LogCollector collector(path, 256, 60.0);
+    Logger::setOutputFunction(
+        [&collector](const char *msg, const uint64_t len) {
+          collector.output(msg, len);
+        },
+        [&collector]() { collector.flush(); });
+    for (int i = 0; i < 20; ++i) LOG_INFO_KV("tick", "i", i);
+    // An error flushes
+    LOG_ERROR_KV("last");
+    EXPECT_EQ(0u, collector.dropped());
+    Logger::setOutputFunction(
+        [](const char *msg, const uint64_t len) {
+          fwrite(msg, 1, len, stdout);
+        },
+        []() { fflush(stdout); });
+  }
+
+  int datagrams = 0;
+  std::string received;
+  char buf[4096];
+  ssize_t n;
+  while ((n = ::recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+    EXPECT_LE(n, 256);
+    EXPECT_EQ('\n', buf[n - 1]);
+    received.append(buf, n);
+    ++datagrams;
+  }
+  ::close(fd);
+  ::unlink(path.c_str());
+  EXPECT_LT(datagrams, 21);
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_NE(std::string::npos,
+              received.find(" event=tick i=" + std::to_string(i) + "\n"));
+  }
+  EXPECT_NE(std::string::npos, received.find(" event=last\n"));
+
+  // Nobody listening
+  LogCollector lost(path, 256, 0.0);
+  lost.output("line\n", 5);
+  EXPECT_EQ(1u, lost.dropped());
+}
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "CpuFeatures.h"
+#include "Md5.h"
+#include "Utility.h"
+
+using namespace canary;
+
+namespace {
+
+const SimdLevel kLevels[] = {SimdLevel::Scalar, SimdLevel::Ssse3,
+                             SimdLevel::Avx2};
+
+std::string hexMd5(const std::string &data) {
+  return utils::getMd5(data);
+}
+
+}  // namespace
+
+TEST(Md5, KnownAnswerTest) {
+  // RFC 1321
+  EXPECT_EQ("D41D8CD98F00B204E9800998ECF8427E", hexMd5(""));
+  EXPECT_EQ("0CC175B9C0F1B6A831C399E269772661", hexMd5("a"));
+  EXPECT_EQ("900150983CD24FB0D6963F7D28E17F72", hexMd5("abc"));
+  EXPECT_EQ("F96B697D7CB7938D525A2F31AAF161D0", hexMd5("message digest"));
+  EXPECT_EQ("C3FCD3D76192E4007DFB496CCA67E13B",
+            hexMd5("abcdefghijklmnopqrstuvwxyz"));
+  EXPECT_EQ("57EDF4A22BE3C955AC49DA2E2107B67A",
+            hexMd5("1234567890123456789012345678901234567890123456789012345678"
+                   "9012345678901234567890"));
+}
+
+TEST(Md5, IncrementalTest) {
+  std::mt19937 random(43);
+  std::string data(300, '\0');
+  for (auto &c : data) c = static_cast<char>(random());
+  for (size_t len = 0; len <= data.size(); len += 7) {
+    auto expected = Md5::digest(data.data(), len);
+    for (size_t split = 0; split <= len; split += 13) {
+      Md5 md5;
+      md5.update(data.data(), split);
+      md5.update(data.data() + split, len - split);
+      std::string digest(Md5::kDigestLength, '\0');
+      md5.final(reinterpret_cast<unsigned char *>(&digest[0]));
+      ASSERT_EQ(expected, digest) << len << " " << split;
+    }
+  }
+}
+
+TEST(Md5, DigestManyTest) {
+  std::mt19937 random(44);
+  std::vector<std::string> messages;
+  // Lengths around the padding edges and far apart
+  for (size_t len : {0, 1, 55, 56, 63, 64, 65, 119, 120, 128, 1000, 5000}) {
+    std::string message(len, '\0');
+    for (auto &c : message) c = static_cast<char>(random());
+    messages.push_back(message);
+  }
+  for (auto level : kLevels) {
+    limitSimd(level);
+    for (size_t count = 0; count <= messages.size(); ++count) {
+      std::vector<const void *> data;
+      std::vector<size_t> lens;
+      for (size_t i = 0; i < count; ++i) {
+        data.push_back(messages[i].data());
+        lens.push_back(messages[i].size());
+      }
+      std::string digests(count * Md5::kDigestLength, '\0');
+      Md5::digestMany(data.data(), lens.data(), count,
+                      reinterpret_cast<unsigned char *>(&digests[0]));
+      for (size_t i = 0; i < count; ++i) {
+        ASSERT_EQ(Md5::digest(messages[i].data(), messages[i].size()),
+                  digests.substr(i * Md5::kDigestLength,
+                                 Md5::kDigestLength))
+            << static_cast<int>(level) << " " << count << " " << i;
+      }
+    }
+  }
+  limitSimd(SimdLevel::Avx2);
+}
+
+TEST(Md5, HexTest) {
+  std::mt19937 random(45);
+  for (auto level : kLevels) {
+    limitSimd(level);
+    for (size_t len = 0; len < 100; ++len) {
+      std::string bytes(len, '\0');
+      for (auto &c : bytes) c = static_cast<char>(random());
+      auto hex = utils::binaryStringToHex(
+          reinterpret_cast<const unsigned char *>(bytes.data()), len);
+      ASSERT_EQ(2 * len, hex.size());
+      for (size_t i = 0; i < len; ++i) {
+        char expected[3];
+        snprintf(expected, sizeof(expected), "%02X",
+                 static_cast<unsigned char>(bytes[i]));
+        ASSERT_EQ(expected, hex.substr(2 * i, 2)) << len;
+      }
+      ASSERT_EQ(bytes, utils::hexToBinaryString(hex.data(), hex.size()));
+      // Lower case is read too
+      for (auto &c : hex) c = static_cast<char>(tolower(c));
+      auto vec = utils::hexToBinaryVector(hex.data(), hex.size());
+      ASSERT_EQ(bytes, std::string(vec.begin(), vec.end()));
+      // A bad digit anywhere
+      for (size_t pos = 0; pos < hex.size(); pos += 5) {
+        for (char bad : {'g', 'G', '/', ':', '@', '`', ' ', '\xb0'}) {
+          auto corrupt = hex;
+          corrupt[pos] = bad;
+          ASSERT_EQ("",
+                    utils::hexToBinaryString(corrupt.data(), corrupt.size()))
+              << pos << " " << bad;
+        }
+      }
+    }
+  }
+  limitSimd(SimdLevel::Avx2);
+}
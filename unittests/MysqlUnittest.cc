@@ -0,0 +1,988 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "EventLoopThread.h"
+#include "EventLoopThreadPool.h"
+#include "Sha1.h"
+#include "Sha256.h"
+#include "TcpServer.h"
+#include "mysql.h"
+
+using namespace canary;
+using namespace canary::mysql;
+
+namespace {
+const uint16_t kPort = 38300;
+const char kNonce[] = "0123456789abcdefghij";
+const char kSwitchNonce[] = "ABCDEFGHIJ0123456789";
+
+// A 1024 bit RSA key of the server, for the full caching_sha2_password
+// authentication
+const char kPublicKey[] =
+    "-----BEGIN PUBLIC KEY-----\n"
+    "MIGfMA0GCSqGSIb3DQEBAQUAA4GNADCBiQKBgQCpSaSFFemUF+/q4Ze/8n2ig8mY\n"
+    "wNiK+dzWUuHh0Ryv2Wnw/2vY6WD9FvW9a/FqemqRSN/MLygtqJGFjTHRC4dgZUZW\n"
+    "ugOVnPIcnurtzYAKo6C3JKfF5iqrb13AacaIhK/JqhVKANMaUtZJoOijV6OlAp7D\n"
+    "Aj4h+IM7IFbXhwnOvwIDAQAB\n"
+    "-----END PUBLIC KEY-----\n";
+const char kModulus[] =
+    "a949a48515e99417efeae197bff27da283c998c0d88af9dcd652e1e1d11cafd9"
+    "69f0ff6bd8e960fd16f5bd6bf16a7a6a9148dfcc2f282da891858d31d10b8760"
+    "654656ba03959cf21c9eeaedcd800aa3a0b724a7c5e62aab6f5dc069c68884af"
+    "c9aa154a00d31a52d649a0e8a357a3a5029ec3023e21f8833b2056d78709cebf";
+const char kPrivateExponent[] =
+    "694ff8db1a109f226d0c4f9f19b7fed454ebdaed4d48d7bbbc50ff587dc03cdd"
+    "21fcdcc8f8bde6aa4bd84028a09cbedf00d6b6f2ccfb4fbc281b4f0508a90563"
+    "bcf266b29fd7996616ae8b8f311d0f6a2ebd610c6b0853545350c3bffbef9727"
+    "89d16f838c08b011bc4082b956ada389fb89a3ad117c81c98fba035f680a1441";
+
+std::string fromHex(const std::string &hex) {
+  std::string bytes;
+  for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+    bytes.push_back(static_cast<char>(std::stoi(hex.substr(i, 2), 0, 16)));
+  }
+  return bytes;
+}
+
+std::string xorString(const std::string &a, const std::string &b) {
+  std::string result(a);
+  for (size_t i = 0; i < result.size() && i < b.size(); ++i) {
+    result[i] ^= b[i];
+  }
+  return result;
+}
+
+// The checks of the server, which only knows the hash of the hash
+bool checkNative(const std::string &scramble, const std::string &password,
+                 const std::string &nonce) {
+  auto stage1 = Sha1::digest(password.data(), password.size());
+  auto stored = Sha1::digest(stage1.data(), stage1.size());
+  auto key = Sha1::digest((nonce + stored).data(), nonce.size() + 20);
+  auto candidate = xorString(scramble, key);
+  return scramble.size() == 20 &&
+         Sha1::digest(candidate.data(), candidate.size()) == stored;
+}
+
+bool checkSha2(const std::string &scramble, const std::string &password,
+               const std::string &nonce) {
+  auto stage1 = Sha256::digest(password.data(), password.size());
+  auto stored = Sha256::digest(stage1.data(), stage1.size());
+  auto key = Sha256::digest((stored + nonce).data(), nonce.size() + 32);
+  auto candidate = xorString(scramble, key);
+  return scramble.size() == 32 &&
+         Sha256::digest(candidate.data(), candidate.size()) == stored;
+}
+
+// The message of an RSA-OAEP block with SHA-1, empty if it is malformed
+std::string oaepDecode(const std::string &block) {
+  auto mgf1 = [](const std::string &seed, size_t len) {
+    std::string mask;
+    for (uint32_t counter = 0; mask.size() < len; ++counter) {
+      std::string input(seed);
+      for (int shift = 24; shift >= 0; shift -= 8) {
+        input.push_back(static_cast<char>(counter >> shift));
+      }
+      mask += Sha1::digest(input.data(), input.size());
+    }
+    return mask.substr(0, len);
+  };
+  if (block.size() < 42 || block[0] != 0) return std::string();
+  auto maskedDb = block.substr(21);
+  auto seed = xorString(block.substr(1, 20), mgf1(maskedDb, 20));
+  auto db = xorString(maskedDb, mgf1(seed, maskedDb.size()));
+  auto one = db.find_first_not_of('\0', 20);
+  if (db.compare(0, 20, Sha1::digest("", 0)) != 0 ||
+      one == std::string::npos || db[one] != 1) {
+    return std::string();
+  }
+  return db.substr(one + 1);
+}
+
+bool checkEncrypted(const std::string &encrypted, const std::string &password,
+                    const std::string &nonce) {
+  auto block = modPow(encrypted, fromHex(kPrivateExponent), fromHex(kModulus));
+  auto message = oaepDecode(block);
+  for (size_t i = 0; i < message.size(); ++i) {
+    message[i] ^= nonce[i % nonce.size()];
+  }
+  return message == password + std::string(1, '\0');
+}
+
+std::string columnDefinition(const std::string &name, MysqlFieldType type) {
+  std::string payload;
+  for (auto text : {"def", "test", "t", "t"}) {
+    appendLenencString(&payload, text);
+  }
+  appendLenencString(&payload, name);
+  appendLenencString(&payload, name);
+  appendLenenc(&payload, 0x0c);
+  bool isText = type == MysqlFieldType::kVarString;
+  appendInt(&payload, isText ? 45 : 63, 2);
+  appendInt(&payload, 255, 4);
+  payload.push_back(static_cast<char>(type));
+  appendInt(&payload, 0, 2);
+  payload.push_back(0);
+  payload.append(2, '\0');
+  return payload;
+}
+
+std::string eofPacket() { return std::string("\xfe\0\0\x02\0", 5); }
+
+std::string okPacket(uint64_t affected, uint64_t insertId) {
+  std::string payload(1, '\0');
+  appendLenenc(&payload, affected);
+  appendLenenc(&payload, insertId);
+  appendInt(&payload, 2, 2);
+  appendInt(&payload, 0, 2);
+  return payload;
+}
+
+std::string errPacket(uint16_t code, const std::string &state,
+                      const std::string &message) {
+  std::string payload("\xff");
+  appendInt(&payload, code, 2);
+  return payload + "#" + state + message;
+}
+
+// A scripted server for user "root" with password "secret". Queries:
+// "SELECT n" gives n rows (id, name, note), note is NULL in odd rows,
+// "INSERT..." affects a row with id 42 and "BIG n" gives a value of n
+// bytes; anything else is a syntax error. Every prepared statement but the
+// ones starting with "BAD" returns one row: its first two parameters, 2.5
+// and a DATETIME.
+class FakeMysql {
+ public:
+  // fullAuth: caching_sha2_password asks for the password itself
+  explicit FakeMysql(const std::string &plugin = kNativePluginName,
+                     bool switchPlugin = false, bool fullAuth = false)
+      : plugin_(plugin),
+        switchPlugin_(switchPlugin),
+        fullAuth_(fullAuth),
+        server_(thread_.getLoop(), InetAddress("127.0.0.1", kPort), "mysql") {}
+
+  void start() {
+    thread_.run();
+    server_.setConnectionCallback([this](const TcpConnectionPtr &conn) {
+      if (conn->connected()) {
+        ++connections_;
+        sendHandshake(conn);
+      } else {
+        sessions_.erase(conn.get());
+      }
+    });
+    server_.setRecvMessageCallback(
+        [this](const TcpConnectionPtr &conn, MsgBuffer *buffer) {
+          onMessage(conn, buffer);
+        });
+    server_.start();
+    std::promise<void> listening;
+    thread_.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+  }
+
+  ~FakeMysql() { server_.stop(); }
+
+  static constexpr const char *kNativePluginName = "mysql_native_password";
+  static constexpr const char *kSha2PluginName = "caching_sha2_password";
+
+  std::atomic<int> connections_{0};
+  std::atomic<int> prepares_{0};
+  std::atomic<int> closes_{0};
+  std::atomic<int> reads_{0};
+  std::atomic<int> keyRequests_{0};
+  std::string database_;
+
+ private:
+  struct Session {
+    // 0: handshake sent, 1: switched, 2: logged in, 3: full authentication
+    int authState_{0};
+    uint32_t statements_{0};
+    std::unordered_map<uint32_t, size_t> paramCounts_;
+  };
+
+  void sendHandshake(const TcpConnectionPtr &conn) {
+    uint32_t capabilities = kClientLongPassword | kClientProtocol41 |
+                            kClientTransactions | kClientSecureConnection |
+                            kClientPluginAuth | kClientPluginAuthLenencData |
+                            kClientConnectWithDb;
+    std::string payload(1, 10);
+    payload.append("8.0.0-fake");
+    payload.push_back('\0');
+    appendInt(&payload, 1, 4);
+    payload.append(kNonce, 8);
+    payload.push_back('\0');
+    appendInt(&payload, capabilities & 0xffff, 2);
+    payload.push_back(45);
+    appendInt(&payload, 2, 2);
+    appendInt(&payload, capabilities >> 16, 2);
+    payload.push_back(21);
+    payload.append(10, '\0');
+    payload.append(kNonce + 8, 12);
+    payload.push_back('\0');
+    payload.append(plugin_);
+    payload.push_back('\0');
+    sessions_[conn.get()] = Session();
+    send(conn, {payload}, 0);
+  }
+
+  void send(const TcpConnectionPtr &conn,
+            const std::vector<std::string> &payloads, uint8_t seq) {
+    MsgBuffer output;
+    for (auto &payload : payloads) seq = appendPacket(&output, payload, seq);
+    conn->send(std::move(output));
+  }
+
+  void onMessage(const TcpConnectionPtr &conn, MsgBuffer *buffer) {
+    ++reads_;
+    while (buffer->readableBytes() >= 4) {
+      auto header = reinterpret_cast<const uint8_t *>(buffer->peek());
+      size_t len = header[0] | (header[1] << 8) | (header[2] << 16);
+      uint8_t seq = header[3];
+      if (buffer->readableBytes() < len + 4) return;
+      std::string payload(buffer->peek() + 4, len);
+      buffer->retrieve(len + 4);
+      onPacket(conn, sessions_[conn.get()], payload, seq);
+    }
+  }
+
+  void onPacket(const TcpConnectionPtr &conn, Session &session,
+                const std::string &payload, uint8_t seq) {
+    PayloadReader reader(payload);
+    if (session.authState_ == 0) {
+      reader.readInt4();  // capabilities
+      reader.readInt4();  // max packet
+      reader.readInt1();  // character set
+      reader.skip(23);
+      auto user = std::string(reader.readNullTerminated());
+      auto scramble = std::string(reader.readLenencString());
+      database_ = std::string(reader.readNullTerminated());
+      auto plugin = std::string(reader.readNullTerminated());
+      ASSERT_TRUE(reader.ok());
+      EXPECT_EQ(plugin_, plugin);
+      if (switchPlugin_) {
+        session.authState_ = 1;
+        std::string request("\xfe");
+        request.append(kNativePluginName);
+        request.push_back('\0');
+        request.append(kSwitchNonce);
+        request.push_back('\0');
+        send(conn, {request}, seq + 1);
+        return;
+      }
+      bool good = plugin == kSha2PluginName
+                      ? checkSha2(scramble, "secret", kNonce)
+                      : checkNative(scramble, "secret", kNonce);
+      if (fullAuth_ && good) {
+        session.authState_ = 3;
+        send(conn, {std::string("\x01\x04", 2)}, seq + 1);
+        return;
+      }
+      finishAuth(conn, session, user == "root" && good, seq + 1);
+      return;
+    }
+    if (session.authState_ == 1) {
+      finishAuth(conn, session, checkNative(payload, "secret", kSwitchNonce),
+                 seq + 1);
+      return;
+    }
+    if (session.authState_ == 3) {
+      if (payload == "\x02") {
+        ++keyRequests_;
+        send(conn, {"\x01" + std::string(kPublicKey)}, seq + 1);
+        return;
+      }
+      finishAuth(conn, session, checkEncrypted(payload, "secret", kNonce),
+                 seq + 1);
+      return;
+    }
+
+    auto command = reader.readInt1();
+    auto body = std::string(reader.readRest());
+    if (command == kComQuery) {
+      onQuery(conn, body);
+    } else if (command == kComStmtPrepare) {
+      ++prepares_;
+      if (body.compare(0, 3, "BAD") == 0) {
+        send(conn, {errPacket(1064, "42000", "You have an error")}, 1);
+        return;
+      }
+      auto id = ++session.statements_;
+      size_t params = std::count(body.begin(), body.end(), '?');
+      session.paramCounts_[id] = params;
+      std::string ok(1, '\0');
+      appendInt(&ok, id, 4);
+      appendInt(&ok, 4, 2);
+      appendInt(&ok, params, 2);
+      ok.append(3, '\0');
+      std::vector<std::string> packets{ok};
+      for (size_t i = 0; i < params; ++i) {
+        packets.push_back(columnDefinition("?", MysqlFieldType::kVarString));
+      }
+      if (params > 0) packets.push_back(eofPacket());
+      auto columns = resultColumns();
+      packets.insert(packets.end(), columns.begin(), columns.end());
+      send(conn, packets, 1);
+    } else if (command == kComStmtExecute) {
+      onExecute(conn, session, payload);
+    } else if (command == kComStmtClose) {
+      ++closes_;
+    } else if (command == kComQuit) {
+      conn->shutdown();
+    }
+  }
+
+  void finishAuth(const TcpConnectionPtr &conn, Session &session, bool good,
+                  uint8_t seq) {
+    if (!good) {
+      send(conn,
+           {errPacket(1045, "28000", "Access denied for user 'root'")}, seq);
+      conn->shutdown();
+      return;
+    }
+    // The fast caching_sha2_password authentication
+    bool fast = plugin_ == kSha2PluginName && session.authState_ == 0;
+    session.authState_ = 2;
+    if (fast) {
+      send(conn, {std::string("\x01\x03", 2), okPacket(0, 0)}, seq);
+    } else {
+      send(conn, {okPacket(0, 0)}, seq);
+    }
+  }
+
+  // The columns of the prepared statements, with the EOF packet
+  std::vector<std::string> resultColumns() {
+    return {columnDefinition("a", MysqlFieldType::kLongLong),
+            columnDefinition("b", MysqlFieldType::kVarString),
+            columnDefinition("c", MysqlFieldType::kDouble),
+            columnDefinition("d", MysqlFieldType::kDateTime), eofPacket()};
+  }
+
+  void onQuery(const TcpConnectionPtr &conn, const std::string &sql) {
+    std::vector<std::string> packets;
+    if (sql.compare(0, 7, "SELECT ") == 0) {
+      auto rows = std::stoi(sql.substr(7));
+      packets.push_back(std::string(1, 3));
+      packets.push_back(columnDefinition("id", MysqlFieldType::kLongLong));
+      packets.push_back(columnDefinition("name", MysqlFieldType::kVarString));
+      packets.push_back(columnDefinition("note", MysqlFieldType::kVarString));
+      packets.push_back(eofPacket());
+      for (int i = 0; i < rows; ++i) {
+        std::string row;
+        appendLenencString(&row, std::to_string(i));
+        appendLenencString(&row, "name" + std::to_string(i));
+        if (i % 2) {
+          row.push_back(static_cast<char>(kNullValue));
+        } else {
+          appendLenencString(&row, "note");
+        }
+        packets.push_back(row);
+      }
+      packets.push_back(eofPacket());
+    } else if (sql.compare(0, 6, "INSERT") == 0) {
+      packets.push_back(okPacket(1, 42));
+    } else if (sql.compare(0, 4, "BIG ") == 0) {
+      packets.push_back(std::string(1, 1));
+      packets.push_back(columnDefinition("big", MysqlFieldType::kVarString));
+      packets.push_back(eofPacket());
+      std::string row;
+      appendLenencString(&row, std::string(std::stoul(sql.substr(4)), 'x'));
+      packets.push_back(row);
+      packets.push_back(eofPacket());
+    } else {
+      packets.push_back(errPacket(1064, "42000", "You have an error"));
+    }
+    send(conn, packets, 1);
+  }
+
+  void onExecute(const TcpConnectionPtr &conn, Session &session,
+                 const std::string &payload) {
+    PayloadReader reader(payload);
+    reader.skip(1);
+    auto id = reader.readInt4();
+    reader.skip(5);
+    auto params = session.paramCounts_[id];
+    auto bitmap = reader.readBytes((params + 7) / 8);
+    if (params > 0) {
+      EXPECT_EQ(1, reader.readInt1());
+    }
+    std::vector<MysqlFieldType> types;
+    for (size_t i = 0; i < params; ++i) {
+      types.push_back(static_cast<MysqlFieldType>(reader.readInt1()));
+      reader.readInt1();
+    }
+    // The first two parameters come back as the first two columns
+    std::string values;
+    std::string nulls(1, 0);
+    for (size_t i = 0; i < params; ++i) {
+      bool isNull = (bitmap[i / 8] >> (i % 8)) & 1;
+      std::string value;
+      if (isNull) {
+        EXPECT_EQ(MysqlFieldType::kNull, types[i]);
+      } else if (types[i] == MysqlFieldType::kLongLong) {
+        appendInt(&value, reader.readInt8(), 8);
+      } else {
+        EXPECT_EQ(MysqlFieldType::kVarString, types[i]);
+        appendLenencString(&value, reader.readLenencString());
+      }
+      if (i >= 2) continue;
+      if (isNull) {
+        nulls[0] |= static_cast<char>(1 << (i + 2));
+      } else {
+        values += value;
+      }
+    }
+    EXPECT_TRUE(reader.ok() && reader.atEnd());
+    std::string row(1, '\0');
+    row += nulls;
+    row += values;
+    double half = 2.5;
+    uint64_t bits;
+    memcpy(&bits, &half, 8);
+    appendInt(&row, bits, 8);
+    row.push_back(11);
+    appendInt(&row, 2024, 2);
+    row.append({1, 2, 3, 4, 5});
+    appendInt(&row, 6, 4);
+
+    std::vector<std::string> packets{std::string(1, 4)};
+    auto columns = resultColumns();
+    packets.insert(packets.end(), columns.begin(), columns.end());
+    packets.push_back(row);
+    packets.push_back(eofPacket());
+    send(conn, packets, 1);
+  }
+
+  const std::string plugin_;
+  const bool switchPlugin_;
+  const bool fullAuth_;
+  EventLoopThread thread_;
+  TcpServer server_;
+  std::unordered_map<TcpConnection *, Session> sessions_;
+};
+
+MysqlConnectionPtr newConnection(EventLoop *loop,
+                                 const std::string &password = "secret") {
+  return std::make_shared<MysqlConnection>(
+      loop, InetAddress("127.0.0.1", kPort), "root", password, "test");
+}
+
+MysqlResultPtr query(const MysqlConnectionPtr &connection,
+                     const std::string &sql) {
+  std::promise<MysqlResultPtr> promise;
+  connection->query(sql, [&](const MysqlResultPtr &result) {
+    promise.set_value(result);
+  });
+  return promise.get_future().get();
+}
+}  // namespace
+
+TEST(Mysql, ProtocolTest) {
+  auto hex = [](const std::string &digest) {
+    static const char digits[] = "0123456789abcdef";
+    std::string text;
+    for (unsigned char c : digest) {
+      text.push_back(digits[c >> 4]);
+      text.push_back(digits[c & 15]);
+    }
+    return text;
+  };
+  EXPECT_EQ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+            hex(Sha256::digest("", 0)));
+  EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+            hex(Sha256::digest("abc", 3)));
+  std::string twoBlocks =
+      "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  EXPECT_EQ("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+            hex(Sha256::digest(twoBlocks.data(), twoBlocks.size())));
+
+  EXPECT_TRUE(checkNative(nativePasswordScramble("secret", kNonce), "secret",
+                          kNonce));
+  EXPECT_FALSE(checkNative(nativePasswordScramble("wrong", kNonce), "secret",
+                           kNonce));
+  EXPECT_TRUE(
+      checkSha2(cachingSha2Scramble("secret", kNonce), "secret", kNonce));
+  EXPECT_TRUE(nativePasswordScramble("", kNonce).empty());
+  // 4^13 mod 497
+  EXPECT_EQ(std::string("\x01\xbd"),
+            modPow(std::string("\x04"), "\x0d", "\x01\xf1"));
+  EXPECT_TRUE(checkEncrypted(rsaEncryptPassword("secret", kNonce, kPublicKey),
+                             "secret", kNonce));
+
+  std::string payload;
+  std::vector<uint64_t> numbers{0,       250,        251,     0xffff,
+                                0x10000, 0xffffff,   1 << 24, 1ULL << 40};
+  for (auto n : numbers) appendLenenc(&payload, n);
+  appendLenencString(&payload, "hello");
+  payload.push_back(static_cast<char>(kNullValue));
+  PayloadReader reader(payload);
+  for (auto n : numbers) EXPECT_EQ(n, reader.readLenenc());
+  EXPECT_EQ("hello", reader.readLenencString());
+  bool isNull = false;
+  reader.readLenencString(&isNull);
+  EXPECT_TRUE(isNull);
+  EXPECT_TRUE(reader.ok() && reader.atEnd());
+  reader.readInt2();
+  EXPECT_FALSE(reader.ok());
+
+  // A payload of exactly the maximum length is followed by an empty packet
+  MsgBuffer output;
+  EXPECT_EQ(5, appendPacket(&output, std::string(kMaxPacketLength, 'p'), 3));
+  ASSERT_EQ(kMaxPacketLength + 8, output.readableBytes());
+  EXPECT_EQ(std::string("\xff\xff\xff\x03", 4),
+            std::string(output.peek(), 4));
+  EXPECT_EQ(std::string("\0\0\0\x04", 4),
+            std::string(output.peek() + kMaxPacketLength + 4, 4));
+
+  // Binary values of prepared statements
+  MysqlColumn tiny, time, datetime, date, integer;
+  tiny.type_ = MysqlFieldType::kTiny;
+  tiny.flags_ = kUnsignedFlag;
+  integer.type_ = MysqlFieldType::kLong;
+  time.type_ = MysqlFieldType::kTime;
+  datetime.type_ = MysqlFieldType::kDateTime;
+  date.type_ = MysqlFieldType::kDate;
+  EXPECT_EQ("200", MysqlField(&tiny, "\xc8", false, true).asString());
+  EXPECT_EQ(-5, MysqlField(&integer, string_view("\xfb\xff\xff\xff", 4),
+                           false, true)
+                    .asInt64());
+  EXPECT_EQ("-26:03:04", MysqlField(&time, string_view("\1\1\0\0\0\2\3\4", 8),
+                                    false, true)
+                             .asString());
+  EXPECT_EQ("2024-01-02 00:00:00",
+            MysqlField(&datetime, string_view("\xe8\x07\1\2", 4), false, true)
+                .asString());
+  EXPECT_EQ("0000-00-00", MysqlField(&date, "", false, true).asString());
+  EXPECT_EQ(17, MysqlField(&integer, "17", false, false).asInt64());
+
+  // The shortest digits in the precision of the column
+  MysqlColumn single, twice;
+  single.type_ = MysqlFieldType::kFloat;
+  twice.type_ = MysqlFieldType::kDouble;
+  float tenth = 0.1f;
+  double third = 1.0 / 3;
+  EXPECT_EQ("0.1", MysqlField(&single,
+                              string_view(reinterpret_cast<char *>(&tenth),
+                                          sizeof(tenth)),
+                              false, true)
+                       .asString());
+  EXPECT_EQ("0.3333333333333333",
+            MysqlField(&twice,
+                       string_view(reinterpret_cast<char *>(&third),
+                                   sizeof(third)),
+                       false, true)
+                .asString());
+}
+
+TEST(Mysql, QueryTest) {
+  FakeMysql server;
+  server.start();
+  EventLoopThread clientThread;
+  clientThread.run();
+  auto loop = clientThread.getLoop();
+  auto connection = newConnection(loop);
+
+  // Issued before the connection is up
+  std::promise<MysqlResultPtr> early;
+  connection->query("SELECT 100", [&](const MysqlResultPtr &result) {
+    early.set_value(result);
+  });
+  connection->connect();
+  auto result = early.get_future().get();
+  ASSERT_TRUE(result->ok()) << result->errorMessage();
+  EXPECT_EQ("test", server.database_);
+  ASSERT_EQ(100u, result->size());
+  ASSERT_EQ(3u, result->columns().size());
+  EXPECT_EQ(1, result->columnIndex("name"));
+  EXPECT_EQ(MysqlFieldType::kLongLong, result->columns()[0].type_);
+  for (size_t i = 0; i < result->size(); ++i) {
+    auto row = (*result)[i];
+    ASSERT_EQ(3u, row.size());
+    EXPECT_EQ(static_cast<long long>(i), row[0].asInt64());
+    EXPECT_EQ("name" + std::to_string(i), row[1].asStringView());
+    EXPECT_EQ(i % 2 == 1, row[2].isNull());
+  }
+
+  result = query(connection, "INSERT INTO t VALUES (1)");
+  EXPECT_TRUE(result->ok());
+  EXPECT_EQ(1u, result->affectedRows());
+  EXPECT_EQ(42u, result->insertId());
+  EXPECT_TRUE(result->empty());
+
+  result = query(connection, "SELEC 1");
+  EXPECT_FALSE(result->ok());
+  EXPECT_EQ(1064u, result->errorCode());
+  EXPECT_EQ("42000", result->sqlState());
+  EXPECT_EQ("You have an error", result->errorMessage());
+
+  // Issued in one iteration of the loop, sent in one write
+  int readsBefore = server.reads_;
+  const int kQueries = 200;
+  std::vector<size_t> sizes;
+  std::promise<void> done;
+  loop->queueInLoop([&]() {
+    for (int i = 0; i < kQueries; ++i) {
+      connection->query("SELECT " + std::to_string(i % 7),
+                        [&](const MysqlResultPtr &result) {
+                          sizes.push_back(result->size());
+                          if (sizes.size() == kQueries) done.set_value();
+                        });
+    }
+  });
+  ASSERT_EQ(std::future_status::ready,
+            done.get_future().wait_for(std::chrono::seconds(5)));
+  for (int i = 0; i < kQueries; ++i) EXPECT_EQ(i % 7, (int)sizes[i]);
+  EXPECT_LE(server.reads_ - readsBefore, 3);
+
+  // A row of more than one packet
+  const size_t kBig = kMaxPacketLength + 1000;
+  result = query(connection, "BIG " + std::to_string(kBig));
+  ASSERT_TRUE(result->ok());
+  ASSERT_EQ(1u, result->size());
+  auto value = (*result)[0][0].asStringView();
+  EXPECT_EQ(kBig, value.size());
+  EXPECT_EQ(std::string(kBig, 'x'), value);
+  EXPECT_TRUE(query(connection, "SELECT 1")->ok());
+}
+
+TEST(Mysql, PreparedStatementTest) {
+  FakeMysql server;
+  server.start();
+  EventLoopThread clientThread;
+  clientThread.run();
+  auto connection = newConnection(clientThread.getLoop());
+  connection->connect();
+
+  std::promise<std::pair<MysqlResultPtr, MysqlStatementPtr>> prepared;
+  connection->prepare("SELECT ?, ?", [&](const MysqlResultPtr &result,
+                                         const MysqlStatementPtr &statement) {
+    prepared.set_value(std::make_pair(result, statement));
+  });
+  auto statement = prepared.get_future().get().second;
+  ASSERT_TRUE(statement);
+  EXPECT_EQ(2u, statement->paramCount());
+  ASSERT_EQ(4u, statement->columns().size());
+  EXPECT_EQ("d", statement->columns()[3].name_);
+
+  auto execute = [&](const std::vector<MysqlParam> &params) {
+    std::promise<MysqlResultPtr> promise;
+    connection->execute(statement, params, [&](const MysqlResultPtr &result) {
+      promise.set_value(result);
+    });
+    return promise.get_future().get();
+  };
+  auto result = execute({-7, "seven"});
+  ASSERT_TRUE(result->ok()) << result->errorMessage();
+  ASSERT_EQ(1u, result->size());
+  auto row = (*result)[0];
+  EXPECT_EQ(-7, row[0].asInt64());
+  EXPECT_EQ("-7", row[0].asString());
+  EXPECT_EQ("seven", row[1].asStringView());
+  EXPECT_EQ(2.5, row[2].asDouble());
+  EXPECT_EQ("2.5", row[2].asString());
+  EXPECT_EQ("2024-01-02 03:04:05.000006", row[3].asString());
+
+  result = execute({nullptr, std::string("x")});
+  ASSERT_TRUE(result->ok());
+  row = (*result)[0];
+  EXPECT_TRUE(row[0].isNull());
+  EXPECT_EQ("x", row[1].asString());
+
+  result = execute({1});
+  EXPECT_EQ(kMysqlParameterCount, result->errorCode());
+
+  // Prepared once, then cached
+  std::vector<std::future<MysqlResultPtr>> futures;
+  for (int i = 0; i < 20; ++i) {
+    auto promise = std::make_shared<std::promise<MysqlResultPtr>>();
+    futures.push_back(promise->get_future());
+    connection->execute("SELECT ?, ? FROM t", {i, "v" + std::to_string(i)},
+                        [promise](const MysqlResultPtr &result) {
+                          promise->set_value(result);
+                        });
+  }
+  for (int i = 0; i < 20; ++i) {
+    auto result = futures[i].get();
+    ASSERT_TRUE(result->ok());
+    EXPECT_EQ(i, (*result)[0][0].asInt64());
+    EXPECT_EQ("v" + std::to_string(i), (*result)[0][1].asString());
+  }
+  EXPECT_EQ(2, server.prepares_);
+
+  connection->closeStatement(statement);
+  EXPECT_TRUE(query(connection, "SELECT 0")->ok());
+  EXPECT_EQ(1, server.closes_);
+}
+
+TEST(Mysql, StreamTest) {
+  FakeMysql server;
+  server.start();
+  EventLoopThread clientThread;
+  clientThread.run();
+  auto connection = newConnection(clientThread.getLoop());
+  connection->setMaxStreamBacklog(64 * 1024);
+  connection->connect();
+
+  // A consumer keeping the batches: reading stops at the backlog
+  const size_t kRows = 200000;
+  std::mutex mutex;
+  std::vector<MysqlResultPtr> kept;
+  std::atomic<bool> done{false};
+  std::promise<MysqlResultPtr> finished;
+  std::promise<void> firstBatch;
+  size_t batchCount = 0;
+  connection->queryStream(
+      "SELECT " + std::to_string(kRows),
+      [&](const MysqlResultPtr &batch) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (batchCount++ == 0) firstBatch.set_value();
+        kept.push_back(batch);
+      },
+      [&](const MysqlResultPtr &result) {
+        done = true;
+        finished.set_value(result);
+      });
+  // Nothing is released, so the rows stop short once reading pauses
+  ASSERT_EQ(std::future_status::ready,
+            firstBatch.get_future().wait_for(std::chrono::seconds(10)));
+  size_t keptRows = 0, keptBytes = 0, largestBatch = 0;
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  for (int still = 0; still < 5;) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t rows = 0;
+    keptBytes = largestBatch = 0;
+    for (auto &batch : kept) {
+      rows += batch->size();
+      keptBytes += batch->dataBytes();
+      largestBatch = std::max(largestBatch, batch->dataBytes());
+    }
+    still = rows == keptRows ? still + 1 : 0;
+    keptRows = rows;
+    if (std::chrono::steady_clock::now() > deadline) break;
+  }
+  EXPECT_FALSE(done);
+  EXPECT_GT(keptRows, 0u);
+  EXPECT_LT(keptRows, kRows / 4);
+  // The backlog, and the read that went past it
+  EXPECT_LE(keptBytes, 64 * 1024 + largestBatch);
+
+  // Released batches let the rows flow again
+  size_t rows = 0;
+  while (true) {
+    std::vector<MysqlResultPtr> batches;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      batches.swap(kept);
+    }
+    for (auto &batch : batches) {
+      ASSERT_TRUE(batch->ok());
+      ASSERT_EQ(3u, batch->columns().size());
+      for (size_t i = 0; i < batch->size(); ++i, ++rows) {
+        ASSERT_EQ(static_cast<long long>(rows), (*batch)[i][0].asInt64());
+        EXPECT_EQ(rows % 2 == 1, (*batch)[i][2].isNull());
+      }
+    }
+    if (batches.empty() && done) break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(kRows, rows);
+  auto result = finished.get_future().get();
+  EXPECT_TRUE(result->ok());
+  EXPECT_TRUE(result->empty());
+  EXPECT_EQ(3u, result->columns().size());
+
+  // Errors go to the done callback
+  std::promise<MysqlResultPtr> failed;
+  connection->queryStream(
+      "FOO", [](const MysqlResultPtr &) { ADD_FAILURE(); },
+      [&](const MysqlResultPtr &result) { failed.set_value(result); });
+  EXPECT_EQ(1064u, failed.get_future().get()->errorCode());
+
+  // Prepared statements stream the binary rows
+  std::promise<MysqlStatementPtr> prepared;
+  connection->prepare("SELECT ?, ?", [&](const MysqlResultPtr &,
+                                         const MysqlStatementPtr &statement) {
+    prepared.set_value(statement);
+  });
+  auto statement = prepared.get_future().get();
+  ASSERT_TRUE(statement);
+  std::promise<MysqlResultPtr> executed;
+  std::vector<MysqlResultPtr> batches;
+  connection->executeStream(
+      statement, {5, "five"},
+      [&](const MysqlResultPtr &batch) { batches.push_back(batch); },
+      [&](const MysqlResultPtr &result) { executed.set_value(result); });
+  EXPECT_TRUE(executed.get_future().get()->ok());
+  ASSERT_EQ(1u, batches.size());
+  ASSERT_EQ(1u, batches[0]->size());
+  EXPECT_EQ(5, (*batches[0])[0][0].asInt64());
+  EXPECT_EQ("2024-01-02 03:04:05.000006", (*batches[0])[0][3].asString());
+  EXPECT_TRUE(query(connection, "SELECT 1")->ok());
+}
+
+TEST(Mysql, BatchTest) {
+  FakeMysql server;
+  server.start();
+  EventLoopThread clientThread;
+  clientThread.run();
+  auto connection = newConnection(clientThread.getLoop());
+  connection->connect();
+  EXPECT_TRUE(query(connection, "SELECT 0")->ok());
+
+  std::promise<MysqlStatementPtr> prepared;
+  connection->prepare("SELECT ?, ?", [&](const MysqlResultPtr &,
+                                         const MysqlStatementPtr &statement) {
+    prepared.set_value(statement);
+  });
+  auto statement = prepared.get_future().get();
+  ASSERT_TRUE(statement);
+
+  auto executeBatch = [&](std::vector<std::vector<MysqlParam>> paramSets) {
+    std::promise<std::vector<MysqlResultPtr>> promise;
+    connection->executeBatch(
+        statement, std::move(paramSets),
+        [&](const std::vector<MysqlResultPtr> &results) {
+          promise.set_value(results);
+        });
+    return promise.get_future().get();
+  };
+  // Sent in one write, the results in order
+  std::vector<std::vector<MysqlParam>> paramSets;
+  for (int i = 0; i < 100; ++i) {
+    paramSets.push_back({i, "v" + std::to_string(i)});
+  }
+  paramSets[50] = {1};
+  int readsBefore = server.reads_;
+  auto results = executeBatch(paramSets);
+  EXPECT_LE(server.reads_ - readsBefore, 3);
+  ASSERT_EQ(100u, results.size());
+  for (int i = 0; i < 100; ++i) {
+    if (i == 50) {
+      EXPECT_EQ(kMysqlParameterCount, results[i]->errorCode());
+      continue;
+    }
+    ASSERT_TRUE(results[i]->ok());
+    EXPECT_EQ(i, (*results[i])[0][0].asInt64());
+    EXPECT_EQ("v" + std::to_string(i), (*results[i])[0][1].asString());
+  }
+  EXPECT_TRUE(executeBatch({}).empty());
+
+  // By sql, prepared once
+  std::promise<std::vector<MysqlResultPtr>> promise;
+  connection->executeBatch("SELECT ?, ? FROM t", {{1, nullptr}, {2, "two"}},
+                           [&](const std::vector<MysqlResultPtr> &results) {
+                             promise.set_value(results);
+                           });
+  results = promise.get_future().get();
+  ASSERT_EQ(2u, results.size());
+  EXPECT_EQ(2, (*results[1])[0][0].asInt64());
+  EXPECT_EQ("two", (*results[1])[0][1].asString());
+  EXPECT_EQ(2, server.prepares_);
+
+  promise = std::promise<std::vector<MysqlResultPtr>>();
+  connection->executeBatch("BAD ?", {{1}, {2}},
+                           [&](const std::vector<MysqlResultPtr> &results) {
+                             promise.set_value(results);
+                           });
+  results = promise.get_future().get();
+  ASSERT_EQ(2u, results.size());
+  EXPECT_EQ(1064u, results[1]->errorCode());
+}
+
+TEST(Mysql, AuthTest) {
+  EventLoopThread clientThread;
+  clientThread.run();
+  auto loop = clientThread.getLoop();
+  {
+    FakeMysql server(FakeMysql::kSha2PluginName);
+    server.start();
+    auto connection = newConnection(loop);
+    connection->connect();
+    EXPECT_TRUE(query(connection, "SELECT 1")->ok());
+  }
+  {
+    FakeMysql server(FakeMysql::kSha2PluginName, true);
+    server.start();
+    auto connection = newConnection(loop);
+    connection->connect();
+    EXPECT_TRUE(query(connection, "SELECT 1")->ok());
+  }
+  {
+    // The password encrypted with the key the server sends, then with a
+    // key known beforehand
+    FakeMysql server(FakeMysql::kSha2PluginName, false, true);
+    server.start();
+    auto connection = newConnection(loop);
+    connection->connect();
+    EXPECT_TRUE(query(connection, "SELECT 1")->ok());
+    EXPECT_EQ(1, server.keyRequests_);
+    connection = newConnection(loop);
+    connection->setServerPublicKey(kPublicKey);
+    connection->connect();
+    EXPECT_TRUE(query(connection, "SELECT 1")->ok());
+    EXPECT_EQ(1, server.keyRequests_);
+    connection = newConnection(loop);
+    connection->setServerPublicKey("not a key");
+    connection->connect();
+    EXPECT_EQ(kMysqlAuthPluginError,
+              query(connection, "SELECT 1")->errorCode());
+  }
+  {
+    FakeMysql server;
+    server.start();
+    auto connection = newConnection(loop, "wrong");
+    connection->connect();
+    auto result = query(connection, "SELECT 1");
+    EXPECT_EQ(1045u, result->errorCode());
+    EXPECT_TRUE(connection->closed());
+    // And so do the commands issued later
+    EXPECT_EQ(1045u, query(connection, "SELECT 1")->errorCode());
+  }
+  // Nothing listens there
+  auto connection = std::make_shared<MysqlConnection>(
+      loop, InetAddress("127.0.0.1", 38301), "root");
+  connection->connect();
+  EXPECT_EQ(kMysqlConnectionError, query(connection, "SELECT 1")->errorCode());
+}
+
+TEST(Mysql, PoolTest) {
+  FakeMysql server;
+  server.start();
+  EventLoopThreadPool pool(2);
+  pool.start();
+  auto client = MysqlClient::newMysqlClient(
+      pool.getLoops(), InetAddress("127.0.0.1", kPort), "root", "secret",
+      "test", 2);
+  std::vector<std::future<MysqlResultPtr>> queries, executions;
+  for (int i = 0; i < 200; ++i) {
+    queries.push_back(client->query("SELECT " + std::to_string(i % 5)));
+    executions.push_back(client->execute("SELECT ?, ?", {i, nullptr}));
+  }
+  for (int i = 0; i < 200; ++i) {
+    auto result = queries[i].get();
+    ASSERT_TRUE(result->ok());
+    EXPECT_EQ(static_cast<size_t>(i % 5), result->size());
+    result = executions[i].get();
+    ASSERT_TRUE(result->ok());
+    EXPECT_EQ(i, (*result)[0][0].asInt64());
+    EXPECT_TRUE((*result)[0][1].isNull());
+  }
+  EXPECT_EQ(4, server.connections_);
+  EXPECT_EQ(4u, client->connectionCount());
+  EXPECT_LE(server.prepares_, 4);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,167 @@
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <limits>
+#include <random>
+#include <string>
+
+#include "LogStream.h"
+#include "Utility.h"
+
+using namespace canary;
+
+namespace {
+
+std::string formatted(int64_t value) {
+  char buf[utils::kMaxInt64Length];
+  return std::string(buf, utils::formatInt64(value, buf));
+}
+
+std::string formatted(uint64_t value) {
+  char buf[utils::kMaxInt64Length];
+  return std::string(buf, utils::formatUint64(value, buf));
+}
+
+std::string formatted(double value) {
+  char buf[utils::kMaxDoubleLength];
+  return std::string(buf, utils::formatDouble(value, buf));
+}
+
+std::string formatted(float value) {
+  char buf[utils::kMaxDoubleLength];
+  return std::string(buf, utils::formatFloat(value, buf));
+}
+
+// The digits of the significand, without the sign, the point and the
+// exponent
+std::string significand(const std::string &text) {
+  std::string digits;
+  for (char c : text) {
+    if (c == 'e') break;
+    if (c >= '0' && c <= '9') digits += c;
+  }
+  auto first = digits.find_first_not_of('0');
+  auto last = digits.find_last_not_of('0');
+  if (first == std::string::npos) return "0";
+  return digits.substr(first, last - first + 1);
+}
+
+// The correctly rounded digits of the fewest that read back as the value
+template <typename T, typename Parse>
+std::string shortestBySearch(T value, Parse parse) {
+  char buf[64];
+  for (int precision = 0; precision < 17; ++precision) {
+    snprintf(buf, sizeof(buf), "%.*e", precision, static_cast<double>(value));
+    if (parse(buf) == value) break;
+  }
+  return significand(buf);
+}
+
+}  // namespace
+
+TEST(NumberFormat, IntegerTest) {
+  EXPECT_EQ("0", formatted(int64_t{0}));
+  EXPECT_EQ("-1", formatted(int64_t{-1}));
+  EXPECT_EQ("9223372036854775807",
+            formatted(std::numeric_limits<int64_t>::max()));
+  EXPECT_EQ("-9223372036854775808",
+            formatted(std::numeric_limits<int64_t>::min()));
+  EXPECT_EQ("18446744073709551615",
+            formatted(std::numeric_limits<uint64_t>::max()));
+  uint64_t power = 1;
+  for (int i = 0; i < 20; ++i, power *= 10) {
+    EXPECT_EQ(std::to_string(power), formatted(power));
+    EXPECT_EQ(std::to_string(power - 1), formatted(power - 1));
+  }
+  std::mt19937_64 random(7);
+  for (int i = 0; i < 100000; ++i) {
+    uint64_t value = random() >> (random() % 64);
+    ASSERT_EQ(std::to_string(value), formatted(value));
+    ASSERT_EQ(std::to_string(-static_cast<int64_t>(value >> 1)),
+              formatted(-static_cast<int64_t>(value >> 1)));
+  }
+}
+
+TEST(NumberFormat, DoubleTest) {
+  EXPECT_EQ("0", formatted(0.0));
+  EXPECT_EQ("-0", formatted(-0.0));
+  EXPECT_EQ("inf", formatted(std::numeric_limits<double>::infinity()));
+  EXPECT_EQ("-inf", formatted(-std::numeric_limits<double>::infinity()));
+  EXPECT_EQ("nan", formatted(std::numeric_limits<double>::quiet_NaN()));
+  EXPECT_EQ("0.1", formatted(0.1));
+  EXPECT_EQ("0.30000000000000004", formatted(0.1 + 0.2));
+  EXPECT_EQ("-123.456", formatted(-123.456));
+  EXPECT_EQ("100", formatted(100.0));
+  EXPECT_EQ("0.0001", formatted(0.0001));
+  EXPECT_EQ("1e-05", formatted(0.00001));
+  EXPECT_EQ("12345678901234568", formatted(12345678901234567.0));
+  EXPECT_EQ("1e+17", formatted(1e17));
+  EXPECT_EQ("1.7976931348623157e+308",
+            formatted(std::numeric_limits<double>::max()));
+  EXPECT_EQ("2.2250738585072014e-308",
+            formatted(std::numeric_limits<double>::min()));
+  EXPECT_EQ("5e-324", formatted(std::numeric_limits<double>::denorm_min()));
+  EXPECT_EQ("9007199254740994", formatted(9007199254740994.0));
+
+  auto parse = [](const char *text) { return strtod(text, nullptr); };
+  std::mt19937_64 random(11);
+  for (int i = 0; i < 200000; ++i) {
+    uint64_t bits = random();
+    // Small integers and round decimals too
+    double value;
+    if (i % 4 == 1) {
+      value = static_cast<double>(bits % 1000000);
+    } else if (i % 4 == 2) {
+      value = static_cast<double>(bits % 100000) / 1000;
+    } else {
+      memcpy(&value, &bits, sizeof(value));
+      if (value != value || value - value != 0) continue;
+    }
+    auto text = formatted(value);
+    ASSERT_EQ(value, parse(text.c_str())) << text;
+    auto expected = shortestBySearch(value, parse);
+    auto digits = significand(text);
+    // The search misses the shortest just below a power of two, where the
+    // interval is lopsided
+    ASSERT_LE(digits.size(), expected.size()) << text;
+    if (digits.size() == expected.size()) {
+      ASSERT_EQ(expected, digits);
+    }
+  }
+}
+
+TEST(NumberFormat, FloatTest) {
+  EXPECT_EQ("0.1", formatted(0.1f));
+  EXPECT_EQ("3.4028235e+38", formatted(std::numeric_limits<float>::max()));
+  EXPECT_EQ("1e-45", formatted(std::numeric_limits<float>::denorm_min()));
+  EXPECT_EQ("16777216", formatted(16777216.0f));
+
+  auto parse = [](const char *text) { return strtof(text, nullptr); };
+  std::mt19937 random(13);
+  for (int i = 0; i < 200000; ++i) {
+    uint32_t bits = random();
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    if (value != value || value - value != 0) continue;
+    auto text = formatted(value);
+    ASSERT_EQ(value, parse(text.c_str())) << text;
+    auto expected = shortestBySearch(value, parse);
+    auto digits = significand(text);
+    ASSERT_LE(digits.size(), expected.size()) << text;
+    if (digits.size() == expected.size()) {
+      ASSERT_EQ(expected, digits);
+    }
+  }
+}
+
+TEST(NumberFormat, LogStreamTest) {
+  LogStream stream;
+  float f = 0.1f;
+  stream << -42 << ' ' << 42u << ' ' << 2.5 << ' ' << f << ' '
+         << std::numeric_limits<long long>::min();
+  EXPECT_EQ("-42 42 2.5 0.1 -9223372036854775808",
+            std::string(stream.bufferData(), stream.bufferLength()));
+}
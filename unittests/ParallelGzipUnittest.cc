@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include <future>
+#include <string>
+
+#include "EventLoopThread.h"
+#include "ParallelGzip.h"
+#include "Utility.h"
+
+using namespace canary;
+
+static std::string makeLog(size_t lines) {
+  std::string data;
+  for (size_t i = 0; i < lines; ++i) {
+    data.append("GET /api/items/" + std::to_string(i % 977) + " 200 ");
+    data.append(utils::genRandomString(6) + "\n");
+  }
+  return data;
+}
+
+TEST(ParallelGzip, RoundTripTest) {
+  auto workers = std::make_shared<EventLoopThreadPool>(4);
+  workers->start();
+  ParallelGzip gzip(workers, 64 * 1024);
+  for (size_t lines : {0, 10, 200000}) {
+    auto data = makeLog(lines);
+    auto compressed = gzip.compress(data.data(), data.length());
+    ASSERT_FALSE(compressed.empty());
+    EXPECT_EQ(data,
+              utils::gzipDecompress(compressed.data(), compressed.length()));
+  }
+  // Priming keeps the ratio close to a single gzip stream
+  auto data = makeLog(200000);
+  auto parallel = gzip.compress(data.data(), data.length());
+  auto serial = utils::gzipCompress(data.data(), data.length());
+  EXPECT_LT(parallel.length(), serial.length() * 102 / 100);
+}
+
+TEST(ParallelGzip, AsyncTest) {
+  auto workers = std::make_shared<EventLoopThreadPool>(3);
+  workers->start();
+  EventLoopThread ioThread;
+  ioThread.run();
+  auto ioLoop = ioThread.getLoop();
+  auto data = makeLog(50000);
+  std::promise<std::string> promise;
+  {
+    ParallelGzip gzip(workers);
+    gzip.compress(ioLoop, data, [&](std::string &&result) {
+      // Delivered on the loop that asked for it
+      EXPECT_TRUE(ioLoop->isInLoopThread());
+      promise.set_value(std::move(result));
+    });
+  }
+  auto compressed = promise.get_future().get();
+  EXPECT_EQ(data,
+            utils::gzipDecompress(compressed.data(), compressed.length()));
+}
+
+TEST(ParallelGzip, WorkerPoolTest) {
+  auto pool = std::make_shared<WorkerPool>(4);
+  EventLoopThread ioThread;
+  ioThread.run();
+  auto ioLoop = ioThread.getLoop();
+  ParallelGzip gzip(pool, 64 * 1024);
+  auto data = makeLog(100000);
+  auto compressed = gzip.compress(data.data(), data.length());
+  EXPECT_EQ(data,
+            utils::gzipDecompress(compressed.data(), compressed.length()));
+
+  std::promise<std::string> promise;
+  gzip.compress(ioLoop, data, [&](std::string &&result) {
+    EXPECT_TRUE(ioLoop->isInLoopThread());
+    promise.set_value(std::move(result));
+  });
+  EXPECT_EQ(compressed, promise.get_future().get());
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,313 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "EventLoopThread.h"
+#include "RedisClusterClient.h"
+#include "TcpServer.h"
+
+using namespace canary;
+
+namespace {
+const uint16_t kPortA = 38298;
+const uint16_t kPortB = 38299;
+const char kAskKey[] = "migrating";
+
+// State shared by the fake nodes. Before the migration node A serves every
+// slot, after it node B serves the upper half, and after a failover node B
+// serves them all. kAskKey is being migrated away from its owner: the
+// owner answers ASK, the other node serves it after ASKING.
+struct FakeCluster {
+  std::atomic<bool> migrated_{false};
+  std::atomic<bool> failedOver_{false};
+  std::atomic<int> moved_{0};
+  std::atomic<int> asked_{0};
+  std::mutex mutex_;
+  std::map<std::string, std::string> store_;
+
+  uint16_t owner(uint16_t slot) const {
+    if (failedOver_) return kPortB;
+    return migrated_ && slot >= 8192 ? kPortB : kPortA;
+  }
+
+  std::string slots() const {
+    auto node = [](uint16_t port) {
+      return "*3\r\n$9\r\n127.0.0.1\r\n:" + std::to_string(port) +
+             "\r\n$2\r\nid\r\n";
+    };
+    if (failedOver_) return "*1\r\n*3\r\n:0\r\n:16383\r\n" + node(kPortB);
+    if (!migrated_) return "*1\r\n*3\r\n:0\r\n:16383\r\n" + node(kPortA);
+    return "*2\r\n*3\r\n:0\r\n:8191\r\n" + node(kPortA) +
+           "*3\r\n:8192\r\n:16383\r\n" + node(kPortB);
+  }
+};
+
+class FakeNode {
+ public:
+  FakeNode(FakeCluster *cluster, uint16_t port)
+      : cluster_(cluster),
+        port_(port),
+        server_(thread_.getLoop(), InetAddress("127.0.0.1", port), "node") {}
+
+  void start() {
+    thread_.run();
+    server_.setRecvMessageCallback(
+        [this](const TcpConnectionPtr &conn, MsgBuffer *buffer) {
+          onMessage(conn, buffer);
+        });
+    server_.start();
+    std::promise<void> listening;
+    thread_.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+  }
+
+  ~FakeNode() { server_.stop(); }
+
+  // Commands are kept unanswered while set
+  std::atomic<bool> stalled_{false};
+
+ private:
+  std::string execute(const TcpConnectionPtr &conn,
+                      const RedisReply &command) {
+    auto name = command[0].asString();
+    bool asking = asking_[conn.get()];
+    asking_[conn.get()] = false;
+    if (name == "CLUSTER") return cluster_->slots();
+    if (name == "ASKING") {
+      asking_[conn.get()] = true;
+      return "+OK\r\n";
+    }
+    auto key = command[1].asString();
+    auto slot = RedisClusterClient::keySlot(key);
+    auto owner = cluster_->owner(slot);
+    auto other = owner == kPortA ? kPortB : kPortA;
+    if (key == kAskKey) {
+      if (port_ == owner) {
+        return "-ASK " + std::to_string(slot) + " 127.0.0.1:" +
+               std::to_string(other) + "\r\n";
+      }
+      if (asking) {
+        ++cluster_->asked_;
+        return "$5\r\nasked\r\n";
+      }
+    }
+    if (port_ != owner) {
+      ++cluster_->moved_;
+      return "-MOVED " + std::to_string(slot) + " 127.0.0.1:" +
+             std::to_string(owner) + "\r\n";
+    }
+    std::lock_guard<std::mutex> lock(cluster_->mutex_);
+    auto &store = cluster_->store_;
+    if (name == "SET") {
+      store[key] = command[2].asString();
+      return "+OK\r\n";
+    }
+    if (name == "GET" || name == "MGET") {
+      std::string result = name == "MGET"
+                               ? "*" + std::to_string(command.size() - 1) +
+                                     "\r\n"
+                               : "";
+      for (size_t i = 1; i < command.size(); ++i) {
+        auto iter = store.find(command[i].asString());
+        if (iter == store.end()) {
+          result += "$-1\r\n";
+        } else {
+          result += "$" + std::to_string(iter->second.size()) + "\r\n" +
+                    iter->second + "\r\n";
+        }
+      }
+      return result;
+    }
+    if (name == "DEL") {
+      int removed = 0;
+      for (size_t i = 1; i < command.size(); ++i) {
+        removed += static_cast<int>(store.erase(command[i].asString()));
+      }
+      return ":" + std::to_string(removed) + "\r\n";
+    }
+    return "-ERR unknown command\r\n";
+  }
+
+  void onMessage(const TcpConnectionPtr &conn, MsgBuffer *buffer) {
+    if (stalled_) return;
+    std::string output;
+    while (true) {
+      RedisReply command;
+      auto len = RespParser::parse(
+          buffer->peek(), buffer->peek() + buffer->readableBytes(), &command);
+      if (len <= 0) break;
+      output += execute(conn, command);
+      buffer->retrieve(len);
+    }
+    conn->send(output);
+  }
+
+  FakeCluster *cluster_;
+  uint16_t port_;
+  EventLoopThread thread_;
+  TcpServer server_;
+  std::unordered_map<TcpConnection *, bool> asking_;
+};
+
+bool waitFor(const std::function<bool()> &condition) {
+  for (int i = 0; i < 200 && !condition(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return condition();
+}
+}  // namespace
+
+TEST(RedisCluster, KeySlotTest) {
+  EXPECT_EQ(12739, RedisClusterClient::keySlot("123456789"));
+  EXPECT_EQ(12182, RedisClusterClient::keySlot("foo"));
+  EXPECT_EQ(RedisClusterClient::keySlot("{user1000}.following"),
+            RedisClusterClient::keySlot("{user1000}.followers"));
+  EXPECT_EQ(RedisClusterClient::keySlot("user1000"),
+            RedisClusterClient::keySlot("{user1000}.followers"));
+  // An empty tag does not count
+  EXPECT_NE(RedisClusterClient::keySlot("{}foo"),
+            RedisClusterClient::keySlot("foo"));
+}
+
+TEST(RedisCluster, RoutingTest) {
+  FakeCluster cluster;
+  FakeNode nodeA(&cluster, kPortA), nodeB(&cluster, kPortB);
+  nodeA.start();
+  nodeB.start();
+  EventLoopThread thread1, thread2;
+  thread1.run();
+  thread2.run();
+  auto client = RedisClusterClient::newRedisClusterClient(
+      {thread1.getLoop(), thread2.getLoop()},
+      {InetAddress("127.0.0.1", kPortB)});
+  client->start(0);
+  ASSERT_TRUE(waitFor([&]() { return client->refreshCount() == 1; }));
+
+  std::vector<std::string> keys;
+  for (int i = 0; i < 100; ++i) keys.push_back("key" + std::to_string(i));
+  std::vector<std::future<std::pair<RedisResult, RedisReply>>> futures;
+  for (auto &key : keys) {
+    futures.push_back(client->execCommand({"SET", key, key}));
+  }
+  for (auto &future : futures) {
+    EXPECT_EQ("OK", future.get().second.asString());
+  }
+  EXPECT_EQ(0, cluster.moved_);
+
+  // Half of the slots move to node B, the map follows the redirects
+  cluster.migrated_ = true;
+  futures.clear();
+  for (auto &key : keys) futures.push_back(client->execCommand({"GET", key}));
+  for (size_t i = 0; i < keys.size(); ++i) {
+    EXPECT_EQ(keys[i], futures[i].get().second.asString());
+  }
+  EXPECT_GT(cluster.moved_, 0);
+  ASSERT_TRUE(waitFor([&]() { return client->refreshCount() >= 2; }));
+  EXPECT_EQ(kPortB, client->nodeOfSlot(16000).toPort());
+
+  cluster.moved_ = 0;
+  futures.clear();
+  for (auto &key : keys) futures.push_back(client->execCommand({"GET", key}));
+  for (auto &future : futures) future.get();
+  EXPECT_EQ(0, cluster.moved_);
+
+  // ASK is followed for the one command
+  auto result = client->execCommand({"GET", kAskKey}).get();
+  EXPECT_EQ("asked", result.second.asString());
+  EXPECT_EQ(1, cluster.asked_);
+}
+
+TEST(RedisCluster, MultiKeyTest) {
+  FakeCluster cluster;
+  cluster.migrated_ = true;
+  FakeNode nodeA(&cluster, kPortA), nodeB(&cluster, kPortB);
+  nodeA.start();
+  nodeB.start();
+  EventLoopThread thread;
+  thread.run();
+  auto client = RedisClusterClient::newRedisClusterClient(
+      {thread.getLoop()}, {InetAddress("127.0.0.1", kPortA)});
+  client->start(0);
+  ASSERT_TRUE(waitFor([&]() { return client->refreshCount() == 1; }));
+
+  std::vector<std::string> keys;
+  for (int i = 0; i < 20; ++i) {
+    keys.push_back("m" + std::to_string(i));
+    if (i % 4 != 0) {
+      client->execCommand({"SET", keys.back(), "v" + std::to_string(i)}).get();
+    }
+  }
+  std::promise<std::vector<std::string>> values;
+  client->mget(keys, [&](RedisResult result,
+                         const std::vector<RedisReply> &replies) {
+    EXPECT_EQ(RedisResult::kOk, result);
+    std::vector<std::string> strings;
+    for (auto &reply : replies) {
+      strings.push_back(reply.isNil() ? "nil" : reply.asString());
+    }
+    values.set_value(strings);
+  });
+  auto strings = values.get_future().get();
+  ASSERT_EQ(keys.size(), strings.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    EXPECT_EQ(i % 4 == 0 ? "nil" : "v" + std::to_string(i), strings[i]);
+  }
+
+  std::promise<long long> removed;
+  client->del(keys, [&](RedisResult result, long long count) {
+    EXPECT_EQ(RedisResult::kOk, result);
+    removed.set_value(count);
+  });
+  EXPECT_EQ(15, removed.get_future().get());
+  EXPECT_EQ(0, cluster.moved_);
+}
+
+TEST(RedisCluster, FailoverTest) {
+  FakeCluster cluster;
+  std::unique_ptr<FakeNode> nodeA(new FakeNode(&cluster, kPortA));
+  FakeNode nodeB(&cluster, kPortB);
+  nodeA->start();
+  nodeB.start();
+  EventLoopThread thread;
+  thread.run();
+  auto client = RedisClusterClient::newRedisClusterClient(
+      {thread.getLoop()},
+      {InetAddress("127.0.0.1", kPortA), InetAddress("127.0.0.1", kPortB)});
+  client->start(0);
+  ASSERT_TRUE(waitFor([&]() { return client->refreshCount() == 1; }));
+  std::vector<std::string> keys;
+  for (int i = 0; i < 20; ++i) {
+    keys.push_back("f" + std::to_string(i));
+    EXPECT_EQ("OK", client->execCommand({"SET", keys.back(), keys.back()})
+                        .get()
+                        .second.asString());
+  }
+
+  // Node A dies with the commands in flight, node B takes its slots
+  nodeA->stalled_ = true;
+  std::vector<std::future<std::pair<RedisResult, RedisReply>>> futures;
+  for (auto &key : keys) futures.push_back(client->execCommand({"GET", key}));
+  cluster.failedOver_ = true;
+  nodeA.reset();
+  for (size_t i = 0; i < keys.size(); ++i) {
+    ASSERT_EQ(std::future_status::ready,
+              futures[i].wait_for(std::chrono::seconds(5)));
+    auto result = futures[i].get();
+    EXPECT_EQ(RedisResult::kOk, result.first);
+    EXPECT_EQ(keys[i], result.second.asString());
+  }
+  EXPECT_EQ(kPortB, client->nodeOfSlot(0).toPort());
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
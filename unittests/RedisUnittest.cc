@@ -0,0 +1,342 @@
+#include <gtest/gtest.h>
+#include <string.h>
+
+#include <atomic>
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EventLoopThread.h"
+#include "RedisClient.h"
+#include "TcpServer.h"
+
+using namespace canary;
+
+namespace {
+const uint16_t kPort = 38296;
+
+// Enough of Redis for the tests: PING, SET, GET, INCR, AUTH (password
+// "secret"), SELECT, HELLO, BIG n (a bulk string of n bytes), PUSH (a
+// RESP3 push message followed by +OK) and HANG (no reply, nor to anything
+// after it).
+class FakeRedis {
+ public:
+  FakeRedis()
+      : server_(thread_.getLoop(), InetAddress("127.0.0.1", kPort), "redis") {}
+
+  void start() {
+    thread_.run();
+    server_.setConnectionCallback([this](const TcpConnectionPtr &conn) {
+      if (conn->connected()) ++connections_;
+    });
+    server_.setRecvMessageCallback(
+        [this](const TcpConnectionPtr &conn, MsgBuffer *buffer) {
+          ++reads_;
+          onMessage(conn, buffer);
+        });
+    server_.start();
+    std::promise<void> listening;
+    thread_.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+  }
+
+  ~FakeRedis() { server_.stop(); }
+
+  std::atomic<int> connections_{0};
+  std::atomic<int> reads_{0};
+  std::atomic<int> auths_{0};
+  std::atomic<int> selects_{0};
+
+ private:
+  void onMessage(const TcpConnectionPtr &conn, MsgBuffer *buffer) {
+    if (conn->hasContext()) {
+      buffer->retrieveAll();
+      return;
+    }
+    std::string output;
+    while (true) {
+      RedisReply command;
+      auto len = RespParser::parse(
+          buffer->peek(), buffer->peek() + buffer->readableBytes(), &command);
+      if (len == 0) break;
+      ASSERT_GT(len, 0);
+      auto name = command[0].asString();
+      if (name == "HANG") {
+        // Deaf from here on, also to what arrives in later reads
+        conn->setContext(std::make_shared<bool>(true));
+        buffer->retrieveAll();
+        break;
+      }
+      if (name == "PING") {
+        output += "+PONG\r\n";
+      } else if (name == "SET") {
+        store_[command[1].asString()] = command[2].asString();
+        output += "+OK\r\n";
+      } else if (name == "GET") {
+        auto iter = store_.find(command[1].asString());
+        if (iter == store_.end()) {
+          output += "$-1\r\n";
+        } else {
+          output += "$" + std::to_string(iter->second.length()) + "\r\n" +
+                    iter->second + "\r\n";
+        }
+      } else if (name == "INCR") {
+        auto &value = store_[command[1].asString()];
+        value = std::to_string(value.empty() ? 1 : std::stoll(value) + 1);
+        output += ":" + value + "\r\n";
+      } else if (name == "AUTH") {
+        ++auths_;
+        output += command[command.size() - 1].asString() == "secret"
+                      ? "+OK\r\n"
+                      : "-WRONGPASS invalid password\r\n";
+      } else if (name == "SELECT") {
+        ++selects_;
+        output += "+OK\r\n";
+      } else if (name == "HELLO") {
+        output += "%1\r\n$5\r\nproto\r\n:3\r\n";
+      } else if (name == "BIG") {
+        auto n = std::stoul(command[1].asString());
+        output += "$" + std::to_string(n) + "\r\n" + std::string(n, 'b') +
+                  "\r\n";
+      } else if (name == "PUSH") {
+        output += ">2\r\n$7\r\nmessage\r\n$2\r\nhi\r\n+OK\r\n";
+      } else {
+        output += "-ERR unknown command\r\n";
+      }
+      buffer->retrieve(len);
+    }
+    conn->send(output);
+  }
+
+  EventLoopThread thread_;
+  TcpServer server_;
+  std::map<std::string, std::string> store_;
+};
+}  // namespace
+
+TEST(Redis, ParserTest) {
+  std::string wire =
+      "+OK\r\n-ERR bad\r\n:-42\r\n$5\r\nhe\r\no\r\n$-1\r\n*-1\r\n"
+      "*3\r\n:1\r\n$0\r\n\r\n*1\r\n+x\r\n"
+      "_\r\n,3.5\r\n#t\r\n(12345678901234567890\r\n=8\r\ntxt:abcd\r\n"
+      "%1\r\n+k\r\n:1\r\n~1\r\n+m\r\n|1\r\n+ttl\r\n:3\r\n:7\r\n";
+  std::vector<std::string> expected{
+      "\"OK\"",          "(error) ERR bad", "-42", "\"he\r\no\"", "nil",
+      "nil",             "[1, \"\", [\"x\"]]", "nil", "3.5", "1",
+      "12345678901234567890", "\"abcd\"",   "[\"k\", 1]", "[\"m\"]", "7"};
+  const char *p = wire.data();
+  const char *end = p + wire.size();
+  for (auto &text : expected) {
+    RedisReply reply;
+    auto len = RespParser::parse(p, end, &reply);
+    ASSERT_GT(len, 0) << text;
+    // Every prefix of a reply is incomplete
+    for (long i = 0; i < len; ++i) {
+      RedisReply partial;
+      ASSERT_EQ(0, RespParser::parse(p, p + i, &partial)) << text << " " << i;
+    }
+    EXPECT_EQ(text, reply.toString());
+    p += len;
+  }
+  EXPECT_EQ(p, end);
+
+  // A big bulk string tells how much of it is needed
+  std::string big = "$100000\r\n" + std::string(1000, 'x');
+  RedisReply reply;
+  size_t needed = 0;
+  EXPECT_EQ(0, RespParser::parse(big.data(), big.data() + big.size(), &reply,
+                                 &needed));
+  EXPECT_EQ(100011u, needed);
+
+  for (const char *bad : {"?\r\n", ":1x\r\n", "$2\r\nabcd\r\n", "#x\r\n",
+                          "$-2\r\n", "+OK\rx"}) {
+    EXPECT_EQ(-1, RespParser::parse(bad, bad + strlen(bad), &reply)) << bad;
+  }
+
+  // A detached reply outlives its buffer
+  RedisReply detached;
+  {
+    std::string data = "*2\r\n$3\r\nfoo\r\n,1.5\r\n";
+    RespParser::parse(data.data(), data.data() + data.size(), &reply);
+    detached = reply.detach();
+    data.assign(data.size(), 'z');
+  }
+  EXPECT_EQ("foo", detached[0].asString());
+  EXPECT_EQ(1.5, detached[1].asDouble());
+
+  MsgBuffer command;
+  appendRedisCommand({"SET", "key", string_view("a\0b", 3)}, &command);
+  EXPECT_EQ(std::string("*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$3\r\na\0b\r\n", 31),
+            std::string(command.peek(), command.readableBytes()));
+}
+
+TEST(Redis, PipeliningTest) {
+  FakeRedis server;
+  server.start();
+  EventLoopThread clientThread;
+  clientThread.run();
+  auto loop = clientThread.getLoop();
+  auto connection =
+      std::make_shared<RedisConnection>(loop, InetAddress("127.0.0.1", kPort));
+  std::promise<void> connected;
+  connection->setConnectionCallback([&](const RedisConnectionPtr &conn) {
+    if (!conn->closed()) connected.set_value();
+  });
+  connection->connect();
+  connected.get_future().wait();
+  int readsBefore = server.reads_;
+
+  // Issued in one iteration of the loop, sent in one write
+  const int kCommands = 200;
+  std::vector<long long> values;
+  std::promise<void> done;
+  loop->queueInLoop([&]() {
+    for (int i = 0; i < kCommands; ++i) {
+      connection->execCommand(
+          [&](RedisResult result, const RedisReply &reply) {
+            EXPECT_EQ(RedisResult::kOk, result);
+            values.push_back(reply.asInteger());
+            if (values.size() == kCommands) done.set_value();
+          },
+          {"INCR", "counter"});
+    }
+  });
+  ASSERT_EQ(std::future_status::ready,
+            done.get_future().wait_for(std::chrono::seconds(5)));
+  for (int i = 0; i < kCommands; ++i) EXPECT_EQ(i + 1, values[i]);
+  EXPECT_LE(server.reads_ - readsBefore, 3);
+
+  // A large reply arriving in many pieces
+  std::promise<size_t> bigDone;
+  connection->execCommand(
+      [&](RedisResult, const RedisReply &reply) {
+        bigDone.set_value(reply.asStringView().size());
+      },
+      {"BIG", "3000000"});
+  EXPECT_EQ(3000000u, bigDone.get_future().get());
+}
+
+TEST(Redis, PoolTest) {
+  FakeRedis server;
+  server.start();
+  EventLoopThread clientThread;
+  clientThread.run();
+  auto client = RedisClient::newRedisClient(
+      clientThread.getLoop(), InetAddress("127.0.0.1", kPort), 3, "secret", 2);
+  std::vector<std::future<std::pair<RedisResult, RedisReply>>> futures;
+  for (int i = 0; i < 300; ++i) {
+    auto key = "k" + std::to_string(i % 10);
+    futures.push_back(client->execCommand({"SET", key, "v"}));
+  }
+  for (auto &future : futures) {
+    auto result = future.get();
+    ASSERT_EQ(RedisResult::kOk, result.first);
+    EXPECT_EQ("OK", result.second.asString());
+  }
+  auto result = client->execCommand({"GET", "k3"}).get();
+  EXPECT_EQ("v", result.second.asString());
+  result = client->execCommand({"GET", "missing"}).get();
+  EXPECT_TRUE(result.second.isNil());
+  result = client->execCommand({"NOPE"}).get();
+  EXPECT_EQ(RedisResult::kOk, result.first);
+  EXPECT_TRUE(result.second.isError());
+  EXPECT_EQ(3, server.connections_);
+  EXPECT_EQ(3, server.auths_);
+  EXPECT_EQ(3, server.selects_);
+}
+
+TEST(Redis, Resp3Test) {
+  FakeRedis server;
+  server.start();
+  EventLoopThread clientThread;
+  clientThread.run();
+  auto connection = std::make_shared<RedisConnection>(
+      clientThread.getLoop(), InetAddress("127.0.0.1", kPort), "", 0, 3);
+  std::promise<std::string> pushed;
+  connection->setPushCallback(
+      [&](const RedisReply &reply) { pushed.set_value(reply.toString()); });
+  std::promise<std::string> replied;
+  connection->execCommand(
+      [&](RedisResult, const RedisReply &reply) {
+        replied.set_value(reply.toString());
+      },
+      {"PUSH"});
+  connection->connect();
+  EXPECT_EQ("[\"message\", \"hi\"]", pushed.get_future().get());
+  EXPECT_EQ("\"OK\"", replied.get_future().get());
+}
+
+TEST(Redis, FailureTest) {
+  EventLoopThread clientThread;
+  clientThread.run();
+  // Nothing listens there
+  auto client = RedisClient::newRedisClient(clientThread.getLoop(),
+                                            InetAddress("127.0.0.1", 38297));
+  EXPECT_EQ(RedisResult::kNetworkFailure,
+            client->execCommand({"PING"}).get().first);
+
+  FakeRedis server;
+  server.start();
+  auto connection = std::make_shared<RedisConnection>(
+      clientThread.getLoop(), InetAddress("127.0.0.1", kPort), "wrong");
+  std::promise<RedisResult> failed;
+  connection->execCommand(
+      [&](RedisResult result, const RedisReply &) { failed.set_value(result); },
+      {"PING"});
+  connection->connect();
+  EXPECT_EQ(RedisResult::kNetworkFailure, failed.get_future().get());
+  EXPECT_TRUE(connection->closed());
+}
+
+TEST(Redis, TimeoutTest) {
+  FakeRedis server;
+  server.start();
+  EventLoopThread clientThread;
+  clientThread.run();
+  auto connection = std::make_shared<RedisConnection>(
+      clientThread.getLoop(), InetAddress("127.0.0.1", kPort));
+  connection->setCommandTimeout(0.25);
+  connection->connect();
+  auto ping = [&]() {
+    auto promise = std::make_shared<std::promise<RedisResult>>();
+    connection->execCommand(
+        [promise](RedisResult result, const RedisReply &) {
+          promise->set_value(result);
+        },
+        {"PING"});
+    return promise->get_future();
+  };
+  // Each in time, though together they take longer than the timeout
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(RedisResult::kOk, ping().get());
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  // The hung command fails, and the one behind it
+  auto start = std::chrono::steady_clock::now();
+  std::promise<RedisResult> hung;
+  connection->execCommand(
+      [&](RedisResult result, const RedisReply &) { hung.set_value(result); },
+      {"HANG"});
+  auto behind = ping();
+  EXPECT_EQ(RedisResult::kTimeout, hung.get_future().get());
+  EXPECT_EQ(RedisResult::kTimeout, behind.get());
+  auto waited = std::chrono::steady_clock::now() - start;
+  EXPECT_GE(waited, std::chrono::milliseconds(200));
+  EXPECT_LT(waited, std::chrono::seconds(2));
+  EXPECT_TRUE(connection->closed());
+
+  auto client = RedisClient::newRedisClient(clientThread.getLoop(),
+                                            InetAddress("127.0.0.1", kPort));
+  client->setCommandTimeout(0.25);
+  EXPECT_EQ(RedisResult::kOk, client->execCommand({"PING"}).get().first);
+  EXPECT_EQ(RedisResult::kTimeout, client->execCommand({"HANG"}).get().first);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
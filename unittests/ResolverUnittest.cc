@@ -0,0 +1,369 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Channel.h"
+#include "EventLoopThread.h"
+#include "Resolver.h"
+
+using namespace canary;
+
+namespace {
+const uint16_t kPort = 38303;
+// Nothing listens there
+const uint16_t kDeadPort = 38304;
+
+void appendInt16(std::string *out, uint16_t value) {
+  out->push_back(static_cast<char>(value >> 8));
+  out->push_back(static_cast<char>(value & 0xff));
+}
+
+void appendInt32(std::string *out, uint32_t value) {
+  appendInt16(out, value >> 16);
+  appendInt16(out, value & 0xffff);
+}
+
+std::string encodeName(const std::string &name) {
+  std::string out;
+  size_t start = 0;
+  while (start < name.size()) {
+    auto dot = name.find('.', start);
+    if (dot == std::string::npos) dot = name.size();
+    out.push_back(static_cast<char>(dot - start));
+    out.append(name, start, dot - start);
+    start = dot + 1;
+  }
+  out.push_back('\0');
+  return out;
+}
+
+std::string record(const std::string &owner, uint16_t type, uint32_t ttl,
+                   const std::string &rdata) {
+  std::string out = owner;
+  appendInt16(&out, type);
+  appendInt16(&out, 1);
+  appendInt32(&out, ttl);
+  appendInt16(&out, static_cast<uint16_t>(rdata.size()));
+  out += rdata;
+  return out;
+}
+
+std::string address(int family, const char *ip) {
+  char bytes[16];
+  inet_pton(family, ip, bytes);
+  return std::string(bytes, family == AF_INET ? 4 : 16);
+}
+
+std::string soa(uint32_t ttl, uint32_t minimum) {
+  std::string rdata = encodeName("ns.test") + encodeName("admin.test");
+  for (int i = 0; i < 4; ++i) appendInt32(&rdata, 1);
+  appendInt32(&rdata, minimum);
+  return record(encodeName("test"), 6, ttl, rdata);
+}
+
+// Answers A (1) and AAAA (28) queries of a few names under "test"
+class StubDns {
+ public:
+  void start() {
+    thread_.run();
+    fd_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    InetAddress addr("127.0.0.1", kPort);
+    ASSERT_EQ(0, ::bind(fd_, addr.getSockAddr(), sizeof(struct sockaddr_in)));
+    std::promise<void> started;
+    thread_.getLoop()->runInLoop([this, &started]() {
+      channel_.reset(new Channel(thread_.getLoop(), fd_));
+      channel_->setReadCallback([this]() { onRead(); });
+      channel_->enableReading();
+      started.set_value();
+    });
+    started.get_future().wait();
+  }
+
+  ~StubDns() {
+    std::promise<void> stopped;
+    thread_.getLoop()->runInLoop([this, &stopped]() {
+      channel_->disableAll();
+      channel_->remove();
+      stopped.set_value();
+    });
+    stopped.get_future().wait();
+    ::close(fd_);
+  }
+
+  int queries(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queries_[name];
+  }
+
+  // The source ports the queries came from
+  size_t ports() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ports_.size();
+  }
+
+ private:
+  void onRead() {
+    char buffer[512];
+    struct sockaddr_in peer;
+    socklen_t peerLength = sizeof(peer);
+    auto n = ::recvfrom(fd_, buffer, sizeof(buffer), 0,
+                        reinterpret_cast<struct sockaddr *>(&peer),
+                        &peerLength);
+    if (n < 17) return;
+    std::string query(buffer, n);
+    std::string name;
+    size_t position = 12;
+    while (query[position] != 0) {
+      size_t length = query[position];
+      if (!name.empty()) name.push_back('.');
+      name.append(query, position + 1, length);
+      position += 1 + length;
+    }
+    auto question = query.substr(12, position + 5 - 12);
+    uint16_t type = (static_cast<uint8_t>(query[position + 1]) << 8) |
+                    static_cast<uint8_t>(query[position + 2]);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++queries_[name];
+      ports_.insert(ntohs(peer.sin_port));
+    }
+
+    int rcode = 0;
+    std::vector<std::string> answers, authorities;
+    auto owner = encodeName(name);
+    if (name == "silent.test") return;
+    if (name == "a.test" || name == "alias.test") {
+      if (name == "alias.test") {
+        answers.push_back(record(owner, 5, 300, encodeName("a.test")));
+        owner = encodeName("a.test");
+      }
+      if (type == 1) {
+        answers.push_back(
+            record(owner, 1, 300, address(AF_INET, "10.0.0.1")));
+        answers.push_back(
+            record(owner, 1, 300, address(AF_INET, "10.0.0.2")));
+        // Not asked for
+        answers.push_back(
+            record(encodeName("b.test"), 1, 300, address(AF_INET, "1.1.1.1")));
+      } else if (name == "a.test") {
+        answers.push_back(
+            record(owner, 28, 300, address(AF_INET6, "2001:db8::1")));
+      } else {
+        authorities.push_back(soa(300, 300));
+      }
+    } else if (name == "short.test") {
+      if (type == 1) {
+        answers.push_back(record(owner, 1, 1, address(AF_INET, "10.0.0.3")));
+      } else {
+        authorities.push_back(soa(300, 1));
+      }
+    } else if (name == "missing.test") {
+      rcode = 3;
+      authorities.push_back(soa(60, 300));
+    } else if (name == "nosoa.test") {
+      rcode = 3;
+    } else {
+      rcode = 2;
+    }
+
+    std::string response = query.substr(0, 2);
+    appendInt16(&response, static_cast<uint16_t>(0x8180 | rcode));
+    appendInt16(&response, 1);
+    appendInt16(&response, static_cast<uint16_t>(answers.size()));
+    appendInt16(&response, static_cast<uint16_t>(authorities.size()));
+    appendInt16(&response, 0);
+    response += question;
+    for (auto &answer : answers) response += answer;
+    for (auto &authority : authorities) response += authority;
+    ::sendto(fd_, response.data(), response.size(), 0,
+             reinterpret_cast<struct sockaddr *>(&peer), peerLength);
+  }
+
+  EventLoopThread thread_;
+  int fd_{-1};
+  std::unique_ptr<Channel> channel_;
+  std::mutex mutex_;
+  std::map<std::string, int> queries_;
+  std::set<uint16_t> ports_;
+};
+
+std::vector<std::string> resolve(const ResolverPtr &resolver,
+                                 const std::string &name) {
+  std::promise<std::vector<std::string>> promise;
+  resolver->resolve(name, [&](const std::vector<InetAddress> &addresses) {
+    std::vector<std::string> ips;
+    for (auto &address : addresses) ips.push_back(address.toIp());
+    promise.set_value(ips);
+  });
+  return promise.get_future().get();
+}
+
+ResolverPtr newResolver(EventLoop *loop,
+                        const std::vector<uint16_t> &ports = {kPort}) {
+  std::vector<InetAddress> servers;
+  for (auto port : ports) servers.emplace_back("127.0.0.1", port);
+  return std::make_shared<Resolver>(loop, servers, "");
+}
+
+using Ips = std::vector<std::string>;
+}  // namespace
+
+TEST(Resolver, ConfigTest) {
+  auto config = Resolver::parseResolvConf(
+      "# comment\n"
+      "nameserver 10.0.0.53\n"
+      "nameserver fe80::1%eth0 ; scoped\n"
+      "search example.com\n"
+      "nameserver bad\n"
+      "options ndots:2 timeout:1 attempts:3\n");
+  ASSERT_EQ(2u, config.servers_.size());
+  EXPECT_EQ("10.0.0.53:53", config.servers_[0].toIpPort());
+  EXPECT_TRUE(config.servers_[1].isIpV6());
+  EXPECT_EQ(53, config.servers_[1].toPort());
+  EXPECT_EQ(1.0, config.timeout_);
+  EXPECT_EQ(3, config.attempts_);
+  config = Resolver::parseResolvConf("");
+  ASSERT_EQ(1u, config.servers_.size());
+  EXPECT_EQ("127.0.0.1:53", config.servers_[0].toIpPort());
+
+  auto hosts = Resolver::parseHosts(
+      "127.0.0.1 localhost\n"
+      "::1 localhost ip6-localhost # loopback\n"
+      "10.1.2.3\tMyHost myhost.local\n"
+      "garbage line\n");
+  ASSERT_EQ(2u, hosts["localhost"].size());
+  EXPECT_EQ("127.0.0.1", hosts["localhost"][0].toIp());
+  EXPECT_EQ("::1", hosts["localhost"][1].toIp());
+  EXPECT_EQ("10.1.2.3", hosts["myhost"][0].toIp());
+  EXPECT_EQ(1u, hosts["myhost.local"].size());
+  EXPECT_EQ(0u, hosts.count("garbage"));
+  EXPECT_EQ(0u, hosts.count("line"));
+}
+
+TEST(Resolver, LookupTest) {
+  Resolver::clearCache();
+  StubDns dns;
+  dns.start();
+  EventLoopThread thread;
+  thread.run();
+  auto resolver = newResolver(thread.getLoop());
+
+  EXPECT_EQ(Ips({"10.0.0.1", "10.0.0.2", "2001:db8::1"}),
+            resolve(resolver, "a.test"));
+  EXPECT_EQ(2, dns.queries("a.test"));
+  // From the cache, shared with the other resolvers of the server
+  EXPECT_EQ(Ips({"10.0.0.1", "10.0.0.2", "2001:db8::1"}),
+            resolve(resolver, "A.Test."));
+  EventLoopThread other;
+  other.run();
+  EXPECT_EQ(3u, resolve(newResolver(other.getLoop()), "a.test").size());
+  EXPECT_EQ(2, dns.queries("a.test"));
+
+  EXPECT_EQ(Ips({"10.0.0.1", "10.0.0.2"}), resolve(resolver, "alias.test"));
+  EXPECT_EQ(Ips({"192.168.1.1"}), resolve(resolver, "192.168.1.1"));
+  EXPECT_EQ(Ips({"::1"}), resolve(resolver, "[::1]"));
+  EXPECT_TRUE(resolve(resolver, "bad..name").empty());
+
+  // Concurrent lookups share the queries
+  Resolver::clearCache();
+  std::vector<std::future<size_t>> futures;
+  for (int i = 0; i < 10; ++i) {
+    auto promise = std::make_shared<std::promise<size_t>>();
+    futures.push_back(promise->get_future());
+    resolver->resolve("a.test",
+                      [promise](const std::vector<InetAddress> &addresses) {
+                        promise->set_value(addresses.size());
+                      });
+  }
+  for (auto &future : futures) EXPECT_EQ(3u, future.get());
+  EXPECT_EQ(4, dns.queries("a.test"));
+  // A socket of its own for each of the three lookups sent
+  EXPECT_EQ(3u, dns.ports());
+}
+
+TEST(Resolver, CacheTest) {
+  Resolver::clearCache();
+  StubDns dns;
+  dns.start();
+  EventLoopThread thread;
+  thread.run();
+  auto resolver = newResolver(thread.getLoop());
+
+  // The TTL of the answer, the shorter one of the negative AAAA answer
+  EXPECT_EQ(Ips({"10.0.0.3"}), resolve(resolver, "short.test"));
+  EXPECT_EQ(Ips({"10.0.0.3"}), resolve(resolver, "short.test"));
+  EXPECT_EQ(2, dns.queries("short.test"));
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  EXPECT_EQ(Ips({"10.0.0.3"}), resolve(resolver, "short.test"));
+  EXPECT_EQ(4, dns.queries("short.test"));
+
+  // Negative answers with a SOA record are cached too
+  EXPECT_TRUE(resolve(resolver, "missing.test").empty());
+  EXPECT_TRUE(resolve(resolver, "missing.test").empty());
+  EXPECT_EQ(2, dns.queries("missing.test"));
+  EXPECT_TRUE(resolve(resolver, "nosoa.test").empty());
+  EXPECT_TRUE(resolve(resolver, "nosoa.test").empty());
+  EXPECT_EQ(4, dns.queries("nosoa.test"));
+}
+
+TEST(Resolver, RetryTest) {
+  Resolver::clearCache();
+  StubDns dns;
+  dns.start();
+  EventLoopThread thread;
+  thread.run();
+  auto resolver = newResolver(thread.getLoop(), {kDeadPort, kPort});
+  resolver->setTimeout(0.1);
+  resolver->setAttempts(2);
+
+  // The first server never answers
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(3u, resolve(resolver, "a.test").size());
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(90));
+
+  // Two rounds over both servers
+  start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(resolve(resolver, "silent.test").empty());
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(390));
+  EXPECT_EQ(4, dns.queries("silent.test"));
+  // Not cached
+  EXPECT_TRUE(resolve(resolver, "silent.test").empty());
+  EXPECT_EQ(8, dns.queries("silent.test"));
+
+  // A server failure goes to the next server at once
+  EXPECT_TRUE(resolve(newResolver(thread.getLoop()), "fail.test").empty());
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(4, dns.queries("fail.test"));
+}
+
+TEST(Resolver, HostsTest) {
+  const char path[] = "/tmp/canary_resolver_hosts";
+  {
+    std::ofstream file(path);
+    file << "10.1.2.3 MyHost\n::1 myhost\n";
+  }
+  EventLoopThread thread;
+  thread.run();
+  auto resolver = std::make_shared<Resolver>(
+      thread.getLoop(), std::vector<InetAddress>(), path);
+  std::remove(path);
+  EXPECT_EQ(Ips({"10.1.2.3", "::1"}), resolve(resolver, "myhost"));
+  EXPECT_EQ(Ips({"10.1.2.3", "::1"}), resolve(resolver, "MYHOST."));
+  // No server to ask
+  EXPECT_TRUE(resolve(resolver, "other").empty());
+}
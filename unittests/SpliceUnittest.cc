@@ -0,0 +1,299 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "EventLoopThread.h"
+#include "TcpClient.h"
+#include "TcpServer.h"
+
+using namespace canary;
+
+namespace {
+const uint16_t kBackendPort = 38310;
+const uint16_t kProxyPort = 38311;
+const uint16_t kPipePort = 38312;
+const uint16_t kStuckPort = 38314;
+const uint16_t kStuckProxyPort = 38315;
+const uint16_t kDevicePort = 38318;
+
+std::string makeData(size_t size) {
+  std::string data(size, '\0');
+  uint32_t state = 1;
+  for (auto &c : data) {
+    state = state * 1103515245 + 12345;
+    c = static_cast<char>(state >> 16);
+  }
+  return data;
+}
+
+// A blocking client socket, with a timeout so that a failure does not hang
+int connectTo(uint16_t port) {
+  InetAddress addr("127.0.0.1", port);
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  timeval timeout{10, 0};
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  EXPECT_EQ(0, ::connect(fd, addr.getSockAddr(), sizeof(sockaddr_in)));
+  return fd;
+}
+
+std::string readAll(int fd, size_t limit) {
+  std::string received;
+  char buf[65536];
+  while (received.size() < limit) {
+    auto n = ::read(fd, buf, sizeof(buf));
+    if (n <= 0) break;
+    received.append(buf, n);
+  }
+  return received;
+}
+
+void startServer(EventLoopThread &thread, TcpServer &server) {
+  server.start();
+  std::promise<void> listening;
+  thread.getLoop()->queueInLoop([&]() { listening.set_value(); });
+  listening.get_future().wait();
+}
+}  // namespace
+
+TEST(Splice, ForwardTest) {
+  EventLoopThread backendThread;
+  backendThread.run();
+  TcpServer backend(backendThread.getLoop(),
+                    InetAddress("127.0.0.1", kBackendPort), "backend");
+  backend.setRecvMessageCallback(
+      [](const TcpConnectionPtr &conn, MsgBuffer *buffer) {
+        conn->send(buffer->peek(), buffer->readableBytes());
+        buffer->retrieveAll();
+      });
+  startServer(backendThread, backend);
+
+  // Each accepted connection is proxied to the backend, both ways
+  EventLoopThread proxyThread;
+  proxyThread.run();
+  TcpServer proxy(proxyThread.getLoop(), InetAddress("127.0.0.1", kProxyPort),
+                  "proxy");
+  // What arrives before the upstream connects stays for forward()
+  proxy.setRecvMessageCallback([](const TcpConnectionPtr &, MsgBuffer *) {});
+  std::promise<std::pair<size_t, size_t>> proxied;
+  proxy.setConnectionCallback([&proxied](const TcpConnectionPtr &conn) {
+    if (conn->connected()) {
+      auto client = std::make_shared<TcpClient>(
+          conn->getLoop(), InetAddress("127.0.0.1", kBackendPort), "upstream");
+      std::weak_ptr<TcpConnection> weakConn = conn;
+      client->setConnectionCallback(
+          [weakConn](const TcpConnectionPtr &upstream) {
+            auto conn = weakConn.lock();
+            if (!conn) return;
+            if (upstream->connected()) {
+              conn->forward(upstream);
+              upstream->forward(conn);
+            } else {
+              conn->shutdown();
+            }
+          });
+      client->connect();
+      conn->setContext(client);
+    } else {
+      auto client = conn->getContext<TcpClient>();
+      auto upstream = client->connection();
+      proxied.set_value({conn->bytesReceived(), conn->bytesSent()});
+      if (upstream) upstream->shutdown();
+      conn->getLoop()->queueInLoop([client]() {});
+      conn->clearContext();
+    }
+  });
+  startServer(proxyThread, proxy);
+
+  const auto data = makeData(4 << 20);
+  int fd = connectTo(kProxyPort);
+  // Sent before the upstream connects too
+  ASSERT_EQ(5, ::write(fd, data.data(), 5));
+  std::thread writer([fd, &data]() {
+    size_t sent = 5;
+    while (sent < data.size()) {
+      auto n = ::write(fd, data.data() + sent, data.size() - sent);
+      if (n <= 0) break;
+      sent += n;
+    }
+  });
+  auto received = readAll(fd, data.size());
+  writer.join();
+  ::close(fd);
+  EXPECT_EQ(data.size(), received.size());
+  EXPECT_TRUE(data == received);
+
+  auto future = proxied.get_future();
+  ASSERT_EQ(std::future_status::ready,
+            future.wait_for(std::chrono::seconds(5)));
+  auto bytes = future.get();
+  EXPECT_EQ(data.size(), bytes.first);
+  EXPECT_EQ(data.size(), bytes.second);
+  proxy.stop();
+  backend.stop();
+}
+
+TEST(Splice, PipeTest) {
+  std::string path = "/tmp/canary_splice_" + std::to_string(getpid());
+  ::unlink(path.c_str());
+  ASSERT_EQ(0, ::mkfifo(path.c_str(), 0600));
+  const auto data = makeData(1 << 20);
+
+  EventLoopThread thread;
+  thread.run();
+  TcpServer server(thread.getLoop(), InetAddress("127.0.0.1", kPipePort),
+                   "pipe");
+  server.setConnectionCallback([&path](const TcpConnectionPtr &conn) {
+    if (conn->connected()) {
+      // Sent until the writer closes
+      conn->sendFile(path.c_str());
+      conn->send("end");
+      conn->shutdown();
+    }
+  });
+  startServer(thread, server);
+
+  // Written in pieces, so that the pipe runs dry in between
+  std::thread writer([&path, &data]() {
+    int pipeFd = ::open(path.c_str(), O_WRONLY);
+    ASSERT_GE(pipeFd, 0);
+    for (size_t sent = 0; sent < data.size(); sent += 100000) {
+      auto length = std::min<size_t>(100000, data.size() - sent);
+      ASSERT_EQ(static_cast<ssize_t>(length),
+                ::write(pipeFd, data.data() + sent, length));
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    ::close(pipeFd);
+  });
+  int fd = connectTo(kPipePort);
+  auto received = readAll(fd, data.size() + 4);
+  writer.join();
+  ::close(fd);
+  ::unlink(path.c_str());
+  EXPECT_EQ(data.size() + 3, received.size());
+  EXPECT_TRUE(data + "end" == received);
+  server.stop();
+}
+
+TEST(Splice, DeviceTest) {
+  // A terminal, which sendfile() does not read
+  int master = ::posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  ASSERT_GE(master, 0);
+  ASSERT_EQ(0, ::grantpt(master));
+  ASSERT_EQ(0, ::unlockpt(master));
+  std::string path = ::ptsname(master);
+  int slave = ::open(path.c_str(), O_RDWR | O_NOCTTY);
+  ASSERT_GE(slave, 0);
+  termios raw;
+  ::tcgetattr(slave, &raw);
+  ::cfmakeraw(&raw);
+  ::tcsetattr(slave, TCSANOW, &raw);
+  std::string data(256 * 1024, '\0');
+  for (size_t i = 0; i < data.size(); ++i) data[i] = 'a' + i % 26;
+
+  EventLoopThread thread;
+  thread.run();
+  TcpServer server(thread.getLoop(), InetAddress("127.0.0.1", kDevicePort),
+                   "device");
+  server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+    if (conn->connected()) {
+      conn->sendFile(path.c_str(), 0, data.size());
+      conn->send("end");
+      conn->shutdown();
+    }
+  });
+  startServer(thread, server);
+
+  int fd = connectTo(kDevicePort);
+  // Written in pieces, so that the terminal runs dry in between, and
+  // given up on when nobody reads
+  std::thread writer([master, &data]() {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    size_t sent = 0;
+    while (sent < data.size() && std::chrono::steady_clock::now() < deadline) {
+      auto n = ::write(master, data.data() + sent,
+                       std::min<size_t>(4096, data.size() - sent));
+      if (n > 0) sent += n;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  auto received = readAll(fd, data.size() + 4);
+  writer.join();
+  ::close(fd);
+  ::close(slave);
+  ::close(master);
+  EXPECT_EQ(data.size() + 3, received.size());
+  EXPECT_TRUE(data + "end" == received);
+  server.stop();
+}
+
+TEST(Splice, SinkCloseTest) {
+  // A backend that never reads, so that the pipe of the proxy fills up
+  int listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  ::setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  InetAddress backendAddr("127.0.0.1", kStuckPort);
+  ASSERT_EQ(0, ::bind(listenFd, backendAddr.getSockAddr(),
+                      sizeof(sockaddr_in)));
+  ASSERT_EQ(0, ::listen(listenFd, 4));
+
+  EventLoopThread proxyThread;
+  proxyThread.run();
+  TcpServer proxy(proxyThread.getLoop(),
+                  InetAddress("127.0.0.1", kStuckProxyPort), "proxy");
+  proxy.setRecvMessageCallback([](const TcpConnectionPtr &, MsgBuffer *) {});
+  std::promise<void> clientClosed;
+  proxy.setConnectionCallback([&clientClosed](const TcpConnectionPtr &conn) {
+    if (conn->connected()) {
+      auto client = std::make_shared<TcpClient>(
+          conn->getLoop(), InetAddress("127.0.0.1", kStuckPort), "upstream");
+      std::weak_ptr<TcpConnection> weakConn = conn;
+      client->setConnectionCallback(
+          [weakConn](const TcpConnectionPtr &upstream) {
+            auto conn = weakConn.lock();
+            if (!conn) return;
+            if (upstream->connected()) {
+              conn->forward(upstream);
+            } else {
+              conn->shutdown();
+            }
+          });
+      client->connect();
+      conn->setContext(client);
+    } else {
+      auto client = conn->getContext<TcpClient>();
+      conn->getLoop()->queueInLoop([client]() {});
+      conn->clearContext();
+      clientClosed.set_value();
+    }
+  });
+  startServer(proxyThread, proxy);
+
+  int fd = connectTo(kStuckProxyPort);
+  int backendFd = ::accept(listenFd, nullptr, nullptr);
+  ASSERT_GE(backendFd, 0);
+  // Written until every buffer on the way is full
+  timeval timeout{0, 200000};
+  ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  const auto data = makeData(1 << 20);
+  while (::write(fd, data.data(), data.size()) > 0) {
+  }
+
+  // The backend goes away: the proxy still sees the client close
+  ::close(backendFd);
+  ::close(listenFd);
+  EXPECT_EQ(0, ::shutdown(fd, SHUT_WR));
+  auto future = clientClosed.get_future();
+  EXPECT_EQ(std::future_status::ready,
+            future.wait_for(std::chrono::seconds(5)));
+  ::close(fd);
+  proxy.stop();
+}
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+#include <string>
+
+#include "CpuFeatures.h"
+#include "Utility.h"
+
+using namespace canary;
+
+namespace {
+
+const SimdLevel kLevels[] = {SimdLevel::Scalar, SimdLevel::Ssse3,
+                             SimdLevel::Avx2};
+
+// The char by char encoding the kernels must match
+std::string referenceEncode(const std::string &src, const char *marks) {
+  static const char hex[] = "0123456789ABCDEF";
+  std::string result;
+  for (char c : src) {
+    auto u = static_cast<unsigned char>(c);
+    if (c == ' ') {
+      result += '+';
+    } else if (isalnum(u) || (c && strchr(marks, c))) {
+      result += c;
+    } else {
+      result += '%';
+      result += hex[u >> 4];
+      result += hex[u & 0x0f];
+    }
+  }
+  return result;
+}
+
+const char kComponentMarks[] = "-_.!~*()";
+const char kUrlMarks[] = "-_.!~*'()&=/\\?";
+
+}  // namespace
+
+TEST(UrlCoding, EncodeEveryCharTest) {
+  // Every char at every offset of the blocks, between kept chars
+  for (auto level : kLevels) {
+    limitSimd(level);
+    for (int c = 0; c < 256; ++c) {
+      for (size_t pos = 0; pos < 70; pos += 3) {
+        std::string src(70, 'a');
+        src[pos] = static_cast<char>(c);
+        ASSERT_EQ(referenceEncode(src, kComponentMarks),
+                  utils::urlEncodeComponent(src))
+            << c << " " << pos;
+        ASSERT_EQ(referenceEncode(src, kUrlMarks), utils::urlEncode(src))
+            << c << " " << pos;
+      }
+    }
+  }
+  limitSimd(SimdLevel::Avx2);
+}
+
+TEST(UrlCoding, RoundTripTest) {
+  std::mt19937 random(42);
+  for (auto level : kLevels) {
+    limitSimd(level);
+    for (size_t length = 0; length < 200; ++length) {
+      std::string src(length, '\0');
+      for (auto &c : src) {
+        // Mostly kept chars, as in real queries
+        c = random() % 8 ? 'a' + random() % 26 : static_cast<char>(random());
+      }
+      auto encoded = utils::urlEncodeComponent(src);
+      ASSERT_EQ(referenceEncode(src, kComponentMarks), encoded);
+      ASSERT_EQ(src, utils::urlDecode(encoded));
+      ASSERT_EQ(utils::needUrlDecoding(encoded.data(),
+                                       encoded.data() + encoded.size()),
+                encoded.find_first_of("+%") != std::string::npos);
+    }
+  }
+  limitSimd(SimdLevel::Avx2);
+}
+
+TEST(UrlCoding, DecodeTest) {
+  for (auto level : kLevels) {
+    limitSimd(level);
+    EXPECT_EQ("a b/c", utils::urlDecode(std::string("a+b%2fc")));
+    EXPECT_EQ("a b/c", utils::urlDecode(std::string("a+b%2Fc")));
+    // Not escapes
+    EXPECT_EQ("%", utils::urlDecode(std::string("%")));
+    EXPECT_EQ("%4", utils::urlDecode(std::string("%4")));
+    EXPECT_EQ("%4g", utils::urlDecode(std::string("%4g")));
+    EXPECT_EQ("%A", utils::urlDecode(std::string("%%41")));
+    std::string longer(100, 'x');
+    longer[63] = '+';
+    longer.replace(90, 3, "%7e");
+    auto expected = longer;
+    expected[63] = ' ';
+    expected.replace(90, 3, "~");
+    EXPECT_EQ(expected, utils::urlDecode(longer));
+  }
+  limitSimd(SimdLevel::Avx2);
+}
+
+TEST(UrlCoding, NoCopyTest) {
+  std::string storage;
+  std::string plain(100, 'k');
+  auto decoded = utils::urlDecode(plain, storage);
+  EXPECT_EQ(plain.data(), decoded.data());
+  auto encoded = utils::urlEncodeComponent(plain, storage);
+  EXPECT_EQ(plain.data(), encoded.data());
+  EXPECT_TRUE(storage.empty());
+
+  std::string query("key=a+b");
+  decoded = utils::urlDecode(query, storage);
+  EXPECT_EQ(storage.data(), decoded.data());
+  EXPECT_EQ("key=a b", decoded);
+  encoded = utils::urlEncode("a b", storage);
+  EXPECT_EQ("a+b", encoded);
+}
@@ -0,0 +1,326 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "CpuFeatures.h"
+#include "EventLoopThread.h"
+#include "Sha1.h"
+#include "Utility.h"
+#include "WebSocketClient.h"
+#include "WebSocketServer.h"
+
+using namespace canary;
+
+static std::string sha1Hex(const std::string &data) {
+  auto digest = Sha1::digest(data.data(), data.length());
+  return utils::binaryStringToHex(
+      reinterpret_cast<const unsigned char *>(digest.data()), digest.length());
+}
+
+TEST(WebSocket, HandshakeKeyTest) {
+  EXPECT_EQ("DA39A3EE5E6B4B0D3255BFEF95601890AFD80709", sha1Hex(""));
+  EXPECT_EQ("A9993E364706816ABA3E25717850C26C9CD0D89D", sha1Hex("abc"));
+  EXPECT_EQ("34AA973CD4C4DAA4F61EEB2BDBAD27316534016F",
+            sha1Hex(std::string(1000000, 'a')));
+  // RFC 6455 1.3
+  EXPECT_EQ("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=",
+            webSocketAcceptKey("dGhlIHNhbXBsZSBub25jZQ=="));
+}
+
+TEST(WebSocket, MaskTest) {
+  const unsigned char key[4] = {0x37, 0xfa, 0x21, 0x3d};
+  // With the instructions of the CPU, then without
+  for (auto level : {SimdLevel::Avx2, SimdLevel::Ssse3, SimdLevel::Scalar}) {
+    limitSimd(level);
+    for (size_t len : {0, 1, 3, 7, 8, 15, 16, 17, 31, 32, 33, 48, 100, 1000}) {
+      for (size_t offset = 0; offset < 4; ++offset) {
+        auto data = utils::genRandomString(static_cast<int>(len));
+        auto expected = data;
+        for (size_t i = 0; i < len; ++i) {
+          expected[i] ^= key[(offset + i) & 3];
+        }
+        maskWebSocketPayload(&data[0], len, key, offset);
+        EXPECT_EQ(expected, data) << len << " " << offset;
+      }
+    }
+  }
+  limitSimd(SimdLevel::Avx2);
+}
+
+TEST(WebSocket, CodecTest) {
+  WebSocketCodec client(WebSocketCodec::Role::kClient);
+  WebSocketCodec server(WebSocketCodec::Role::kServer, 100000);
+  MsgBuffer wire;
+  client.encode(WebSocketMessageType::Text, "hello", 5, &wire);
+  std::string big = utils::genRandomString(70000);
+  client.encode(WebSocketMessageType::Binary, big.data(), big.length(), &wire);
+  client.encode(WebSocketMessageType::Ping, "p", 1, &wire);
+
+  std::vector<std::pair<WebSocketMessageType, std::string>> messages;
+  auto collect = [&](WebSocketMessageType type, string_view message) {
+    messages.emplace_back(type, std::string(message));
+  };
+  // Frames may arrive in pieces
+  MsgBuffer input;
+  while (wire.readableBytes() > 0) {
+    auto n = std::min<size_t>(1000, wire.readableBytes());
+    input.append(wire.peek(), n);
+    wire.retrieve(n);
+    ASSERT_TRUE(server.decode(&input, collect));
+  }
+  ASSERT_EQ(3u, messages.size());
+  EXPECT_EQ(WebSocketMessageType::Text, messages[0].first);
+  EXPECT_EQ("hello", messages[0].second);
+  EXPECT_EQ(big, messages[1].second);
+  EXPECT_EQ(WebSocketMessageType::Ping, messages[2].first);
+
+  // A fragmented message: "Hel" + "lo", with a ping in between
+  messages.clear();
+  const unsigned char fragments[] = {0x01, 0x03, 'H',  'e', 'l', 0x89, 0x00,
+                                     0x80, 0x02, 'l',  'o'};
+  MsgBuffer clientInput;
+  clientInput.append(reinterpret_cast<const char *>(fragments),
+                     sizeof(fragments));
+  ASSERT_TRUE(client.decode(&clientInput, collect));
+  ASSERT_EQ(2u, messages.size());
+  EXPECT_EQ(WebSocketMessageType::Ping, messages[0].first);
+  EXPECT_EQ("Hello", messages[1].second);
+
+  // A server must refuse unmasked frames
+  MsgBuffer unmasked;
+  WebSocketCodec::encodeFrame(WebSocketMessageType::Text, "x", 1, false, false,
+                              &unmasked);
+  EXPECT_FALSE(server.decode(&unmasked, collect));
+  EXPECT_EQ(1002, server.closeCode());
+
+  WebSocketCodec limited(WebSocketCodec::Role::kServer, 10);
+  MsgBuffer tooBig;
+  client.encode(WebSocketMessageType::Text, big.data(), 11, &tooBig);
+  EXPECT_FALSE(limited.decode(&tooBig, collect));
+  EXPECT_EQ(1009, limited.closeCode());
+}
+
+TEST(WebSocket, Utf8Test) {
+  WebSocketCodec client(WebSocketCodec::Role::kClient);
+  std::vector<std::string> received;
+  auto collect = [&](WebSocketMessageType, string_view message) {
+    received.emplace_back(message);
+  };
+  auto decodes = [&](const std::string &text, WebSocketMessageType type) {
+    WebSocketCodec server(WebSocketCodec::Role::kServer);
+    MsgBuffer wire;
+    client.encode(type, text.data(), text.length(), &wire);
+    bool ok = server.decode(&wire, collect);
+    if (!ok) {
+      EXPECT_EQ(1007, server.closeCode());
+    }
+    return ok;
+  };
+  auto text = WebSocketMessageType::Text;
+  EXPECT_TRUE(decodes("", text));
+  EXPECT_TRUE(decodes("plain ascii, long enough for the word loop", text));
+  EXPECT_TRUE(decodes("\xc2\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 "
+                      "\xf4\x8f\xbf\xbf",
+                      text));
+  // Overlong, a surrogate, past U+10FFFF, cut short, a stray continuation
+  EXPECT_FALSE(decodes("\xc0\x80", text));
+  EXPECT_FALSE(decodes("\xe0\x80\xaf", text));
+  EXPECT_FALSE(decodes("ok\xed\xa0\x80", text));
+  EXPECT_FALSE(decodes("\xf4\x90\x80\x80", text));
+  EXPECT_FALSE(decodes("abcdefgh\xe2\x82", text));
+  EXPECT_FALSE(decodes("\x80", text));
+  // Binary messages are not text
+  EXPECT_TRUE(decodes("\xc0\x80", WebSocketMessageType::Binary));
+
+  // A character split between fragments is fine, the message is checked
+  // once it is complete
+  received.clear();
+  WebSocketCodec receiver(WebSocketCodec::Role::kClient);
+  const unsigned char split[] = {0x01, 0x02, 'a', 0xe2,
+                                 0x80, 0x02, 0x82, 0xac};
+  MsgBuffer input;
+  input.append(reinterpret_cast<const char *>(split), sizeof(split));
+  ASSERT_TRUE(receiver.decode(&input, collect));
+  ASSERT_EQ(1u, received.size());
+  EXPECT_EQ("a\xe2\x82\xac", received[0]);
+  const unsigned char cut[] = {0x01, 0x02, 'a', 0xe2, 0x80, 0x01, 0x82};
+  input.append(reinterpret_cast<const char *>(cut), sizeof(cut));
+  EXPECT_FALSE(receiver.decode(&input, collect));
+  EXPECT_EQ(1007, receiver.closeCode());
+
+  // Checked after inflating
+  WebSocketCodec deflater(WebSocketCodec::Role::kClient);
+  WebSocketCodec inflater(WebSocketCodec::Role::kServer);
+  deflater.enableDeflate(PerMessageDeflateParams());
+  inflater.enableDeflate(PerMessageDeflateParams());
+  std::string invalid(1000, 'x');
+  invalid += "\xff";
+  MsgBuffer wire;
+  deflater.encode(text, invalid.data(), invalid.length(), &wire);
+  EXPECT_FALSE(inflater.decode(&wire, collect));
+  EXPECT_EQ(1007, inflater.closeCode());
+}
+
+TEST(WebSocket, PerMessageDeflateTest) {
+  PerMessageDeflateParams params;
+  EXPECT_FALSE(PerMessageDeflateParams::parse("x-webkit-deflate", &params));
+  EXPECT_FALSE(PerMessageDeflateParams::parse(
+      "permessage-deflate; server_max_window_bits=20", &params));
+  ASSERT_TRUE(PerMessageDeflateParams::parse(
+      "permessage-deflate; server_max_window_bits=20, permessage-deflate; "
+      "client_no_context_takeover; client_max_window_bits",
+      &params));
+  EXPECT_TRUE(params.clientNoContextTakeover_);
+  EXPECT_EQ(15, params.serverMaxWindowBits_);
+  EXPECT_EQ("permessage-deflate; client_no_context_takeover",
+            params.toString());
+
+  WebSocketCodec server(WebSocketCodec::Role::kServer);
+  WebSocketCodec client(WebSocketCodec::Role::kClient);
+  server.enableDeflate(PerMessageDeflateParams());
+  client.enableDeflate(PerMessageDeflateParams());
+  std::string json;
+  for (int i = 0; i < 4; ++i) {
+    json += "{\"symbol\":\"CNRY\",\"price\":1234.5,\"volume\":100},";
+  }
+  std::vector<std::string> received;
+  auto collect = [&](WebSocketMessageType, string_view message) {
+    received.emplace_back(message);
+  };
+  size_t firstSize = 0;
+  for (int i = 0; i < 3; ++i) {
+    MsgBuffer wire;
+    server.encode(WebSocketMessageType::Text, json.data(), json.length(),
+                  &wire);
+    // Context takeover makes the repeated message tiny
+    if (i == 0) firstSize = wire.readableBytes();
+    if (i == 2) {
+      EXPECT_LT(wire.readableBytes(), firstSize / 2);
+    }
+    ASSERT_TRUE(client.decode(&wire, collect));
+  }
+  // A shared frame compressed without context decodes in the middle of a
+  // context takeover stream, as long as the sender resets its context.
+  auto frame = WebSocketSharedFrame::make(json.data(), json.length(),
+                                          WebSocketMessageType::Text, true);
+  ASSERT_TRUE(frame.deflated_);
+  EXPECT_TRUE(server.acceptsSharedDeflate());
+  ASSERT_TRUE(client.decode(frame.deflated_.get(), collect));
+  server.resetDeflateContext();
+  MsgBuffer wire;
+  server.encode(WebSocketMessageType::Text, json.data(), json.length(), &wire);
+  ASSERT_TRUE(client.decode(&wire, collect));
+  ASSERT_EQ(5u, received.size());
+  for (auto &message : received) EXPECT_EQ(json, message);
+}
+
+TEST(WebSocket, ServerClientTest) {
+  EventLoopThread serverThread;
+  serverThread.run();
+  auto serverLoop = serverThread.getLoop();
+  const uint16_t port = 38292;
+  WebSocketServer server(serverLoop, InetAddress("127.0.0.1", port));
+  server.setIoLoopNum(2);
+  server.enablePerMessageDeflate();
+  server.setHandshakeCallback(
+      [](const std::string &path, const WebSocketHeaders &headers) {
+        return path == "/feed" && headers.count("host") > 0;
+      });
+  server.setMessageCallback([](const WebSocketConnectionPtr &conn,
+                               string_view message, WebSocketMessageType type) {
+    if (type == WebSocketMessageType::Text) {
+      conn->send("echo:" + std::string(message));
+    }
+  });
+  server.start();
+  std::promise<void> listening;
+  serverLoop->queueInLoop([&]() { listening.set_value(); });
+  listening.get_future().wait();
+
+  EventLoopThread clientThread;
+  clientThread.run();
+  const int kClients = 3;
+  std::vector<std::unique_ptr<WebSocketClient>> clients;
+  std::atomic<int> connected{0}, echoed{0}, broadcasted{0}, closed{0};
+  std::promise<void> allConnected, allEchoed, allBroadcasted, allClosed;
+  std::string feed(2000, 'f');
+  for (int i = 0; i < kClients; ++i) {
+    clients.emplace_back(new WebSocketClient(clientThread.getLoop(),
+                                             InetAddress("127.0.0.1", port),
+                                             "localhost", "/feed"));
+    auto &client = clients.back();
+    client->enablePerMessageDeflate(i != 0);
+    client->setConnectionCallback([&](const WebSocketConnectionPtr &conn) {
+      if (conn->connected()) {
+        if (++connected == kClients) allConnected.set_value();
+      } else if (++closed == kClients) {
+        allClosed.set_value();
+      }
+    });
+    client->setMessageCallback([&](const WebSocketConnectionPtr &,
+                                   string_view message,
+                                   WebSocketMessageType) {
+      if (message == "echo:hi") {
+        if (++echoed == kClients) allEchoed.set_value();
+      } else if (message == feed) {
+        if (++broadcasted == kClients) allBroadcasted.set_value();
+      }
+    });
+    client->connect();
+  }
+  ASSERT_EQ(std::future_status::ready,
+            allConnected.get_future().wait_for(std::chrono::seconds(5)));
+  EXPECT_EQ(static_cast<size_t>(kClients), server.connectionCount());
+  EXPECT_FALSE(clients[0]->connection()->deflateEnabled());
+  EXPECT_TRUE(clients[1]->connection()->deflateEnabled());
+
+  for (auto &client : clients) client->connection()->send("hi");
+  ASSERT_EQ(std::future_status::ready,
+            allEchoed.get_future().wait_for(std::chrono::seconds(5)));
+
+  server.broadcast(feed);
+  ASSERT_EQ(std::future_status::ready,
+            allBroadcasted.get_future().wait_for(std::chrono::seconds(5)));
+
+  for (auto &client : clients) client->disconnect();
+  ASSERT_EQ(std::future_status::ready,
+            allClosed.get_future().wait_for(std::chrono::seconds(5)));
+  server.stop();
+}
+
+TEST(WebSocket, HandshakeRejectTest) {
+  EventLoopThread serverThread;
+  serverThread.run();
+  auto serverLoop = serverThread.getLoop();
+  const uint16_t port = 38293;
+  WebSocketServer server(serverLoop, InetAddress("127.0.0.1", port));
+  server.setHandshakeCallback(
+      [](const std::string &path, const WebSocketHeaders &) {
+        return path == "/feed";
+      });
+  server.start();
+  std::promise<void> listening;
+  serverLoop->queueInLoop([&]() { listening.set_value(); });
+  listening.get_future().wait();
+
+  EventLoopThread clientThread;
+  clientThread.run();
+  WebSocketClient client(clientThread.getLoop(),
+                         InetAddress("127.0.0.1", port), "localhost",
+                         "/private");
+  std::promise<void> failed;
+  client.setConnectionErrorCallback([&]() { failed.set_value(); });
+  client.connect();
+  EXPECT_EQ(std::future_status::ready,
+            failed.get_future().wait_for(std::chrono::seconds(5)));
+  EXPECT_EQ(0u, server.connectionCount());
+  server.stop();
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
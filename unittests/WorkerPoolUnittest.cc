@@ -0,0 +1,190 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EventLoopThread.h"
+#include "LockFreeQueue.h"
+#include "WorkerPool.h"
+
+using namespace canary;
+
+namespace {
+// Keeps the only worker of a pool busy until released
+class Blocker {
+ public:
+  explicit Blocker(WorkerPool &pool) {
+    std::promise<void> started;
+    auto future = released_.get_future().share();
+    pool.submit([&started, future]() {
+      started.set_value();
+      future.wait();
+    });
+    started.get_future().wait();
+  }
+
+  void release() { released_.set_value(); }
+
+ private:
+  std::promise<void> released_;
+};
+}  // namespace
+
+TEST(WorkerPool, DequeTest) {
+  WorkStealingDeque<int *> deque(2);
+  const int kItems = 200000;
+  std::vector<int> items(kItems);
+  std::vector<std::atomic<int>> taken(kItems);
+  std::atomic<bool> done{false};
+  std::atomic<int> count{0};
+  auto take = [&](int *item) {
+    ++taken[item - items.data()];
+    ++count;
+  };
+  std::vector<std::thread> thieves;
+  for (int i = 0; i < 3; ++i) {
+    thieves.emplace_back([&]() {
+      while (!done || !deque.empty()) {
+        if (auto item = deque.steal()) take(item);
+      }
+    });
+  }
+  // The owner pops some of what it pushes, the thieves take the rest
+  for (int i = 0; i < kItems; ++i) {
+    deque.push(&items[i]);
+    if (i % 3 == 0) {
+      if (auto item = deque.pop()) take(item);
+    }
+  }
+  while (auto item = deque.pop()) take(item);
+  done = true;
+  for (auto &thief : thieves) thief.join();
+  EXPECT_EQ(kItems, count);
+  for (auto &times : taken) ASSERT_EQ(1, times);
+}
+
+TEST(WorkerPool, SubmitTest) {
+  WorkerPool pool(4);
+  EXPECT_EQ(4u, pool.size());
+  std::atomic<int> count{0};
+  std::promise<void> done;
+  for (int i = 0; i < 10000; ++i) {
+    pool.submit([&]() {
+      if (++count == 10000) done.set_value();
+    });
+  }
+  done.get_future().wait();
+
+  // The result is delivered in the loop that asked for it
+  EventLoopThread thread;
+  thread.run();
+  auto loop = thread.getLoop();
+  std::promise<std::string> result;
+  loop->runInLoop([&]() {
+    pool.submit(
+        loop,
+        []() {
+          EXPECT_TRUE(WorkerPool::cancelled() == false);
+          return std::string(1000, 'x');
+        },
+        [&, loop](std::string &&data) {
+          EXPECT_TRUE(loop->isInLoopThread());
+          result.set_value(std::move(data));
+        });
+  });
+  EXPECT_EQ(std::string(1000, 'x'), result.get_future().get());
+}
+
+TEST(WorkerPool, StealTest) {
+  WorkerPool pool(4);
+  std::mutex mutex;
+  std::set<std::thread::id> threads;
+  std::atomic<int> count{0};
+  std::promise<void> done;
+  // The jobs of a job go to the deque of its worker, the others steal them
+  pool.submit([&]() {
+    for (int i = 0; i < 64; ++i) {
+      pool.submit([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          threads.insert(std::this_thread::get_id());
+        }
+        if (++count == 64) done.set_value();
+      });
+    }
+  });
+  done.get_future().wait();
+  EXPECT_GT(threads.size(), 1u);
+}
+
+TEST(WorkerPool, PriorityTest) {
+  WorkerPool pool(1);
+  Blocker blocker(pool);
+  std::mutex mutex;
+  std::string order;
+  std::promise<void> done;
+  auto job = [&](char name) {
+    return [&, name]() {
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(name);
+      if (order.size() == 4) done.set_value();
+    };
+  };
+  pool.submit(job('l'), WorkerPool::Priority::Low);
+  pool.submit(job('n'), WorkerPool::Priority::Normal);
+  pool.submit(job('h'), WorkerPool::Priority::High);
+  pool.submit(job('N'));
+  blocker.release();
+  done.get_future().wait();
+  EXPECT_EQ("hnNl", order);
+}
+
+TEST(WorkerPool, CancelTest) {
+  WorkerPool pool(1);
+  EventLoopThread thread;
+  thread.run();
+  auto loop = thread.getLoop();
+  std::atomic<bool> ran{false};
+  std::atomic<bool> delivered{false};
+
+  // Not started yet
+  Blocker blocker(pool);
+  auto handle = pool.submit([&]() { ran = true; });
+  EXPECT_TRUE(handle.cancel());
+  EXPECT_FALSE(handle.cancel());
+  blocker.release();
+
+  // Running: it is told, and its result is dropped
+  std::promise<void> started;
+  std::promise<void> stopped;
+  handle = pool.submit(
+      loop,
+      [&]() {
+        started.set_value();
+        while (!WorkerPool::cancelled()) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        stopped.set_value();
+        return 1;
+      },
+      [&](int) { delivered = true; });
+  started.get_future().wait();
+  EXPECT_FALSE(handle.cancel());
+  stopped.get_future().wait();
+
+  // Finished
+  std::promise<void> finished;
+  handle = pool.submit([&]() { finished.set_value(); });
+  finished.get_future().wait();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_FALSE(handle.cancel());
+  EXPECT_FALSE(ran);
+  EXPECT_FALSE(delivered);
+}
@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <future>
+#include <memory>
+#include <string>
+
+#include "EventLoopThread.h"
+#include "TcpServer.h"
+
+using namespace canary;
+
+namespace {
+const uint16_t kPort = 38313;
+const uint16_t kClosePort = 38316;
+
+void startServer(EventLoopThread &thread, TcpServer &server) {
+  server.start();
+  std::promise<void> listening;
+  thread.getLoop()->queueInLoop([&]() { listening.set_value(); });
+  listening.get_future().wait();
+}
+
+std::string makeData(size_t size, char seed) {
+  std::string data(size, '\0');
+  uint32_t state = seed;
+  for (auto &c : data) {
+    state = state * 1103515245 + 12345;
+    c = static_cast<char>(state >> 16);
+  }
+  return data;
+}
+}  // namespace
+
+TEST(ZeroCopy, SendTest) {
+  const auto large = makeData(8 << 20, 1);
+  const auto moved = makeData(1 << 20, 2);
+  const auto small = makeData(1000, 3);
+  std::promise<void> released;
+
+  EventLoopThread thread;
+  thread.run();
+  TcpServer server(thread.getLoop(), InetAddress("127.0.0.1", kPort),
+                   "zerocopy");
+  server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+    if (!conn->connected()) return;
+    // Nothing polled for once the bytes are out, the completions still
+    // arrive
+    conn->stopRecv();
+    conn->setZeroCopyThreshold(64 * 1024);
+    // Released only once the kernel is done with it
+    std::shared_ptr<std::string> message(new std::string(large),
+                                         [&released](std::string *message) {
+                                           delete message;
+                                           released.set_value();
+                                         });
+    conn->send(message);
+    message.reset();
+    conn->send(std::string(moved));
+    // Below the threshold, copied as usual
+    conn->send(small);
+  });
+  startServer(thread, server);
+
+  InetAddress addr("127.0.0.1", kPort);
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  timeval timeout{10, 0};
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  ASSERT_EQ(0, ::connect(fd, addr.getSockAddr(), sizeof(sockaddr_in)));
+  auto expected = large + moved + small;
+  std::string received;
+  char buf[65536];
+  while (received.size() < expected.size()) {
+    auto n = ::read(fd, buf, sizeof(buf));
+    if (n <= 0) break;
+    received.append(buf, n);
+  }
+  EXPECT_EQ(expected.size(), received.size());
+  EXPECT_TRUE(expected == received);
+
+  // While the connection is still open
+  auto future = released.get_future();
+  EXPECT_EQ(std::future_status::ready,
+            future.wait_for(std::chrono::seconds(5)));
+  ::close(fd);
+  server.stop();
+}
+
+TEST(ZeroCopy, CloseTest) {
+  const auto large = makeData(8 << 20, 4);
+  std::promise<void> released, closed;
+
+  EventLoopThread thread;
+  thread.run();
+  TcpServer server(thread.getLoop(), InetAddress("127.0.0.1", kClosePort),
+                   "zerocopy");
+  server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+    if (!conn->connected()) {
+      closed.set_value();
+      return;
+    }
+    conn->setZeroCopyThreshold(64 * 1024);
+    std::shared_ptr<std::string> message(new std::string(large),
+                                         [&released](std::string *message) {
+                                           delete message;
+                                           released.set_value();
+                                         });
+    conn->send(message);
+    message.reset();
+    // With most of the message still to go
+    conn->forceClose();
+  });
+  startServer(thread, server);
+
+  // A small window, so that the kernel of the server keeps a part
+  InetAddress addr("127.0.0.1", kClosePort);
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  int window = 64 * 1024;
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &window, sizeof(window));
+  timeval timeout{10, 0};
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  ASSERT_EQ(0, ::connect(fd, addr.getSockAddr(), sizeof(sockaddr_in)));
+  ASSERT_EQ(std::future_status::ready,
+            closed.get_future().wait_for(std::chrono::seconds(5)));
+
+  // The connection is gone, the message is kept while it is being sent
+  auto future = released.get_future();
+  EXPECT_EQ(std::future_status::timeout,
+            future.wait_for(std::chrono::milliseconds(300)));
+  std::string received;
+  char buf[65536];
+  for (;;) {
+    auto n = ::read(fd, buf, sizeof(buf));
+    if (n <= 0) break;
+    received.append(buf, n);
+  }
+  EXPECT_GT(received.size(), 0u);
+  EXPECT_LT(received.size(), large.size());
+  EXPECT_EQ(0, large.compare(0, received.size(), received));
+  EXPECT_EQ(std::future_status::ready,
+            future.wait_for(std::chrono::seconds(5)));
+  ::close(fd);
+  server.stop();
+}